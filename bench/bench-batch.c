@@ -0,0 +1,113 @@
+/*
+
+Batch update benchmark for the rbtree library. Starting from a tree of n
+random keys, applies batches of b keys, first with an insert() or
+search_and_delete() loop and then with batch_insert() or batch_delete(),
+and reports batches/sec and keys/sec for each. Batches are drawn either
+uniformly over the key space or from a narrow window (clustered).
+
+Usage: bench-batch [n] [b] [batches]   (default: 1000000 1000 200)
+
+*/
+
+#include "rbtree.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+
+// Prototypes.
+void fill(int *, size_t, bool);
+void report(const char *, const char *, double, size_t, size_t);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+
+int main(int argc, char** argv) {
+
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  size_t b = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+  size_t batches = argc > 3 ? strtoul(argv[3], NULL, 10) : 200;
+  size_t i = 0, j = 0;
+  int c = 0;
+  double start = 0;
+  const char *dist = NULL;
+
+  int *keys = malloc(b * batches * sizeof(int));
+  if (keys == NULL) {
+    fprintf(stderr, "Error allocating memory for batches!\n");
+    exit(EXT_F);
+  }
+
+  struct RBTree *tree = init_rbtree();
+  for (i = 0; i < n; i++)
+    insert(tree, (int)(next_rand() & 0x7fffffff), NULL);
+
+  printf("%-10s %-24s %14s %14s\n", "batches", "method", "batches/s", "keys/s");
+
+  for (c = 0; c < 2; c++) {
+    dist = c == 0 ? "uniform" : "clustered";
+    fill(keys, b * batches, c == 1 ? true : false);
+    for (i = 0; i < batches; i++)
+      fill(keys + i * b, b, c == 1 ? true : false);
+
+    start = now();
+    for (i = 0; i < batches; i++)
+      for (j = 0; j < b; j++)
+        insert(tree, keys[i * b + j], NULL);
+    report(dist, "insert loop", now() - start, batches, b);
+
+    start = now();
+    for (i = 0; i < batches; i++)
+      for (j = 0; j < b; j++)
+        search_and_delete(tree, keys[i * b + j]);
+    report(dist, "search_and_delete loop", now() - start, batches, b);
+
+    start = now();
+    for (i = 0; i < batches; i++)
+      batch_insert(tree, keys + i * b, NULL, b);
+    report(dist, "batch_insert", now() - start, batches, b);
+
+    start = now();
+    for (i = 0; i < batches; i++)
+      batch_delete(tree, keys + i * b, b, NULL);
+    report(dist, "batch_delete", now() - start, batches, b);
+  }
+
+  dest_rbtree(&tree);
+  free(keys);
+  return 0;
+}
+
+// Random keys, or keys from a random window 64 times the batch size.
+void fill(int *keys, size_t b, bool clustered) {
+  size_t i = 0;
+  unsigned long long base = next_rand() & 0x7fffffff;
+  for (i = 0; i < b; i++)
+    keys[i] = clustered
+      ? (int)((base + next_rand() % (64 * b)) & 0x7fffffff)
+      : (int)(next_rand() & 0x7fffffff);
+}
+
+void report(const char *dist, const char *method, double secs, size_t batches,
+  size_t b) {
+  printf("%-10s %-24s %14.0f %14.0f\n", dist, method, batches / secs,
+    batches * b / secs);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
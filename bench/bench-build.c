@@ -0,0 +1,66 @@
+/*
+
+Bulk load benchmark for the rbtree library. For every size given on the
+command line, times building a tree from n sorted keys with an insert()
+loop and with init_rbtree_sorted().
+
+Usage: bench-build [n ...]      (default: 1000 1000000 10000000)
+
+*/
+
+#include "rbtree.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+
+// Prototypes.
+double now(void);
+
+int main(int argc, char** argv) {
+
+  size_t defaults[] = { 1000, 1000000, 10000000 };
+  size_t count = argc > 1 ? (size_t)argc - 1 : 3;
+  size_t i = 0, j = 0, n = 0;
+  double start = 0, loop = 0, bulk = 0;
+  struct RBTree *tree = NULL;
+
+  printf("%12s %14s %14s %8s\n", "keys", "insert loop s", "bulk load s", "speedup");
+
+  for (i = 0; i < count; i++) {
+    n = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : defaults[i];
+
+    int *keys = malloc(n * sizeof(int));
+    if (keys == NULL) {
+      fprintf(stderr, "Error allocating memory for %lu keys!\n", (unsigned long)n);
+      exit(EXT_F);
+    }
+    for (j = 0; j < n; j++)
+      keys[j] = (int)j;
+
+    start = now();
+    tree = init_rbtree();
+    for (j = 0; j < n; j++)
+      insert(tree, keys[j], NULL);
+    loop = now() - start;
+    dest_rbtree(&tree);
+
+    start = now();
+    tree = init_rbtree_sorted(keys, NULL, n, NULL);
+    bulk = now() - start;
+    dest_rbtree(&tree);
+
+    printf("%12lu %14.4f %14.4f %7.1fx\n", (unsigned long)n, loop, bulk, loop / bulk);
+    free(keys);
+  }
+
+  return 0;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
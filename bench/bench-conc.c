@@ -0,0 +1,187 @@
+/*
+
+Concurrent read benchmark for the rbtree library. Every thread runs the
+same mix on a shared tree of n keys: 50 lookups, then one update (a delete
+and re-insert of a random key), over and over for a fixed time. Two ways:
+
+  mutex  -- a plain tree with every operation under one global mutex.
+  conc   -- the concurrent tree: lock-free lookups of the published
+            version in a read section, updates that publish a new one.
+
+For 1 up to the given number of threads, prints the total lookup rate and
+the speedup over a single thread of the same mode.
+
+Usage: bench-conc [threads] [n]      (default: 4 1000000)
+
+*/
+
+#include "rbconc.h"
+#include<pthread.h>
+#include<sched.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F   1
+#define READS   50   // Lookups per update.
+#define SECONDS 1.0  // Run time per measurement.
+
+// Shared state of one measurement.
+struct Run {
+  struct RBTree *tree;
+  struct RBTreeConc *conc;
+  pthread_mutex_t lock;
+  size_t n;
+  volatile int stop;
+};
+
+// Per-thread state.
+struct Worker {
+  pthread_t thread;
+  struct Run *run;
+  uint64_t seed;
+  size_t lookups;
+};
+
+// Prototypes.
+double now(void);
+uint64_t next_rand(uint64_t *);
+void* run_mutex(void *);
+void* run_conc(void *);
+double measure(struct Run *, size_t, void* (*)(void *));
+
+int main(int argc, char** argv) {
+
+  size_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+  size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+  size_t t = 0, i = 0;
+  double mutex = 0, conc = 0, mutex1 = 0, conc1 = 0;
+  struct Run run;
+
+  run.tree = init_rbtree();
+  run.conc = init_rbtree_conc(NULL, NULL);
+  run.n = n;
+  pthread_mutex_init(&run.lock, NULL);
+  for (i = 0; i < n; i++) {
+    insert(run.tree, (int)(i * 2), NULL);
+    conc_insert(run.conc, (int)(i * 2), NULL);
+  }
+
+  printf("%8s %16s %8s %16s %8s\n", "threads", "mutex lookups/s", "scale",
+    "conc lookups/s", "scale");
+
+  for (t = 1; t <= threads; t++) {
+    mutex = measure(&run, t, run_mutex);
+    conc = measure(&run, t, run_conc);
+    if (t == 1) {
+      mutex1 = mutex;
+      conc1 = conc;
+    }
+    printf("%8lu %16.0f %7.2fx %16.0f %7.2fx\n", (unsigned long)t, mutex,
+      mutex / mutex1, conc, conc / conc1);
+  }
+
+  pthread_mutex_destroy(&run.lock);
+  dest_rbtree_conc(&run.conc);
+  dest_rbtree(&run.tree);
+  return 0;
+}
+
+// Run t threads for SECONDS and return the total lookups per second.
+double measure(struct Run *run, size_t t, void* (*body)(void *)) {
+
+  struct Worker *workers = malloc(t * sizeof(struct Worker));
+  size_t i = 0, lookups = 0;
+  double start = 0;
+
+  if (workers == NULL) {
+    fprintf(stderr, "Error allocating memory for %lu threads!\n", (unsigned long)t);
+    exit(EXT_F);
+  }
+
+  run->stop = 0;
+  start = now();
+  for (i = 0; i < t; i++) {
+    workers[i].run = run;
+    workers[i].seed = 88172645463325252ULL + i;
+    workers[i].lookups = 0;
+    pthread_create(&workers[i].thread, NULL, body, &workers[i]);
+  }
+  while (now() - start < SECONDS)
+    sched_yield();
+  run->stop = 1;
+  for (i = 0; i < t; i++) {
+    pthread_join(workers[i].thread, NULL);
+    lookups += workers[i].lookups;
+  }
+
+  free(workers);
+  return lookups / (now() - start);
+}
+
+void* run_mutex(void *arg) {
+
+  struct Worker *self = arg;
+  struct Run *run = self->run;
+  size_t i = 0;
+  int k = 0;
+
+  while (!run->stop) {
+    for (i = 0; i < READS; i++) {
+      k = (int)(next_rand(&self->seed) % (2 * run->n));
+      pthread_mutex_lock(&run->lock);
+      search(run->tree, k);
+      pthread_mutex_unlock(&run->lock);
+    }
+    self->lookups += READS;
+
+    k = (int)(next_rand(&self->seed) % run->n) * 2;
+    pthread_mutex_lock(&run->lock);
+    search_and_delete(run->tree, k);
+    insert(run->tree, k, NULL);
+    pthread_mutex_unlock(&run->lock);
+  }
+
+  return NULL;
+}
+
+void* run_conc(void *arg) {
+
+  struct Worker *self = arg;
+  struct Run *run = self->run;
+  struct RBTreeReader reader;
+  size_t i = 0;
+  int k = 0;
+
+  conc_reader_register(run->conc, &reader);
+  while (!run->stop) {
+    for (i = 0; i < READS; i++) {
+      k = (int)(next_rand(&self->seed) % (2 * run->n));
+      conc_read_begin(run->conc, &reader);
+      conc_search(run->conc, k, NULL);
+      conc_read_end(&reader);
+    }
+    self->lookups += READS;
+
+    k = (int)(next_rand(&self->seed) % run->n) * 2;
+    conc_search_and_delete(run->conc, k);
+    conc_insert(run->conc, k, NULL);
+  }
+  conc_reader_unregister(run->conc, &reader);
+
+  return NULL;
+}
+
+uint64_t next_rand(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,108 @@
+/*
+
+Frozen tree benchmark for the rbtree library. Builds a tree of n random
+keys for every size given on the command line, freezes it in both layouts
+and reports lookups/sec of search() on the tree against frozen_search() on
+each image, along with the time to freeze and to thaw.
+
+Usage: bench-freeze [n ...]      (default: 1000 1000000 10000000)
+
+*/
+
+#include "rbfreeze.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define LOOKUPS 2000000
+#define EXT_F 1
+
+// Prototypes.
+double run_tree(struct RBTree *, int *);
+double run_frozen(struct RBTreeFrozen *, int *);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+static volatile int sink = 0; // Keeps the lookups from being optimized away.
+
+int main(int argc, char** argv) {
+
+  size_t defaults[] = { 1000, 1000000, 10000000 };
+  size_t count = argc > 1 ? (size_t)argc - 1 : 3;
+  size_t i = 0, j = 0, n = 0;
+  struct RBTree *tree = NULL, *thawed = NULL;
+  struct RBTreeFrozen *eytzinger = NULL, *veb = NULL;
+  double start = 0, freeze = 0, thaw = 0;
+
+  int *queries = malloc(LOOKUPS * sizeof(int));
+  if (queries == NULL) {
+    fprintf(stderr, "Error allocating memory for queries!\n");
+    exit(EXT_F);
+  }
+
+  printf("%-12s %14s %14s %14s %10s %10s\n", "n", "search/s", "eytzinger/s",
+    "veb/s", "freeze s", "thaw s");
+
+  for (i = 0; i < count; i++) {
+    n = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : defaults[i];
+
+    tree = init_rbtree();
+    for (j = 0; j < n; j++)
+      insert(tree, (int)(next_rand() & 0x7fffffff), NULL);
+    for (j = 0; j < LOOKUPS; j++)
+      queries[j] = (int)(next_rand() & 0x7fffffff);
+
+    start = now();
+    eytzinger = tree_freeze(tree, FREEZE_EYTZINGER);
+    freeze = now() - start;
+    veb = tree_freeze(tree, FREEZE_VEB);
+
+    start = now();
+    thawed = tree_thaw(eytzinger, NULL);
+    thaw = now() - start;
+
+    printf("%-12zu %14.0f %14.0f %14.0f %10.3f %10.3f\n", n,
+      run_tree(tree, queries), run_frozen(eytzinger, queries),
+      run_frozen(veb, queries), freeze, thaw);
+
+    dest_rbtree_frozen(&eytzinger);
+    dest_rbtree_frozen(&veb);
+    dest_rbtree(&thawed);
+    dest_rbtree(&tree);
+  }
+
+  free(queries);
+  return 0;
+}
+
+double run_tree(struct RBTree *tree, int *queries) {
+  size_t i = 0;
+  double start = now();
+  for (i = 0; i < LOOKUPS; i++)
+    sink += search(tree, queries[i]) != NULL;
+  return LOOKUPS / (now() - start);
+}
+
+double run_frozen(struct RBTreeFrozen *frozen, int *queries) {
+  size_t i = 0;
+  double start = now();
+  for (i = 0; i < LOOKUPS; i++)
+    sink += frozen_search(frozen, queries[i], NULL);
+  return LOOKUPS / (now() - start);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
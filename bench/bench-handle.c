@@ -0,0 +1,158 @@
+/*
+
+Handle benchmark for the rbtree library. For a tree of n keys, times the
+updates that start from a node the caller already holds against their
+search-based equivalents:
+
+  erase     -- search_and_delete(key) vs erase_node(node), for every node.
+  rekey     -- search_and_delete + insert vs rekey_node, moving each key
+               by a small step (usually in place) or to a random key.
+  insert    -- insert vs insert_hint with the previous node as the hint,
+               on ascending keys and on nearly sorted keys (each key off
+               its place by less than 8).
+
+Reports operations/sec for each.
+
+Usage: bench-handle [n]      (default: 1000000)
+
+*/
+
+#include "rbtree.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F  1
+#define JITTER 8 // Displacement of nearly sorted keys.
+
+// Prototypes.
+struct RBTree* build(int *, size_t, struct RBTreeNode **);
+void report(const char *, size_t, double, double);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+
+int main(int argc, char** argv) {
+
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  size_t i = 0, j = 0;
+  int *keys = malloc(n * sizeof(int)), *moved = malloc(n * sizeof(int));
+  int tmp = 0, m = 0;
+  struct RBTreeNode **nodes = malloc(n * sizeof(struct RBTreeNode *));
+  struct RBTreeNode *hint = NULL;
+  struct RBTree *tree = NULL;
+  double start = 0, base = 0;
+
+  if (keys == NULL || moved == NULL || nodes == NULL) {
+    fprintf(stderr, "Error allocating memory for %lu keys!\n", (unsigned long)n);
+    exit(EXT_F);
+  }
+  for (i = 0; i < n; i++)
+    keys[i] = (int)(next_rand() % (4 * n));
+
+  printf("%-24s %14s %14s %8s\n", "operation", "search ops/s", "handle ops/s",
+    "speedup");
+
+  // Erase.
+  tree = build(keys, n, NULL);
+  start = now();
+  for (i = 0; i < n; i++)
+    search_and_delete(tree, keys[i]);
+  base = now() - start;
+  dest_rbtree(&tree);
+  tree = build(keys, n, nodes);
+  start = now();
+  for (i = 0; i < n; i++)
+    erase_node(tree, nodes[i]);
+  report("erase", n, base, now() - start);
+  dest_rbtree(&tree);
+
+  // Re-key by a small step, then to random keys.
+  for (m = 0; m < 2; m++) {
+    for (i = 0; i < n; i++)
+      moved[i] = m == 0 ? keys[i] + 1 : (int)(next_rand() % (4 * n));
+    tree = build(keys, n, NULL);
+    start = now();
+    for (i = 0; i < n; i++) {
+      search_and_delete(tree, keys[i]);
+      insert(tree, moved[i], NULL);
+    }
+    base = now() - start;
+    dest_rbtree(&tree);
+    tree = build(keys, n, nodes);
+    start = now();
+    for (i = 0; i < n; i++)
+      rekey_node(tree, nodes[i], moved[i]);
+    report(m == 0 ? "rekey +1" : "rekey random", n, base, now() - start);
+    dest_rbtree(&tree);
+  }
+
+  // Sorted and nearly sorted inserts.
+  for (m = 0; m < 2; m++) {
+    for (i = 0; i < n; i++)
+      moved[i] = (int)i;
+    for (i = 0; m == 1 && i < n; i++) { // Shuffle blocks of JITTER keys.
+      j = i - i % JITTER + next_rand() % JITTER;
+      if (j < n) {
+        tmp = moved[i];
+        moved[i] = moved[j];
+        moved[j] = tmp;
+      }
+    }
+    tree = init_rbtree();
+    start = now();
+    for (i = 0; i < n; i++)
+      insert(tree, moved[i], NULL);
+    base = now() - start;
+    dest_rbtree(&tree);
+    tree = init_rbtree();
+    hint = NULL;
+    start = now();
+    for (i = 0; i < n; i++)
+      hint = insert_hint(tree, hint, moved[i], NULL);
+    report(m == 0 ? "insert ascending" : "insert nearly sorted", n, base,
+      now() - start);
+    dest_rbtree(&tree);
+  }
+
+  free(nodes);
+  free(moved);
+  free(keys);
+  return 0;
+}
+
+// A tree of the keys, in order; node i goes to nodes[i] if not NULL.
+struct RBTree* build(int *keys, size_t n, struct RBTreeNode **nodes) {
+
+  struct RBTree *tree = init_rbtree();
+  struct RBTreeNode *node = NULL;
+  size_t i = 0;
+
+  for (i = 0; i < n; i++) {
+    node = insert(tree, keys[i], NULL);
+    if (nodes != NULL)
+      nodes[i] = node;
+  }
+
+  return tree;
+}
+
+void report(const char *name, size_t n, double search, double handle) {
+  printf("%-24s %14.0f %14.0f %7.2fx\n", name, n / search, n / handle,
+    search / handle);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
@@ -0,0 +1,105 @@
+/*
+
+Node layout benchmark for the rbtree library. Reports the node size and the
+memory held by the node pool, and the throughput of insert, search and
+search_and_delete for n random keys. `make bench-layout` builds this program
+twice, once with the default layout (build/bench-layout) and once with
+RBTREE_COMPACT (build/bench-layout-compact), so the two can be compared.
+
+Usage: bench-layout [n ...]      (default: 1000000)
+
+*/
+
+#include "rbtree.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+
+#ifdef RBTREE_COMPACT
+#define LAYOUT "compact"
+#else
+#define LAYOUT "default"
+#endif
+
+// Prototypes.
+size_t pool_bytes(struct RBTreePool *);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+static volatile int sink = 0; // Keeps the lookups from being optimized away.
+
+int main(int argc, char** argv) {
+
+  size_t count = argc > 1 ? (size_t)argc - 1 : 1;
+  size_t i = 0, j = 0, n = 0, bytes = 0;
+  double start = 0, ins = 0, srh = 0, del = 0;
+
+  printf("%-8s %12s %6s %12s %14s %14s %14s\n", "layout", "keys", "node",
+    "pool bytes", "insert/s", "search/s", "delete/s");
+
+  for (i = 0; i < count; i++) {
+    n = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : 1000000;
+
+    int *keys = malloc(n * sizeof(int));
+    if (keys == NULL) {
+      fprintf(stderr, "Error allocating memory for %lu keys!\n", (unsigned long)n);
+      exit(EXT_F);
+    }
+    for (j = 0; j < n; j++)
+      keys[j] = (int)(next_rand() & 0x7fffffff);
+
+    struct RBTree *tree = init_rbtree();
+
+    start = now();
+    for (j = 0; j < n; j++)
+      insert(tree, keys[j], NULL);
+    ins = n / (now() - start);
+    bytes = pool_bytes(tree->pool);
+
+    start = now();
+    for (j = 0; j < n; j++)
+      sink += search(tree, keys[next_rand() % n])->key;
+    srh = n / (now() - start);
+
+    start = now();
+    for (j = 0; j < n; j++)
+      search_and_delete(tree, keys[j]);
+    del = n / (now() - start);
+
+    printf("%-8s %12lu %6lu %12lu %14.0f %14.0f %14.0f\n", LAYOUT,
+      (unsigned long)n, (unsigned long)sizeof(struct RBTreeNode),
+      (unsigned long)bytes, ins, srh, del);
+
+    dest_rbtree(&tree);
+    free(keys);
+  }
+
+  return 0;
+}
+
+// Bytes of node storage currently held by the pool's slabs.
+size_t pool_bytes(struct RBTreePool *pool) {
+  size_t bytes = 0;
+  struct RBTreeSlab *slab = NULL;
+  for (slab = pool->slabs; slab != NULL; slab = slab->next)
+    bytes += slab->capacity * pool->nodeSize;
+  return bytes;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
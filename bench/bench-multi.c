@@ -0,0 +1,129 @@
+/*
+
+Multimap benchmark for the rbtree library. Inserts n values under skewed
+keys (key = d * u^4 for uniform u in [0, 1), so a few keys take most of
+the values) and deletes them again one at a time, once into a plain tree
+that keeps every duplicate as a node and once into the multimap. For key
+ranges d = n, n/10, n/100 and n/1000 it reports the tree nodes, the memory
+taken per value, the height of the tree and the insert and delete rates.
+
+Usage: bench-multi [n]      (default: 1000000)
+
+*/
+
+#include "rbmulti.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+
+// Bytes currently obtained through the counting hooks.
+struct Usage {
+  size_t live;
+};
+
+// Prototypes.
+void* count_alloc(void *, size_t);
+void count_release(void *, void *, size_t);
+void report(size_t, const char *, size_t, size_t, size_t, int, double, double);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+
+int main(int argc, char** argv) {
+
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  size_t distinct[] = { n, n / 10, n / 100, n / 1000 };
+  size_t i = 0, j = 0, d = 0, bytes = 0, nodes = 0;
+  struct Usage usage = { 0 };
+  struct RBTreeAllocator hooks = { count_alloc, count_release, &usage };
+  struct RBTree *tree = NULL;
+  struct RBMultiMap *map = NULL;
+  double u = 0, start = 0, ins = 0;
+  int *keys = malloc(n * sizeof(int));
+  int h = 0;
+
+  if (keys == NULL) {
+    fprintf(stderr, "Error allocating memory for keys!\n");
+    exit(EXT_F);
+  }
+
+  printf("%-10s %-10s %10s %12s %8s %14s %14s\n", "range", "structure",
+    "nodes", "bytes/value", "height", "insert/s", "delete/s");
+
+  for (i = 0; i < sizeof(distinct) / sizeof(distinct[0]); i++) {
+    if ((d = distinct[i]) == 0)
+      continue;
+    for (j = 0; j < n; j++) {
+      u = (next_rand() >> 11) / 9007199254740992.0;
+      keys[j] = (int)(d * u * u * u * u);
+    }
+
+    tree = init_rbtree_alloc(&hooks);
+    start = now();
+    for (j = 0; j < n; j++)
+      insert(tree, keys[j], NULL);
+    ins = now() - start;
+    bytes = usage.live;
+    nodes = tree_size(tree);
+    h = height(tree, tree->root);
+    start = now();
+    for (j = 0; j < n; j++)
+      search_and_delete(tree, keys[j]);
+    report(d, "rbtree", nodes, n, bytes, h, ins, now() - start);
+    dest_rbtree(&tree);
+
+    map = init_rbmulti(&hooks);
+    start = now();
+    for (j = 0; j < n; j++)
+      multi_insert(map, keys[j], NULL);
+    ins = now() - start;
+    bytes = usage.live;
+    nodes = multi_keys(map);
+    h = height(map->tree, map->tree->root);
+    start = now();
+    for (j = 0; j < n; j++)
+      multi_delete_one(map, keys[j], NULL);
+    report(0, "multimap", nodes, n, bytes, h, ins, now() - start);
+    dest_rbmulti(&map);
+  }
+
+  free(keys);
+  return 0;
+}
+
+// One row; d == 0 repeats the range of the row above.
+void report(size_t d, const char *name, size_t nodes, size_t n, size_t bytes,
+  int h, double ins, double del) {
+  char range[24] = "";
+  if (d > 0)
+    sprintf(range, "%lu", (unsigned long)d);
+  printf("%-10s %-10s %10lu %12.1f %8d %14.0f %14.0f\n", range, name,
+    (unsigned long)nodes, (double)bytes / n, h, n / ins, n / del);
+}
+
+void* count_alloc(void *ctx, size_t size) {
+  ((struct Usage *)ctx)->live += size;
+  return malloc(size);
+}
+
+void count_release(void *ctx, void *ptr, size_t size) {
+  ((struct Usage *)ctx)->live -= size;
+  free(ptr);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
@@ -0,0 +1,179 @@
+/*
+
+Parallel bulk operations benchmark for the rbtree library. On n random
+keys, times with 1, 2, 4, ... up to the given number of threads:
+
+  build    -- par_build_rbtree from the unsorted keys.
+  for_each -- par_for_each, storing a hash of each key in its node's data.
+  map      -- par_map, hashing the data of each node again.
+  reduce   -- par_reduce, summing the data of all nodes.
+  teardown -- par_dest_rbtree, clearing a 32-byte record per node as a
+              destructor would. The records come from one array, so that
+              the state of malloc does not skew the times.
+
+One thread means no pool at all. Reports seconds for each operation and
+the speedup over one thread. The speedup is bounded by the cores of the
+machine, which are printed first.
+
+Usage: bench-par [threads] [n]      (default: 8 4000000)
+
+*/
+
+#include "rbpar.h"
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+
+//Constants
+#define EXT_F  1
+#define RECORD 32 // Bytes of satellite data per node at teardown.
+#define OPS    5
+
+// Prototypes.
+void hash_key(struct RBTreeNode *, void *);
+void* hash_data(void *, void *);
+void* add_data(void *, struct RBTreeNode *, void *);
+void* add_sums(void *, void *, void *);
+void clear_record(void *);
+void measure(const int *, void **, size_t, struct RBTaskPool *, double *);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+
+int main(int argc, char** argv) {
+
+  size_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+  size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 4000000;
+  size_t t = 0, i = 0;
+  int *keys = malloc(n * sizeof(int));
+  void **records = malloc(n * sizeof(void *));
+  char *store = malloc(n * RECORD);
+  struct RBTaskPool *workers = NULL;
+  double times[OPS], one[OPS];
+
+  if (keys == NULL || records == NULL || store == NULL) {
+    fprintf(stderr, "Error allocating memory for %lu keys!\n", (unsigned long)n);
+    exit(EXT_F);
+  }
+  memset(store, 1, n * RECORD);
+  for (i = 0; i < n; i++) {
+    keys[i] = (int)(next_rand() & 0x7fffffff);
+    records[i] = store + i * RECORD;
+  }
+
+  printf("%lu keys, %ld cores\n", (unsigned long)n, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%8s %16s %16s %16s %16s %16s\n", "threads", "build s",
+    "for_each s", "map s", "reduce s", "teardown s");
+
+  for (t = 1; t <= threads; t *= 2) {
+    workers = t > 1 ? init_task_pool(t - 1) : NULL;
+    if (t > 1 && workers == NULL) {
+      fprintf(stderr, "Error starting %lu threads!\n", (unsigned long)t);
+      exit(EXT_F);
+    }
+    measure(keys, records, n, workers, times);
+    if (t == 1)
+      for (i = 0; i < OPS; i++)
+        one[i] = times[i];
+    printf("%8lu", (unsigned long)t);
+    for (i = 0; i < OPS; i++)
+      printf(" %8.3f %6.2fx", times[i], one[i] / times[i]);
+    printf("\n");
+    if (workers != NULL)
+      dest_task_pool(&workers);
+  }
+
+  free(store);
+  free(records);
+  free(keys);
+  return 0;
+}
+
+// Time the operations on one pool.
+void measure(const int *keys, void **records, size_t n,
+  struct RBTaskPool *workers, double *times) {
+
+  struct RBTree *tree = NULL;
+  uint64_t *sum = NULL;
+  double start = now();
+
+  if ((tree = par_build_rbtree(keys, NULL, n, NULL, workers)) == NULL) {
+    fprintf(stderr, "Error building the tree!\n");
+    exit(EXT_F);
+  }
+  times[0] = now() - start;
+
+  start = now();
+  par_for_each(tree, hash_key, NULL, workers);
+  times[1] = now() - start;
+
+  start = now();
+  par_map(tree, hash_data, NULL, workers);
+  times[2] = now() - start;
+
+  start = now();
+  sum = par_reduce(tree, add_data, add_sums, NULL, workers);
+  times[3] = now() - start;
+  if (sum == NULL || *sum == 0) // Keeps the work from being optimized away.
+    fprintf(stderr, "Unexpected sum!\n");
+  free(sum);
+  dest_rbtree(&tree);
+
+  if ((tree = par_build_rbtree(keys, records, n, NULL, workers)) == NULL) {
+    fprintf(stderr, "Error building the tree!\n");
+    exit(EXT_F);
+  }
+  start = now();
+  par_dest_rbtree(&tree, clear_record, workers);
+  times[4] = now() - start;
+}
+
+// The data of a node becomes a hash of its key.
+void hash_key(struct RBTreeNode *node, void *ctx) {
+  (void)ctx;
+  node->data = hash_data((void *)(uintptr_t)(unsigned int)node->key, NULL);
+}
+
+void* hash_data(void *data, void *ctx) {
+  uint64_t h = (uint64_t)(uintptr_t)data * 0x9E3779B97F4A7C15ULL;
+  (void)ctx;
+  return (void *)(uintptr_t)((h ^ h >> 29) | 1);
+}
+
+void* add_data(void *acc, struct RBTreeNode *node, void *ctx) {
+  (void)ctx;
+  if (acc == NULL && (acc = calloc(1, sizeof(uint64_t))) == NULL) {
+    fprintf(stderr, "Error allocating memory for a sum!\n");
+    exit(EXT_F);
+  }
+  *(uint64_t *)acc += (uintptr_t)node->data;
+  return acc;
+}
+
+void* add_sums(void *left, void *right, void *ctx) {
+  (void)ctx;
+  *(uint64_t *)left += *(uint64_t *)right;
+  free(right);
+  return left;
+}
+
+void clear_record(void *record) {
+  memset(record, 0, RECORD);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
@@ -0,0 +1,146 @@
+/*
+
+Persistent tree benchmark for the rbtree library. Inserts and then deletes
+n random keys, once with insert()/search_and_delete() on a plain tree and
+once with persist_insert()/persist_delete(), dropping each old version as
+soon as the next exists. A third run keeps a snapshot every k updates
+alive until the end, as long-running scans would, and reports the nodes
+those snapshots pin. Also reports the cost of persist_snapshot().
+
+Usage: bench-persist [n] [k]   (default: 1000000 1000)
+
+*/
+
+#include "rbpersist.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+
+// Prototypes.
+void run_persist(int *, size_t, size_t);
+size_t pool_nodes(struct RBTreePool *);
+void report(const char *, double, size_t);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+
+int main(int argc, char** argv) {
+
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  size_t k = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+  size_t i = 0;
+  double start = 0;
+  struct RBTree *tree = NULL;
+
+  int *keys = malloc(n * sizeof(int));
+  if (keys == NULL) {
+    fprintf(stderr, "Error allocating memory for keys!\n");
+    exit(EXT_F);
+  }
+  for (i = 0; i < n; i++)
+    keys[i] = (int)(next_rand() & 0x7fffffff);
+
+  printf("%-32s %14s\n", "method", "updates/s");
+
+  tree = init_rbtree();
+  start = now();
+  for (i = 0; i < n; i++)
+    insert(tree, keys[i], NULL);
+  for (i = 0; i < n; i++)
+    search_and_delete(tree, keys[i]);
+  report("insert/search_and_delete", now() - start, 2 * n);
+  dest_rbtree(&tree);
+
+  run_persist(keys, n, 0);
+  run_persist(keys, n, k);
+
+  free(keys);
+  return 0;
+}
+
+// Insert and delete all keys persistently, keeping every k-th version.
+void run_persist(int *keys, size_t n, size_t k) {
+
+  struct RBTreePersist *store = init_rbtree_persist(NULL);
+  struct RBTreeVersion *version = persist_empty(store);
+  struct RBTreeVersion *next = NULL;
+  struct RBTreeVersion **kept = NULL;
+  size_t nkept = 0, i = 0;
+  double start = 0;
+  char name[64];
+
+  if (k > 0 && (kept = malloc((2 * n / k + 1) * sizeof(*kept))) == NULL) {
+    fprintf(stderr, "Error allocating memory for snapshots!\n");
+    exit(EXT_F);
+  }
+
+  start = now();
+  for (i = 0; i < 2 * n; i++) {
+    if (i < n)
+      next = persist_insert(version, keys[i], NULL);
+    else
+      next = persist_delete(version, keys[i - n], NULL);
+    dest_rbtree_version(&version);
+    version = next;
+    if (k > 0 && i % k == 0)
+      kept[nkept++] = persist_snapshot(version);
+  }
+  if (k == 0)
+    sprintf(name, "persist_insert/persist_delete");
+  else
+    sprintf(name, "  keeping every %zu-th version", k);
+  report(name, now() - start, 2 * n);
+
+  if (k > 0) {
+    printf("%-32s %14zu (%zu snapshots)\n", "  nodes pinned",
+      pool_nodes(store->pool), nkept);
+    start = now();
+    for (i = 0; i < n; i++) {
+      next = persist_snapshot(kept[nkept / 2]);
+      dest_rbtree_version(&next);
+    }
+    printf("%-32s %14.1f\n", "  persist_snapshot ns", (now() - start) / n * 1e9);
+    while (nkept > 0)
+      dest_rbtree_version(&kept[--nkept]);
+    free(kept);
+  }
+
+  dest_rbtree_version(&version);
+  dest_rbtree_persist(&store);
+}
+
+// Nodes handed out by a pool and not given back.
+size_t pool_nodes(struct RBTreePool *pool) {
+  struct RBTreeSlab *slab = NULL;
+  void *node = NULL;
+  size_t count = 0;
+
+  for (slab = pool->slabs; slab != NULL; slab = slab->next)
+    count += slab->capacity;
+  count -= (pool->bumpEnd - pool->bump) / pool->nodeSize;
+  for (node = pool->freeList; node != NULL; node = *(void **)node)
+    count--;
+  return count;
+}
+
+void report(const char *method, double secs, size_t updates) {
+  printf("%-32s %14.0f\n", method, updates / secs);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
@@ -0,0 +1,190 @@
+/*
+
+Priority queue benchmark for the rbtree library. For every size given on
+the command line, runs two timer-queue workloads three ways:
+
+  heap   -- an array-based binary heap, the usual baseline.
+  pq     -- the tree through rbpq.h: pq_push and pq_pop.
+  search -- the tree popped with search_and_delete of minimum's key, which
+            searches again for the key it was just given.
+
+  fill   -- push n random deadlines, then pop them all.
+  hold   -- with n deadlines queued, pop the earliest and push a new one
+            somewhat later, 4n times; the queue stays at n.
+
+Reports operations/sec, a push or pop counting as one operation.
+
+Usage: bench-pq [n ...]      (default: 1000 100000 1000000)
+
+*/
+
+#include "rbpq.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+#define HOLDS 4 // Hold operations per queued deadline.
+
+// Binary heap baseline.
+struct HeapItem {
+  int key;
+  void *data;
+};
+
+struct Heap {
+  struct HeapItem *items;
+  size_t size;
+};
+
+// Prototypes.
+void heap_push(struct Heap *, int, void *);
+int heap_pop(struct Heap *);
+void run(const char *, size_t, const int *, int);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+
+int main(int argc, char** argv) {
+
+  size_t defaults[] = { 1000, 100000, 1000000 };
+  size_t count = argc > 1 ? (size_t)argc - 1 : 3;
+  size_t i = 0, j = 0, n = 0;
+  int *keys = NULL;
+
+  printf("%-10s %-8s %14s %14s %14s\n", "n", "workload", "heap ops/s",
+    "pq ops/s", "search ops/s");
+
+  for (i = 0; i < count; i++) {
+    n = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : defaults[i];
+    if ((keys = malloc(n * sizeof(int))) == NULL) {
+      fprintf(stderr, "Error allocating memory for %lu keys!\n", (unsigned long)n);
+      exit(EXT_F);
+    }
+    for (j = 0; j < n; j++)
+      keys[j] = (int)(next_rand() % (4 * n));
+
+    run("fill", n, keys, 0);
+    run("hold", n, keys, 1);
+    free(keys);
+  }
+
+  return 0;
+}
+
+// One workload, all three ways, and its line of the report.
+void run(const char *name, size_t n, const int *keys, int hold) {
+
+  struct Heap heap;
+  struct RBTree *tree = NULL;
+  struct RBTreeNode *min = NULL;
+  size_t j = 0, ops = hold ? 2 * HOLDS * n : 2 * n;
+  double start = 0, rate[3];
+  unsigned long long saved = seed;
+  int key = 0, mode = 0;
+  char label[24];
+
+  heap.items = malloc(n * sizeof(struct HeapItem));
+  if (heap.items == NULL) {
+    fprintf(stderr, "Error allocating memory for the heap!\n");
+    exit(EXT_F);
+  }
+
+  for (mode = 0; mode < 3; mode++) {
+    heap.size = 0;
+    tree = init_rbtree();
+    seed = saved; // Same deadlines for every way.
+    if (hold) {
+      for (j = 0; j < n; j++) {
+        if (mode == 0)
+          heap_push(&heap, keys[j], NULL);
+        else
+          pq_push(tree, keys[j], NULL);
+      }
+    }
+
+    start = now();
+    for (j = 0; j < (hold ? HOLDS * n : n); j++) {
+      if (!hold) {
+        key = keys[j];
+      } else if (mode == 0) {
+        key = heap_pop(&heap);
+      } else if (mode == 1) {
+        pq_pop(tree, &key, NULL);
+      } else {
+        key = minimum(tree)->key;
+        search_and_delete(tree, key);
+      }
+      if (hold)
+        key += (int)(next_rand() % (2 * n)) + 1;
+      if (mode == 0)
+        heap_push(&heap, key, NULL);
+      else
+        pq_push(tree, key, NULL);
+    }
+    for (j = 0; !hold && j < n; j++) {
+      if (mode == 0) {
+        heap_pop(&heap);
+      } else if (mode == 1) {
+        pq_pop(tree, NULL, NULL);
+      } else {
+        min = minimum(tree);
+        search_and_delete(tree, min->key);
+      }
+    }
+    rate[mode] = ops / (now() - start);
+    dest_rbtree(&tree);
+  }
+
+  sprintf(label, "%lu", (unsigned long)n);
+  printf("%-10s %-8s %14.0f %14.0f %14.0f\n", hold ? "" : label, name,
+    rate[0], rate[1], rate[2]);
+  free(heap.items);
+}
+
+void heap_push(struct Heap *heap, int key, void *data) {
+
+  size_t i = heap->size++, parent = 0;
+
+  while (i > 0 && heap->items[parent = (i - 1) / 2].key > key) {
+    heap->items[i] = heap->items[parent];
+    i = parent;
+  }
+  heap->items[i].key = key;
+  heap->items[i].data = data;
+}
+
+// Remove the minimum and return its key. The heap must not be empty.
+int heap_pop(struct Heap *heap) {
+
+  struct HeapItem last = heap->items[--heap->size];
+  size_t i = 0, child = 0;
+  int key = heap->items[0].key;
+
+  while ((child = 2 * i + 1) < heap->size) {
+    if (child + 1 < heap->size && heap->items[child + 1].key < heap->items[child].key)
+      child++;
+    if (heap->items[child].key >= last.key)
+      break;
+    heap->items[i] = heap->items[child];
+    i = child;
+  }
+  heap->items[i] = last;
+
+  return key;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
@@ -0,0 +1,119 @@
+/*
+
+Search micro-benchmark for the rbtree library. Builds a tree of n random
+keys for every size given on the command line and measures lookups/sec of
+the iterative search() against the previous recursive, validating descent.
+
+Usage: bench-search [n ...]      (default: 1000 1000000)
+
+The 100M key run needs roughly 5 GB of memory:
+
+  build/bench-search 1000 1000000 100000000
+
+Build with `make bench-search DEFS=-DRBTREE_PREFETCH` to enable prefetching.
+
+*/
+
+#include "rbtree.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define LOOKUPS 2000000
+#define EXT_F 1
+
+// Prototypes.
+struct RBTreeNode* recursive_search(int, struct RBTreeNode *, struct RBTreeNode *);
+double run(struct RBTree *, int *, size_t, bool);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+static volatile int sink = 0; // Keeps the lookups from being optimized away.
+
+int main(int argc, char** argv) {
+
+  size_t defaults[] = { 1000, 1000000 };
+  size_t count = argc > 1 ? (size_t)argc - 1 : 2;
+  size_t i = 0, j = 0, n = 0;
+
+  printf("%12s %16s %16s %8s\n", "keys", "recursive/s", "iterative/s", "speedup");
+
+  for (i = 0; i < count; i++) {
+    n = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : defaults[i];
+
+    int *keys = malloc(n * sizeof(int));
+    if (keys == NULL) {
+      fprintf(stderr, "Error allocating memory for %lu keys!\n", (unsigned long)n);
+      exit(EXT_F);
+    }
+
+    // Distinct even keys in random order.
+    for (j = 0; j < n; j++)
+      keys[j] = (int)(2 * j);
+    for (j = n - 1; j > 0; j--) {
+      size_t r = next_rand() % (j + 1);
+      int t = keys[j];
+      keys[j] = keys[r];
+      keys[r] = t;
+    }
+
+    struct RBTree *tree = init_rbtree();
+    for (j = 0; j < n; j++)
+      insert(tree, keys[j], NULL);
+
+    double rec = run(tree, keys, n, true);
+    double itr = run(tree, keys, n, false);
+    printf("%12lu %16.0f %16.0f %7.2fx\n", (unsigned long)n, rec, itr, itr / rec);
+
+    dest_rbtree(&tree);
+    free(keys);
+  }
+
+  return 0;
+}
+
+// Lookups per second for LOOKUPS random hits.
+double run(struct RBTree *tree, int *keys, size_t n, bool recursive) {
+  struct RBTreeNode *res = NULL;
+  size_t i = 0;
+  double start = now();
+
+  for (i = 0; i < LOOKUPS; i++) {
+    int key = keys[next_rand() % n];
+    res = recursive ? recursive_search(key, tree->root, tree->nil) : search(tree, key);
+    sink += res->key;
+  }
+
+  return LOOKUPS / (now() - start);
+}
+
+// The search as it was before: recursive, validating every level.
+struct RBTreeNode* recursive_search(int key, struct RBTreeNode *root,
+  struct RBTreeNode *nil) {
+  validate(root, false);
+
+  if (root == nil)
+    return NULL;
+  else if (key < root->key)
+    return recursive_search(key, root->left, nil);
+  else if (key > root->key)
+    return recursive_search(key, root->right, nil);
+  else
+    return root;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
@@ -0,0 +1,155 @@
+/*
+
+Join, split and set operation benchmark for the rbtree library. Builds two
+trees of n random keys each (about half of them shared) and times, against
+the drain-and-reinsert approach it replaces:
+
+  split  -- tree_split at the median vs. moving half the keys over with
+            search_and_delete and insert.
+  join   -- tree_join of the halves back together vs. the same drain.
+  union  -- tree_union, sequential and on a task pool, vs. draining b
+            into a with a search before each insert: for two trees of n
+            keys, for n and n / 100 keys, and for two trees of n keys
+            with disjoint ranges (merge).
+
+Usage: bench-set [threads] [n ...]      (default: 4 100000 1000000)
+
+*/
+
+#include "rbjoin.h"
+#include<limits.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+
+// Prototypes.
+double now(void);
+uint64_t next_rand(uint64_t *);
+struct RBTree* random_tree(struct RBTree *, size_t, int, uint64_t *);
+void union_row(size_t, size_t, int, const char *, struct RBTaskPool *);
+void drain(struct RBTree *, struct RBTree *, int);
+
+int main(int argc, char** argv) {
+
+  size_t defaults[] = { 100000, 1000000 };
+  size_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+  size_t count = argc > 2 ? (size_t)argc - 2 : 2;
+  size_t i = 0, n = 0;
+  uint64_t state = 88172645463325252ULL;
+  double start = 0, slow = 0, fast = 0;
+  struct RBTaskPool *workers = init_task_pool(threads);
+  struct RBTree *a = NULL, *b = NULL;
+
+  printf("%10s %10s %14s %14s %14s\n", "keys", "op", "drain s", "rbjoin s",
+    "parallel s");
+
+  for (i = 0; i < count; i++) {
+    n = argc > 2 ? strtoul(argv[i + 2], NULL, 10) : defaults[i];
+
+    // Split at the median, then join back.
+    a = random_tree(NULL, n, 0, &state);
+    b = init_rbtree_like(a);
+    start = now();
+    drain(a, b, 0);
+    slow = now() - start;
+    drain(b, a, INT_MIN);
+    start = now();
+    tree_split(a, 0, b);
+    fast = now() - start;
+    printf("%10lu %10s %14.4f %14.6f %14s\n", (unsigned long)n, "split", slow, fast, "-");
+
+    start = now();
+    tree_join(a, 0, NULL, b);
+    fast = now() - start;
+    search_and_delete(a, 0);
+    start = now();
+    drain(a, b, 0);
+    drain(b, a, INT_MIN);
+    slow = (now() - start) / 2;
+    printf("%10lu %10s %14.4f %14.6f %14s\n", (unsigned long)n, "join", slow, fast, "-");
+    dest_rbtree(&b);
+    dest_rbtree(&a);
+
+    // Union of equal sizes, of a small tree into a large one, and of two
+    // trees with disjoint key ranges (merging shards).
+    union_row(n, n, 0, "union", workers);
+    union_row(n, n / 100, 0, "union/100", workers);
+    union_row(n, n, 2 * (int)n, "merge", workers);
+  }
+
+  dest_task_pool(&workers);
+  return 0;
+}
+
+// Time a union of random trees of n and m keys three ways, and print a row.
+void union_row(size_t n, size_t m, int offset, const char *label,
+  struct RBTaskPool *workers) {
+
+  double start = 0, slow = 0, fast = 0, par = 0;
+  struct RBTree *a = NULL, *b = NULL;
+  uint64_t state = 0;
+  int round = 0;
+
+  for (round = 0; round < 3; round++) {
+    state = 1;
+    a = random_tree(NULL, n, 0, &state);
+    b = random_tree(a, m, offset, &state);
+    start = now();
+    if (round == 0)
+      drain(b, a, INT_MIN);
+    else
+      tree_union(a, b, NULL, round == 1 ? NULL : workers);
+    *(round == 0 ? &slow : round == 1 ? &fast : &par) = now() - start;
+    dest_rbtree(&b);
+    dest_rbtree(&a);
+  }
+
+  printf("%10lu %10s %14.4f %14.6f %14.6f\n", (unsigned long)n, label, slow,
+    fast, par);
+}
+
+// n distinct random keys in [offset - n, offset + n), in a new tree of
+// like's family.
+struct RBTree* random_tree(struct RBTree *like, size_t n, int offset,
+  uint64_t *state) {
+
+  struct RBTree *tree = like != NULL ? init_rbtree_like(like) : init_rbtree();
+  int k = 0;
+
+  while (tree_size(tree) < n) {
+    k = (int)(next_rand(state) % (2 * n)) - (int)n + offset;
+    if (search(tree, k) == NULL)
+      insert(tree, k, NULL);
+  }
+  return tree;
+}
+
+// Move every node of from with key >= lo into to, one key at a time.
+void drain(struct RBTree *from, struct RBTree *to, int lo) {
+  struct RBTreeIter iter;
+  struct RBTreeNode *node = NULL;
+  int k = 0;
+
+  while ((node = iter_lower_bound(from, &iter, lo)) != NULL) {
+    k = node->key;
+    search_and_delete(from, k);
+    if (search(to, k) == NULL)
+      insert(to, k, NULL);
+  }
+}
+
+uint64_t next_rand(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
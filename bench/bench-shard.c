@@ -0,0 +1,159 @@
+/*
+
+Sharded map benchmark for the rbtree library. Every thread runs the same
+mix on a shared map of n keys: 9 lookups, then one update (a delete and
+re-insert of a random key), over and over for a fixed time. Two ways:
+
+  one     -- a map that is never split: every operation takes the same
+             shard lock, as with a single tree under one mutex.
+  sharded -- a map split into shards of at most SHARD_MAX_KEYS keys.
+
+For 1, 2, 4, ... up to the given number of threads, prints the total rate
+of operations (lookups and updates) and the speedup over a single thread
+of the same mode.
+
+Usage: bench-shard [threads] [n]      (default: 64 1000000)
+
+*/
+
+#include "rbshard.h"
+#include<pthread.h>
+#include<sched.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F   1
+#define READS   9    // Lookups per update.
+#define SECONDS 1.0  // Run time per measurement.
+
+// Shared state of one measurement.
+struct Run {
+  struct RBShardMap *map;
+  size_t n;
+  volatile int stop;
+};
+
+// Per-thread state.
+struct Worker {
+  pthread_t thread;
+  struct Run *run;
+  uint64_t seed;
+  size_t ops;
+};
+
+// Prototypes.
+double now(void);
+uint64_t next_rand(uint64_t *);
+void* run_mix(void *);
+double measure(struct Run *, size_t);
+
+int main(int argc, char** argv) {
+
+  size_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+  size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+  size_t t = 0, i = 0;
+  double one = 0, sharded = 0, one1 = 0, sharded1 = 0;
+  struct Run single, split;
+
+  single.map = init_rbshard_map(SIZE_MAX, NULL);
+  split.map = init_rbshard_map(0, NULL);
+  if (single.map == NULL || split.map == NULL) {
+    fprintf(stderr, "Error allocating memory for the maps!\n");
+    exit(EXT_F);
+  }
+  single.n = split.n = n;
+  for (i = 0; i < n; i++) {
+    shard_insert(single.map, (int)(i * 2), NULL);
+    shard_insert(split.map, (int)(i * 2), NULL);
+  }
+
+  printf("%lu keys, %lu shards\n", (unsigned long)n,
+    (unsigned long)shard_count(split.map));
+  printf("%8s %16s %8s %16s %8s\n", "threads", "one ops/s", "scale",
+    "sharded ops/s", "scale");
+
+  for (t = 1; t <= threads; t *= 2) {
+    one = measure(&single, t);
+    sharded = measure(&split, t);
+    if (t == 1) {
+      one1 = one;
+      sharded1 = sharded;
+    }
+    printf("%8lu %16.0f %7.2fx %16.0f %7.2fx\n", (unsigned long)t, one,
+      one / one1, sharded, sharded / sharded1);
+  }
+
+  dest_rbshard_map(&split.map);
+  dest_rbshard_map(&single.map);
+  return 0;
+}
+
+// Run t threads for SECONDS and return the total operations per second.
+double measure(struct Run *run, size_t t) {
+
+  struct Worker *workers = malloc(t * sizeof(struct Worker));
+  size_t i = 0, ops = 0;
+  double start = 0;
+
+  if (workers == NULL) {
+    fprintf(stderr, "Error allocating memory for %lu threads!\n", (unsigned long)t);
+    exit(EXT_F);
+  }
+
+  run->stop = 0;
+  start = now();
+  for (i = 0; i < t; i++) {
+    workers[i].run = run;
+    workers[i].seed = 88172645463325252ULL + i;
+    workers[i].ops = 0;
+    pthread_create(&workers[i].thread, NULL, run_mix, &workers[i]);
+  }
+  while (now() - start < SECONDS)
+    sched_yield();
+  run->stop = 1;
+  for (i = 0; i < t; i++) {
+    pthread_join(workers[i].thread, NULL);
+    ops += workers[i].ops;
+  }
+
+  free(workers);
+  return ops / (now() - start);
+}
+
+void* run_mix(void *arg) {
+
+  struct Worker *self = arg;
+  struct Run *run = self->run;
+  size_t i = 0;
+  int k = 0;
+
+  while (!run->stop) {
+    for (i = 0; i < READS; i++) {
+      k = (int)(next_rand(&self->seed) % (2 * run->n));
+      shard_search(run->map, k, NULL);
+    }
+
+    k = (int)(next_rand(&self->seed) % run->n) * 2;
+    shard_search_and_delete(run->map, k, NULL);
+    shard_insert(run->map, k, NULL);
+    self->ops += READS + 2;
+  }
+
+  return NULL;
+}
+
+uint64_t next_rand(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
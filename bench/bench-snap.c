@@ -0,0 +1,97 @@
+/*
+
+Cold start benchmark for the rbtree library. Builds a tree of n random keys
+with an insert() loop, the way a restarting service would, saves it with
+snap_save() and then times getting it back: snap_open() plus a first
+search, and snap_promote() into a mutable tree. Also compares lookups/sec
+on the mapped snapshot with search() on the tree.
+
+Usage: bench-snap [n] [file]   (default: 50000000 /tmp/bench-snap.rbs)
+
+*/
+
+#include "rbsnap.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+#define LOOKUPS 1000000
+
+// Prototypes.
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+
+int main(int argc, char** argv) {
+
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 50000000;
+  const char *path = argc > 2 ? argv[2] : "/tmp/bench-snap.rbs";
+  struct RBTree *tree = NULL;
+  struct RBSnapshot *snap = NULL;
+  size_t i = 0, found = 0;
+  double start = 0;
+  unsigned long long saved = 0;
+
+  printf("%-28s %12s\n", "step", "seconds");
+
+  tree = init_rbtree();
+  start = now();
+  for (i = 0; i < n; i++)
+    insert(tree, (int)(next_rand() & 0x7fffffff), NULL);
+  printf("%-28s %12.3f\n", "insert loop", now() - start);
+
+  start = now();
+  if (!snap_save(tree, path, NULL)) {
+    perror("snap_save");
+    exit(EXT_F);
+  }
+  printf("%-28s %12.3f\n", "snap_save", now() - start);
+
+  saved = seed;
+  start = now();
+  for (i = 0; i < LOOKUPS; i++)
+    found += search(tree, (int)(next_rand() & 0x7fffffff)) != NULL;
+  printf("%-28s %12.0f\n", "search lookups/s", LOOKUPS / (now() - start));
+  dest_rbtree(&tree);
+
+  start = now();
+  if ((snap = snap_open(path)) == NULL) {
+    perror("snap_open");
+    exit(EXT_F);
+  }
+  found += snap_search(snap, 0) != NULL;
+  printf("%-28s %12.6f\n", "snap_open + first search", now() - start);
+
+  seed = saved;
+  start = now();
+  for (i = 0; i < LOOKUPS; i++)
+    found += snap_search(snap, (int)(next_rand() & 0x7fffffff)) != NULL;
+  printf("%-28s %12.0f\n", "snap_search lookups/s", LOOKUPS / (now() - start));
+
+  start = now();
+  tree = snap_promote(snap, NULL, NULL);
+  printf("%-28s %12.3f\n", "snap_promote", now() - start);
+
+  printf("(%zu keys, %zu found)\n", tree_size(tree), found);
+  snap_close(&snap);
+  dest_rbtree(&tree);
+  remove(path);
+  return 0;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
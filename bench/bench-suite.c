@@ -0,0 +1,418 @@
+/*
+
+Benchmark suite for the rbtree library. For every tree size and key
+distribution it runs, in this order:
+
+  insert      n inserts of the distribution's keys
+  search      n lookups drawn from the same distribution
+  minmax      n calls, alternating minimum and maximum
+  iterate     one full in-order pass with iter_next
+  delete      search_and_delete of the first n/2 keys inserted
+  teardown    dest_rbtree of the remaining n - n/2 nodes, reported as
+              nodes freed/sec with the mean ns per node as its latency
+
+Distributions:
+
+  random      uniform 31-bit keys
+  sequential  0, 1, 2, ...; lookups in the same order
+  zipf        Zipfian (theta 0.99) over n keys scattered over the int range,
+              so a few keys are inserted and looked up very often
+  adversarial outside in: 0, n-1, 1, n-2, ... so that every insert lands on
+              one of the two spines and both grow as deep as they can
+
+For every operation it reports ops/sec and the p50/p99/p999 latency in ns,
+and the peak RSS of the process so far (sizes run in the order given, so
+run them smallest first). Latency is sampled on at most LAT_SAMPLES calls
+per operation; the cost of reading the clock is measured once and taken
+off both the samples and the throughput.
+
+Usage: bench-suite [-c file.csv] [-j file.json] [-d dist,...] [n ...]
+                                       (default: 1000 10000 100000 1000000)
+
+`make bench-full` adds 10M and 100M keys. The 100M key run needs roughly
+5 GB of memory, for the nodes and the key array:
+
+  build/bench-suite 1000 10000 100000 1000000 10000000 100000000
+
+Each CSV/JSON row carries the version string the suite was built with
+(BENCH_VERSION, set by `make bench` from git) and the node layout, so runs
+of different versions can be compared row by row.
+
+*/
+
+#include "rbtree.h"
+#include<math.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/resource.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+#define LAT_SAMPLES 100000
+#define ZIPF_THETA 0.99
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+#if defined(RBTREE_COMPACT) && defined(RBTREE_ORDER_STATS)
+#define LAYOUT "compact+order-stats"
+#elif defined(RBTREE_COMPACT)
+#define LAYOUT "compact"
+#elif defined(RBTREE_ORDER_STATS)
+#define LAYOUT "order-stats"
+#else
+#define LAYOUT "default"
+#endif
+
+#ifdef RBTREE_PREFETCH
+#define PREFETCH "+prefetch"
+#else
+#define PREFETCH ""
+#endif
+
+// Key distributions.
+enum dist { RANDOM, SEQUENTIAL, ZIPF, ADVERSARIAL, DISTS };
+
+static const char *dist_names[DISTS] =
+  { "random", "sequential", "zipf", "adversarial" };
+
+// Latency samples of one operation.
+struct Timer {
+
+  double *samples;  /* Sampled latencies in ns.              */
+  size_t count;     /* Samples taken.                        */
+  size_t stride;    /* Time every stride-th call.            */
+  double start;     /* Start of the whole loop, in ns.       */
+  double sampleAt;  /* Start of the call being sampled.      */
+
+};
+
+// Where the results go.
+struct Output {
+
+  FILE *csv;        /* CSV file, or NULL.                    */
+  FILE *json;       /* JSON file, or NULL.                   */
+  size_t rows;      /* Rows written so far.                  */
+
+};
+
+// Prototypes.
+void run(enum dist, size_t, int *, struct Timer *, struct Output *);
+void fill(enum dist, int *, size_t, bool);
+void report(struct Output *, enum dist, size_t, const char *, struct Timer *,
+  size_t);
+int cmp_double(const void *, const void *);
+double percentile(struct Timer *, double);
+long peak_rss_kb(void);
+double zeta(size_t, double);
+int scatter(unsigned long long);
+double now_ns(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+static volatile int sink = 0; // Keeps the lookups from being optimized away.
+static double overhead = 0;   // Cost of one clock read pair, in ns.
+
+// Start and stop a timed loop; sample call i if it is on the stride.
+#define LOOP_BEGIN(t)\
+  ((t)->count = 0, (t)->start = now_ns())
+#define CALL_BEGIN(t, i)\
+  do { if ((i) % (t)->stride == 0) (t)->sampleAt = now_ns(); } while (0)
+#define CALL_END(t, i)\
+  do { if ((i) % (t)->stride == 0) (t)->samples[(t)->count++] =\
+    now_ns() - (t)->sampleAt - overhead; } while (0)
+
+int main(int argc, char** argv) {
+
+  size_t defaults[] = { 1000, 10000, 100000, 1000000 };
+  size_t sizes[64];
+  size_t nsizes = 0, i = 0, max = 0;
+  bool use[DISTS] = { true, true, true, true };
+  struct Output out = { NULL, NULL, 0 };
+  struct Timer timer;
+  double calib[1000];
+  int *keys = NULL;
+  int d = 0;
+  char *name = NULL;
+
+  for (i = 1; i < (size_t)argc; i++) {
+    if (strcmp(argv[i], "-c") == 0 && i + 1 < (size_t)argc) {
+      if ((out.csv = fopen(argv[++i], "w")) == NULL) {
+        perror(argv[i]);
+        exit(EXT_F);
+      }
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < (size_t)argc) {
+      if ((out.json = fopen(argv[++i], "w")) == NULL) {
+        perror(argv[i]);
+        exit(EXT_F);
+      }
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < (size_t)argc) {
+      for (d = 0; d < DISTS; d++)
+        use[d] = false;
+      for (name = strtok(argv[++i], ","); name; name = strtok(NULL, ","))
+        for (d = 0; d < DISTS; d++)
+          if (strcmp(name, dist_names[d]) == 0)
+            use[d] = true;
+    } else if (nsizes < sizeof(sizes) / sizeof(sizes[0])) {
+      sizes[nsizes++] = strtoul(argv[i], NULL, 10);
+    }
+  }
+  if (nsizes == 0) {
+    memcpy(sizes, defaults, sizeof(defaults));
+    nsizes = sizeof(defaults) / sizeof(defaults[0]);
+  }
+
+  for (i = 0; i < nsizes; i++)
+    max = sizes[i] > max ? sizes[i] : max;
+  keys = malloc((max > 0 ? max : 1) * sizeof(int));
+  timer.samples = malloc(LAT_SAMPLES * sizeof(double));
+  if (keys == NULL || timer.samples == NULL) {
+    fprintf(stderr, "Error allocating memory for %lu keys!\n",
+      (unsigned long)max);
+    exit(EXT_F);
+  }
+
+  // Median cost of reading the clock twice.
+  for (i = 0; i < 1000; i++) {
+    calib[i] = now_ns();
+    calib[i] = now_ns() - calib[i];
+  }
+  qsort(calib, 1000, sizeof(double), cmp_double);
+  overhead = calib[500];
+
+  if (out.csv != NULL)
+    fprintf(out.csv, "version,layout,dist,n,op,ops_per_sec,p50_ns,p99_ns,"
+      "p999_ns,peak_rss_kb\n");
+  if (out.json != NULL)
+    fprintf(out.json, "{\n  \"version\": \"%s\",\n  \"layout\": \"%s\",\n"
+      "  \"results\": [", BENCH_VERSION, LAYOUT PREFETCH);
+
+  printf("rbtree %s, %s layout, %d-byte nodes\n", BENCH_VERSION,
+    LAYOUT PREFETCH, (int)sizeof(struct RBTreeNode));
+  printf("%-12s %10s %-9s %14s %10s %10s %10s %12s\n", "dist", "n", "op",
+    "ops/s", "p50 ns", "p99 ns", "p999 ns", "peak RSS KB");
+
+  for (i = 0; i < nsizes; i++)
+    for (d = 0; d < DISTS; d++)
+      if (use[d] && sizes[i] > 0)
+        run((enum dist)d, sizes[i], keys, &timer, &out);
+
+  if (out.csv != NULL)
+    fclose(out.csv);
+  if (out.json != NULL) {
+    fprintf(out.json, "\n  ]\n}\n");
+    fclose(out.json);
+  }
+  free(timer.samples);
+  free(keys);
+  return 0;
+}
+
+// All operations for one distribution and size.
+void run(enum dist dist, size_t n, int *keys, struct Timer *t,
+  struct Output *out) {
+
+  struct RBTree *tree = init_rbtree();
+  struct RBTreeIter iter;
+  struct RBTreeNode *node = NULL;
+  size_t i = 0, half = n / 2;
+
+  t->stride = n > LAT_SAMPLES ? (n + LAT_SAMPLES - 1) / LAT_SAMPLES : 1;
+
+  fill(dist, keys, n, false);
+  LOOP_BEGIN(t);
+  for (i = 0; i < n; i++) {
+    CALL_BEGIN(t, i);
+    insert(tree, keys[i], NULL);
+    CALL_END(t, i);
+  }
+  report(out, dist, n, "insert", t, n);
+
+  fill(dist, keys, n, true);
+  LOOP_BEGIN(t);
+  for (i = 0; i < n; i++) {
+    CALL_BEGIN(t, i);
+    sink += search(tree, keys[i]) != NULL;
+    CALL_END(t, i);
+  }
+  report(out, dist, n, "search", t, n);
+
+  LOOP_BEGIN(t);
+  for (i = 0; i < n; i++) {
+    CALL_BEGIN(t, i);
+    sink += (i & 1 ? maximum(tree) : minimum(tree))->key;
+    CALL_END(t, i);
+  }
+  report(out, dist, n, "minmax", t, n);
+
+  node = iter_begin(tree, &iter);
+  LOOP_BEGIN(t);
+  for (i = 0; node != NULL; i++) {
+    CALL_BEGIN(t, i);
+    node = iter_next(&iter);
+    CALL_END(t, i);
+  }
+  report(out, dist, n, "iterate", t, i);
+
+  fill(dist, keys, n, false);
+  LOOP_BEGIN(t);
+  for (i = 0; i < half; i++) {
+    CALL_BEGIN(t, i);
+    search_and_delete(tree, keys[i]);
+    CALL_END(t, i);
+  }
+  report(out, dist, n, "delete", t, half);
+
+  // One call for all nodes: the latency reported is the mean per node.
+  t->stride = 1;
+  LOOP_BEGIN(t);
+  CALL_BEGIN(t, 0);
+  dest_rbtree(&tree);
+  CALL_END(t, 0);
+  t->samples[0] /= n - half;
+  report(out, dist, n, "teardown", t, n - half);
+}
+
+/*
+Fill keys with n keys of a distribution, the same ones every time for
+inserts. Lookups (again = true) of random keys visit the inserted keys in
+a shuffled order, and of Zipfian keys draw anew; the other distributions replay
+their insert order.
+*/
+void fill(enum dist dist, int *keys, size_t n, bool again) {
+
+  static double zetan = 0, eta = 0;
+  static size_t zipfn = 0;
+  double u = 0, alpha = 1 / (1 - ZIPF_THETA);
+  size_t i = 0, rank = 0;
+
+  seed = again ? 0x9E3779B97F4A7C15ULL : 88172645463325252ULL;
+
+  switch (dist) {
+  case RANDOM:
+    if (again) {
+      fill(dist, keys, n, false);
+      seed = 0x9E3779B97F4A7C15ULL;
+      for (i = n - 1; i > 0; i--) {
+        rank = next_rand() % (i + 1);
+        u = keys[i], keys[i] = keys[rank], keys[rank] = (int)u;
+      }
+    } else {
+      for (i = 0; i < n; i++)
+        keys[i] = (int)(next_rand() & 0x7fffffff);
+    }
+    break;
+  case SEQUENTIAL:
+    for (i = 0; i < n; i++)
+      keys[i] = (int)i;
+    break;
+  case ZIPF:
+    // Gray et al., "Quickly generating billion-record synthetic databases".
+    if (zipfn != n) {
+      zipfn = n;
+      zetan = zeta(n, ZIPF_THETA);
+      eta = (1 - pow(2.0 / n, 1 - ZIPF_THETA)) /
+        (1 - zeta(2, ZIPF_THETA) / zetan);
+    }
+    for (i = 0; i < n; i++) {
+      u = (next_rand() >> 11) * (1.0 / 9007199254740992.0);
+      if (u * zetan < 1)
+        rank = 0;
+      else if (u * zetan < 1 + pow(0.5, ZIPF_THETA))
+        rank = 1;
+      else
+        rank = (size_t)(n * pow(eta * u - eta + 1, alpha));
+      keys[i] = scatter(rank);
+    }
+    break;
+  case ADVERSARIAL:
+    for (i = 0; i < n; i++)
+      keys[i] = (int)(i % 2 == 0 ? i / 2 : n - 1 - i / 2);
+    break;
+  default:
+    break;
+  }
+}
+
+// One result row to stdout and to the CSV/JSON files.
+void report(struct Output *out, enum dist dist, size_t n, const char *op,
+  struct Timer *t, size_t ops) {
+
+  double secs = (now_ns() - t->start - t->count * overhead) / 1e9;
+  double rate = ops / (secs > 0 ? secs : 1e-9);
+  double p50 = 0, p99 = 0, p999 = 0;
+  long rss = peak_rss_kb();
+
+  qsort(t->samples, t->count, sizeof(double), cmp_double);
+  p50  = percentile(t, 0.5);
+  p99  = percentile(t, 0.99);
+  p999 = percentile(t, 0.999);
+
+  printf("%-12s %10lu %-9s %14.0f %10.0f %10.0f %10.0f %12ld\n",
+    dist_names[dist], (unsigned long)n, op, rate, p50, p99, p999, rss);
+
+  if (out->csv != NULL)
+    fprintf(out->csv, "%s,%s,%s,%lu,%s,%.0f,%.0f,%.0f,%.0f,%ld\n",
+      BENCH_VERSION, LAYOUT PREFETCH, dist_names[dist], (unsigned long)n, op,
+      rate, p50, p99, p999, rss);
+  if (out->json != NULL)
+    fprintf(out->json, "%s\n    {\"dist\": \"%s\", \"n\": %lu, \"op\": \"%s\", "
+      "\"ops_per_sec\": %.0f, \"p50_ns\": %.0f, \"p99_ns\": %.0f, "
+      "\"p999_ns\": %.0f, \"peak_rss_kb\": %ld}", out->rows > 0 ? "," : "",
+      dist_names[dist], (unsigned long)n, op, rate, p50, p99, p999, rss);
+  out->rows++;
+}
+
+int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of the sorted samples, never below zero.
+double percentile(struct Timer *t, double p) {
+  size_t rank = (size_t)ceil(p * t->count);
+  double value = 0;
+  if (t->count == 0)
+    return 0;
+  value = t->samples[rank > 0 ? rank - 1 : 0];
+  return value > 0 ? value : 0;
+}
+
+// Peak resident set size of the process so far.
+long peak_rss_kb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Generalized harmonic number: sum of 1 / i^theta for i = 1..n.
+double zeta(size_t n, double theta) {
+  double sum = 0;
+  size_t i = 0;
+  for (i = 1; i <= n; i++)
+    sum += 1 / pow((double)i, theta);
+  return sum;
+}
+
+// Spread a Zipf rank over the int range, so hot keys are not adjacent.
+int scatter(unsigned long long rank) {
+  rank = (rank + 1) * 0x9E3779B97F4A7C15ULL;
+  return (int)((rank ^ rank >> 31) & 0x7fffffff);
+}
+
+double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// xorshift64
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
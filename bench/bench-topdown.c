@@ -0,0 +1,115 @@
+/*
+
+Top-down tree benchmark for the rbtree library. For every size given on
+the command line, inserts n random keys, looks up n random keys (half of
+them present) and deletes all keys again, once with the CLRS-style tree of
+rbtree.h and once with the single-pass top-down tree, and reports
+operations/sec for each, after the node size of both.
+
+Usage: bench-topdown [n ...]      (default: 1000000 10000000)
+
+*/
+
+#include "rbtopdown.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+
+//Constants
+#define EXT_F 1
+
+// Prototypes.
+void report(const char *, const char *, double, size_t);
+double now(void);
+unsigned long long next_rand(void);
+
+static unsigned long long seed = 88172645463325252ULL;
+static volatile int sink = 0; // Keeps the lookups from being optimized away.
+
+int main(int argc, char** argv) {
+
+  size_t defaults[] = { 1000000, 10000000 };
+  size_t count = argc > 1 ? (size_t)argc - 1 : 2;
+  size_t i = 0, j = 0, n = 0;
+  struct RBTree *tree = NULL;
+  struct TopDownTree *td = NULL;
+  int *keys = NULL, *queries = NULL;
+  double start = 0;
+  char label[32];
+
+  printf("node bytes: rbtree %zu, top-down %zu\n\n",
+    sizeof(struct RBTreeNode), sizeof(struct TopDownNode));
+  printf("%-10s %-18s %-10s %14s\n", "n", "tree", "op", "ops/s");
+
+  for (i = 0; i < count; i++) {
+    n = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : defaults[i];
+    keys = malloc(n * sizeof(int));
+    queries = malloc(n * sizeof(int));
+    if (keys == NULL || queries == NULL) {
+      fprintf(stderr, "Error allocating memory for keys!\n");
+      exit(EXT_F);
+    }
+    for (j = 0; j < n; j++)
+      keys[j] = (int)(next_rand() & 0x7fffffff);
+    for (j = 0; j < n; j++)
+      queries[j] = j % 2 == 0 ? keys[next_rand() % n]
+        : (int)(next_rand() & 0x7fffffff);
+    sprintf(label, "%zu", n);
+
+    tree = init_rbtree();
+    start = now();
+    for (j = 0; j < n; j++)
+      insert(tree, keys[j], NULL);
+    report(label, "rbtree", now() - start, n);
+    start = now();
+    for (j = 0; j < n; j++)
+      sink += search(tree, queries[j]) != NULL;
+    report("", "", now() - start, n);
+    start = now();
+    for (j = 0; j < n; j++)
+      search_and_delete(tree, keys[j]);
+    report("", "", now() - start, n);
+    dest_rbtree(&tree);
+
+    td = init_tdtree();
+    start = now();
+    for (j = 0; j < n; j++)
+      td_insert(td, keys[j], NULL);
+    report("", "top-down", now() - start, n);
+    start = now();
+    for (j = 0; j < n; j++)
+      sink += td_search(td, queries[j], NULL);
+    report("", "", now() - start, n);
+    start = now();
+    for (j = 0; j < n; j++)
+      td_search_and_delete(td, keys[j]);
+    report("", "", now() - start, n);
+    dest_tdtree(&td);
+
+    free(keys);
+    free(queries);
+  }
+
+  return 0;
+}
+
+// One row per operation, in the order insert, search, delete.
+void report(const char *n, const char *tree, double secs, size_t ops) {
+  static const char *names[] = { "insert", "search", "delete" };
+  static int row = 0;
+  printf("%-10s %-18s %-10s %14.0f\n", n, tree, names[row++ % 3], ops / secs);
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64
+unsigned long long next_rand(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
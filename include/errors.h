@@ -1,17 +1,41 @@
 #ifndef ERRORS_H
 #define ERRORS_H
 
+#include<errno.h>
+
 /****** ERROR MESSAGES ******/
 
 #define MEM_ERROR "Could not allocate memory.\n"
 #define INV_NODE "Invalid RB-Tree Node.\n"
 #define NULL_NODE "Node is null!\n"
 #define INV_DELOC "Cannot deallocate node, data present.\n"
+#define UNSORTED "Keys for bulk load are not sorted.\n"
+#define THREAD_ERROR "Could not start worker thread.\n"
+#define NOT_FAMILY "Trees do not share a node pool.\n"
+#define NOT_ORDERED "Trees overlap; join needs left <= key <= right.\n"
+#define NOT_EMPTY "Target tree of split is not empty.\n"
+#define TOO_LARGE "Tree is too large to freeze.\n"
+#define NOT_DECREASE "New key is larger than the old one.\n"
+#define INV_INTERVAL "Interval ends before it starts.\n"
+#define SNAP_TOO_LARGE "Tree is too large to save.\n"
+#define FILE_ERROR "Could not access snapshot file.\n"
+#define BAD_SNAP "Snapshot file is damaged.\n"
 
 #define FAIL_EXIT 1
 
 /****** FUNCTION PROTOTYPES ******/
 
+/*
+Report an error the caller recovers from: errno is set to the given code
+and the error handler is called (see set_error_handler in rbtree.h). If the
+handler returns, so does this, and the caller fails with its error value.
+*/
+void report_error(int, const char *);
+
+/*
+Report an error the caller cannot back out of. The error handler is called
+as for report_error, and the process exits if it returns.
+*/
 void display_error(char*);
 
 
@@ -0,0 +1,93 @@
+#ifndef RBCONC_H
+#define RBCONC_H
+
+/*
+Concurrent Red-Black tree: one writer at a time, any number of readers
+without locks. The tree is persistent (rbpersist.h). Writers serialize on
+a mutex, build the next version by copying the updated path and publish
+it with one atomic store. Readers load the current version and search it;
+it never changes under them, so they neither wait nor retry. Replaced
+versions, with the nodes only they reach, and the data of deleted nodes
+are reclaimed by epochs, so nothing a reader may still hold is reused or
+released under it.
+*/
+
+#include "rbpersist.h"
+#include<pthread.h>
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+#define CONC_RECLAIM 64 /* Writes that trigger a reclamation attempt.       */
+#define CONC_EPOCHS  3  /* Limbo lists: current epoch and the two before.   */
+
+/*
+Per-thread reader state. The caller owns it and registers it once with
+conc_reader_register before its first read section.
+*/
+struct RBTreeReader {
+
+  size_t state;               /* Epoch << 1 | 1 inside a section, else 0. */
+  struct RBTreeReader *next;  /* Next registered reader.                  */
+
+};
+
+/* A version replaced by a write, with the data the write deleted. */
+struct RBTreeRetired {
+
+  struct RBTreeVersion *version;  /* Destroyed once reclaimed.        */
+  void *data;                     /* Deleted data, or NULL.           */
+  struct RBTreeRetired *next;     /* Next entry of its limbo list.    */
+
+};
+
+struct RBTreeConc {
+
+  struct RBTreePersist *store;        /* Nodes of every version.             */
+  struct RBTreeVersion *current;      /* Version readers search.             */
+  pthread_mutex_t lock;               /* Serializes writers.                 */
+  size_t epoch;                       /* Global epoch.                       */
+  struct RBTreeReader *readers;       /* Registered readers.                 */
+  struct RBTreeRetired *limbo[CONC_EPOCHS]; /* Retired writes, by epoch.    */
+  size_t retired;                     /* Writes retired since last attempt.  */
+  void (*release)(void *);            /* Frees data of deleted nodes.        */
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for a concurrent tree. release may be NULL. */
+struct RBTreeConc* init_rbtree_conc(void (*)(void *),
+	const struct RBTreeAllocator *);
+
+/* Destructor for a concurrent tree. No reader may be in a section. */
+void dest_rbtree_conc(struct RBTreeConc **);
+
+/****** READER FUNCTIONS ******/
+
+/* Register a reader with the tree. */
+void conc_reader_register(struct RBTreeConc *, struct RBTreeReader *);
+
+/* Unregister a reader. It must not be in a section. */
+void conc_reader_unregister(struct RBTreeConc *, struct RBTreeReader *);
+
+/* Enter a read section. */
+void conc_read_begin(struct RBTreeConc *, struct RBTreeReader *);
+
+/* Leave a read section. */
+void conc_read_end(struct RBTreeReader *);
+
+/* Lock-free search of the current version; only inside a read section. */
+bool conc_search(struct RBTreeConc *, int, void **);
+
+/****** WRITER FUNCTIONS ******/
+
+/* Publish a version with a node inserted. */
+bool conc_insert(struct RBTreeConc *, int, void *);
+
+/* Publish a version with a node deleted; its data is released later. */
+bool conc_search_and_delete(struct RBTreeConc *, int);
+
+/* Wait until every write so far has been reclaimed. */
+void conc_synchronize(struct RBTreeConc *);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef RBFREEZE_H
+#define RBFREEZE_H
+
+/*
+Frozen trees: a read-only copy of a tree laid out in contiguous arrays for
+searching with few cache misses. tree_freeze copies the keys and data of a
+tree in order and lays the keys out again in one of two search orders:
+
+  FREEZE_EYTZINGER  Breadth-first order of a complete tree. The children of
+                    slot i are slots 2i and 2i + 1, so the image is nothing
+                    but keys, and the next four levels of a search are
+                    prefetched in one cache line.
+  FREEZE_VEB        van Emde Boas order. Every subtree of height h/2 lies in
+                    one contiguous run, so a search touches O(log_B n) cache
+                    lines for any line size B without knowing B.
+
+Searches return positions in key order, so a range scan is a walk over the
+sorted keys. tree_thaw turns a frozen tree back into a mutable one in O(n).
+*/
+
+#include "rbtree.h"
+#include<stdint.h>
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+/* Search orders of a frozen image. */
+enum freeze_layout {
+	FREEZE_EYTZINGER,
+	FREEZE_VEB
+};
+
+/* Node of a van Emde Boas image. Children are slots, or FROZEN_NONE. */
+#define FROZEN_NONE UINT32_MAX
+
+struct FrozenNode {
+
+  int key;            /* Key of the node.                        */
+  uint32_t rank;      /* Position of the key in key order.       */
+  uint32_t child[2];  /* Slots of the left and right child.      */
+
+};
+
+struct RBTreeFrozen {
+
+  enum freeze_layout layout;       /* Search order of the image.        */
+  size_t size;                     /* Number of keys.                   */
+  int *keys;                       /* Keys in order.                    */
+  void **data;                     /* Satellite data, in key order.     */
+  int *eytzinger;                  /* EYTZINGER: keys, slots 1 to size. */
+  uint32_t *ranks;                 /* EYTZINGER: position of each slot. */
+  struct FrozenNode *veb;          /* VEB: nodes, root in slot 0.       */
+  void *block;                     /* Memory behind all of the above.   */
+  size_t blockSize;                /* Size of block in bytes.           */
+  struct RBTreeAllocator allocator; /* Hooks block was obtained from.   */
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Read-only copy of a tree in the given search order -- O(n). */
+struct RBTreeFrozen* tree_freeze(struct RBTree *, enum freeze_layout);
+
+/* Destructor for a frozen tree. */
+void dest_rbtree_frozen(struct RBTreeFrozen **);
+
+/* Mutable tree with the keys and data of a frozen tree -- O(n). */
+struct RBTree* tree_thaw(struct RBTreeFrozen *, const struct RBTreeAllocator *);
+
+/****** ACCESSOR FUNCTIONS ******/
+
+/* Search a frozen tree. The data of the key goes to the void **. */
+bool frozen_search(struct RBTreeFrozen *, int, void **);
+
+/* Position of the first key >= the given key, or the size if none. */
+size_t frozen_lower_bound(struct RBTreeFrozen *, int);
+
+/* Number of keys in a frozen tree -- O(1). */
+size_t frozen_size(struct RBTreeFrozen *);
+
+/* Call a function on every key in [lo, hi) and its data. */
+size_t frozen_scan(struct RBTreeFrozen *, int, int,
+	int (*)(int, void *, void *), void *);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef RBGENERIC_H
+#define RBGENERIC_H
+
+/*
+Type-specialized Red-Black trees. RBTREE_DEFINE(name, ktype, cmp) generates
+a node type that embeds a struct RBTreeNode followed by a key of type ktype,
+plus static inline insert/search/delete functions whose comparisons are
+expanded in place, so there is no function-pointer call per level. The
+rebalancing is the library's own: insert_link, delete_node and the rotations.
+
+cmp(a, b) is a function or macro taking two ktype values and returning <0, 0
+or >0. RBTREE_CMP_NUM covers arithmetic types and RBTREE_CMP_BYTES covers
+fixed-length byte keys declared with RBTREE_BYTES_KEY. For example:
+
+  RBTREE_DEFINE(u64tree, uint64_t, RBTREE_CMP_NUM)
+  RBTREE_DEFINE(dbltree, double, RBTREE_CMP_NUM)
+  RBTREE_BYTES_KEY(digest, 20);
+  RBTREE_DEFINE(digtree, struct digest, RBTREE_CMP_BYTES)
+
+A generated tree is an ordinary struct RBTree created with name##_init, so
+minimum, maximum, successor, tree_size, dest_rbtree etc. all apply to it;
+name##_key reads the key of any of its nodes.
+*/
+
+#include "errors.h"
+#include "rbtree.h"
+#include<string.h>
+
+/****** COMPARATORS ******/
+
+#define RBTREE_CMP_NUM(a, b)\
+  (((a) > (b)) - ((a) < (b)))
+
+#define RBTREE_CMP_BYTES(a, b)\
+  memcmp((a).bytes, (b).bytes, sizeof((a).bytes))
+
+/* Declare a fixed-length byte key, struct name { unsigned char bytes[len]; }. */
+#define RBTREE_BYTES_KEY(name, len)\
+  struct name { unsigned char bytes[len]; }
+
+/****** TREE GENERATOR ******/
+
+#define RBTREE_DEFINE(name, ktype, cmp)\
+\
+struct name##_node {\
+  struct RBTreeNode base; /* Must come first. */\
+  ktype key;\
+};\
+\
+static inline struct RBTree* name##_init(const struct RBTreeAllocator *allocator) {\
+  return init_rbtree_sized(sizeof(struct name##_node), allocator);\
+}\
+\
+static inline ktype name##_key(const struct RBTreeNode *node) {\
+  return ((const struct name##_node *)node)->key;\
+}\
+\
+static inline struct RBTreeNode* name##_insert(struct RBTree *tree, ktype key,\
+  void *data) {\
+  struct RBTreeNode *newest =\
+    init_rbtree_node(tree->pool, NULL, tree->nil, tree->nil, 0, data, RED, false);\
+  struct RBTreeNode *walk = tree->root;\
+  struct RBTreeNode *parent = tree->nil;\
+  int order = 0;\
+  if (newest == NULL) {\
+    report_error(ENOMEM, MEM_ERROR);\
+    return NULL;\
+  }\
+  ((struct name##_node *)newest)->key = key;\
+  while (walk != tree->nil) {\
+    parent = walk;\
+    order = cmp(key, ((struct name##_node *)walk)->key);\
+    walk = order < 0 ? walk->left : walk->right;\
+  }\
+  insert_link(tree, parent, newest, parent != tree->nil && order < 0);\
+  return newest;\
+}\
+\
+static inline struct RBTreeNode* name##_search(struct RBTree *tree, ktype key) {\
+  struct RBTreeNode *walk = tree->root;\
+  int order = 0;\
+  while (walk != tree->nil) {\
+    if ((order = cmp(key, ((struct name##_node *)walk)->key)) == 0)\
+      return walk;\
+    walk = order < 0 ? walk->left : walk->right;\
+  }\
+  return NULL;\
+}\
+\
+static inline void* name##_search_and_delete(struct RBTree *tree, ktype key) {\
+  struct RBTreeNode *result = name##_search(tree, key);\
+  void *response = NULL;\
+  if (result == NULL)\
+    return NULL;\
+  response = delete_node(tree, result);\
+  dest_rbtree_node(tree->pool, &result);\
+  return response;\
+}
+
+#endif
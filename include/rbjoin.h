@@ -0,0 +1,41 @@
+#ifndef RBJOIN_H
+#define RBJOIN_H
+
+/*
+Join, split and set operations on int-keyed Red-Black trees. They relink
+whole subtrees rather than moving keys one at a time, so every tree taking
+part must belong to one family: the first tree made with any constructor,
+and the others with init_rbtree_like from it.
+*/
+
+#include "rbtree.h"
+#include "rbtasks.h"
+
+/****** CONSTANTS ******/
+
+/* Set operations fork a task per subtree of at least this black-height. */
+#define SET_PAR_BH 8
+
+/****** JOIN AND SPLIT ******/
+
+/* Join t1, a new node and t2 into t1, where t1 <= key <= t2. O(lg n). */
+struct RBTreeNode* tree_join(struct RBTree *, int, void *, struct RBTree *);
+
+/* Move the nodes with key >= k from a tree to an empty one. O(lg n). */
+void tree_split(struct RBTree *, int, struct RBTree *);
+
+/****** SET OPERATIONS ******/
+
+/* a = a union b; b is emptied. */
+void tree_union(struct RBTree *, struct RBTree *, void (*)(void *),
+	struct RBTaskPool *);
+
+/* a = a intersection b; b is emptied. */
+void tree_intersection(struct RBTree *, struct RBTree *, void (*)(void *),
+	struct RBTaskPool *);
+
+/* a = a minus b; b is emptied. */
+void tree_difference(struct RBTree *, struct RBTree *, void (*)(void *),
+	struct RBTaskPool *);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef RBMULTI_H
+#define RBMULTI_H
+
+/*
+Multimap on a Red-Black tree: one tree node per distinct key, holding all
+values inserted under that key. The first value sits in the node's data
+field and any further ones in a FIFO list of 16-byte entries from a pool
+of their own, so duplicates cost an entry instead of a tree node and do
+not make the tree any taller. Values of a key come back in the order they
+were inserted, and multi_delete_one removes the oldest.
+
+The tree is an ordinary struct RBTree whose nodes are struct RBMultiNode,
+so iterators, range_scan and the rest of rbtree.h apply to map->tree and
+see each distinct key once.
+*/
+
+#include "rbpool.h"
+#include "rbtree.h"
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+/* A value after the first of its key. */
+struct RBMultiEntry {
+
+  struct RBMultiEntry *next; /* Next entry; the tail links to the head. */
+  void *data;                /* The value.                              */
+
+};
+
+struct RBMultiNode {
+
+  struct RBTreeNode base;    /* Must come first. base.data: oldest value. */
+  struct RBMultiEntry *tail; /* Newest entry of a circular list, or NULL. */
+  size_t count;              /* Values under the key.                     */
+
+};
+
+struct RBMultiMap {
+
+  struct RBTree *tree;          /* One node per distinct key.  */
+  struct RBTreePool *entries;   /* Pool of the extra values.   */
+  size_t size;                  /* Values in the map.          */
+
+};
+
+/* Position in the values of one key. */
+struct RBMultiIter {
+
+  struct RBMultiNode *node;  /* Node of the key, or NULL.            */
+  struct RBMultiEntry *next; /* Entry after the last value returned. */
+  size_t left;               /* Values not returned yet.             */
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for an empty multimap. A NULL allocator selects malloc/free. */
+struct RBMultiMap* init_rbmulti(const struct RBTreeAllocator *);
+
+/* Destructor for a multimap. Releases all nodes and entries at once. */
+void dest_rbmulti(struct RBMultiMap **);
+
+/****** UPDATE FUNCTIONS ******/
+
+/* Add a value under a key, after any it already has. */
+bool multi_insert(struct RBMultiMap *, int, void *);
+
+/* Remove the oldest value of a key; it goes to the void **. */
+bool multi_delete_one(struct RBMultiMap *, int, void **);
+
+/* Remove all values of a key, passing each to the function if not NULL. */
+size_t multi_delete_all(struct RBMultiMap *, int, void (*)(void *));
+
+/****** ACCESSOR FUNCTIONS ******/
+
+/* Number of values under a key -- O(lg n). */
+size_t multi_count(struct RBMultiMap *, int);
+
+/* Start iterating over the values of a key. Returns their number. */
+size_t multi_equal_range(struct RBMultiMap *, int, struct RBMultiIter *);
+
+/* Next value of the key, oldest first; false once all have been seen. */
+bool multi_iter_next(struct RBMultiIter *, void **);
+
+/* Number of values in the map -- O(1). */
+size_t multi_size(struct RBMultiMap *);
+
+/* Number of distinct keys in the map -- O(1). */
+size_t multi_keys(struct RBMultiMap *);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef RBPAR_H
+#define RBPAR_H
+
+/*
+Parallel bulk operations on int-keyed Red-Black trees, run on a fork-join
+pool from rbtasks.h: visiting every node (for_each, map, reduce), tearing
+a tree down with its satellite data, and building a tree from unsorted
+keys. A NULL pool runs everything in the caller.
+
+The traversals split the tree by subtree and fork a task for each half of
+a subtree, down to a black-height that leaves about PAR_TASKS subtrees per
+thread. The callbacks run concurrently on
+different nodes; they may change the data of the node they are given, but
+not its key or the tree.
+*/
+
+#include "rbtree.h"
+#include "rbtasks.h"
+
+/****** CONSTANTS ******/
+
+/* Traversals fork until there are about this many subtrees per thread... */
+#define PAR_TASKS 8
+
+/* ...but not for subtrees below this black-height. */
+#define PAR_MIN_BH 6
+
+/* Sorting and building fork a task per run of at least this many keys. */
+#define PAR_MIN_KEYS 16384
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for a tree of unsorted keys: parallel sort, then O(n) build. */
+struct RBTree* par_build_rbtree(const int *, void * const *, size_t,
+	const struct RBTreeAllocator *, struct RBTaskPool *);
+
+/* Destructor that passes the data of every node to a release function. */
+void par_dest_rbtree(struct RBTree **, void (*)(void *), struct RBTaskPool *);
+
+/****** TRAVERSALS ******/
+
+/* Call a function on every node, in no particular order. */
+void par_for_each(struct RBTree *, void (*)(struct RBTreeNode *, void *),
+	void *, struct RBTaskPool *);
+
+/* Replace the data of every node with a function of it. */
+void par_map(struct RBTree *, void* (*)(void *, void *), void *,
+	struct RBTaskPool *);
+
+/* Fold the nodes in key order and combine the partial results. */
+void* par_reduce(struct RBTree *, void* (*)(void *, struct RBTreeNode *,
+	void *), void* (*)(void *, void *, void *), void *, struct RBTaskPool *);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef RBPERSIST_H
+#define RBPERSIST_H
+
+/*
+Persistent Red-Black tree. An update never changes a node that a version
+can reach: it copies the path from the root to the updated position and
+returns a new version, so every older version stays valid and shares all
+other nodes with the new one. Taking a snapshot is O(1).
+
+Persistent nodes are ordinary struct RBTreeNodes, but since a shared node
+has no single parent, their parent word holds a reference count instead.
+Nodes are released when the last version that reaches them is destroyed.
+
+An update that runs out of memory releases the copies it made and returns
+NULL (see report_error); the version it started from is unchanged.
+*/
+
+#include "rbtree.h"
+#include<pthread.h>
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+/* Longest root-to-leaf path an update can copy: 2 lg(n + 1), plus room. */
+#define PERSIST_MAX_DEPTH (16 * sizeof(size_t) + 4)
+
+/* Node store shared by all versions of one persistent tree. */
+struct RBTreePersist {
+
+  struct RBTreePool *pool;  /* Pool all nodes are allocated from.      */
+  struct RBTreeNode *nil;   /* Sentinel shared by every version.       */
+  pthread_mutex_t lock;     /* Serializes updates and node releases.   */
+
+};
+
+/* One immutable version. Owns a reference to its root. */
+struct RBTreeVersion {
+
+  struct RBTreePersist *store; /* Store the nodes live in.        */
+  struct RBTreeNode *root;     /* Root node, or the sentinel.     */
+  size_t size;                 /* Number of nodes in the version. */
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for a node store. A NULL allocator selects malloc/free. */
+struct RBTreePersist* init_rbtree_persist(const struct RBTreeAllocator *);
+
+/* Destructor for a node store. Every version must be destroyed first. */
+void dest_rbtree_persist(struct RBTreePersist **);
+
+/* The empty version of a store. */
+struct RBTreeVersion* persist_empty(struct RBTreePersist *);
+
+/* Another handle on the same version -- O(1). */
+struct RBTreeVersion* persist_snapshot(struct RBTreeVersion *);
+
+/* Destructor for a version. Releases the nodes no other version reaches. */
+void dest_rbtree_version(struct RBTreeVersion **);
+
+/****** UPDATE FUNCTIONS ******/
+
+/* New version with a node inserted -- O(lg n) copies. */
+struct RBTreeVersion* persist_insert(struct RBTreeVersion *, int, void *);
+
+/* New version with a node of the given key deleted -- O(lg n) copies. */
+struct RBTreeVersion* persist_delete(struct RBTreeVersion *, int, void **);
+
+/****** ACCESSOR FUNCTIONS ******/
+
+/* Search a version for a given key. */
+struct RBTreeNode* persist_search(struct RBTreeVersion *, int);
+
+/* Number of nodes in a version -- O(1). */
+size_t version_size(struct RBTreeVersion *);
+
+/* Call a function on every node of a version with key in [lo, hi). */
+size_t persist_scan(struct RBTreeVersion *, int, int,
+	int (*)(struct RBTreeNode *, void *), void *);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef RBPOOL_H
+#define RBPOOL_H
+
+/* Slab allocator for fixed-size tree nodes. */
+
+#include<stddef.h>
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+#define POOL_MIN_SLAB 16    /* Nodes in the first slab of a pool.    */
+#define POOL_MAX_SLAB 4096  /* Upper bound on the nodes in one slab. */
+
+/*
+User-supplied memory hooks. alloc must return memory suitably aligned for
+any object (as malloc does), or NULL on failure. release receives the same
+size that was passed to alloc for that block. ctx is passed through untouched.
+*/
+struct RBTreeAllocator {
+
+  void* (*alloc)(void *ctx, size_t size);            /* Obtain a block.   */
+  void  (*release)(void *ctx, void *ptr, size_t size); /* Return a block. */
+  void *ctx;                                         /* User state.       */
+
+};
+
+/* Header of one slab. The nodes follow directly after it. */
+struct RBTreeSlab {
+
+  struct RBTreeSlab *next; /* Next (older) slab of the pool. */
+  size_t capacity;         /* Number of nodes in this slab.  */
+
+};
+
+struct RBTreePool {
+
+  struct RBTreeAllocator allocator; /* Hooks used for slabs and the pool. */
+  struct RBTreeSlab *slabs;         /* Singly linked list of slabs.       */
+  void *freeList;                   /* Recycled nodes, linked in place.   */
+  char *bump;                       /* Next untouched node in newest slab. */
+  char *bumpEnd;                    /* End of the newest slab.            */
+  size_t nodeSize;                  /* Size of one node in bytes.         */
+  size_t nextCapacity;              /* Capacity of the next slab.         */
+  size_t refs;                      /* Trees sharing the pool.            */
+#ifdef RBTREE_STATS
+  size_t nodeAllocs;                /* Nodes handed out, blocks included. */
+  size_t nodeFrees;                 /* Nodes given back.                  */
+  size_t slabAllocs;                /* Slabs obtained from the allocator. */
+#endif
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for a node pool. A NULL allocator selects malloc/free. */
+struct RBTreePool* init_rbtree_pool(const struct RBTreeAllocator *, size_t);
+
+/* Destructor for a node pool. Releases every slab at once. */
+void dest_rbtree_pool(struct RBTreePool **);
+
+/****** ALLOCATION FUNCTIONS ******/
+
+/* Take one node from the pool. */
+void* pool_alloc_node(struct RBTreePool *);
+
+/* Take a contiguous block of nodes from the pool as one dedicated slab. */
+void* pool_alloc_block(struct RBTreePool *, size_t);
+
+/* Give a node back to the pool's free list. */
+void pool_free_node(struct RBTreePool *, void *);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef RBPQ_H
+#define RBPQ_H
+
+/*
+Priority queue on an int-keyed Red-Black tree, e.g. a timer queue keyed by
+deadline. The tree keeps its minimum cached, so peeking is O(1), and
+popping deletes that node directly: it has no left child, so the next
+minimum is one step away, and delete_fixup does O(1) amortized work. No
+key is searched for. Equal keys come out in the order they were pushed.
+
+The queue is an ordinary tree from init_rbtree or any other constructor.
+The node returned by pq_push is a handle for pq_decrease_key and
+pq_cancel until the node leaves the queue.
+*/
+
+#include "rbtree.h"
+
+/****** UPDATE FUNCTIONS ******/
+
+/* Add a key with its data. Returns the node, or NULL if memory ran out. */
+struct RBTreeNode* pq_push(struct RBTree *, int, void *);
+
+/* Remove the minimum; its key and data go to the pointers. */
+bool pq_pop(struct RBTree *, int *, void **);
+
+/* Lower the key of a queued node, reusing the node. */
+bool pq_decrease_key(struct RBTree *, struct RBTreeNode *, int);
+
+/* Remove a queued node, e.g. a cancelled timer. Returns its data. */
+void* pq_cancel(struct RBTree *, struct RBTreeNode *);
+
+/****** ACCESSOR FUNCTIONS ******/
+
+/* Node with the minimum key, the oldest of equal ones -- O(1). */
+struct RBTreeNode* pq_peek(struct RBTree *);
+
+#endif
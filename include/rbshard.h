@@ -0,0 +1,104 @@
+#ifndef RBSHARD_H
+#define RBSHARD_H
+
+/*
+Sharded map: the key space is cut into ranges, and each range is held by a
+Red-Black tree of its own with its own lock, pool and sentinel. Writers to
+different shards never touch the same memory, so updates scale with the
+number of threads as long as the keys spread over the shards. The shards
+stay in key order, so a range scan visits them one after the other.
+
+A shard that grows past the size limit is split in two at its median key,
+and a shard that shrinks below a quarter of the limit is merged with a
+neighbor when the two fit in half the limit; an empty shard is dropped.
+Splits and merges rebuild the shards in O(n) with init_rbtree_sorted while
+holding the locks of the shards involved; each one pays for the inserts or
+deletes that led up to it. The directory of shards is read without locks:
+a resize swaps in a new one and frees the old one once no operation can
+still be reading it, so operations on other shards go on meanwhile.
+*/
+
+#include "rbtree.h"
+#include<pthread.h>
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+#define SHARD_MAX_KEYS 65536 /* Default size limit of a shard.                */
+#define SHARD_SLOTS    64    /* Reader counters, shared by threads in turn.   */
+
+/*
+One range of keys. Each shard starts a cache line of its own, so threads
+locking neighboring shards do not contend for one line.
+*/
+struct RBShard {
+
+  int low;              /* Smallest key of the range; INT_MIN for the first. */
+  int high;             /* Largest key of the range; INT_MAX for the last.   */
+  bool dead;            /* Merged away; operations that reach it look again. */
+  struct RBTree *tree;  /* The keys of the range.                            */
+  size_t limit;         /* Split when the tree grows past this.              */
+  size_t floor;         /* Try a merge when the tree shrinks below this.     */
+  pthread_mutex_t lock; /* Guards the fields above.                          */
+
+} __attribute__((aligned(64)));
+
+/* Shards in key order. Never changed once published; resizes make a new one. */
+struct RBShardDir {
+
+  size_t count;            /* Number of shards.                     */
+  int *lows;               /* Low key of each shard, for searching. */
+  struct RBShard **shards; /* The shards.                           */
+
+};
+
+/* Operations in progress, counted by phase; one cache line per slot. */
+struct RBShardSlot {
+
+  size_t readers[2];
+
+} __attribute__((aligned(64)));
+
+struct RBShardMap {
+
+  struct RBShardDir *dir;     /* Current directory, swapped by resizes.     */
+  size_t maxKeys;             /* Size limit of a shard.                     */
+  size_t phase;               /* Counter of the slots new operations use.   */
+  pthread_mutex_t resizeLock; /* Serializes resizes.                        */
+  const struct RBTreeAllocator *allocator; /* &hooks, or NULL for malloc.   */
+  struct RBTreeAllocator hooks;            /* Copy of the user's hooks.     */
+  struct RBShardSlot slots[SHARD_SLOTS];   /* Operations in progress.       */
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for an empty map. 0 selects SHARD_MAX_KEYS. */
+struct RBShardMap* init_rbshard_map(size_t, const struct RBTreeAllocator *);
+
+/* Destructor for a map. No other thread may be using it. */
+void dest_rbshard_map(struct RBShardMap **);
+
+/****** UPDATE FUNCTIONS ******/
+
+/* Insert under the lock of the key's shard. Returns false if memory ran out. */
+bool shard_insert(struct RBShardMap *, int, void *);
+
+/* Delete one node with the key; its data goes to the void **. */
+bool shard_search_and_delete(struct RBShardMap *, int, void **);
+
+/****** ACCESSOR FUNCTIONS ******/
+
+/* Search under the lock of the key's shard. Its data goes to the void **. */
+bool shard_search(struct RBShardMap *, int, void **);
+
+/* Call a function on every node with lo <= key < hi, in order. */
+size_t shard_range_scan(struct RBShardMap *, int, int,
+	int (*)(struct RBTreeNode *, void *), void *);
+
+/* Number of keys in the map -- O(#shards). */
+size_t shard_size(struct RBShardMap *);
+
+/* Number of shards. */
+size_t shard_count(struct RBShardMap *);
+
+#endif
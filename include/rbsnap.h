@@ -0,0 +1,115 @@
+#ifndef RBSNAP_H
+#define RBSNAP_H
+
+/*
+Binary snapshots of a Red-Black tree. snap_save writes the tree to a file
+whose nodes refer to their children by relative offsets instead of by
+pointers. snap_open maps such a file read-only and can search it straight
+away: there is no parsing, no per-node allocation and no pointer fixup, so
+opening costs the same for any number of nodes. snap_promote turns an open
+snapshot back into an ordinary, mutable tree in O(n).
+
+Files are in the byte order of the machine that wrote them; snap_open
+refuses files written with the other byte order.
+
+A damaged file can make searches and scans give wrong answers, but they
+never read outside the mapping, visit a node twice or go deeper than a
+valid tree of that size could. snap_promote checks the shape, key order
+and colors of the whole file first and refuses one that fails.
+*/
+
+#include "rbtree.h"
+#include<stdint.h>
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+#define SNAP_MAGIC   "RBTSNAP"  /* First 8 bytes of every snapshot file.  */
+#define SNAP_VERSION 1          /* Format version written by snap_save.   */
+#define SNAP_BLACK   1          /* Node flag: the node is black.          */
+#define SNAP_DATA    2          /* Node flag: the node has saved data.    */
+
+/* File header, at offset 0. */
+struct RBSnapHeader {
+
+  char magic[8];      /* SNAP_MAGIC, NUL-padded.                          */
+  uint32_t version;   /* SNAP_VERSION.                                    */
+  uint32_t order;     /* 0x01020304 as written, to detect byte order.     */
+  uint32_t nodeSize;  /* sizeof(struct RBSnapNode).                       */
+  uint32_t reserved;  /* Zero.                                            */
+  uint64_t count;     /* Number of nodes.                                 */
+  uint64_t root;      /* Index of the root node; 0 if the tree is empty.  */
+  uint64_t dataSize;  /* Bytes in the data section.                       */
+
+};
+
+/*
+One node. The node array follows the header, in postorder, so the root is
+the last node. The data section follows the node array; every saved data
+item in it is a uint64_t length followed by the bytes, 8-byte aligned.
+*/
+struct RBSnapNode {
+
+  int32_t key;        /* Key of the node.                                 */
+  int32_t left;       /* Index of the left child minus own index, or 0.   */
+  int32_t right;      /* Index of the right child minus own index, or 0.  */
+  uint32_t flags;     /* SNAP_BLACK | SNAP_DATA.                          */
+  uint64_t data;      /* Offset of the data item in the data section.     */
+
+};
+
+/*
+Serializer callbacks for satellite data. size and encode are used by
+snap_save, decode by snap_promote. ctx is passed through untouched.
+*/
+struct RBSnapCodec {
+
+  size_t (*size)(const void *data, void *ctx);  /* Bytes needed for data. */
+  void (*encode)(const void *data, void *buf, void *ctx); /* Write them.  */
+  void* (*decode)(const void *buf, size_t size, void *ctx); /* Rebuild.   */
+  void *ctx;                                     /* User state.           */
+
+};
+
+/* A mapped snapshot file. */
+struct RBSnapshot {
+
+  void *map;                        /* Start of the mapping.         */
+  size_t length;                    /* Length of the mapping.        */
+  const struct RBSnapHeader *header; /* Header at the start of the map. */
+  const struct RBSnapNode *nodes;   /* Node array.                   */
+  const char *dataBase;             /* Start of the data section.    */
+  int maxDepth;                     /* Depth no valid tree exceeds.  */
+
+};
+
+/****** SAVE AND LOAD FUNCTIONS ******/
+
+/* Write a tree to a snapshot file. A NULL codec saves no data. */
+bool snap_save(struct RBTree *, const char *, const struct RBSnapCodec *);
+
+/* Map a snapshot file read-only. NULL if it cannot be opened or is invalid. */
+struct RBSnapshot* snap_open(const char *);
+
+/* Unmap a snapshot. */
+void snap_close(struct RBSnapshot **);
+
+/* Build a mutable tree from a snapshot -- O(n). */
+struct RBTree* snap_promote(struct RBSnapshot *, const struct RBSnapCodec *,
+	const struct RBTreeAllocator *);
+
+/****** ACCESSOR FUNCTIONS ******/
+
+/* Search a snapshot for a given key. */
+const struct RBSnapNode* snap_search(struct RBSnapshot *, int);
+
+/* Saved data of a node, or NULL if none; its length goes to the size_t. */
+const void* snap_data(struct RBSnapshot *, const struct RBSnapNode *, size_t *);
+
+/* Number of nodes in a snapshot -- O(1). */
+size_t snap_size(struct RBSnapshot *);
+
+/* Call a function on every node with key in [lo, hi). */
+size_t snap_scan(struct RBSnapshot *, int, int,
+	int (*)(const struct RBSnapNode *, void *), void *);
+
+#endif
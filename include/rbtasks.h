@@ -0,0 +1,88 @@
+#ifndef RBTASKS_H
+#define RBTASKS_H
+
+/*
+Fork-join thread pool used by the parallel tree operations. Every worker
+has a deque of its own: it pushes and pops tasks at the bottom, without a
+lock, and idle threads steal from the top of other workers' deques, so
+the oldest, and in a recursion the largest, tasks are the ones that move.
+Tasks spawned by threads outside the pool go to a shared stack instead.
+*/
+
+#include<pthread.h>
+#include<stddef.h>
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+/* Capacity of a worker's deque; a task spawned onto a full one runs at once. */
+#define TASK_DEQUE_SIZE 1024
+
+/* Rounds of stealing an idle worker tries before it goes to sleep. */
+#define TASK_SPINS 64
+
+/*
+One unit of work. The caller owns the memory (usually a local variable of
+the forking function), so spawning allocates nothing. The task must stay
+alive until task_wait has returned for it.
+*/
+struct RBTask {
+
+  void (*run)(void *);  /* Work to perform.                  */
+  void *arg;            /* Argument passed to run.           */
+  int done;             /* Set once run has returned.        */
+  struct RBTask *next;  /* Next task in the shared stack.    */
+
+};
+
+/*
+Work-stealing deque of one worker (Chase-Lev). Only the owner changes
+bottom; thieves and the owner's last pop race for top with a CAS. Each
+deque starts a cache line of its own, so pushes do not slow down thieves
+polling the neighbouring deques.
+*/
+struct RBTaskDeque {
+
+  long top;                              /* Next task to steal.       */
+  long bottom;                           /* Next free slot.           */
+  struct RBTaskPool *pool;               /* Pool of the owner.        */
+  unsigned seed;                         /* Victim choice of owner.   */
+  struct RBTask *tasks[TASK_DEQUE_SIZE]; /* Ring of pending tasks.    */
+
+} __attribute__((aligned(64)));
+
+struct RBTaskPool {
+
+  pthread_t *threads;         /* Worker threads.                         */
+  struct RBTaskDeque *deques; /* One deque per worker.                   */
+  size_t nthreads;            /* Number of worker threads.               */
+  pthread_mutex_t lock;       /* Protects the stack and sleeping.        */
+  pthread_cond_t wake;        /* Signalled for sleeping workers.         */
+  pthread_cond_t finished;    /* Broadcast for blocked task_waits.       */
+  struct RBTask *stack;       /* Tasks from outside the pool, newest first. */
+  int sleepers;               /* Workers asleep on wake.                 */
+  unsigned wakes;             /* Signals sent on wake so far.            */
+  int waiters;                /* Threads asleep on finished.             */
+  int shutdown;               /* Workers exit once set.                  */
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for a task pool with the given number of workers. */
+struct RBTaskPool* init_task_pool(size_t);
+
+/* Destructor for a task pool. Pending tasks must have been waited for. */
+void dest_task_pool(struct RBTaskPool **);
+
+/****** TASK FUNCTIONS ******/
+
+/* Queue a task; a NULL pool runs it immediately instead. */
+void task_spawn(struct RBTaskPool *, struct RBTask *, void (*)(void *), void *);
+
+/* Wait for a spawned task, running other pending tasks meanwhile. */
+void task_wait(struct RBTaskPool *, struct RBTask *);
+
+/* Number of threads that can work on tasks, counting the caller. */
+size_t task_parallelism(struct RBTaskPool *);
+
+#endif
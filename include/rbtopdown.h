@@ -0,0 +1,67 @@
+#ifndef RBTOPDOWN_H
+#define RBTOPDOWN_H
+
+/*
+Top-down Red-Black tree for int keys. Insertion and deletion restore the
+Red-Black properties on the way down, splitting 4-nodes before an insert
+and pushing a red node ahead of a delete, so each update is one pass from
+the root that never has to climb back. Nodes therefore have no parent
+pointer and no sentinel: an int-keyed node is 32 bytes instead of 40/48.
+
+Nothing below the current node is touched after it is left, which is what
+hand-over-hand locking and path copying want. The price is some extra
+rotations and color flips on the way down, and that the rest of rbtree.h
+(iterators, successor, join, order statistics) needs parent pointers and
+does not apply here. The API mirrors the int-keyed functions of rbtree.h.
+Equal keys are kept, as in insert; search and delete find one of them.
+*/
+
+#include "rbtree.h"
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+struct TopDownNode {
+
+  struct TopDownNode *link[2]; /* Left and right child, or NULL.    */
+  int key;                     /* int key used for ordering data.   */
+  color_t c;                   /* Current color (red/black).        */
+  void *data;                  /* void pointer to satelite data.    */
+
+};
+
+struct TopDownTree {
+
+  struct TopDownNode *root; /* Root node, or NULL if the tree is empty. */
+  size_t size;              /* Number of nodes.                         */
+  struct RBTreePool *pool;  /* Pool all nodes are allocated from.       */
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for an empty top-down tree. */
+struct TopDownTree* init_tdtree(void);
+
+/* Constructor for a top-down tree with user-supplied memory hooks. */
+struct TopDownTree* init_tdtree_alloc(const struct RBTreeAllocator *);
+
+/* Destructor for a top-down tree. Releases all nodes at once. */
+void dest_tdtree(struct TopDownTree **);
+
+/****** UPDATE FUNCTIONS ******/
+
+/* Insertion function. Returns false if memory ran out. */
+bool td_insert(struct TopDownTree *, int, void *);
+
+/* Search and delete function. Returns the data of the deleted key. */
+void* td_search_and_delete(struct TopDownTree *, int);
+
+/****** ACCESSOR FUNCTIONS ******/
+
+/* Search the tree for a given key. Its data goes to the void **. */
+bool td_search(struct TopDownTree *, int, void **);
+
+/* Number of keys in the tree -- O(1). */
+size_t td_size(struct TopDownTree *);
+
+#endif
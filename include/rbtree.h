@@ -3,6 +3,10 @@
 
 /* Simple Red-Black tree implementation. */
 
+#include "rbpool.h"
+#include<stddef.h>
+#include<stdint.h>
+
 
 /****** CONSTANTS AND TYPE DEFINITIONS ******/
 
@@ -18,89 +22,367 @@ enum color {
 
 typedef enum color color_t;
 
+// Value of RBTree.size while the size is not known (after a split).
+#define SIZE_UNKNOWN ((size_t)-1)
+
+/*
+Node layout. Defining RBTREE_COMPACT stores the color in the low bit of the
+parent pointer and drops the isSen flag; the sentinel is then recognized by
+comparing against tree->nil. This takes an int-keyed node from 48 to 40 bytes.
+Always go through the accessor macros below instead of the fields.
+
+Defining RBTREE_ORDER_STATS adds the number of nodes in each subtree, which
+costs one more word per node and gives rank and select in O(lg n).
+
+Defining RBTREE_INTERVALS makes every node the closed interval [key, high]
+and adds the largest high of each subtree, for overlap queries. Nodes made
+by insert are the point intervals [key, key].
+*/
 struct RBTreeNode {
 
+#ifdef RBTREE_COMPACT
+  uintptr_t pc;              /* Parent pointer | color in bit 0. */
+#else
   struct RBTreeNode *parent; /* Pointer to parent node.      */
+#endif
   struct RBTreeNode *left;   /* Pointer to left child node.  */
   struct RBTreeNode *right;  /* Pointer to right child node. */
 
   int key;                   /* int key used for ordering data. */
+#ifdef RBTREE_INTERVALS
+  int high;                  /* End of the interval [key, high]. */
+#endif
   void *data;                /* void pointer to satelite data.  */
+#ifdef RBTREE_INTERVALS
+  int maxHigh;               /* Largest high in the subtree; INT_MIN for nil. */
+#endif
+#ifdef RBTREE_ORDER_STATS
+  size_t size;               /* Nodes in the subtree rooted here; 0 for nil. */
+#endif
+#ifndef RBTREE_COMPACT
   color_t c;                 /* Current color (red/black) of the node. */
-	bool isSen;								 /* Is this node the sentinel? */
+  bool isSen;                /* Is this node the sentinel? */
+#endif
+
+};
+
+/****** NODE ACCESSORS ******/
+
+#ifdef RBTREE_COMPACT
+#define node_parent(n)\
+  ((struct RBTreeNode *)((n)->pc & ~(uintptr_t)1))
+#define node_color(n)\
+  ((color_t)((n)->pc & 1))
+#define set_parent(n, p)\
+  ((n)->pc = (uintptr_t)(p) | ((n)->pc & 1))
+#define set_color(n, col)\
+  ((n)->pc = ((n)->pc & ~(uintptr_t)1) | (uintptr_t)(col))
+#else
+#define node_parent(n)\
+  ((n)->parent)
+#define node_color(n)\
+  ((n)->c)
+#define set_parent(n, p)\
+  ((n)->parent = (p))
+#define set_color(n, col)\
+  ((n)->c = (col))
+#endif
+
+/*
+Instrumentation. Defining RBTREE_STATS makes every tree count the work done
+on its hot paths; without it none of the counters exist and the code that
+bumps them compiles away. The counters are plain, unsynchronized integers:
+searches update them too, so a tree built with RBTREE_STATS must not be
+searched from several threads at once.
+*/
+#define STATS_DEPTHS 64 /* Depth histogram buckets; the last takes the rest. */
+
+struct RBTreeStats {
+
+  size_t leftRotations;             /* Calls to left_rotate.               */
+  size_t rightRotations;            /* Calls to right_rotate.              */
+  size_t insertFixup[7];            /* [0] calls, [1-6] iterations by case. */
+  size_t deleteFixup[9];            /* [0] calls, [1-8] iterations by case. */
+  size_t searchDepth[STATS_DEPTHS]; /* Searches by nodes visited.          */
+  size_t insertDepth[STATS_DEPTHS]; /* Inserts by nodes visited.           */
+  size_t nodeAllocs;                /* Nodes taken from the pool.          */
+  size_t nodeFrees;                 /* Nodes given back to the pool.       */
+  size_t slabAllocs;                /* Slabs obtained from the allocator.  */
+
+};
+
+/*
+Tree handle. Owns the root, the sentinel and the node pool. Trees made with
+init_rbtree_like form a family sharing the pool and the sentinel, so nodes
+can be moved between them (see rbjoin.h).
+*/
+struct RBTree {
+
+  struct RBTreeNode *root;      /* Root node, or nil if the tree is empty. */
+  struct RBTreeNode *nil;       /* Sentinel, the child of every leaf.     */
+  struct RBTreeNode *leftmost;  /* Cached node with minimum key, or nil.  */
+  struct RBTreeNode *rightmost; /* Cached node with maximum key, or nil.  */
+  size_t size;                  /* Number of nodes, or SIZE_UNKNOWN.      */
+  struct RBTreePool *pool;      /* Pool all nodes are allocated from.     */
+  int (*cmp)(const void *, const void *); /* Data comparator, or NULL.   */
+  int blackHeight;              /* BLACK nodes on any root-to-nil path.   */
+#ifdef RBTREE_STATS
+  struct RBTreeStats stats;     /* Hot path counters; see tree_stats.     */
+#endif
+
+};
+
+/*
+In-order iterator. Lives wherever the caller puts it (usually the stack),
+so iterating allocates nothing. node is tree->nil once the iterator has
+run off either end. Updates to the tree invalidate the iterator unless they
+leave its current node in place.
+*/
+struct RBTreeIter {
+
+  struct RBTree *tree;     /* Tree being iterated.          */
+  struct RBTreeNode *node; /* Current node, or tree->nil.   */
 
 };
 
+/****** ERROR HANDLING ******/
+
+/*
+Errors are reported to a handler, which by default prints the message to
+stderr. The failing call then sets errno -- ENOMEM when memory runs out,
+EINVAL for a bad argument -- and returns its error value: NULL from the
+constructors and insert, fewer keys than asked from batch_insert. Node
+arguments are only checked when built with RBTREE_DEBUG.
+*/
+
+/* Install the function called on every error, or NULL for none. */
+void set_error_handler(void (*)(const char *, void *), void *);
+
 /****** CONSTRUCTORS AND DESTRUCTORS ******/
 
 /* Constructor for Red-Black tree node. */
-struct RBTreeNode* init_rbtree_node(struct RBTreeNode *, struct RBTreeNode *,
-	struct RBTreeNode *, int, void *, color_t, bool);
+struct RBTreeNode* init_rbtree_node(struct RBTreePool *, struct RBTreeNode *,
+	struct RBTreeNode *, struct RBTreeNode *, int, void *, color_t, bool);
 
 /* Destructor for Red-Black tree node. */
-void dest_rbtree_node(struct RBTreeNode **);
+void dest_rbtree_node(struct RBTreePool *, struct RBTreeNode **);
 
 /* Specialized free function to help avoid dangling pointers. */
-void free_rbtree_node(struct RBTreeNode **);
+void free_rbtree_node(struct RBTreePool *, struct RBTreeNode **);
+
+/* Constructor for an empty Red-Black tree. */
+struct RBTree* init_rbtree(void);
+
+/* Constructor for Red-Black tree with user-supplied memory hooks. */
+struct RBTree* init_rbtree_alloc(const struct RBTreeAllocator *);
+
+/* Constructor for Red-Black tree with nodes of a custom size. */
+struct RBTree* init_rbtree_sized(size_t, const struct RBTreeAllocator *);
+
+/* Constructor for Red-Black tree ordered by a data comparator. */
+struct RBTree* init_rbtree_cmp(int (*)(const void *, const void *),
+	const struct RBTreeAllocator *);
+
+/* Constructor for Red-Black tree built from sorted keys in O(n). */
+struct RBTree* init_rbtree_sorted(const int *, void * const *, size_t,
+	const struct RBTreeAllocator *);
 
-/* Constructor for Red-Black tree itself. */
-struct RBTreeNode* init_rbtree(int, void *);
+/* Private recursive helper for init_rbtree_sorted. */
+struct RBTreeNode* build_sorted_(struct RBTree *, char *, const int *,
+	void * const *, size_t, size_t, int, int);
 
-/* Public destructor wrapper for for RB-Tree. */
-void dest_rbtree(struct RBTreeNode **);
+/* Private helper: set up one slot of a sorted build's block as a node. */
+struct RBTreeNode* sorted_node_(struct RBTree *, char *, size_t, int, void *,
+	bool, size_t);
 
-/* Private destructor for RBT. */
-void dest_rbtree_(struct RBTreeNode **);
+/* Private helper: link a node of a sorted build to its subtrees. */
+void sorted_link_(struct RBTree *, struct RBTreeNode *, struct RBTreeNode *,
+	struct RBTreeNode *);
+
+/* Constructor for an empty tree sharing the pool and sentinel of another. */
+struct RBTree* init_rbtree_like(struct RBTree *);
+
+/* Destructor for RB-Tree. Releases the node pool with its last tree. */
+void dest_rbtree(struct RBTree **);
 
 /****** UPDATE FUNCTIONS ******/
 
 /* Insertion function. */
-struct RBTreeNode* insert(struct RBTreeNode **, int, void *);
+struct RBTreeNode* insert(struct RBTree *, int, void *);
+
+/* Insertion after a hint node, e.g. the last one inserted. */
+struct RBTreeNode* insert_hint(struct RBTree *, struct RBTreeNode *, int,
+	void *);
+
+/* Insertion function for comparator-ordered trees. */
+struct RBTreeNode* insert_cmp(struct RBTree *, void *);
+
+/* Link a new node below its parent and fix the tree. */
+void insert_link(struct RBTree *, struct RBTreeNode *, struct RBTreeNode *,
+	bool);
+
+/* Insert a batch of keys, sorted first, reusing each descent. */
+size_t batch_insert(struct RBTree *, const int *, void * const *, size_t);
+
+/* Private helper: start node of a descent for key from a finger node. */
+struct RBTreeNode* finger_start(struct RBTree *, struct RBTreeNode *, int);
 
 /* Correct RBT properties after inserts. */
-void insert_fixup(struct RBTreeNode **, struct RBTreeNode *);
+void insert_fixup(struct RBTree *, struct RBTreeNode *);
 
 /* Search and delete function . */
-void* search_and_delete(struct RBTreeNode **, int);
+void* search_and_delete(struct RBTree *, int);
+
+/* Search and delete function for comparator-ordered trees. */
+void* search_and_delete_cmp(struct RBTree *, const void *);
+
+/* Search and delete a batch of keys, sorted first, reusing each descent. */
+size_t batch_delete(struct RBTree *, const int *, size_t, void **);
 
 /* Delete function. */
-void* delete_node(struct RBTreeNode **, struct RBTreeNode *);
+void* delete_node(struct RBTree *, struct RBTreeNode *);
+
+/* Private helper: link a node detached by delete_node back in under a key. */
+void relink_node_(struct RBTree *, struct RBTreeNode *, int, void *);
+
+/* Delete a node held by the caller and recycle it. Returns its data. */
+void* erase_node(struct RBTree *, struct RBTreeNode *);
+
+/* Change the key of a node held by the caller, reusing the node. */
+bool rekey_node(struct RBTree *, struct RBTreeNode *, int);
 
 /* Correct RBT properties after deletion. */
-void delete_fixup(struct RBTreeNode **, struct RBTreeNode *);
+void delete_fixup(struct RBTree *, struct RBTreeNode *);
 
 /* Transplant utility function. Used for inserts/deletes */
-void transplant(struct RBTreeNode **, struct RBTreeNode *, struct RBTreeNode *);
+void transplant(struct RBTree *, struct RBTreeNode *, struct RBTreeNode *);
 
 /****** ACCESSOR FUNCTIONS ******/
 
 /* Search the tree for a given key. */
-struct RBTreeNode* search(int, struct RBTreeNode *);
+struct RBTreeNode* search(struct RBTree *, int);
+
+/* Search a comparator-ordered tree. */
+struct RBTreeNode* search_cmp(struct RBTree *, const void *);
+
+/* Node with minimum key -- O(1), cached. */
+struct RBTreeNode* minimum(struct RBTree *);
+
+/* Node with maximum key -- O(1), cached. */
+struct RBTreeNode* maximum(struct RBTree *);
 
-/* Search tree for node with minimum key. */
-struct RBTreeNode* minimum(struct RBTreeNode *);
+/* Number of nodes in the tree -- O(1), except once after a split. */
+size_t tree_size(struct RBTree *);
 
-/* Search tree for node with maximum key. */
-struct RBTreeNode* maximum(struct RBTreeNode *);
+/* Private helper for tree_size: count the nodes of a subtree. */
+size_t count_nodes_(struct RBTree *, struct RBTreeNode *);
+
+/* Search subtree for node with minimum key. */
+struct RBTreeNode* subtree_minimum(struct RBTree *, struct RBTreeNode *);
+
+/* Search subtree for node with maximum key. */
+struct RBTreeNode* subtree_maximum(struct RBTree *, struct RBTreeNode *);
 
 /* Find predecessor node. */
-struct RBTreeNode* predecessor(struct RBTreeNode *);
+struct RBTreeNode* predecessor(struct RBTree *, struct RBTreeNode *);
 
 /* Find successor node. */
-struct RBTreeNode* successor(struct RBTreeNode *);
+struct RBTreeNode* successor(struct RBTree *, struct RBTreeNode *);
 
 /* Compute the height of the RBT -- O(n) operation. */
-int height(struct RBTreeNode *);
+int height(struct RBTree *, struct RBTreeNode *);
+
+/* Black-height of the RBT, maintained by every update -- O(1). */
+int tree_black_height(struct RBTree *);
+
+/****** ITERATOR FUNCTIONS ******/
+
+/* Position iterator at the node with minimum key. */
+struct RBTreeNode* iter_begin(struct RBTree *, struct RBTreeIter *);
+
+/* Position iterator past the node with maximum key. */
+struct RBTreeNode* iter_end(struct RBTree *, struct RBTreeIter *);
+
+/* Position iterator at the first node with key >= the given key. */
+struct RBTreeNode* iter_lower_bound(struct RBTree *, struct RBTreeIter *, int);
+
+/* Position iterator at the first node with key > the given key. */
+struct RBTreeNode* iter_upper_bound(struct RBTree *, struct RBTreeIter *, int);
+
+/* Advance iterator to the next node in order. */
+struct RBTreeNode* iter_next(struct RBTreeIter *);
+
+/* Move iterator back to the previous node in order. */
+struct RBTreeNode* iter_prev(struct RBTreeIter *);
+
+/* Call a function on every node with key in [lo, hi). */
+size_t range_scan(struct RBTree *, int, int,
+	int (*)(struct RBTreeNode *, void *), void *);
+
+#ifdef RBTREE_ORDER_STATS
+
+/****** ORDER STATISTICS ******/
+
+/* Node with the given 0-based position in key order -- O(lg n). */
+struct RBTreeNode* tree_select(struct RBTree *, size_t);
+
+/* Number of keys less than the given key -- O(lg n). */
+size_t tree_rank(struct RBTree *, int);
+
+/* Number of keys in [lo, hi) -- O(lg n). */
+size_t count_range(struct RBTree *, int, int);
+
+/* Private helper: add to the subtree sizes from a node up to the root. */
+void add_size_(struct RBTree *, struct RBTreeNode *, size_t);
+
+/* Private helper: recompute the subtree size of a node from its children. */
+void fix_size_(struct RBTreeNode *);
+
+#endif
+
+#ifdef RBTREE_INTERVALS
+
+/****** INTERVAL QUERIES ******/
+
+/* Insert the interval [lo, hi] with its data. */
+struct RBTreeNode* insert_interval(struct RBTree *, int, int, void *);
+
+/* Some node whose interval overlaps [lo, hi] -- O(lg n). */
+struct RBTreeNode* interval_search(struct RBTree *, int, int);
+
+/* Call a function on every node whose interval overlaps [lo, hi]. */
+size_t interval_scan(struct RBTree *, int, int,
+	int (*)(struct RBTreeNode *, void *), void *);
+
+/* Private helper: raise the largest high from a node up to the root. */
+void raise_max_(struct RBTree *, struct RBTreeNode *, int);
+
+/* Private helper: recompute the largest high of a node from its children. */
+void fix_max_(struct RBTreeNode *);
+
+#endif
+
+#ifdef RBTREE_STATS
+
+/****** INSTRUMENTATION ******/
+
+/* Copy the counters of a tree, with those of its pool, to a snapshot. */
+void tree_stats(struct RBTree *, struct RBTreeStats *);
+
+/* Zero the counters of a tree and of its pool. */
+void tree_stats_reset(struct RBTree *);
+
+#endif
 
 /****** UTILITY FUNCTIONS ******/
 
-/* Validate nodes accepted as parameters. */
-void validate(struct RBTreeNode *, bool);
+/* Validate nodes accepted as parameters (checked with RBTREE_DEBUG). */
+bool validate(struct RBTreeNode *, bool);
 
 /* Left-Rotate operation. */
-void left_rotate(struct RBTreeNode **, struct RBTreeNode *);
+void left_rotate(struct RBTree *, struct RBTreeNode *);
 
 /* Right-Rotate operation. */
-void right_rotate(struct RBTreeNode **, struct RBTreeNode *);
+void right_rotate(struct RBTree *, struct RBTreeNode *);
 
 #endif
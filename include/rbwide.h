@@ -0,0 +1,78 @@
+#ifndef RBWIDE_H
+#define RBWIDE_H
+
+/*
+Wide-node search tree for int keys: a B+ tree whose nodes hold up to
+WIDE_KEYS keys in one 64-byte cache line. The child to descend to is found
+by comparing the key against all keys of a node at once, with AVX2 where
+the CPU has it (checked at run time) and with a scalar loop elsewhere, so
+a lookup takes about log16(n) dependent loads instead of log2(n). Data
+lives in the leaves, which are linked in key order.
+
+The API mirrors the int-keyed functions of rbtree.h. Equal keys are kept,
+as in insert; search and delete find one of them.
+*/
+
+#include "rbtree.h"
+
+/****** CONSTANTS AND TYPE DEFINITIONS ******/
+
+#define WIDE_KEYS 16               /* Keys per node: 64 bytes of ints.  */
+#define WIDE_MIN  (WIDE_KEYS / 2)  /* Fewest keys of a non-root node.   */
+
+struct WideNode {
+
+  int keys[WIDE_KEYS];     /* Sorted keys; separators in inner nodes. */
+  unsigned count;          /* Number of keys in use.                  */
+  bool leaf;               /* Is this a leaf?                         */
+  union {
+    struct WideNode *child[WIDE_KEYS + 1]; /* Inner node: children.   */
+    void *data[WIDE_KEYS];                 /* Leaf: satellite data.   */
+  } u;
+  struct WideNode *next;   /* Leaf: next leaf in key order, or NULL.  */
+
+};
+
+struct WideTree {
+
+  struct WideNode *root;   /* Root node, an empty leaf if no keys.    */
+  size_t size;             /* Number of keys.                         */
+  int height;              /* Levels of inner nodes above the leaves. */
+  struct RBTreePool *pool; /* Pool all nodes are allocated from.      */
+  struct WideNode *spare;  /* Nodes reserved for splits, via next.    */
+  int spares;              /* Number of reserved nodes.               */
+  unsigned (*rank)(const int *, unsigned, int); /* Keys < key; SIMD.  */
+
+};
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/* Constructor for an empty wide-node tree. */
+struct WideTree* init_wtree(void);
+
+/* Constructor for a wide-node tree with user-supplied memory hooks. */
+struct WideTree* init_wtree_alloc(const struct RBTreeAllocator *);
+
+/* Destructor for a wide-node tree. Releases all nodes at once. */
+void dest_wtree(struct WideTree **);
+
+/****** UPDATE FUNCTIONS ******/
+
+/* Insertion function. Returns false if memory ran out. */
+bool wide_insert(struct WideTree *, int, void *);
+
+/* Search and delete function. Returns the data of the deleted key. */
+void* wide_search_and_delete(struct WideTree *, int);
+
+/****** ACCESSOR FUNCTIONS ******/
+
+/* Search the tree for a given key. Its data goes to the void **. */
+bool wide_search(struct WideTree *, int, void **);
+
+/* Number of keys in the tree -- O(1). */
+size_t wide_size(struct WideTree *);
+
+/* Name of the node search in use: "avx2" or "scalar". */
+const char* wide_simd(struct WideTree *);
+
+#endif
@@ -1,10 +1,50 @@
 #include "errors.h"
+#include "rbtree.h"
 #include<stdio.h>
 #include<stdlib.h>
 
+static void print_handler(const char *, void *);
+
+// Current error handler and its user pointer.
+static void (*handler)(const char *, void *) = print_handler;
+static void *handlerCtx = NULL;
+
+/**
+Install the function called with the message of every error the library
+reports, and a user pointer passed through to it. The library function
+that failed sets errno and returns its error value (NULL, false or 0, as
+documented) once the handler returns. A NULL handler reports nothing, so
+failures show only in those return values.
+
+The default handler prints the message to stderr and returns. The handler is shared by all
+trees and threads; install it before the library is used.
+
+@param fn Handler, or NULL for none.
+@param ctx User pointer passed to the handler.
+**/
+void set_error_handler(void (*fn)(const char *, void *), void *ctx) {
+  handler    = fn;
+  handlerCtx = ctx;
+}
+
+void report_error(int err, const char *msg) {
+  if (handler != NULL)
+    handler(msg, handlerCtx);
+  errno = err; // After the handler, which may have changed it.
+}
+
 void display_error(char* msg) {
 
-  fprintf(stderr, msg);
+  if (handler != NULL)
+    handler(msg, handlerCtx);
+  else
+    fputs(msg, stderr); // Do not exit without a word.
   exit(FAIL_EXIT);
 
 }
+
+// Default handler: say what went wrong and let the caller fail.
+static void print_handler(const char *msg, void *ctx) {
+  (void)ctx;
+  fputs(msg, stderr);
+}
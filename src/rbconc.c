@@ -0,0 +1,323 @@
+#include "errors.h"
+#include "rbconc.h"
+#include<sched.h>
+#include<stdlib.h>
+
+/*
+Publication. A write builds the next version with persist_insert or
+persist_delete, which copy the path they change and leave every node the
+current version reaches as it is. The finished version is published with
+a release store of conc->current, and a reader's acquire load of that
+pointer makes every node of the version visible to it. Published nodes
+are never written again except for their reference counts, which share
+no field with what a search reads, so readers need neither atomics on
+the nodes nor a retry.
+
+Reclamation. The version a write replaces goes on the limbo list of the
+epoch of the write, together with the data the write deleted. The epoch
+only advances once every reader inside a section has seen the current
+one. After two advances no reader can still hold the version, and it is
+destroyed, releasing the nodes no newer version shares, and the data is
+passed to the release function.
+*/
+
+static bool publish(struct RBTreeConc *, struct RBTreeVersion *, void *);
+static void retire(struct RBTreeConc *, struct RBTreeRetired *);
+static bool try_advance(struct RBTreeConc *);
+static void reclaim(struct RBTreeConc *, size_t);
+
+/**
+Function to construct a new, empty concurrent RBT.
+
+@param release Called on the data of deleted nodes once no reader can
+still hold it, or NULL if the data needs no release.
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@return Pointer to the new concurrent tree, or NULL if memory ran out.
+**/
+struct RBTreeConc* init_rbtree_conc(void (*release)(void *),
+  const struct RBTreeAllocator *allocator) {
+
+  struct RBTreeConc *conc = NULL;
+  size_t i = 0;
+
+  if ((conc = malloc(sizeof(struct RBTreeConc))) == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  if ((conc->store = init_rbtree_persist(allocator)) == NULL) {
+    free(conc);
+    return NULL;
+  }
+  if ((conc->current = persist_empty(conc->store)) == NULL) {
+    dest_rbtree_persist(&conc->store);
+    free(conc);
+    return NULL;
+  }
+
+  conc->epoch   = 0;
+  conc->readers = NULL;
+  conc->retired = 0;
+  conc->release = release;
+  for (i = 0; i < CONC_EPOCHS; i++)
+    conc->limbo[i] = NULL;
+  pthread_mutex_init(&conc->lock, NULL);
+
+  return conc;
+}
+
+/**
+Function to destroy a concurrent tree. Writes still waiting for reclamation
+are reclaimed first, releasing the data they deleted.
+
+CAUTION: No reader may be inside a read section, and the data of the
+nodes still in the tree must be handled by the caller, e.g. with a
+persist_scan of conc->current beforehand.
+
+@param conc Double pointer to the tree to be destroyed.
+**/
+void dest_rbtree_conc(struct RBTreeConc **conc) {
+
+  size_t i = 0;
+
+  for (i = 0; i < CONC_EPOCHS; i++)
+    reclaim(*conc, i);
+  dest_rbtree_version(&(*conc)->current);
+  dest_rbtree_persist(&(*conc)->store);
+  pthread_mutex_destroy(&(*conc)->lock);
+  free(*conc);
+  *conc = NULL;
+}
+
+/**
+Register a reader. Every thread that reads the tree needs a reader of its
+own, registered before its first read section.
+
+@param conc The concurrent tree.
+@param reader Caller-owned reader state.
+**/
+void conc_reader_register(struct RBTreeConc *conc, struct RBTreeReader *reader) {
+  pthread_mutex_lock(&conc->lock);
+  reader->state = 0;
+  reader->next = conc->readers;
+  conc->readers = reader;
+  pthread_mutex_unlock(&conc->lock);
+}
+
+/**
+Unregister a reader, e.g. before its thread exits.
+
+@param conc The concurrent tree.
+@param reader Registered reader, outside any read section.
+**/
+void conc_reader_unregister(struct RBTreeConc *conc,
+  struct RBTreeReader *reader) {
+
+  struct RBTreeReader **walk = NULL;
+
+  pthread_mutex_lock(&conc->lock);
+  for (walk = &conc->readers; *walk != NULL; walk = &(*walk)->next) {
+    if (*walk == reader) {
+      *walk = reader->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&conc->lock);
+}
+
+/**
+Enter a read section. Until the matching conc_read_end, no node or data
+found by conc_search is reclaimed. Sections should be short, since they
+hold back reclamation; they must not be nested.
+
+@param conc The concurrent tree.
+@param reader The calling thread's registered reader.
+**/
+void conc_read_begin(struct RBTreeConc *conc, struct RBTreeReader *reader) {
+
+  size_t epoch = 0;
+
+  // Announce the epoch, and make sure it was still current once announced.
+  do {
+    epoch = __atomic_load_n(&conc->epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&reader->state, epoch << 1 | 1, __ATOMIC_SEQ_CST);
+  } while (__atomic_load_n(&conc->epoch, __ATOMIC_SEQ_CST) != epoch);
+}
+
+/**
+Leave a read section.
+
+@param reader The calling thread's reader.
+**/
+void conc_read_end(struct RBTreeReader *reader) {
+  __atomic_store_n(&reader->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+Search without taking any lock. Loads the current version once and
+searches it with persist_search; writes publish new versions instead of
+changing this one, so the search never waits for a writer or repeats.
+
+@param conc The concurrent tree.
+@param key Key to search for.
+@param data Receives the data of the node found, if any. It stays valid
+until the end of the read section, even if the node is deleted meanwhile.
+@return Was a node with the key found?
+**/
+bool conc_search(struct RBTreeConc *conc, int key, void **data) {
+
+  struct RBTreeNode *node =
+    persist_search(__atomic_load_n(&conc->current, __ATOMIC_ACQUIRE), key);
+
+  if (node != NULL && data != NULL)
+    *data = node->data;
+  return node != NULL;
+}
+
+/**
+Insert under the writer lock: publish a version built by persist_insert.
+
+@param conc The concurrent tree.
+@param k Key of the new node.
+@param data Satellite data of the new node.
+@return Was the key inserted? Only false if memory ran out.
+**/
+bool conc_insert(struct RBTreeConc *conc, int k, void *data) {
+
+  bool inserted = false;
+
+  pthread_mutex_lock(&conc->lock);
+  inserted = publish(conc, persist_insert(conc->current, k, data), NULL);
+  pthread_mutex_unlock(&conc->lock);
+  return inserted;
+}
+
+/**
+Search and delete under the writer lock: publish a version built by
+persist_delete. The data is not released right away but retired with the
+old version: readers that found it may keep using it until they leave
+their read section. It is passed to the tree's release function once
+that has happened.
+
+@param conc The concurrent tree.
+@param k Key of the node to delete.
+@return Was a node with the key deleted? False if there is none, or if
+memory ran out, in which case the tree is unchanged.
+**/
+bool conc_search_and_delete(struct RBTreeConc *conc, int k) {
+
+  struct RBTreeVersion *next = NULL;
+  void *data = NULL;
+  bool deleted = false;
+
+  pthread_mutex_lock(&conc->lock);
+  if (persist_search(conc->current, k) != NULL) {
+    next = persist_delete(conc->current, k, &data);
+    deleted = publish(conc, next, data);
+  }
+  pthread_mutex_unlock(&conc->lock);
+
+  return deleted;
+}
+
+/**
+Wait until every write before the call has been reclaimed, in the manner
+of synchronize_rcu. Afterwards no reader holds data of a node deleted
+before the call, and it has been passed to the release function. Readers must not call this inside a section.
+
+@param conc The concurrent tree.
+**/
+void conc_synchronize(struct RBTreeConc *conc) {
+
+  size_t advanced = 0;
+
+  pthread_mutex_lock(&conc->lock);
+  while (advanced < CONC_EPOCHS) {
+    if (try_advance(conc)) {
+      advanced++;
+    } else {
+      pthread_mutex_unlock(&conc->lock);
+      sched_yield();
+      pthread_mutex_lock(&conc->lock);
+    }
+  }
+  pthread_mutex_unlock(&conc->lock);
+}
+
+/*
+Make next the current version and retire the one it replaces, with the
+data the write deleted. A NULL next is a write that ran out of memory.
+Caller holds the writer lock.
+*/
+static bool publish(struct RBTreeConc *conc, struct RBTreeVersion *next,
+  void *data) {
+
+  const struct RBTreeAllocator *allocator = &conc->store->pool->allocator;
+  struct RBTreeRetired *old = NULL;
+
+  if (next == NULL)
+    return false;
+  if ((old = allocator->alloc(allocator->ctx,
+      sizeof(struct RBTreeRetired))) == NULL) {
+    dest_rbtree_version(&next); // Never published: no reader has it.
+    report_error(ENOMEM, MEM_ERROR);
+    return false;
+  }
+
+  old->version = conc->current;
+  old->data = data;
+  __atomic_store_n(&conc->current, next, __ATOMIC_RELEASE);
+  retire(conc, old);
+  return true;
+}
+
+// Put a replaced version on the current limbo list.
+static void retire(struct RBTreeConc *conc, struct RBTreeRetired *old) {
+
+  size_t slot = conc->epoch % CONC_EPOCHS;
+
+  old->next = conc->limbo[slot];
+  conc->limbo[slot] = old;
+
+  if (++conc->retired >= CONC_RECLAIM) {
+    conc->retired = 0;
+    try_advance(conc);
+  }
+}
+
+// Advance the epoch if every reader in a section has seen the current one,
+// and reclaim the list of the epoch before the previous one.
+static bool try_advance(struct RBTreeConc *conc) {
+
+  struct RBTreeReader *reader = NULL;
+  size_t epoch = conc->epoch;
+  size_t state = 0;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (reader = conc->readers; reader != NULL; reader = reader->next) {
+    state = __atomic_load_n(&reader->state, __ATOMIC_SEQ_CST);
+    if ((state & 1) && state >> 1 != epoch)
+      return false;
+  }
+
+  __atomic_store_n(&conc->epoch, epoch + 1, __ATOMIC_RELEASE);
+  reclaim(conc, (epoch + 1) % CONC_EPOCHS);
+  return true;
+}
+
+// Destroy the versions of one limbo list and release their data.
+static void reclaim(struct RBTreeConc *conc, size_t slot) {
+
+  const struct RBTreeAllocator *allocator = &conc->store->pool->allocator;
+  struct RBTreeRetired *old = conc->limbo[slot];
+  struct RBTreeRetired *next = NULL;
+
+  conc->limbo[slot] = NULL;
+  while (old != NULL) {
+    next = old->next;
+    dest_rbtree_version(&old->version);
+    if (conc->release != NULL && old->data != NULL)
+      conc->release(old->data);
+    allocator->release(allocator->ctx, old, sizeof(struct RBTreeRetired));
+    old = next;
+  }
+}
@@ -0,0 +1,313 @@
+#include "errors.h"
+#include "rbfreeze.h"
+
+// Cache line size the images are aligned to.
+#define LINE 64
+
+// Round n up to a multiple of a power of two.
+#define ALIGN_UP(n, a)\
+  (((n) + (a) - 1) & ~(uintptr_t)((a) - 1))
+
+static void eytzinger_(struct RBTreeFrozen *, size_t, size_t *);
+static void place_(uint32_t *, size_t, size_t, int, uint32_t *);
+static void place_below_(uint32_t *, size_t, size_t, int, int, uint32_t *);
+static uint32_t link_(struct RBTreeFrozen *, uint32_t *, size_t, size_t);
+
+/**
+Function to freeze a tree. The keys and data are copied out in order, and
+the keys are laid out again in the requested search order (see rbfreeze.h),
+all in one block from the tree's allocator hooks with the image aligned to
+a cache line. The tree itself is left as it is; if it is not needed any
+more it can be destroyed, handling its data as usual, since the frozen
+tree only copies the data pointers. Runs in O(n) for EYTZINGER and in
+O(n lg lg n) for VEB.
+
+@param tree The RBT to freeze.
+@param layout Search order of the image.
+@return Pointer to the new frozen tree, or NULL if the tree has too many
+keys for 32-bit slots (errno EOVERFLOW) or memory ran out (ENOMEM).
+**/
+struct RBTreeFrozen* tree_freeze(struct RBTree *tree,
+  enum freeze_layout layout) {
+
+  struct RBTreeAllocator hooks = tree->pool->allocator;
+  struct RBTreeFrozen *frozen = NULL;
+  struct RBTreeIter iter;
+  struct RBTreeNode *node = NULL;
+  size_t n = tree_size(tree);
+  size_t dataOff = 0, imageOff = 0, ranksOff = 0, i = 0;
+  uint32_t *pos = NULL;
+  uint32_t next = 0;
+  int depth = 0;
+  char *base = NULL;
+
+  if (n >= FROZEN_NONE) {
+    report_error(EOVERFLOW, TOO_LARGE);
+    return NULL;
+  }
+  if ((frozen = hooks.alloc(hooks.ctx, sizeof(struct RBTreeFrozen))) == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  // One block: sorted keys, sorted data, then the image on a line boundary.
+  dataOff  = ALIGN_UP(n * sizeof(int), sizeof(void *));
+  imageOff = ALIGN_UP(dataOff + n * sizeof(void *), LINE);
+  if (layout == FREEZE_EYTZINGER) {
+    ranksOff = ALIGN_UP(imageOff + (n + 1) * sizeof(int), sizeof(uint32_t));
+    frozen->blockSize = ranksOff + (n + 1) * sizeof(uint32_t) + LINE;
+  } else {
+    frozen->blockSize = imageOff + n * sizeof(struct FrozenNode) + LINE;
+  }
+  if ((frozen->block = hooks.alloc(hooks.ctx, frozen->blockSize)) == NULL) {
+    hooks.release(hooks.ctx, frozen, sizeof(struct RBTreeFrozen));
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  base = (char *)ALIGN_UP((uintptr_t)frozen->block, LINE);
+  frozen->layout    = layout;
+  frozen->size      = n;
+  frozen->allocator = hooks;
+  frozen->keys      = (int *)base;
+  frozen->data      = (void **)(base + dataOff);
+  frozen->eytzinger = NULL;
+  frozen->ranks     = NULL;
+  frozen->veb       = NULL;
+
+  for (node = iter_begin(tree, &iter); node != NULL; node = iter_next(&iter)) {
+    frozen->keys[i] = node->key;
+    frozen->data[i] = node->data;
+    i++;
+  }
+
+  if (layout == FREEZE_EYTZINGER) {
+    frozen->eytzinger = (int *)(base + imageOff);
+    frozen->ranks     = (uint32_t *)(base + ranksOff);
+    frozen->eytzinger[0] = 0; // Unused; the root is slot 1.
+    frozen->ranks[0]     = 0;
+    i = 0;
+    eytzinger_(frozen, 1, &i);
+  } else if (n > 0) {
+    frozen->veb = (struct FrozenNode *)(base + imageOff);
+    if ((pos = hooks.alloc(hooks.ctx, n * sizeof(uint32_t))) == NULL) {
+      dest_rbtree_frozen(&frozen);
+      report_error(ENOMEM, MEM_ERROR);
+      return NULL;
+    }
+    for (i = n; i > 0; i >>= 1)
+      depth++;
+    place_(pos, 0, n, depth, &next);
+    link_(frozen, pos, 0, n);
+    hooks.release(hooks.ctx, pos, n * sizeof(uint32_t));
+  }
+
+  return frozen;
+}
+
+/**
+Function to destroy a frozen tree. Once it has been destroyed the
+reference is nullified.
+
+CAUTION: The data pointers are not followed; the data is still owned by
+whoever owned it before the tree was frozen.
+
+@param frozen Double pointer to the frozen tree to be destroyed.
+**/
+void dest_rbtree_frozen(struct RBTreeFrozen **frozen) {
+
+  struct RBTreeAllocator hooks = (*frozen)->allocator;
+
+  hooks.release(hooks.ctx, (*frozen)->block, (*frozen)->blockSize);
+  hooks.release(hooks.ctx, *frozen, sizeof(struct RBTreeFrozen));
+  *frozen = NULL;
+}
+
+/**
+Function to thaw a frozen tree: a new, mutable tree with the same keys and
+data, built in O(n) by init_rbtree_sorted. The frozen tree stays valid.
+With RBTREE_INTERVALS the nodes are points; a frozen tree keeps no ends.
+
+@param frozen The frozen tree.
+@param allocator Memory hooks for the new tree, or NULL for malloc/free.
+@return Pointer to the new tree handle, or NULL.
+**/
+struct RBTree* tree_thaw(struct RBTreeFrozen *frozen,
+  const struct RBTreeAllocator *allocator) {
+  return init_rbtree_sorted(frozen->keys, frozen->data, frozen->size,
+    allocator);
+}
+
+/**
+Search a frozen tree for a given key.
+
+@param frozen The frozen tree.
+@param key Key to look for.
+@param data Receives the data of the key if it is found. May be NULL.
+@return Whether the key was found.
+**/
+bool frozen_search(struct RBTreeFrozen *frozen, int key, void **data) {
+
+  size_t rank = frozen_lower_bound(frozen, key);
+
+  if (rank == frozen->size || frozen->keys[rank] != key)
+    return false;
+  if (data != NULL)
+    *data = frozen->data[rank];
+  return true;
+}
+
+/**
+Lower bound search in the image. In the Eytzinger order the descent has no
+branches: it goes right by adding the result of the comparison, and the
+slot 4 levels further down, which holds the 16 possible descendants in one
+cache line, is prefetched on every step. The slot of the answer is then
+found by undoing the final right turns. The van Emde Boas image is walked
+through its child slots, indexed by the result of the comparison, and the
+answer is kept with a mask instead of a branch.
+
+@param frozen The frozen tree.
+@param key Key to look for.
+@return Position in key order of the first key >= key, or the size if
+there is none.
+**/
+size_t frozen_lower_bound(struct RBTreeFrozen *frozen, int key) {
+
+  const int *eytzinger = frozen->eytzinger;
+  const struct FrozenNode *node = NULL;
+  size_t n = frozen->size;
+  unsigned long long k = 1;
+  uint32_t slot = 0, mask = 0, best = (uint32_t)n;
+  int right = 0;
+
+  if (frozen->layout == FREEZE_EYTZINGER) {
+    while (k <= n) {
+      __builtin_prefetch(eytzinger + 16 * k);
+      k = 2 * k + (eytzinger[k] < key);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k != 0 ? frozen->ranks[k] : n;
+  }
+
+  slot = n > 0 ? 0 : FROZEN_NONE;
+  while (slot != FROZEN_NONE) {
+    node = frozen->veb + slot;
+    right = key > node->key;
+    mask = (uint32_t)right - 1; // All ones when going left.
+    best = (best & ~mask) | (node->rank & mask);
+    slot = node->child[right];
+  }
+
+  return best;
+}
+
+/**
+Number of keys in a frozen tree.
+
+@param frozen The frozen tree.
+@return Number of keys.
+**/
+size_t frozen_size(struct RBTreeFrozen *frozen) {
+  return frozen->size;
+}
+
+/**
+Range query over a frozen tree, as range_scan: one lower bound search,
+then a sequential walk over the sorted keys. Calls visit on every key with
+lo <= key < hi, in order, and stops early when visit returns non-zero.
+Runs in O(lg n + k) for k visited keys.
+
+@param frozen The frozen tree.
+@param lo Inclusive lower bound of the range.
+@param hi Exclusive upper bound of the range.
+@param visit Callback receiving each key, its data and ctx.
+@param ctx User pointer passed through to visit.
+@return Number of keys visited.
+**/
+size_t frozen_scan(struct RBTreeFrozen *frozen, int lo, int hi,
+  int (*visit)(int, void *, void *), void *ctx) {
+
+  size_t rank = frozen_lower_bound(frozen, lo);
+  size_t count = 0;
+
+  while (rank < frozen->size && frozen->keys[rank] < hi) {
+    count++;
+    if (visit(frozen->keys[rank], frozen->data[rank], ctx) != 0)
+      break;
+    rank++;
+  }
+
+  return count;
+}
+
+/*
+Fill the Eytzinger image by an in-order walk of the implicit complete tree,
+so that slot k receives the next key in order when it is visited.
+*/
+static void eytzinger_(struct RBTreeFrozen *frozen, size_t k, size_t *rank) {
+  if (k > frozen->size)
+    return;
+  eytzinger_(frozen, 2 * k, rank);
+  frozen->eytzinger[k] = frozen->keys[*rank];
+  frozen->ranks[k] = (uint32_t)*rank;
+  (*rank)++;
+  eytzinger_(frozen, 2 * k + 1, rank);
+}
+
+/*
+Assign slots in van Emde Boas order to the top levels of the balanced tree
+over keys [lo, hi), rooted at the middle key as in build_sorted_. The top
+half of the levels is placed first, then every subtree hanging below it,
+each recursively in the same way. pos maps a key's position to its slot.
+*/
+static void place_(uint32_t *pos, size_t lo, size_t hi, int levels,
+  uint32_t *next) {
+
+  int top = levels / 2;
+
+  if (lo == hi || levels == 0)
+    return;
+  if (levels == 1) {
+    pos[lo + (hi - lo) / 2] = (*next)++;
+    return;
+  }
+
+  place_(pos, lo, hi, top, next);
+  place_below_(pos, lo, hi, top, levels - top, next);
+}
+
+/* Place the subtrees rooted depth levels below [lo, hi), left to right. */
+static void place_below_(uint32_t *pos, size_t lo, size_t hi, int depth,
+  int levels, uint32_t *next) {
+
+  size_t mid = lo + (hi - lo) / 2;
+
+  if (lo == hi)
+    return;
+  if (depth == 0) {
+    place_(pos, lo, hi, levels, next);
+    return;
+  }
+
+  place_below_(pos, lo, mid, depth - 1, levels, next);
+  place_below_(pos, mid + 1, hi, depth - 1, levels, next);
+}
+
+/* Fill the van Emde Boas nodes of keys [lo, hi); returns the root's slot. */
+static uint32_t link_(struct RBTreeFrozen *frozen, uint32_t *pos, size_t lo,
+  size_t hi) {
+
+  size_t mid = lo + (hi - lo) / 2;
+  struct FrozenNode *node = NULL;
+
+  if (lo == hi)
+    return FROZEN_NONE;
+
+  node = frozen->veb + pos[mid];
+  node->key   = frozen->keys[mid];
+  node->rank  = (uint32_t)mid;
+  node->child[0] = link_(frozen, pos, lo, mid);
+  node->child[1] = link_(frozen, pos, mid + 1, hi);
+
+  return pos[mid];
+}
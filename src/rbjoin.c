@@ -0,0 +1,621 @@
+#include "errors.h"
+#include "rbjoin.h"
+#include<stdlib.h>
+
+/*
+Everything here works on detached subtrees: a root whose parent is the
+sentinel, together with its black-height, the number of BLACK nodes on any
+path from the root down to the sentinel (the root included, the sentinel
+not). Keeping the black-height alongside each subtree is what makes join
+O(|bh(l) - bh(r)| + 1) and split O(lg n) without storing it in the nodes.
+
+Subtrees of a set operation may be worked on by several threads at once.
+They never share a node, and the shared sentinel is only ever read: every
+write to a parent pointer below is guarded against the sentinel.
+*/
+
+// Set operation performed by a job.
+enum SetOp {
+  SET_UNION,
+  SET_INTERSECTION,
+  SET_DIFFERENCE
+};
+
+// A detached subtree and its black-height.
+struct Subtree {
+  struct RBTreeNode *root;
+  int bh;
+};
+
+// Subtrees dropped by a set operation, linked through their roots' parents.
+struct DropList {
+  struct RBTreeNode *head;
+  struct RBTreeNode *tail;
+};
+
+// One set operation on a pair of subtrees; a unit of parallel work.
+struct SetJob {
+  struct RBTreeNode *nil;     // Sentinel of the family.
+  enum SetOp op;              // Operation to perform.
+  struct Subtree a;           // First operand.
+  struct Subtree b;           // Second operand.
+  struct Subtree result;      // Output.
+  struct DropList dropped;    // Output: nodes to be freed.
+  struct RBTaskPool *workers; // Pool for forking, or NULL.
+};
+
+static struct Subtree join_(struct RBTreeNode *, struct Subtree,
+  struct RBTreeNode *, struct Subtree);
+static struct Subtree join2_(struct RBTreeNode *, struct Subtree,
+  struct Subtree);
+static struct RBTreeNode* split_(struct RBTreeNode *, struct Subtree, int,
+  bool, struct Subtree *, struct Subtree *);
+static struct RBTreeNode* split_last_(struct RBTreeNode *, struct Subtree,
+  struct Subtree *);
+static void set_op_(struct SetJob *);
+static void set_task_(void *);
+static void set_operation_(struct RBTree *, struct RBTree *, enum SetOp,
+  void (*)(void *), struct RBTaskPool *);
+
+/****** HELPERS ******/
+
+// Split a subtree into its root and its two detached children.
+#define detach(nil, t, root, l, r)\
+  do{\
+    (root) = (t).root;\
+    (l).root = (root)->left;\
+    (r).root = (root)->right;\
+    (l).bh = (r).bh = (t).bh - (node_color(root) == BLACK);\
+    if ((l).root != (nil))\
+      set_parent((l).root, (nil));\
+    if ((r).root != (nil))\
+      set_parent((r).root, (nil));\
+  } while (0)
+
+// Nodes may only move between trees of one family.
+static bool check_family(struct RBTree *a, struct RBTree *b) {
+  if (a->pool != b->pool || a->nil != b->nil || a == b) {
+    report_error(EINVAL, NOT_FAMILY);
+    return false;
+  }
+  return true;
+}
+
+// Make a subtree the whole of a tree, with its root BLACK.
+static void set_tree(struct RBTree *tree, struct Subtree t) {
+  tree->root = t.root;
+  tree->blackHeight = t.bh;
+  if (t.root != tree->nil) {
+    set_parent(t.root, tree->nil);
+    if (node_color(t.root) == RED)
+      tree->blackHeight++;
+    set_color(t.root, BLACK);
+  }
+}
+
+// Empty a tree without touching its former nodes.
+static void clear_tree(struct RBTree *tree) {
+  tree->root      = tree->nil;
+  tree->leftmost  = tree->nil;
+  tree->rightmost = tree->nil;
+  tree->size      = 0;
+  tree->blackHeight = 0;
+}
+
+// Append a detached subtree to a drop list.
+static void drop(struct RBTreeNode *nil, struct DropList *list,
+  struct RBTreeNode *root) {
+
+  if (root == nil)
+    return;
+  set_parent(root, nil);
+  if (list->head == NULL)
+    list->head = root;
+  else
+    set_parent(list->tail, root);
+  list->tail = root;
+}
+
+// Append the list from to the list into.
+static void drop_all(struct RBTreeNode *nil, struct DropList *into,
+  struct DropList *from) {
+
+  if (from->head == NULL)
+    return;
+  if (into->head == NULL)
+    into->head = from->head;
+  else
+    set_parent(into->tail, from->head);
+  into->tail = from->tail;
+  set_parent(into->tail, nil);
+}
+
+// Hand the data of a subtree to discard and recycle its nodes.
+static size_t free_subtree(struct RBTree *tree, struct RBTreeNode *root,
+  void (*discard)(void *)) {
+
+  size_t count = 0;
+
+  if (root == tree->nil)
+    return 0;
+  count = 1 + free_subtree(tree, root->left, discard)
+    + free_subtree(tree, root->right, discard);
+  if (discard != NULL && root->data != NULL)
+    discard(root->data);
+  root->data = 0;
+  dest_rbtree_node(tree->pool, &root);
+  return count;
+}
+
+/****** JOIN AND SPLIT ******/
+
+/**
+Join two trees of one family and a new node between them. Every key of t1
+must be at most k and every key of t2 at least k. The result is left in t1
+and t2 is emptied. Runs in O(lg n): the shorter tree is hung from the spine
+of the taller one at equal black-height and the usual insert fixup repairs
+the single RED-RED violation this may cause.
+
+@param t1 Tree with the smaller keys; receives the result.
+@param k Key of the new node.
+@param data Satellite data of the new node.
+@param t2 Tree with the larger keys, of the same family as t1.
+@return Pointer to the new node, or NULL if the trees are not of one family
+or out of order (errno EINVAL) or memory ran out (ENOMEM). Both trees are
+then left as they were.
+**/
+struct RBTreeNode* tree_join(struct RBTree *t1, int k, void *data,
+  struct RBTree *t2) {
+
+  struct RBTreeNode *node = NULL;
+  struct Subtree l, r;
+
+  if (!check_family(t1, t2))
+    return NULL;
+  if ((t1->root != t1->nil && t1->rightmost->key > k) ||
+      (t2->root != t2->nil && t2->leftmost->key < k)) {
+    report_error(EINVAL, NOT_ORDERED);
+    return NULL;
+  }
+
+  node = init_rbtree_node(t1->pool, t1->nil, t1->nil, t1->nil, k, data, RED,
+    false);
+  if (node == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  l.root = t1->root;
+  l.bh   = t1->blackHeight;
+  r.root = t2->root;
+  r.bh   = t2->blackHeight;
+  set_tree(t1, join_(t1->nil, l, node, r));
+
+  // In-order the result is t1, node, t2.
+  if (l.root == t1->nil)
+    t1->leftmost = node;
+  t1->rightmost = r.root != t1->nil ? t2->rightmost : node;
+  t1->size = t1->size != SIZE_UNKNOWN && t2->size != SIZE_UNKNOWN ?
+    t1->size + t2->size + 1 : SIZE_UNKNOWN;
+  clear_tree(t2);
+
+  return node;
+}
+
+/**
+Split a tree around a key. The nodes with key less than k stay in tree and
+those with key at least k move to right, which must be an empty tree of
+the same family. Runs in O(lg n): the subtrees hanging off the search path
+for k are joined back together on either side, and the cost of those joins
+telescopes along the path.
+
+The sizes of the two parts are not known afterwards; each is recounted by
+the next call to tree_size. With RBTREE_ORDER_STATS they are read off the
+roots instead.
+
+@param tree Tree to split; keeps the smaller keys.
+@param k Smallest key to move.
+@param right Empty tree of the same family; receives the larger keys. If it
+is not, the error is reported and neither tree is changed.
+**/
+void tree_split(struct RBTree *tree, int k, struct RBTree *right) {
+
+  struct RBTreeNode *first = tree->leftmost;
+  struct RBTreeNode *last = tree->rightmost;
+  struct Subtree whole, l, r;
+
+  if (!check_family(tree, right))
+    return;
+  if (right->root != right->nil) {
+    report_error(EINVAL, NOT_EMPTY);
+    return;
+  }
+
+  whole.root = tree->root;
+  whole.bh   = tree->blackHeight;
+  split_(tree->nil, whole, k, false, &l, &r);
+  set_tree(tree, l);
+  set_tree(right, r);
+
+  tree->leftmost   = l.root != tree->nil ? first : tree->nil;
+  tree->rightmost  = subtree_maximum(tree, l.root);
+  right->leftmost  = subtree_minimum(right, r.root);
+  right->rightmost = r.root != right->nil ? last : right->nil;
+
+#ifdef RBTREE_ORDER_STATS
+  right->size = r.root->size; // The sentinel's size is 0.
+  tree->size  = l.root->size;
+#else
+  if (r.root == right->nil) {
+    right->size = 0;
+  } else if (l.root == tree->nil) {
+    right->size = tree->size;
+    tree->size = 0;
+  } else {
+    right->size = tree->size = SIZE_UNKNOWN;
+  }
+#endif
+}
+
+/**
+Private join of l, m and r where every key of l is at most m's key and every
+key of r at least that. The roots of l and r are made BLACK first. With equal
+black-heights m simply becomes a RED root over them. Otherwise the walk goes
+down the inner spine of the taller tree to the first BLACK node c with the
+black-height of the shorter one, and m replaces c as a RED node with c and
+the shorter tree as children. That keeps every black-height intact, and
+insert_fixup on a stack tree handle removes a RED parent of m if there is
+one. The new black-height is recovered on the way from m back to the root,
+which is no longer than the walk down.
+
+@param nil Sentinel of the family.
+@param l Left subtree.
+@param m Middle node.
+@param r Right subtree.
+@return The joined subtree; its root may be RED.
+**/
+static struct Subtree join_(struct RBTreeNode *nil, struct Subtree l,
+  struct RBTreeNode *m, struct Subtree r) {
+
+  struct RBTree tmp = { .root = nil, .nil = nil, .leftmost = nil,
+    .rightmost = nil };
+  struct RBTreeNode *c = NULL, *p = nil, *walk = NULL;
+  struct Subtree joined;
+  int cb = 0;
+
+  if (l.root != nil) {
+    set_parent(l.root, nil);
+    if (node_color(l.root) == RED) {
+      set_color(l.root, BLACK);
+      l.bh++;
+    }
+  }
+  if (r.root != nil) {
+    set_parent(r.root, nil);
+    if (node_color(r.root) == RED) {
+      set_color(r.root, BLACK);
+      r.bh++;
+    }
+  }
+  set_color(m, RED);
+
+  if (l.bh == r.bh) {
+    m->left  = l.root;
+    m->right = r.root;
+    set_parent(m, nil);
+    if (l.root != nil)
+      set_parent(l.root, m);
+    if (r.root != nil)
+      set_parent(r.root, m);
+#ifdef RBTREE_ORDER_STATS
+    fix_size_(m);
+#endif
+#ifdef RBTREE_INTERVALS
+    fix_max_(m);
+#endif
+    joined.root = m;
+    joined.bh   = l.bh;
+    return joined;
+  }
+
+  if (l.bh > r.bh) { // Hang r from the right spine of l.
+    for (c = l.root, cb = l.bh; cb > r.bh || node_color(c) == RED; c = c->right) {
+      cb -= node_color(c) == BLACK;
+      p = c;
+    }
+    p->right = m;
+    m->left  = c;
+    m->right = r.root;
+    tmp.root = l.root;
+  } else {           // Hang l from the left spine of r.
+    for (c = r.root, cb = r.bh; cb > l.bh || node_color(c) == RED; c = c->left) {
+      cb -= node_color(c) == BLACK;
+      p = c;
+    }
+    p->left  = m;
+    m->left  = l.root;
+    m->right = c;
+    tmp.root = r.root;
+  }
+
+  set_parent(m, p);
+  if (m->left != nil)
+    set_parent(m->left, m);
+  if (m->right != nil)
+    set_parent(m->right, m);
+#ifdef RBTREE_ORDER_STATS
+  fix_size_(m);
+  add_size_(&tmp, p, m->size - c->size); // The whole shorter tree and m.
+#endif
+#ifdef RBTREE_INTERVALS
+  fix_max_(m);
+  raise_max_(&tmp, p, m->maxHigh);
+#endif
+  insert_fixup(&tmp, m);
+
+  // Both children of m have black-height cb.
+  joined.root = tmp.root;
+  joined.bh   = cb;
+  for (walk = m; walk != nil; walk = node_parent(walk))
+    joined.bh += node_color(walk) == BLACK;
+  return joined;
+}
+
+/**
+Private join of l and r without a middle node: the maximum of l is taken
+out and used as the middle node.
+
+@param nil Sentinel of the family.
+@param l Left subtree.
+@param r Right subtree.
+@return The joined subtree; its root may be RED.
+**/
+static struct Subtree join2_(struct RBTreeNode *nil, struct Subtree l,
+  struct Subtree r) {
+
+  struct RBTreeNode *m = NULL;
+  struct Subtree rest;
+
+  if (l.root == nil)
+    return r;
+  if (r.root == nil)
+    return l;
+  m = split_last_(nil, l, &rest);
+  return join_(nil, rest, m, r);
+}
+
+/**
+Private split of a subtree around k. With take set, a node with key k is
+taken out and returned, the keys less than k go to l and the others to r.
+Without take, every key of at least k goes to r and NULL is returned.
+
+@param nil Sentinel of the family.
+@param t Subtree to split; its nodes are reused.
+@param k Key to split around.
+@param take Take out a node with key k?
+@param l Receives the subtree of smaller keys.
+@param r Receives the subtree of larger keys.
+@return The node taken out, or NULL.
+**/
+static struct RBTreeNode* split_(struct RBTreeNode *nil, struct Subtree t,
+  int k, bool take, struct Subtree *l, struct Subtree *r) {
+
+  struct RBTreeNode *root = NULL, *found = NULL;
+  struct Subtree left, right, rest;
+
+  if (t.root == nil) {
+    l->root = r->root = nil;
+    l->bh = r->bh = 0;
+    return NULL;
+  }
+
+  detach(nil, t, root, left, right);
+
+  if (take && k == root->key) {
+    root->left = root->right = nil;
+    *l = left;
+    *r = right;
+    return root;
+  }
+
+  if (k < root->key || (!take && k == root->key)) {
+    found = split_(nil, left, k, take, l, &rest);
+    *r = join_(nil, rest, root, right);
+  } else {
+    found = split_(nil, right, k, take, &rest, r);
+    *l = join_(nil, left, root, rest);
+  }
+  return found;
+}
+
+/**
+Private helper for join2_. Takes the node with maximum key out of a subtree.
+
+@param nil Sentinel of the family.
+@param t Non-empty subtree.
+@param rest Receives the subtree without its maximum.
+@return The node taken out.
+**/
+static struct RBTreeNode* split_last_(struct RBTreeNode *nil, struct Subtree t,
+  struct Subtree *rest) {
+
+  struct RBTreeNode *root = NULL, *last = NULL;
+  struct Subtree left, right, shorter;
+
+  detach(nil, t, root, left, right);
+
+  if (right.root == nil) {
+    root->left = nil;
+    *rest = left;
+    return root;
+  }
+
+  last = split_last_(nil, right, &shorter);
+  *rest = join_(nil, left, root, shorter);
+  return last;
+}
+
+/****** SET OPERATIONS ******/
+
+/**
+Union of two trees of one family. The result is left in a and b is
+emptied. Where both trees hold a key, the node of a is kept and the data
+of the node of b is handed to discard.
+
+Both trees are worked on in place: b is split around the root key of a,
+the halves are combined recursively with the subtrees of a, and the two
+results are joined again through the root. This takes O(m lg(n/m + 1))
+for trees of sizes m <= n. When a pool of workers is given, the two
+recursive calls run in parallel for subtrees of black-height SET_PAR_BH
+and up.
+
+NOTE: The set operations are meant for trees with distinct keys. A
+duplicated key of b is matched against at most one node of a.
+
+Trees of different families are reported as NOT_FAMILY and left alone.
+
+@param a First operand; receives the result.
+@param b Second operand, of the same family as a; emptied.
+@param discard Called on the data of every node dropped, or NULL.
+@param workers Pool to run in, or NULL to run in the caller only.
+**/
+void tree_union(struct RBTree *a, struct RBTree *b, void (*discard)(void *),
+  struct RBTaskPool *workers) {
+  set_operation_(a, b, SET_UNION, discard, workers);
+}
+
+/**
+Intersection of two trees of one family: the nodes of a whose key is also
+in b. The result is left in a and b is emptied; see tree_union.
+
+@param a First operand; receives the result.
+@param b Second operand, of the same family as a; emptied.
+@param discard Called on the data of every node dropped, or NULL.
+@param workers Pool to run in, or NULL to run in the caller only.
+**/
+void tree_intersection(struct RBTree *a, struct RBTree *b,
+  void (*discard)(void *), struct RBTaskPool *workers) {
+  set_operation_(a, b, SET_INTERSECTION, discard, workers);
+}
+
+/**
+Difference of two trees of one family: the nodes of a whose key is not in
+b. The result is left in a and b is emptied; see tree_union.
+
+@param a First operand; receives the result.
+@param b Second operand, of the same family as a; emptied.
+@param discard Called on the data of every node dropped, or NULL.
+@param workers Pool to run in, or NULL to run in the caller only.
+**/
+void tree_difference(struct RBTree *a, struct RBTree *b,
+  void (*discard)(void *), struct RBTaskPool *workers) {
+  set_operation_(a, b, SET_DIFFERENCE, discard, workers);
+}
+
+/**
+Private driver of the set operations. Runs the recursion, then frees the
+dropped nodes in the calling thread and fixes up the tree handles. Every
+node ends up either in the result or dropped, which gives the new size.
+
+@param a First operand; receives the result.
+@param b Second operand; emptied.
+@param op Operation to perform.
+@param discard Called on the data of every node dropped, or NULL.
+@param workers Pool to run in, or NULL.
+**/
+static void set_operation_(struct RBTree *a, struct RBTree *b, enum SetOp op,
+  void (*discard)(void *), struct RBTaskPool *workers) {
+
+  struct SetJob job;
+  struct RBTreeNode *list = NULL, *next = NULL;
+  size_t dropped = 0;
+
+  if (!check_family(a, b))
+    return;
+
+  job.nil      = a->nil;
+  job.op       = op;
+  job.a.root   = a->root;
+  job.a.bh     = a->blackHeight;
+  job.b.root   = b->root;
+  job.b.bh     = b->blackHeight;
+  job.workers  = workers;
+  job.dropped.head = job.dropped.tail = NULL;
+  set_op_(&job);
+
+  for (list = job.dropped.head; list != NULL; list = next) {
+    next = list == job.dropped.tail ? NULL : node_parent(list);
+    dropped += free_subtree(a, list, discard);
+  }
+
+  a->size = a->size != SIZE_UNKNOWN && b->size != SIZE_UNKNOWN ?
+    a->size + b->size - dropped : SIZE_UNKNOWN;
+  set_tree(a, job.result);
+  a->leftmost  = subtree_minimum(a, a->root);
+  a->rightmost = subtree_maximum(a, a->root);
+  clear_tree(b);
+}
+
+/**
+Private recursion of the set operations on the subtrees of one job. Forks
+the left half onto the job's workers when it is large enough to be worth
+a task.
+
+@param job Operands on input; result and dropped nodes on output.
+**/
+static void set_op_(struct SetJob *job) {
+
+  struct RBTreeNode *nil = job->nil;
+  struct RBTreeNode *root = NULL, *found = NULL;
+  struct SetJob left = *job, right = *job;
+  struct RBTask task;
+  bool keep = false;
+
+  job->dropped.head = job->dropped.tail = NULL;
+
+  if (job->a.root == nil || job->b.root == nil) {
+    if (job->op == SET_UNION) {
+      job->result = job->a.root != nil ? job->a : job->b;
+    } else if (job->op == SET_INTERSECTION) {
+      drop(nil, &job->dropped, job->a.root);
+      drop(nil, &job->dropped, job->b.root);
+      job->result.root = nil;
+      job->result.bh   = 0;
+    } else {
+      drop(nil, &job->dropped, job->b.root);
+      job->result = job->a;
+    }
+    return;
+  }
+
+  detach(nil, job->a, root, left.a, right.a);
+  found = split_(nil, job->b, root->key, true, &left.b, &right.b);
+
+  if (job->workers != NULL && job->a.bh >= SET_PAR_BH) {
+    task_spawn(job->workers, &task, set_task_, &left);
+    set_op_(&right);
+    task_wait(job->workers, &task);
+  } else {
+    set_op_(&left);
+    set_op_(&right);
+  }
+
+  drop_all(nil, &job->dropped, &left.dropped);
+  drop_all(nil, &job->dropped, &right.dropped);
+
+  if (found != NULL)
+    drop(nil, &job->dropped, found);
+
+  keep = job->op == SET_UNION || (job->op == SET_INTERSECTION) == (found != NULL);
+  if (keep) {
+    job->result = join_(nil, left.result, root, right.result);
+  } else {
+    root->left = root->right = nil;
+    drop(nil, &job->dropped, root);
+    job->result = join2_(nil, left.result, right.result);
+  }
+}
+
+// Task entry point for set_op_.
+static void set_task_(void *job) {
+  set_op_(job);
+}
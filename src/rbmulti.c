@@ -0,0 +1,269 @@
+#include "errors.h"
+#include "rbmulti.h"
+
+/**
+Function to construct a new, empty multimap.
+
+@param allocator Memory hooks for the tree and the entries, or NULL for
+malloc/free.
+@return Pointer to the new multimap, or NULL if memory ran out.
+**/
+struct RBMultiMap* init_rbmulti(const struct RBTreeAllocator *allocator) {
+
+  struct RBTree *tree = init_rbtree_sized(sizeof(struct RBMultiNode), allocator);
+  struct RBTreeAllocator hooks;
+  struct RBMultiMap *map = NULL;
+
+  if (tree == NULL)
+    return NULL;
+  hooks = tree->pool->allocator;
+  if ((map = hooks.alloc(hooks.ctx, sizeof(struct RBMultiMap))) == NULL) {
+    dest_rbtree(&tree);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  if ((map->entries = init_rbtree_pool(&hooks, sizeof(struct RBMultiEntry))) == NULL) {
+    hooks.release(hooks.ctx, map, sizeof(struct RBMultiMap));
+    dest_rbtree(&tree);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  map->tree = tree;
+  map->size = 0;
+
+  return map;
+}
+
+/**
+Function to destroy a multimap. Nodes and entries go back with their pools
+in O(#slabs). Once the map has been destroyed the reference is nullified.
+
+CAUTION: The values must be handled by the caller.
+
+@param map Double pointer to the multimap to be destroyed.
+**/
+void dest_rbmulti(struct RBMultiMap **map) {
+
+  struct RBTreeAllocator hooks = (*map)->tree->pool->allocator;
+
+  dest_rbtree_pool(&(*map)->entries);
+  dest_rbtree(&(*map)->tree);
+  hooks.release(hooks.ctx, *map, sizeof(struct RBMultiMap));
+  *map = NULL;
+}
+
+/**
+Insertion function. A new key gets a tree node holding the value; a key
+already in the map gets the value appended to its list, with no change to
+the tree. Runs in O(lg n) for n distinct keys.
+
+@param map The multimap.
+@param key Key to insert under.
+@param data The value.
+@return true, or false if memory ran out; the map is unchanged then.
+**/
+bool multi_insert(struct RBMultiMap *map, int key, void *data) {
+
+  struct RBTree *tree = map->tree;
+  struct RBTreeNode *walk = tree->root, *parent = tree->nil;
+  struct RBMultiNode *node = NULL;
+  struct RBMultiEntry *entry = NULL;
+
+  while (walk != tree->nil && walk->key != key) {
+    parent = walk;
+    walk = key < walk->key ? walk->left : walk->right;
+  }
+
+  if (walk != tree->nil) { // Append to the key's list.
+    node = (struct RBMultiNode *)walk;
+    if ((entry = pool_alloc_node(map->entries)) == NULL) {
+      report_error(ENOMEM, MEM_ERROR);
+      return false;
+    }
+    entry->data = data;
+    if (node->tail == NULL) {
+      entry->next = entry;
+    } else {
+      entry->next = node->tail->next;
+      node->tail->next = entry;
+    }
+    node->tail = entry;
+    node->count++;
+  } else {
+    node = (struct RBMultiNode *)init_rbtree_node(tree->pool, NULL,
+      tree->nil, tree->nil, key, data, RED, false);
+    if (node == NULL) {
+      report_error(ENOMEM, MEM_ERROR);
+      return false;
+    }
+    node->tail  = NULL;
+    node->count = 1;
+    insert_link(tree, parent, &node->base,
+      parent != tree->nil && key < parent->key);
+  }
+  map->size++;
+
+  return true;
+}
+
+/**
+Remove the oldest value of a key. The key's tree node is deleted with its
+last value.
+
+@param map The multimap.
+@param key Key to delete from.
+@param data Receives the value removed, if any. May be NULL.
+@return Did the key have a value to remove?
+**/
+bool multi_delete_one(struct RBMultiMap *map, int key, void **data) {
+
+  struct RBTreeNode *found = search(map->tree, key);
+  struct RBMultiNode *node = (struct RBMultiNode *)found;
+  struct RBMultiEntry *head = NULL;
+  void *value = NULL;
+
+  if (found == NULL)
+    return false;
+
+  if (node->tail == NULL) { // Last value: the node goes.
+    value = delete_node(map->tree, found);
+    dest_rbtree_node(map->tree->pool, &found);
+  } else { // The head of the list moves up into the node.
+    value = found->data;
+    head = node->tail->next;
+    found->data = head->data;
+    if (head == node->tail)
+      node->tail = NULL;
+    else
+      node->tail->next = head->next;
+    pool_free_node(map->entries, head);
+    node->count--;
+  }
+  map->size--;
+
+  if (data != NULL)
+    *data = value;
+  return true;
+}
+
+/**
+Remove a key and all of its values with one tree deletion.
+
+@param map The multimap.
+@param key Key to delete.
+@param release Called on each value, oldest first, or NULL.
+@return Number of values removed.
+**/
+size_t multi_delete_all(struct RBMultiMap *map, int key,
+  void (*release)(void *)) {
+
+  struct RBTreeNode *found = search(map->tree, key);
+  struct RBMultiNode *node = (struct RBMultiNode *)found;
+  struct RBMultiEntry *walk = NULL, *next = NULL;
+  size_t count = 0;
+  void *value = NULL;
+
+  if (found == NULL)
+    return 0;
+
+  count = node->count;
+  if (node->tail != NULL) {
+    walk = node->tail->next;
+    node->tail->next = NULL; // Break the circle.
+  }
+  value = delete_node(map->tree, found);
+  dest_rbtree_node(map->tree->pool, &found);
+  if (release != NULL)
+    release(value);
+  for (; walk != NULL; walk = next) {
+    next = walk->next;
+    if (release != NULL)
+      release(walk->data);
+    pool_free_node(map->entries, walk);
+  }
+  map->size -= count;
+
+  return count;
+}
+
+/**
+Number of values stored under a key.
+
+@param map The multimap.
+@param key Key to count.
+@return Number of values, 0 if the key is not in the map.
+**/
+size_t multi_count(struct RBMultiMap *map, int key) {
+
+  struct RBTreeNode *found = search(map->tree, key);
+
+  return found != NULL ? ((struct RBMultiNode *)found)->count : 0;
+}
+
+/**
+Start iterating over the values of a key with multi_iter_next. The
+iterator is invalidated by any update of that key.
+
+@param map The multimap.
+@param key Key whose values to visit.
+@param iter Iterator to set up.
+@return Number of values the iterator will return.
+**/
+size_t multi_equal_range(struct RBMultiMap *map, int key,
+  struct RBMultiIter *iter) {
+
+  iter->node = (struct RBMultiNode *)search(map->tree, key);
+  iter->next = NULL;
+  iter->left = iter->node != NULL ? iter->node->count : 0;
+
+  return iter->left;
+}
+
+/**
+Step an iterator set up by multi_equal_range.
+
+@param iter The iterator.
+@param data Receives the next value. May be NULL.
+@return Was there another value?
+**/
+bool multi_iter_next(struct RBMultiIter *iter, void **data) {
+
+  void *value = NULL;
+
+  if (iter->left == 0)
+    return false;
+
+  if (iter->left == iter->node->count) { // First value: in the node.
+    value = iter->node->base.data;
+    iter->next = iter->node->tail != NULL ? iter->node->tail->next : NULL;
+  } else {
+    value = iter->next->data;
+    iter->next = iter->next->next;
+  }
+  iter->left--;
+
+  if (data != NULL)
+    *data = value;
+  return true;
+}
+
+/**
+Number of values in the map, counting every duplicate.
+
+@param map The multimap.
+@return Number of values.
+**/
+size_t multi_size(struct RBMultiMap *map) {
+  return map->size;
+}
+
+/**
+Number of distinct keys in the map, i.e. of nodes in its tree.
+
+@param map The multimap.
+@return Number of keys.
+**/
+size_t multi_keys(struct RBMultiMap *map) {
+  return tree_size(map->tree);
+}
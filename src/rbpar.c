@@ -0,0 +1,573 @@
+#include "errors.h"
+#include "rbpar.h"
+#include<stdlib.h>
+#include<string.h>
+
+/*
+The traversals fold each subtree with the caller's visit function in key
+order, forking the left half of every subtree down to a cutoff
+black-height. The cutoff leaves about PAR_TASKS subtrees per thread of the
+pool, so that stealing can even out unequal halves, but never goes below
+PAR_MIN_BH, where a task would cost more than its fold. A red-black tree is at most 2 lg n deep, so the recursion is safe on
+any tree; the folds below also loop down right spines instead of
+recursing. Partial results are combined left to right, so the combine
+function of par_reduce needs to be associative but not commutative.
+
+par_build_rbtree sorts (key, data) entries with a parallel merge sort:
+runs of about n / (4 * threads) keys are copied in and LSD radix sorted
+by one task each, then merged pairwise, splitting each merge around the
+median of its larger input. The sort is stable, so equal keys keep the
+order they were given in. The sorted entries are then linked into one
+pool block the same way init_rbtree_sorted does, forking by halves.
+*/
+
+// Stable radix sort of the runs: three 11-bit digits of the key.
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_MIN  64
+#define RADIX_DIGIT(key, shift)\
+  (((unsigned int)(key) ^ 0x80000000u) >> (shift) & (RADIX_SIZE - 1))
+
+// One fold over a subtree; a unit of parallel work.
+struct FoldJob {
+  struct RBTree *tree;
+  struct RBTreeNode *root;             // Subtree to fold.
+  int bh;                              // Its black-height.
+  int cutoff;                          // Lowest black-height to fork at.
+  void* (*visit)(void *, struct RBTreeNode *, void *);
+  void* (*combine)(void *, void *, void *);
+  void *ctx;                           // Passed to visit and combine.
+  void *result;                        // Output; NULL for no nodes.
+  struct RBTaskPool *workers;          // Pool for forking, or NULL.
+};
+
+// Callbacks of par_for_each, par_map and par_dest_rbtree.
+struct Apply {
+  void (*each)(struct RBTreeNode *, void *);
+  void* (*map)(void *, void *);
+  void (*release)(void *);
+  void *ctx;
+};
+
+// A key with its data, as sorted by par_build_rbtree.
+struct ParEntry {
+  int key;
+  void *data;
+};
+
+// Sort of a run of keys; a unit of parallel work.
+struct SortJob {
+  const int *keys;             // Input run.
+  void * const *data;          // Its data, or NULL.
+  struct ParEntry *from;       // Storage for the run.
+  struct ParEntry *to;         // Scratch of the same size.
+  size_t n;                    // Length of the run.
+  size_t leaf;                 // Runs up to this long are not split.
+  bool second;                 // Leave the result in to instead of from?
+  struct RBTaskPool *workers;
+};
+
+// Stable merge of two sorted runs; a unit of parallel work.
+struct MergeJob {
+  const struct ParEntry *a;
+  size_t na;
+  const struct ParEntry *b;
+  size_t nb;
+  struct ParEntry *out;
+  struct RBTaskPool *workers;
+};
+
+// Linking of a run of sorted entries; a unit of parallel work.
+struct BuildJob {
+  struct RBTree *tree;
+  char *block;                     // Node storage, in key order.
+  const struct ParEntry *entries;  // All sorted entries.
+  size_t lo, hi;                   // Run to link, [lo, hi).
+  int depth;                       // Depth of the run's root.
+  int redDepth;                    // Depth colored RED, or -1.
+  struct RBTreeNode *root;         // Output.
+  struct RBTaskPool *workers;
+};
+
+static void fold_job_(struct FoldJob *);
+static void sort_job_(struct SortJob *);
+static void merge_job_(struct MergeJob *);
+static void build_job_(struct BuildJob *);
+static void fold_task_(void *);
+static void sort_task_(void *);
+static void merge_task_(void *);
+static void build_task_(void *);
+
+/****** HELPERS ******/
+
+// Fold a subtree into acc in key order.
+static void* fold_(struct FoldJob *job, struct RBTreeNode *node, void *acc) {
+  for (; node != job->tree->nil; node = node->right) {
+    acc = fold_(job, node->left, acc);
+    acc = job->visit(acc, node, job->ctx);
+  }
+  return acc;
+}
+
+// Combine two partial results, either of which may stand for no nodes.
+static void* combine_(struct FoldJob *job, void *left, void *right) {
+  if (left == NULL)
+    return right;
+  if (right == NULL)
+    return left;
+  return job->combine(left, right, job->ctx);
+}
+
+static void* each_visit(void *acc, struct RBTreeNode *node, void *apply) {
+  ((struct Apply *)apply)->each(node, ((struct Apply *)apply)->ctx);
+  return acc;
+}
+
+static void* map_visit(void *acc, struct RBTreeNode *node, void *apply) {
+  node->data = ((struct Apply *)apply)->map(node->data,
+    ((struct Apply *)apply)->ctx);
+  return acc;
+}
+
+static void* release_visit(void *acc, struct RBTreeNode *node, void *apply) {
+  ((struct Apply *)apply)->release(node->data);
+  return acc;
+}
+
+/*
+Black-height down to which a fold of a tree of black-height bh forks. Each
+black level at or above it at least doubles the tasks, so the cutoff is
+lg(PAR_TASKS * threads) levels below the root.
+*/
+static int fork_cutoff(int bh, struct RBTaskPool *workers) {
+
+  size_t tasks = PAR_TASKS * task_parallelism(workers);
+  int levels = 0;
+
+  while (((size_t)1 << levels) < tasks)
+    levels++;
+  return bh - levels + 1 > PAR_MIN_BH ? bh - levels + 1 : PAR_MIN_BH;
+}
+
+// Run a fold over a whole tree.
+static void* fold_tree(struct RBTree *tree,
+  void* (*visit)(void *, struct RBTreeNode *, void *),
+  void* (*combine)(void *, void *, void *), void *ctx,
+  struct RBTaskPool *workers) {
+
+  struct FoldJob job;
+
+  job.tree    = tree;
+  job.root    = tree->root;
+  job.bh      = tree->blackHeight;
+  job.cutoff  = fork_cutoff(tree->blackHeight, workers);
+  job.visit   = visit;
+  job.combine = combine;
+  job.ctx     = ctx;
+  job.result  = NULL;
+  job.workers = workers;
+  fold_job_(&job);
+
+  return job.result;
+}
+
+// Stable LSD radix sort of n entries from a; the result ends up in b.
+static void radix_sort(struct ParEntry *a, struct ParEntry *b, size_t n) {
+
+  struct ParEntry *from = a, *to = b, *swap = NULL;
+  struct ParEntry entry;
+  size_t count[RADIX_SIZE];
+  size_t i = 0, j = 0, sum = 0, t = 0;
+  unsigned int shift = 0;
+
+  if (n < RADIX_MIN) {
+    for (i = 1; i < n; i++) {
+      entry = a[i];
+      for (j = i; j > 0 && a[j - 1].key > entry.key; j--)
+        a[j] = a[j - 1];
+      a[j] = entry;
+    }
+    memcpy(b, a, n * sizeof(struct ParEntry));
+    return;
+  }
+
+  for (shift = 0; shift < 32; shift += RADIX_BITS) {
+    for (i = 0; i < RADIX_SIZE; i++)
+      count[i] = 0;
+    for (i = 0; i < n; i++)
+      count[RADIX_DIGIT(from[i].key, shift)]++;
+    for (i = 0, sum = 0; i < RADIX_SIZE; i++) {
+      t = count[i];
+      count[i] = sum;
+      sum += t;
+    }
+    for (i = 0; i < n; i++)
+      to[count[RADIX_DIGIT(from[i].key, shift)]++] = from[i];
+    swap = from;
+    from = to;
+    to = swap;
+  }
+  // Three passes leave the result in b.
+}
+
+// Sequential part of the build: the same recursion as build_sorted_.
+static struct RBTreeNode* build_(struct RBTree *tree, char *block,
+  const struct ParEntry *entries, size_t lo, size_t hi, int depth,
+  int redDepth) {
+
+  size_t mid = lo + (hi - lo) / 2;
+  struct RBTreeNode *node = NULL;
+
+  if (lo == hi)
+    return tree->nil;
+
+  node = sorted_node_(tree, block, mid, entries[mid].key, entries[mid].data,
+    depth == redDepth, hi - lo);
+  sorted_link_(tree, node,
+    build_(tree, block, entries, lo, mid, depth + 1, redDepth),
+    build_(tree, block, entries, mid + 1, hi, depth + 1, redDepth));
+
+  return node;
+}
+
+/****** CONSTRUCTORS AND DESTRUCTORS ******/
+
+/**
+Function to construct an RBT from n keys in any order. The keys are sorted
+by a parallel merge sort on the pool, equal keys keeping the order they
+were given in, and linked into a perfectly balanced tree in O(n) as by
+init_rbtree_sorted, with the two halves of every large run built in
+parallel. The tree is the same as init_rbtree_sorted would give for the
+sorted keys. Takes 32 bytes per key of temporary memory.
+
+@param keys Keys, in any order.
+@param data Satellite data for each key, or NULL for all NULL data.
+@param n Number of keys.
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@param workers Pool to run on, or NULL to run in the caller.
+@return Pointer to the new tree handle, or NULL if memory ran out.
+**/
+struct RBTree* par_build_rbtree(const int *keys, void * const *data,
+  size_t n, const struct RBTreeAllocator *allocator,
+  struct RBTaskPool *workers) {
+
+  struct RBTree *tree = NULL;
+  struct ParEntry *entries = NULL;
+  struct SortJob sort;
+  struct BuildJob build;
+  char *block = NULL;
+  size_t i = 0;
+  int depth = 0;
+
+  if ((tree = init_rbtree_alloc(allocator)) == NULL || n == 0)
+    return tree;
+
+  if ((entries = malloc(2 * n * sizeof(struct ParEntry))) == NULL ||
+      (block = pool_alloc_block(tree->pool, n)) == NULL) {
+    free(entries);
+    dest_rbtree(&tree);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  sort.keys    = keys;
+  sort.data    = data;
+  sort.from    = entries;
+  sort.to      = entries + n;
+  sort.n       = n;
+  sort.leaf    = n;
+  sort.second  = false;
+  sort.workers = workers;
+  if (workers != NULL) {
+    sort.leaf = n / (4 * task_parallelism(workers));
+    if (sort.leaf < PAR_MIN_KEYS)
+      sort.leaf = PAR_MIN_KEYS;
+  }
+  sort_job_(&sort);
+
+  // Depth of the deepest level; it only gets RED nodes if it is not full.
+  for (i = n; i > 1; i >>= 1)
+    depth++;
+
+  build.tree     = tree;
+  build.block    = block;
+  build.entries  = entries;
+  build.lo       = 0;
+  build.hi       = n;
+  build.depth    = 0;
+  build.redDepth = (n & (n + 1)) != 0 ? depth : -1;
+  build.workers  = workers;
+  build_job_(&build);
+  free(entries);
+
+  tree->root = build.root;
+  set_parent(tree->root, tree->nil);
+  tree->leftmost  = (struct RBTreeNode *)block;
+  tree->rightmost = (struct RBTreeNode *)(block + (n - 1) * tree->pool->nodeSize);
+  tree->size      = n;
+  tree->blackHeight = (n & (n + 1)) != 0 ? depth : depth + 1;
+
+  return tree;
+}
+
+/**
+Function to destroy a tree together with its satellite data. The release
+function is called on the data of every node from the pool's threads,
+subtree by subtree; then the tree goes as with dest_rbtree, which frees
+the nodes slab by slab without visiting them. Once the tree has been
+destroyed the handle is nullified.
+
+@param tree Double pointer to the RBT to be deallocated.
+@param release Called on the data of each node, or NULL.
+@param workers Pool to run on, or NULL to run in the caller.
+**/
+void par_dest_rbtree(struct RBTree **tree, void (*release)(void *),
+  struct RBTaskPool *workers) {
+
+  struct Apply apply;
+
+  if (release != NULL) {
+    apply.release = release;
+    fold_tree(*tree, release_visit, NULL, &apply, workers);
+  }
+  dest_rbtree(tree);
+}
+
+/****** TRAVERSALS ******/
+
+/**
+Call a function on every node of a tree. Nodes of one subtree are visited
+in key order by one thread, but subtrees are visited concurrently.
+
+@param tree The RBT.
+@param each Called with each node and ctx. It may change the node's data.
+@param ctx Passed to each.
+@param workers Pool to run on, or NULL to run in the caller.
+**/
+void par_for_each(struct RBTree *tree,
+  void (*each)(struct RBTreeNode *, void *), void *ctx,
+  struct RBTaskPool *workers) {
+
+  struct Apply apply;
+
+  apply.each = each;
+  apply.ctx  = ctx;
+  fold_tree(tree, each_visit, NULL, &apply, workers);
+}
+
+/**
+Replace the data of every node of a tree with the value of a function of
+it, e.g. to convert all records at once.
+
+@param tree The RBT.
+@param map Called with the data of each node and ctx; returns new data.
+@param ctx Passed to map.
+@param workers Pool to run on, or NULL to run in the caller.
+**/
+void par_map(struct RBTree *tree, void* (*map)(void *, void *), void *ctx,
+  struct RBTaskPool *workers) {
+
+  struct Apply apply;
+
+  apply.map = map;
+  apply.ctx = ctx;
+  fold_tree(tree, map_visit, NULL, &apply, workers);
+}
+
+/**
+Reduce a tree to one value. Each thread folds a run of nodes in key order
+into an accumulator with visit, starting from NULL, and runs that are
+next to each other are merged with combine, left run first. The result is
+the same as one fold over the whole tree when combine is associative.
+
+Accumulators are opaque to the tree: visit creates one when given NULL
+(e.g. with malloc) and must never return NULL, and combine merges its
+second argument into a result it returns (e.g. the first, freeing the
+second). Both are called concurrently on different accumulators.
+
+@param tree The RBT.
+@param visit Called with an accumulator or NULL, a node and ctx.
+@param combine Called with two accumulators and ctx.
+@param ctx Passed to visit and combine.
+@param workers Pool to run on, or NULL to run in the caller.
+@return The final accumulator, or NULL for an empty tree.
+**/
+void* par_reduce(struct RBTree *tree,
+  void* (*visit)(void *, struct RBTreeNode *, void *),
+  void* (*combine)(void *, void *, void *), void *ctx,
+  struct RBTaskPool *workers) {
+  return fold_tree(tree, visit, combine, ctx, workers);
+}
+
+/****** PARALLEL RECURSIONS ******/
+
+/*
+Fold one subtree. A large subtree forks the fold of its left child, visits
+its root and folds its right child meanwhile, then combines the three.
+*/
+static void fold_job_(struct FoldJob *job) {
+
+  struct RBTreeNode *root = job->root;
+  struct FoldJob left = *job, right = *job;
+  struct RBTask task;
+  void *mid = NULL;
+
+  if (job->workers == NULL || job->bh < job->cutoff || root == job->tree->nil) {
+    job->result = fold_(job, root, NULL);
+    return;
+  }
+
+  left.root  = root->left;
+  right.root = root->right;
+  left.bh = right.bh = job->bh - (node_color(root) == BLACK);
+
+  task_spawn(job->workers, &task, fold_task_, &left);
+  mid = job->visit(NULL, root, job->ctx);
+  fold_job_(&right);
+  task_wait(job->workers, &task);
+
+  job->result = combine_(job, left.result, combine_(job, mid, right.result));
+}
+
+/*
+Sort a run. A leaf run is copied in from the input and radix sorted; a
+longer one sorts its halves in parallel into the other buffer and merges
+them back.
+*/
+static void sort_job_(struct SortJob *job) {
+
+  struct SortJob left = *job, right = *job;
+  struct MergeJob merge;
+  struct RBTask task;
+  size_t half = job->n / 2, i = 0;
+
+  if (job->n <= job->leaf) {
+    for (i = 0; i < job->n; i++) {
+      job->from[i].key  = job->keys[i];
+      job->from[i].data = job->data != NULL ? job->data[i] : NULL;
+    }
+    radix_sort(job->from, job->to, job->n);
+    if (!job->second)
+      memcpy(job->from, job->to, job->n * sizeof(struct ParEntry));
+    return;
+  }
+
+  left.n = half;
+  left.second = !job->second;
+  right.keys = job->keys + half;
+  right.data = job->data != NULL ? job->data + half : NULL;
+  right.from = job->from + half;
+  right.to   = job->to + half;
+  right.n    = job->n - half;
+  right.second = !job->second;
+
+  task_spawn(job->workers, &task, sort_task_, &left);
+  sort_job_(&right);
+  task_wait(job->workers, &task);
+
+  merge.a   = job->second ? job->from : job->to;
+  merge.na  = half;
+  merge.b   = merge.a + half;
+  merge.nb  = job->n - half;
+  merge.out = job->second ? job->to : job->from;
+  merge.workers = job->workers;
+  merge_job_(&merge);
+}
+
+/*
+Merge two runs, entries of a first among equal keys. A long merge is cut
+at the middle of its longer input and the matching position of the other,
+chosen so that equal keys stay on the same side as before, and the two
+pieces are merged in parallel.
+*/
+static void merge_job_(struct MergeJob *job) {
+
+  struct MergeJob left = *job, right = *job;
+  struct RBTask task;
+  size_t i = 0, j = 0, k = 0, lo = 0, hi = 0;
+
+  if (job->workers == NULL || job->na + job->nb < PAR_MIN_KEYS) {
+    while (i < job->na && j < job->nb)
+      job->out[k++] = job->b[j].key < job->a[i].key ? job->b[j++] : job->a[i++];
+    memcpy(job->out + k, job->a + i, (job->na - i) * sizeof(struct ParEntry));
+    memcpy(job->out + k + job->na - i, job->b + j,
+      (job->nb - j) * sizeof(struct ParEntry));
+    return;
+  }
+
+  if (job->na >= job->nb) { // b is cut before the first key >= a[i].
+    i = job->na / 2;
+    for (lo = 0, hi = job->nb; lo < hi; )
+      if (job->b[(lo + hi) / 2].key < job->a[i].key)
+        lo = (lo + hi) / 2 + 1;
+      else
+        hi = (lo + hi) / 2;
+    j = lo;
+  } else { // a is cut before the first key > b[j].
+    j = job->nb / 2;
+    for (lo = 0, hi = job->na; lo < hi; )
+      if (job->a[(lo + hi) / 2].key <= job->b[j].key)
+        lo = (lo + hi) / 2 + 1;
+      else
+        hi = (lo + hi) / 2;
+    i = lo;
+  }
+
+  left.na  = i;
+  left.nb  = j;
+  right.a  = job->a + i;
+  right.na = job->na - i;
+  right.b  = job->b + j;
+  right.nb = job->nb - j;
+  right.out = job->out + i + j;
+
+  task_spawn(job->workers, &task, merge_task_, &left);
+  merge_job_(&right);
+  task_wait(job->workers, &task);
+}
+
+// Link a run of sorted entries, building the halves of a long run in parallel.
+static void build_job_(struct BuildJob *job) {
+
+  struct BuildJob left = *job, right = *job;
+  struct RBTreeNode *node = NULL;
+  struct RBTask task;
+  size_t mid = job->lo + (job->hi - job->lo) / 2;
+
+  if (job->workers == NULL || job->hi - job->lo < PAR_MIN_KEYS) {
+    job->root = build_(job->tree, job->block, job->entries, job->lo,
+      job->hi, job->depth, job->redDepth);
+    return;
+  }
+
+  node = sorted_node_(job->tree, job->block, mid, job->entries[mid].key,
+    job->entries[mid].data, job->depth == job->redDepth, job->hi - job->lo);
+  left.hi = mid;
+  left.depth++;
+  right.lo = mid + 1;
+  right.depth++;
+
+  task_spawn(job->workers, &task, build_task_, &left);
+  build_job_(&right);
+  task_wait(job->workers, &task);
+
+  sorted_link_(job->tree, node, left.root, right.root);
+  job->root = node;
+}
+
+// Task entry points for the recursions above.
+static void fold_task_(void *job) {
+  fold_job_(job);
+}
+
+static void sort_task_(void *job) {
+  sort_job_(job);
+}
+
+static void merge_task_(void *job) {
+  merge_job_(job);
+}
+
+static void build_task_(void *job) {
+  build_job_(job);
+}
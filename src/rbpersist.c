@@ -0,0 +1,658 @@
+#include "errors.h"
+#include "rbpersist.h"
+
+/*
+Copy-on-write. An update starts from an O(1) snapshot of the old version
+and, before it changes any node, replaces the node by a private copy in
+the new version (own_). The nodes copied so far are exactly the path from
+the root, so the fixups of insert and delete follow CLRS, but find parents
+on that path instead of through parent pointers, and copy the uncle,
+sibling or nephew they recolor or rotate. Rotations only ever move copies.
+
+Reference counts. The parent word of a persistent node holds its count,
+shifted past the color bit of the compact layout. A node is counted once
+for every version root and every node that points at it. The counts are
+changed atomically, since versions may be destroyed by other threads while
+an update runs; nodes only ever change while the update that made them
+holds the store lock and no other thread can reach them.
+
+Running out of memory. A copy that cannot be made leaves its link on the
+shared node, and every copy made so far is reachable from the new root
+with its counts intact, recolored or rotated as it may be. Dropping that
+root therefore releases exactly the copies and the references they took,
+and the old version is untouched.
+*/
+
+// Count of one reference, leaving bit 0 to the color.
+#define REF_ONE 2
+
+#ifdef RBTREE_COMPACT
+#define REFS(n)\
+  ((n)->pc)
+#define init_refs(n)\
+  ((n)->pc = REF_ONE | ((n)->pc & 1))
+#else
+#define REFS(n)\
+  ((n)->parent)
+#define init_refs(n)\
+  ((n)->parent = (struct RBTreeNode *)(uintptr_t)REF_ONE)
+#endif
+
+static struct RBTreeVersion* new_version(struct RBTreePersist *,
+  struct RBTreeNode *, size_t);
+static void incref(struct RBTreePersist *, struct RBTreeNode *);
+static void decref(struct RBTreePersist *, struct RBTreeNode *);
+static struct RBTreeNode* own_(struct RBTreePersist *, struct RBTreeNode **);
+static struct RBTreeNode** link_(struct RBTreeNode **, struct RBTreeNode **,
+  size_t);
+static void rotate_left_(struct RBTreeNode *, struct RBTreeNode **);
+static void rotate_right_(struct RBTreeNode *, struct RBTreeNode **);
+static bool persist_insert_fixup(struct RBTreePersist *, struct RBTreeNode **,
+  struct RBTreeNode **, size_t);
+static bool persist_delete_fixup(struct RBTreePersist *, struct RBTreeNode **,
+  struct RBTreeNode **, size_t, bool);
+static struct RBTreeVersion* abort_update(struct RBTreePersist *,
+  struct RBTreeNode *);
+static size_t scan_(struct RBTreeNode *, struct RBTreeNode *, int, int,
+  int (*)(struct RBTreeNode *, void *), void *, bool *);
+
+/**
+Function to construct a new node store for a persistent RBT.
+
+@param allocator Memory hooks for nodes and handles, or NULL for malloc/free.
+@return Pointer to the new store, or NULL if memory ran out.
+**/
+struct RBTreePersist* init_rbtree_persist(
+  const struct RBTreeAllocator *allocator) {
+
+  struct RBTreePool *pool =
+    init_rbtree_pool(allocator, sizeof(struct RBTreeNode));
+  struct RBTreePersist *store = NULL;
+
+  if (pool != NULL)
+    store = pool->allocator.alloc(pool->allocator.ctx,
+      sizeof(struct RBTreePersist));
+  if (store == NULL || (store->nil = init_rbtree_node(pool, NULL, NULL, NULL,
+      0, NULL, BLACK, true)) == NULL) {
+    if (store != NULL)
+      pool->allocator.release(pool->allocator.ctx, store,
+        sizeof(struct RBTreePersist));
+    if (pool != NULL)
+      dest_rbtree_pool(&pool);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  store->pool = pool;
+  pthread_mutex_init(&store->lock, NULL);
+
+  return store;
+}
+
+/**
+Function to destroy a node store. Once the store has been destroyed the
+reference is nullified.
+
+CAUTION: Every version of the store must have been destroyed.
+
+@param store Double pointer to the store to be destroyed.
+**/
+void dest_rbtree_persist(struct RBTreePersist **store) {
+
+  struct RBTreePool *pool = (*store)->pool;
+
+  pthread_mutex_destroy(&(*store)->lock);
+  pool->allocator.release(pool->allocator.ctx, *store,
+    sizeof(struct RBTreePersist));
+  dest_rbtree_pool(&pool);
+  *store = NULL;
+}
+
+/**
+The empty version of a store, the starting point for its first updates.
+
+@param store The node store.
+@return Pointer to a new handle on the empty version, or NULL if memory
+ran out.
+**/
+struct RBTreeVersion* persist_empty(struct RBTreePersist *store) {
+  return new_version(store, store->nil, 0);
+}
+
+/**
+Take a snapshot of a version. The snapshot is a handle of its own that
+stays valid after the original is destroyed. Runs in O(1).
+
+@param version The version.
+@return Pointer to a new handle on the same version, or NULL if memory
+ran out.
+**/
+struct RBTreeVersion* persist_snapshot(struct RBTreeVersion *version) {
+  incref(version->store, version->root);
+  return new_version(version->store, version->root, version->size);
+}
+
+/**
+Function to destroy a version handle. Nodes that no other version reaches
+are returned to the pool; the cost is proportional to their number. Once
+the handle has been destroyed the reference is nullified.
+
+NOTE: Satellite data is shared between versions, so it is never released
+here; it must outlive every version that holds it.
+
+@param version Double pointer to the version to be destroyed.
+**/
+void dest_rbtree_version(struct RBTreeVersion **version) {
+
+  struct RBTreePersist *store = (*version)->store;
+
+  pthread_mutex_lock(&store->lock);
+  decref(store, (*version)->root);
+  pthread_mutex_unlock(&store->lock);
+
+  store->pool->allocator.release(store->pool->allocator.ctx, *version,
+    sizeof(struct RBTreeVersion));
+  *version = NULL;
+}
+
+/**
+Persistent insertion. Copies the path to the new leaf, links the leaf and
+fixes the copies as insert_fixup would. The old version is left intact.
+Equal keys go to the right, as in insert. Runs in O(lg n).
+
+@param version The version to insert into.
+@param key Key of the new node.
+@param data Satellite data of the new node.
+@return Pointer to a new handle on the updated version, or NULL if memory
+ran out, in which case nothing has changed.
+**/
+struct RBTreeVersion* persist_insert(struct RBTreeVersion *version, int key,
+  void *data) {
+
+  struct RBTreePersist *store = version->store;
+  struct RBTreeNode *nil = store->nil;
+  struct RBTreeNode *path[PERSIST_MAX_DEPTH];
+  struct RBTreeNode *root = version->root;
+  struct RBTreeNode **link = &root;
+  size_t depth = 0;
+
+  pthread_mutex_lock(&store->lock);
+
+  incref(store, root);
+  while (*link != nil) {
+    if ((path[depth] = own_(store, link)) == NULL)
+      return abort_update(store, root);
+    link = key < path[depth]->key ? &path[depth]->left : &path[depth]->right;
+    depth++;
+  }
+
+  *link = init_rbtree_node(store->pool, NULL, nil, nil, key, data, RED, false);
+  if (*link == NULL) {
+    *link = nil;
+    return abort_update(store, root);
+  }
+  init_refs(*link);
+  path[depth] = *link;
+
+  if (!persist_insert_fixup(store, &root, path, depth))
+    return abort_update(store, root);
+
+  pthread_mutex_unlock(&store->lock);
+
+  return new_version(store, root, version->size + 1);
+}
+
+/**
+Copy-on-write counterpart of insert_fixup. path[0..depth] are the copies
+from the root to the new node; the uncle is copied before it is recolored.
+
+@param store The node store.
+@param root Root link of the new version.
+@param path Copied path, ending at the new node.
+@param depth Index of the new node in path.
+@return False if memory ran out for a copy of the uncle.
+**/
+static bool persist_insert_fixup(struct RBTreePersist *store,
+  struct RBTreeNode **root, struct RBTreeNode **path, size_t depth) {
+
+  struct RBTreeNode *parent = NULL;
+  struct RBTreeNode *grand = NULL;
+  struct RBTreeNode *uncle = NULL;
+
+  while (depth > 1 && node_color(path[depth - 1]) == RED) {
+    parent = path[depth - 1];
+    grand = path[depth - 2];
+
+    if (parent == grand->left) {
+      if (node_color(grand->right) == RED) {
+        if ((uncle = own_(store, &grand->right)) == NULL)
+          return false;
+        set_color(parent, BLACK);
+        set_color(uncle, BLACK);
+        set_color(grand, RED);
+        depth -= 2;
+      } else {
+        if (path[depth] == parent->right) {
+          rotate_left_(parent, &grand->left);
+          parent = path[depth];
+        }
+        set_color(parent, BLACK);
+        set_color(grand, RED);
+        rotate_right_(grand, link_(root, path, depth - 2));
+        break;
+      }
+    } else {
+      if (node_color(grand->left) == RED) {
+        if ((uncle = own_(store, &grand->left)) == NULL)
+          return false;
+        set_color(parent, BLACK);
+        set_color(uncle, BLACK);
+        set_color(grand, RED);
+        depth -= 2;
+      } else {
+        if (path[depth] == parent->left) {
+          rotate_right_(parent, &grand->right);
+          parent = path[depth];
+        }
+        set_color(parent, BLACK);
+        set_color(grand, RED);
+        rotate_left_(grand, link_(root, path, depth - 2));
+        break;
+      }
+    }
+  }
+
+  // The root is a copy, or the new node itself.
+  set_color(*root, BLACK);
+  return true;
+}
+
+/**
+Persistent deletion. Copies the path to the node with the given key, and
+on to its successor if it has two children; the successor's key and data
+then move into the copy of the deleted node, which is safe since only the
+new version reaches that copy. The node left with at most one child is
+unlinked and the copies are fixed as delete_fixup would. The old version
+is left intact. Runs in O(lg n).
+
+@param version The version to delete from.
+@param key Key of the node to delete.
+@param data Receives the data of the deleted node, or NULL if the key is
+not in the version. May itself be NULL.
+@return Pointer to a new handle on the updated version, which is a
+snapshot of the old one if the key is not in it, or NULL if memory ran
+out, in which case nothing has changed.
+**/
+struct RBTreeVersion* persist_delete(struct RBTreeVersion *version, int key,
+  void **data) {
+
+  struct RBTreePersist *store = version->store;
+  struct RBTreeNode *nil = store->nil;
+  struct RBTreeNode *path[PERSIST_MAX_DEPTH];
+  struct RBTreeNode *root = version->root;
+  struct RBTreeNode **link = &root;
+  struct RBTreeNode *target = NULL;
+  struct RBTreeNode *gone = NULL;
+  struct RBTreeNode *child = NULL;
+  void *found = NULL;
+  size_t depth = 0;
+  bool left = false;
+
+  if (data != NULL)
+    *data = NULL;
+  if (persist_search(version, key) == NULL)
+    return persist_snapshot(version);
+
+  pthread_mutex_lock(&store->lock);
+
+  incref(store, root);
+  for (;;) {
+    if ((path[depth] = own_(store, link)) == NULL)
+      return abort_update(store, root);
+    if (path[depth]->key == key)
+      break;
+    link = key < path[depth]->key ? &path[depth]->left : &path[depth]->right;
+    depth++;
+  }
+
+  target = path[depth];
+  found = target->data;
+
+  // Two children: continue to the successor and take its place.
+  if (target->left != nil && target->right != nil) {
+    link = &target->right;
+    depth++;
+    if ((path[depth] = own_(store, link)) == NULL)
+      return abort_update(store, root);
+    while (path[depth]->left != nil) {
+      link = &path[depth]->left;
+      depth++;
+      if ((path[depth] = own_(store, link)) == NULL)
+        return abort_update(store, root);
+    }
+    target->key  = path[depth]->key;
+    target->data = path[depth]->data;
+  }
+
+  // Unlink the copy; its reference to the child passes on to the link.
+  gone = path[depth];
+  child = gone->left != nil ? gone->left : gone->right;
+  left = depth > 0 && path[depth - 1]->left == gone;
+  *link = child;
+
+  if (node_color(gone) == BLACK &&
+      !persist_delete_fixup(store, &root, path, depth, left)) {
+    gone->data = NULL;
+    free_rbtree_node(store->pool, &gone);
+    return abort_update(store, root);
+  }
+
+  gone->data = NULL;
+  free_rbtree_node(store->pool, &gone);
+
+  pthread_mutex_unlock(&store->lock);
+
+  version = new_version(store, root, version->size - 1);
+  if (version != NULL && data != NULL)
+    *data = found;
+
+  return version;
+}
+
+/**
+Copy-on-write counterpart of delete_fixup. The extra black sits at
+position depth below path[depth - 1], on the given side; since it may be
+the sentinel, the side cannot be found by comparing pointers. The sibling
+and nephews are copied before they are recolored or rotated.
+
+@param store The node store.
+@param root Root link of the new version.
+@param path Copied path; path[0..depth-1] are the ancestors of the extra black.
+@param depth Depth of the extra black.
+@param left Whether the extra black is a left child.
+@return False if memory ran out for a copy.
+**/
+static bool persist_delete_fixup(struct RBTreePersist *store,
+  struct RBTreeNode **root, struct RBTreeNode **path, size_t depth,
+  bool left) {
+
+  struct RBTreeNode *parent = NULL;
+  struct RBTreeNode *sibling = NULL;
+  struct RBTreeNode **link = NULL;
+
+  for (;;) {
+    link = depth == 0 ? root
+      : left ? &path[depth - 1]->left : &path[depth - 1]->right;
+    if (depth == 0 || node_color(*link) == RED)
+      break;
+
+    parent = path[depth - 1];
+
+    if (left) {
+      if ((sibling = own_(store, &parent->right)) == NULL)
+        return false;
+      if (node_color(sibling) == RED) {
+        set_color(sibling, BLACK);
+        set_color(parent, RED);
+        rotate_left_(parent, link_(root, path, depth - 1));
+        path[depth - 1] = sibling;
+        path[depth] = parent;
+        depth++;
+        if ((sibling = own_(store, &parent->right)) == NULL)
+          return false;
+      }
+      if (node_color(sibling->left) == BLACK &&
+          node_color(sibling->right) == BLACK) {
+        set_color(sibling, RED);
+        depth--;
+        left = depth > 0 && path[depth - 1]->left == parent;
+      } else {
+        if (node_color(sibling->right) == BLACK) {
+          if (own_(store, &sibling->left) == NULL)
+            return false;
+          set_color(sibling->left, BLACK);
+          set_color(sibling, RED);
+          rotate_right_(sibling, &parent->right);
+          sibling = parent->right;  // Its right child is the old sibling's copy.
+        } else if (own_(store, &sibling->right) == NULL) {
+          return false;
+        }
+        set_color(sibling, node_color(parent));
+        set_color(parent, BLACK);
+        set_color(sibling->right, BLACK);
+        rotate_left_(parent, link_(root, path, depth - 1));
+        return true;
+      }
+    } else {
+      if ((sibling = own_(store, &parent->left)) == NULL)
+        return false;
+      if (node_color(sibling) == RED) {
+        set_color(sibling, BLACK);
+        set_color(parent, RED);
+        rotate_right_(parent, link_(root, path, depth - 1));
+        path[depth - 1] = sibling;
+        path[depth] = parent;
+        depth++;
+        if ((sibling = own_(store, &parent->left)) == NULL)
+          return false;
+      }
+      if (node_color(sibling->right) == BLACK &&
+          node_color(sibling->left) == BLACK) {
+        set_color(sibling, RED);
+        depth--;
+        left = depth > 0 && path[depth - 1]->left == parent;
+      } else {
+        if (node_color(sibling->left) == BLACK) {
+          if (own_(store, &sibling->right) == NULL)
+            return false;
+          set_color(sibling->right, BLACK);
+          set_color(sibling, RED);
+          rotate_left_(sibling, &parent->left);
+          sibling = parent->left;  // Its left child is the old sibling's copy.
+        } else if (own_(store, &sibling->left) == NULL) {
+          return false;
+        }
+        set_color(sibling, node_color(parent));
+        set_color(parent, BLACK);
+        set_color(sibling->left, BLACK);
+        rotate_right_(parent, link_(root, path, depth - 1));
+        return true;
+      }
+    }
+  }
+
+  // A red node absorbs the extra black; nodes above depth 0 are copies
+  // already, a child moved up from the old version is not.
+  if (*link != store->nil && node_color(*link) == RED) {
+    if ((depth == 0 || *link != path[depth]) && own_(store, link) == NULL)
+      return false;
+    set_color(*link, BLACK);
+  }
+  return true;
+}
+
+/**
+Search a version for a given key. Versions never change, so this needs
+no lock and may run alongside updates and other searches.
+
+@param version The version.
+@param key Key to look for.
+@return The node with the key, or null if there is none.
+**/
+struct RBTreeNode* persist_search(struct RBTreeVersion *version, int key) {
+
+  struct RBTreeNode *nil = version->store->nil;
+  struct RBTreeNode *walk = version->root;
+
+  while (walk != nil && walk->key != key)
+    walk = key < walk->key ? walk->left : walk->right;
+
+  return walk != nil ? walk : NULL;
+}
+
+/**
+Number of nodes in a version.
+
+@param version The version.
+@return Number of nodes.
+**/
+size_t version_size(struct RBTreeVersion *version) {
+  return version->size;
+}
+
+/**
+Range query over a version, as range_scan. Calls visit on every node with
+lo <= key < hi, in order, and stops early when visit returns non-zero.
+Like persist_search it needs no lock, so a long scan of a snapshot can run
+while updates go on. Runs in O(lg n + k) for k visited nodes.
+
+@param version The version to scan.
+@param lo Inclusive lower bound of the range.
+@param hi Exclusive upper bound of the range.
+@param visit Callback receiving each node and ctx.
+@param ctx User pointer passed through to visit.
+@return Number of nodes visited.
+**/
+size_t persist_scan(struct RBTreeVersion *version, int lo, int hi,
+  int (*visit)(struct RBTreeNode *, void *), void *ctx) {
+
+  bool stop = false;
+
+  return scan_(version->store->nil, version->root, lo, hi, visit, ctx, &stop);
+}
+
+/* Recursive helper for persist_scan; depth is bounded by the height. */
+static size_t scan_(struct RBTreeNode *nil, struct RBTreeNode *node, int lo,
+  int hi, int (*visit)(struct RBTreeNode *, void *), void *ctx, bool *stop) {
+
+  size_t count = 0;
+
+  if (node == nil)
+    return 0;
+
+  if (lo <= node->key)
+    count += scan_(nil, node->left, lo, hi, visit, ctx, stop);
+  if (*stop || node->key >= hi)
+    return count;
+  if (lo <= node->key) {
+    count++;
+    if (visit(node, ctx) != 0) {
+      *stop = true;
+      return count;
+    }
+  }
+  return count + scan_(nil, node->right, lo, hi, visit, ctx, stop);
+}
+
+/*
+Allocate a handle on a version whose root reference has been taken. If
+memory runs out the reference is dropped again and NULL returned.
+*/
+static struct RBTreeVersion* new_version(struct RBTreePersist *store,
+  struct RBTreeNode *root, size_t size) {
+
+  struct RBTreeVersion *version = store->pool->allocator.alloc(
+    store->pool->allocator.ctx, sizeof(struct RBTreeVersion));
+
+  if (version == NULL) {
+    pthread_mutex_lock(&store->lock);
+    return abort_update(store, root);
+  }
+
+  version->store = store;
+  version->root  = root;
+  version->size  = size;
+
+  return version;
+}
+
+/*
+Give up an update that ran out of memory: drop the new root, which
+releases every copy made so far, then unlock the store. Returns NULL.
+*/
+static struct RBTreeVersion* abort_update(struct RBTreePersist *store,
+  struct RBTreeNode *root) {
+
+  decref(store, root);
+  pthread_mutex_unlock(&store->lock);
+  report_error(ENOMEM, MEM_ERROR);
+  return NULL;
+}
+
+/* Take a reference to a node. */
+static void incref(struct RBTreePersist *store, struct RBTreeNode *node) {
+  if (node != store->nil)
+    __atomic_add_fetch(&REFS(node), REF_ONE, __ATOMIC_RELAXED);
+}
+
+/*
+Drop a reference to a node, releasing it and dropping its references to
+its children when it was the last. Caller holds the store lock.
+*/
+static void decref(struct RBTreePersist *store, struct RBTreeNode *node) {
+
+  struct RBTreeNode *right = NULL;
+
+  while (node != store->nil &&
+      (uintptr_t)__atomic_sub_fetch(&REFS(node), REF_ONE,
+        __ATOMIC_ACQ_REL) < REF_ONE) {
+    right = node->right;
+    decref(store, node->left);
+    node->data = NULL;
+    free_rbtree_node(store->pool, &node);
+    node = right;
+  }
+}
+
+/*
+Replace the node at a link of a copy by a copy of its own, so that it may
+be changed. The old node keeps its other references, so it is not freed.
+Returns the copy, or NULL if memory ran out, leaving the link as it was.
+*/
+static struct RBTreeNode* own_(struct RBTreePersist *store,
+  struct RBTreeNode **link) {
+
+  struct RBTreeNode *old = *link;
+  struct RBTreeNode *copy = init_rbtree_node(store->pool, NULL, old->left,
+    old->right, old->key, old->data, node_color(old), false);
+
+  if (copy == NULL)
+    return NULL;
+  init_refs(copy);
+  incref(store, old->left);
+  incref(store, old->right);
+  decref(store, old);
+  *link = copy;
+
+  return copy;
+}
+
+/* Link to path[depth]: the root link, or a child field of path[depth - 1]. */
+static struct RBTreeNode** link_(struct RBTreeNode **root,
+  struct RBTreeNode **path, size_t depth) {
+
+  if (depth == 0)
+    return root;
+  return path[depth - 1]->left == path[depth]
+    ? &path[depth - 1]->left : &path[depth - 1]->right;
+}
+
+/* Left-rotate a copy whose right child is a copy, updating its link. */
+static void rotate_left_(struct RBTreeNode *node, struct RBTreeNode **link) {
+
+  struct RBTreeNode *r = node->right;
+
+  node->right = r->left;
+  r->left = node;
+  *link = r;
+}
+
+/* Right-rotate a copy whose left child is a copy, updating its link. */
+static void rotate_right_(struct RBTreeNode *node, struct RBTreeNode **link) {
+
+  struct RBTreeNode *l = node->left;
+
+  node->left = l->right;
+  l->right = node;
+  *link = l;
+}
@@ -0,0 +1,203 @@
+#include "errors.h"
+#include "rbpool.h"
+#include<stdlib.h>
+
+#define MIN(a, b)\
+  (a < b ? a : b)
+
+// Bump an allocation counter (build with RBTREE_STATS).
+#ifdef RBTREE_STATS
+#define POOL_STAT(pool, counter, n)\
+  ((pool)->counter += (n))
+#else
+#define POOL_STAT(pool, counter, n)\
+  ((void)0)
+#endif
+
+// Slab header size, rounded so the first node is suitably aligned.
+#define SLAB_HEADER\
+  ((sizeof(struct RBTreeSlab) + sizeof(long double) - 1)\
+    / sizeof(long double) * sizeof(long double))
+
+static void* default_alloc(void *ctx, size_t size) {
+  (void)ctx;
+  return malloc(size);
+}
+
+static void default_release(void *ctx, void *ptr, size_t size) {
+  (void)ctx;
+  (void)size;
+  free(ptr);
+}
+
+/**
+Function to construct a new node pool. Nodes are carved out of slabs
+obtained from the allocator hooks, starting at POOL_MIN_SLAB nodes per slab
+and doubling up to POOL_MAX_SLAB. Freed nodes go on a free list and are
+handed out again before any new slab is requested.
+
+The pool functions report no errors of their own: when the allocator hooks
+fail they set errno to ENOMEM and return NULL, and the caller decides what
+that means.
+
+@param allocator User memory hooks, or NULL for malloc/free.
+@param nodeSize Size in bytes of every node handed out by the pool.
+@return Pointer to the new pool, or NULL if it could not be allocated.
+**/
+struct RBTreePool* init_rbtree_pool(const struct RBTreeAllocator *allocator,
+  size_t nodeSize) {
+
+  struct RBTreeAllocator hooks = { default_alloc, default_release, NULL };
+  struct RBTreePool *pool = NULL;
+
+  if (allocator != NULL)
+    hooks = *allocator;
+
+  if ((pool = hooks.alloc(hooks.ctx, sizeof(struct RBTreePool))) == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  // Free nodes store the free list link in their first word.
+  if (nodeSize < sizeof(void *))
+    nodeSize = sizeof(void *);
+  nodeSize = (nodeSize + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+
+  pool->allocator    = hooks;
+  pool->slabs        = NULL;
+  pool->freeList     = NULL;
+  pool->bump         = NULL;
+  pool->bumpEnd      = NULL;
+  pool->nodeSize     = nodeSize;
+  pool->nextCapacity = POOL_MIN_SLAB;
+  pool->refs         = 1;
+#ifdef RBTREE_STATS
+  pool->nodeAllocs   = 0;
+  pool->nodeFrees    = 0;
+  pool->slabAllocs   = 0;
+#endif
+
+  return pool;
+}
+
+/**
+Function to destroy a pool along with every node it ever handed out.
+The cost is O(#slabs), no matter how many nodes are still in use. Once
+the pool has been destroyed the reference is nullified.
+
+CAUTION: Any satellite data still referenced by live nodes must
+be handled by the caller first.
+
+@param pool Double pointer to the pool to be destroyed.
+**/
+void dest_rbtree_pool(struct RBTreePool **pool) {
+
+  struct RBTreeAllocator hooks = (*pool)->allocator;
+  struct RBTreeSlab *slab = (*pool)->slabs;
+  struct RBTreeSlab *next = NULL;
+
+  while (slab != NULL) {
+    next = slab->next;
+    hooks.release(hooks.ctx, slab,
+      SLAB_HEADER + slab->capacity * (*pool)->nodeSize);
+    slab = next;
+  }
+
+  hooks.release(hooks.ctx, *pool, sizeof(struct RBTreePool));
+  *pool = NULL;
+}
+
+/**
+Take one node from the pool. Recycled nodes are preferred, then the unused
+tail of the newest slab. A new slab is only requested when both are empty.
+
+@param pool Pool to allocate from.
+@return Pointer to uninitialized memory of pool->nodeSize bytes, or NULL if
+a new slab was needed and could not be allocated.
+**/
+void* pool_alloc_node(struct RBTreePool *pool) {
+
+  void *node = NULL;
+  struct RBTreeSlab *slab = NULL;
+  size_t capacity = 0;
+
+  if (pool->freeList != NULL) { // Recycle first.
+    POOL_STAT(pool, nodeAllocs, 1);
+    node = pool->freeList;
+    pool->freeList = *(void **)node;
+    return node;
+  }
+
+  if (pool->bump == pool->bumpEnd) { // Newest slab is exhausted.
+    capacity = pool->nextCapacity;
+    slab = pool->allocator.alloc(pool->allocator.ctx,
+      SLAB_HEADER + capacity * pool->nodeSize);
+    if (slab == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    POOL_STAT(pool, slabAllocs, 1);
+
+    slab->next     = pool->slabs;
+    slab->capacity = capacity;
+    pool->slabs    = slab;
+    pool->bump     = (char *)slab + SLAB_HEADER;
+    pool->bumpEnd  = pool->bump + capacity * pool->nodeSize;
+    pool->nextCapacity = MIN(2 * capacity, POOL_MAX_SLAB);
+  }
+
+  POOL_STAT(pool, nodeAllocs, 1);
+  node = pool->bump;
+  pool->bump += pool->nodeSize;
+  return node;
+}
+
+/**
+Take n nodes of contiguous memory from the pool. The block is obtained as a
+slab of its own, so node i of the block lives at block + i * nodeSize, and
+it is released with the rest of the pool. Any node of the block may later
+be given back with pool_free_node.
+
+@param pool Pool to allocate from.
+@param n Number of nodes in the block, at least one.
+@return Pointer to the first node of the block, or NULL.
+**/
+void* pool_alloc_block(struct RBTreePool *pool, size_t n) {
+
+  struct RBTreeSlab *slab = pool->allocator.alloc(pool->allocator.ctx,
+    SLAB_HEADER + n * pool->nodeSize);
+
+  if (slab == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  POOL_STAT(pool, slabAllocs, 1);
+  POOL_STAT(pool, nodeAllocs, n);
+
+  // Link behind the newest slab so the bump region stays where it is.
+  slab->capacity = n;
+  if (pool->slabs == NULL) {
+    slab->next = NULL;
+    pool->slabs = slab;
+  } else {
+    slab->next = pool->slabs->next;
+    pool->slabs->next = slab;
+  }
+
+  return (char *)slab + SLAB_HEADER;
+}
+
+/**
+Return a node to the pool. The memory is not given back to the allocator
+until the pool itself is destroyed; it is reused by later allocations.
+
+@param pool Pool that the node was allocated from.
+@param node Node to be recycled.
+**/
+void pool_free_node(struct RBTreePool *pool, void *node) {
+  if (node != NULL) {
+    POOL_STAT(pool, nodeFrees, 1);
+    *(void **)node = pool->freeList;
+    pool->freeList = node;
+  }
+}
@@ -0,0 +1,89 @@
+#include "errors.h"
+#include "rbpq.h"
+
+/**
+Add a key to the queue. This is insert: equal keys go after the ones
+already queued, which is what makes the queue FIFO among them.
+
+@param tree The queue.
+@param key Priority; smaller keys come out first.
+@param data Satellite data of the key.
+@return The new node, a handle for pq_decrease_key and pq_cancel, or NULL
+if memory ran out.
+**/
+struct RBTreeNode* pq_push(struct RBTree *tree, int key, void *data) {
+  return insert(tree, key, data);
+}
+
+/**
+Remove the node with the minimum key. It is the cached leftmost node, and
+delete_node finds the next minimum from it in O(1): the right child, or
+its only child, or else the parent. With the O(1) amortized rebalancing of
+delete_fixup, popping is O(1) amortized. The node goes back to the pool.
+
+@param tree The queue.
+@param key Receives the minimum key. May be NULL.
+@param data Receives the data of the key. May be NULL.
+@return false if the queue was empty.
+**/
+bool pq_pop(struct RBTree *tree, int *key, void **data) {
+
+  struct RBTreeNode *node = tree->leftmost;
+  void *value = NULL;
+
+  if (node == tree->nil)
+    return false;
+
+  if (key != NULL)
+    *key = node->key;
+  value = erase_node(tree, node);
+  if (data != NULL)
+    *data = value;
+
+  return true;
+}
+
+/**
+Lower the key of a queued node with rekey_node. If the node still sorts
+after its predecessor the key is changed in place; otherwise the node is
+deleted and linked back in under the new key, without allocating. Either
+way the handle stays valid, and a lowered node comes out after the nodes
+already queued with its new key. Runs in O(lg n).
+
+@param tree The queue.
+@param node A node in the queue.
+@param key New key, not larger than the node's.
+@return false (errno EINVAL) if the key is larger than the node's.
+**/
+bool pq_decrease_key(struct RBTree *tree, struct RBTreeNode *node, int key) {
+
+  if (key > node->key) {
+    report_error(EINVAL, NOT_DECREASE);
+    return false;
+  }
+
+  return rekey_node(tree, node, key);
+}
+
+/**
+Remove a node from the queue before it is popped. The node goes back to
+the pool and the handle must not be used again.
+
+@param tree The queue.
+@param node A node in the queue.
+@return Data of the node.
+**/
+void* pq_cancel(struct RBTree *tree, struct RBTreeNode *node) {
+  return erase_node(tree, node);
+}
+
+/**
+The node with the minimum key, which pq_pop would remove next. The tree
+caches it, so this is O(1).
+
+@param tree The queue.
+@return The node, or NULL if the queue is empty.
+**/
+struct RBTreeNode* pq_peek(struct RBTree *tree) {
+  return minimum(tree);
+}
@@ -0,0 +1,677 @@
+#include "errors.h"
+#include "rbshard.h"
+#include<limits.h>
+#include<sched.h>
+#include<stdlib.h>
+
+/*
+Locking. The directory is read without a lock. An operation counts itself
+in its thread's reader slot (enter_), loads the current directory, finds
+the shard of its key and locks the shard's mutex. A resize may have
+changed that shard in between, so the operation checks that the shard is
+alive and still holds the key, and otherwise looks again in the directory,
+which the resize has replaced by then. Operations on different shards
+share no lock, only the slot counters, which threads spread over.
+
+Resizes are serialized by resizeLock. A resize locks the shards it
+changes, rebuilds them, publishes a new directory with one atomic store
+and unlocks them. The old directory, and a shard merged away, may still be
+in use by operations that loaded the old directory, so the resize waits
+for those to leave (synchronize_) before freeing them. It flips phase
+twice and each time waits for the counters of the phase before to drain.
+Operations that enter after a flip count themselves in the other counter,
+so a steady stream of them cannot hold a resize off for ever.
+
+An operation that leaves its shard too large or too small only notes it;
+the resize runs after the operation has left the map.
+*/
+
+/* State of a shard_range_scan, threaded through range_scan. */
+struct ScanState {
+
+  int (*visit)(struct RBTreeNode *, void *); /* The caller's callback. */
+  void *ctx;                                 /* The caller's pointer.  */
+  bool stop;                                 /* visit asked to stop.   */
+
+};
+
+// Reader slot of the calling thread, handed out in turn on first use.
+static __thread size_t ownSlot = SHARD_SLOTS;
+static size_t slotsTaken = 0;
+
+static size_t* enter_(struct RBShardMap *);
+static void leave_(size_t *);
+static struct RBShard* lock_shard_(struct RBShardMap *, int);
+static size_t find_(const struct RBShardDir *, int);
+static struct RBShardDir* alloc_dir_(size_t);
+static struct RBShardDir* new_dir_(const struct RBShardDir *, size_t,
+  struct RBShard *);
+static struct RBShard* new_shard_(struct RBShardMap *, int, int,
+  struct RBTree *);
+static void free_shard_(struct RBShard *);
+static void resize_(struct RBShardMap *, int);
+static struct RBShardDir* split_(struct RBShardMap *, struct RBShardDir *,
+  size_t);
+static struct RBShardDir* merge_(struct RBShardMap *, struct RBShardDir *,
+  size_t);
+static struct RBShardDir* drop_(struct RBShardDir *, size_t);
+static void synchronize_(struct RBShardMap *);
+static size_t collect_(struct RBTree *, int *, void **);
+static int scan_visit_(struct RBTreeNode *, void *);
+
+/**
+Function to construct a new, empty sharded map. It starts with one shard
+for all keys and is split as it grows.
+
+@param maxKeys Size limit of a shard, or 0 for SHARD_MAX_KEYS.
+@param allocator Memory hooks for the shards' trees, or NULL for
+malloc/free. The hooks are copied.
+@return Pointer to the new map, or NULL if memory ran out.
+**/
+struct RBShardMap* init_rbshard_map(size_t maxKeys,
+  const struct RBTreeAllocator *allocator) {
+
+  struct RBShardMap *map = NULL;
+  struct RBTree *tree = NULL;
+  size_t i = 0;
+
+  if ((map = aligned_alloc(64, sizeof(struct RBShardMap))) == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  map->maxKeys   = maxKeys > 0 ? maxKeys : SHARD_MAX_KEYS;
+  map->allocator = NULL;
+  if (allocator != NULL) {
+    map->hooks     = *allocator;
+    map->allocator = &map->hooks;
+  }
+  map->phase = 0;
+  for (i = 0; i < SHARD_SLOTS; i++)
+    map->slots[i].readers[0] = map->slots[i].readers[1] = 0;
+
+  if ((map->dir = alloc_dir_(1)) == NULL) {
+    free(map);
+    return NULL;
+  }
+  if ((tree = init_rbtree_alloc(map->allocator)) == NULL) {
+    free(map->dir);
+    free(map);
+    return NULL;
+  }
+  if ((map->dir->shards[0] = new_shard_(map, INT_MIN, INT_MAX, tree)) == NULL) {
+    dest_rbtree(&tree);
+    free(map->dir);
+    free(map);
+    return NULL;
+  }
+  map->dir->lows[0] = INT_MIN;
+  pthread_mutex_init(&map->resizeLock, NULL);
+
+  return map;
+}
+
+/**
+Function to destroy a sharded map and all of its shards. Once the map has
+been destroyed the reference is nullified.
+
+CAUTION: No other thread may be using the map, and the data of the keys
+must be handled by the caller, as for dest_rbtree.
+
+@param map Double pointer to the map to be destroyed.
+**/
+void dest_rbshard_map(struct RBShardMap **map) {
+
+  size_t i = 0;
+
+  for (i = 0; i < (*map)->dir->count; i++)
+    free_shard_((*map)->dir->shards[i]);
+  free((*map)->dir);
+  pthread_mutex_destroy(&(*map)->resizeLock);
+  free(*map);
+  *map = NULL;
+}
+
+/**
+Insertion function. Only the shard whose range holds the key is locked.
+If the shard has outgrown its limit it is split afterwards.
+
+@param map The sharded map.
+@param key Key to insert. Equal keys are kept, as in insert.
+@param data Satellite data of the key.
+@return true, or false if memory ran out; the map is unchanged then.
+**/
+bool shard_insert(struct RBShardMap *map, int key, void *data) {
+
+  size_t *section = enter_(map);
+  struct RBShard *shard = lock_shard_(map, key);
+  bool inserted = false, large = false;
+
+  inserted = insert(shard->tree, key, data) != NULL;
+  large = tree_size(shard->tree) > shard->limit;
+  pthread_mutex_unlock(&shard->lock);
+  leave_(section);
+
+  if (large)
+    resize_(map, key);
+
+  return inserted;
+}
+
+/**
+Search and delete function. Only the shard whose range holds the key is
+locked. If the shard has become small it may be merged afterwards.
+
+@param map The sharded map.
+@param key Key to delete.
+@param data Receives the data of the deleted node, if any. May be NULL.
+@return Was a node with the key found and deleted?
+**/
+bool shard_search_and_delete(struct RBShardMap *map, int key, void **data) {
+
+  size_t *section = enter_(map);
+  struct RBShard *shard = lock_shard_(map, key);
+  struct RBTreeNode *node = NULL;
+  void *value = NULL;
+  bool small = false;
+
+  if ((node = search(shard->tree, key)) != NULL) {
+    value = delete_node(shard->tree, node);
+    small = (shard->low != INT_MIN || shard->high != INT_MAX) && // Not alone.
+      (tree_size(shard->tree) < shard->floor || tree_size(shard->tree) == 0);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  leave_(section);
+
+  if (small)
+    resize_(map, key);
+  if (node != NULL && data != NULL)
+    *data = value;
+
+  return node != NULL;
+}
+
+/**
+Search the map for a key under the lock of its shard.
+
+@param map The sharded map.
+@param key Key to search for.
+@param data Receives the data of the node found, if any. May be NULL.
+@return Was a node with the key found?
+**/
+bool shard_search(struct RBShardMap *map, int key, void **data) {
+
+  size_t *section = enter_(map);
+  struct RBShard *shard = lock_shard_(map, key);
+  struct RBTreeNode *node = NULL;
+
+  if ((node = search(shard->tree, key)) != NULL && data != NULL)
+    *data = node->data;
+  pthread_mutex_unlock(&shard->lock);
+  leave_(section);
+
+  return node != NULL;
+}
+
+/**
+Range query across shards. Calls visit on every node with lo <= key < hi,
+in order, one shard at a time and under that shard's lock. Each shard is
+seen at one instant, but writers may change the shards that are not being
+visited, so the scan as a whole is not a snapshot. The scan stops early
+when visit returns non-zero. Runs in O(s lg n + k) for s shards in range.
+
+NOTE: visit must not call back into the map, which would deadlock.
+
+@param map The sharded map.
+@param lo Inclusive lower bound of the range.
+@param hi Exclusive upper bound of the range.
+@param visit Callback receiving each node and ctx.
+@param ctx User pointer passed through to visit.
+@return Number of nodes visited.
+**/
+size_t shard_range_scan(struct RBShardMap *map, int lo, int hi,
+  int (*visit)(struct RBTreeNode *, void *), void *ctx) {
+
+  struct ScanState state = { visit, ctx, false };
+  struct RBShard *shard = NULL;
+  size_t *section = NULL, count = 0;
+  int key = lo, high = 0;
+
+  if (lo >= hi)
+    return 0;
+
+  // Shard by shard, each picked by the first key after the last one and
+  // scanned from there on. A shard merged meanwhile may also hold keys
+  // already visited; no range is skipped or repeated.
+  section = enter_(map);
+  for (;;) {
+    shard = lock_shard_(map, key);
+    count += range_scan(shard->tree, key, hi, scan_visit_, &state);
+    high = shard->high;
+    pthread_mutex_unlock(&shard->lock);
+    if (state.stop || high >= hi - 1)
+      break;
+    key = high + 1;
+  }
+  leave_(section);
+
+  return count;
+}
+
+/**
+Number of keys in the map: the sum of the shard sizes, each taken under
+its shard's lock. Like a range scan, it is not a snapshot.
+
+@param map The sharded map.
+@return Number of keys.
+**/
+size_t shard_size(struct RBShardMap *map) {
+
+  size_t *section = enter_(map);
+  struct RBShard *shard = NULL;
+  struct RBTreeNode *node = NULL;
+  struct RBTreeIter iter;
+  size_t size = 0;
+  int key = INT_MIN, high = 0;
+
+  for (;;) {
+    shard = lock_shard_(map, key);
+    if (shard->low == key)
+      size += tree_size(shard->tree);
+    else // Merged with shards already counted: count only from key on.
+      for (node = iter_lower_bound(shard->tree, &iter, key); node != NULL;
+          node = iter_next(&iter))
+        size++;
+    high = shard->high;
+    pthread_mutex_unlock(&shard->lock);
+    if (high == INT_MAX)
+      break;
+    key = high + 1;
+  }
+  leave_(section);
+
+  return size;
+}
+
+/**
+Number of shards the map is currently cut into.
+
+@param map The sharded map.
+@return Number of shards.
+**/
+size_t shard_count(struct RBShardMap *map) {
+
+  size_t *section = enter_(map);
+  size_t count = __atomic_load_n(&map->dir, __ATOMIC_SEQ_CST)->count;
+
+  leave_(section);
+
+  return count;
+}
+
+/*
+Count the caller in its slot for the current phase, until leave_ with the
+counter returned. Every load of the directory must come after this one.
+*/
+static size_t* enter_(struct RBShardMap *map) {
+
+  size_t *counter = NULL;
+
+  if (ownSlot == SHARD_SLOTS)
+    ownSlot = __atomic_fetch_add(&slotsTaken, 1, __ATOMIC_RELAXED) % SHARD_SLOTS;
+  counter = &map->slots[ownSlot].readers[
+    __atomic_load_n(&map->phase, __ATOMIC_SEQ_CST) & 1];
+  __atomic_add_fetch(counter, 1, __ATOMIC_SEQ_CST);
+
+  return counter;
+}
+
+static void leave_(size_t *counter) {
+  __atomic_sub_fetch(counter, 1, __ATOMIC_RELEASE);
+}
+
+/*
+Lock the shard whose range holds key. A shard found in the directory may
+have been split, merged or dropped before its lock was ours; the resize
+has published a new directory by then, so look again.
+*/
+static struct RBShard* lock_shard_(struct RBShardMap *map, int key) {
+
+  struct RBShardDir *dir = NULL;
+  struct RBShard *shard = NULL;
+
+  for (;;) {
+    dir = __atomic_load_n(&map->dir, __ATOMIC_SEQ_CST);
+    shard = dir->shards[find_(dir, key)];
+    pthread_mutex_lock(&shard->lock);
+    if (!shard->dead && shard->low <= key && key <= shard->high)
+      return shard;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+/* Index of the shard whose range holds key: the last with low <= key. */
+static size_t find_(const struct RBShardDir *dir, int key) {
+
+  size_t lo = 0, hi = dir->count, mid = 0;
+
+  while (hi - lo > 1) {
+    mid = lo + (hi - lo) / 2;
+    if (dir->lows[mid] <= key)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* A directory of count shards in one block; NULL if out of memory. */
+static struct RBShardDir* alloc_dir_(size_t count) {
+
+  struct RBShardDir *dir = malloc(sizeof(struct RBShardDir) +
+    count * (sizeof(struct RBShard *) + sizeof(int)));
+
+  if (dir == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  dir->count  = count;
+  dir->shards = (struct RBShard **)(dir + 1);
+  dir->lows   = (int *)(dir->shards + count);
+
+  return dir;
+}
+
+/*
+Copy of a directory with add inserted at index at, or without the shard
+at index at if add is NULL. The first shard always starts at INT_MIN.
+*/
+static struct RBShardDir* new_dir_(const struct RBShardDir *old, size_t at,
+  struct RBShard *add) {
+
+  struct RBShardDir *dir =
+    alloc_dir_(add != NULL ? old->count + 1 : old->count - 1);
+  size_t i = 0, j = 0;
+
+  if (dir == NULL)
+    return NULL;
+  for (i = 0; i <= old->count; i++) {
+    if (i == at && add != NULL)
+      dir->shards[j++] = add;
+    if (i < old->count && (i != at || add != NULL))
+      dir->shards[j++] = old->shards[i];
+  }
+  for (i = 0; i < dir->count; i++)
+    dir->lows[i] = dir->shards[i]->low;
+  dir->lows[0] = INT_MIN;
+
+  return dir;
+}
+
+/*
+A new shard for the keys in [low, high], holding tree; NULL if out of
+memory. Shards are aligned to a cache line.
+*/
+static struct RBShard* new_shard_(struct RBShardMap *map, int low, int high,
+  struct RBTree *tree) {
+
+  struct RBShard *shard = aligned_alloc(64, sizeof(struct RBShard));
+
+  if (shard == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  shard->low   = low;
+  shard->high  = high;
+  shard->dead  = false;
+  shard->tree  = tree;
+  shard->limit = map->maxKeys;
+  shard->floor = map->maxKeys / 4;
+  pthread_mutex_init(&shard->lock, NULL);
+
+  return shard;
+}
+
+static void free_shard_(struct RBShard *shard) {
+  if (shard->tree != NULL)
+    dest_rbtree(&shard->tree);
+  pthread_mutex_destroy(&shard->lock);
+  free(shard);
+}
+
+/*
+Split or merge the shard that holds key, if it still needs it once its
+lock is ours; another thread may have resized it in the meantime. A shard
+is merged with the smaller of its neighbors. An empty shard is simply
+dropped and its range goes to a neighbor. A shrink locks the neighbors as
+well, in key order like every holder of several shard locks.
+*/
+static void resize_(struct RBShardMap *map, int key) {
+
+  struct RBShardDir *old = NULL, *dir = NULL;
+  struct RBShard *shard = NULL, *prev = NULL, *next = NULL;
+  size_t i = 0, j = 0, n = 0;
+  bool shrink = false, neighbors = false;
+
+  pthread_mutex_lock(&map->resizeLock);
+  old = map->dir;
+  i = find_(old, key);
+  shard = old->shards[i];
+  prev = i > 0 ? old->shards[i - 1] : NULL;
+  next = i + 1 < old->count ? old->shards[i + 1] : NULL;
+
+  pthread_mutex_lock(&shard->lock);
+  n = tree_size(shard->tree);
+  shrink = old->count > 1 && (n < shard->floor || n == 0);
+  if ((neighbors = shrink)) { // Relock in key order; the size may change.
+    pthread_mutex_unlock(&shard->lock);
+    if (prev != NULL)
+      pthread_mutex_lock(&prev->lock);
+    pthread_mutex_lock(&shard->lock);
+    if (next != NULL)
+      pthread_mutex_lock(&next->lock);
+    n = tree_size(shard->tree);
+    shrink = n < shard->floor || n == 0;
+  }
+
+  if (n > shard->limit) {
+    dir = split_(map, old, i);
+  } else if (shrink && n == 0) {
+    dir = drop_(old, i);
+  } else if (shrink) {
+    j = next == NULL || (prev != NULL &&
+      tree_size(prev->tree) < tree_size(next->tree)) ? i - 1 : i;
+    if (tree_size(old->shards[j]->tree) + tree_size(old->shards[j + 1]->tree)
+        <= map->maxKeys / 2)
+      dir = merge_(map, old, j);
+    else
+      shard->floor = n / 2; // Not before it has halved again.
+  }
+
+  // Publish before unlocking, so that operations that find a shard changed
+  // find the new directory when they look again.
+  if (dir != NULL)
+    __atomic_store_n(&map->dir, dir, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&shard->lock);
+  if (neighbors) {
+    if (next != NULL)
+      pthread_mutex_unlock(&next->lock);
+    if (prev != NULL)
+      pthread_mutex_unlock(&prev->lock);
+  }
+
+  if (dir != NULL) {
+    synchronize_(map);
+    for (i = 0; i < old->count; i++)
+      if (old->shards[i]->dead)
+        free_shard_(old->shards[i]);
+    free(old);
+  }
+  pthread_mutex_unlock(&map->resizeLock);
+}
+
+/*
+Split shard i at its median key into two shards with fresh trees, and
+return the directory with both. Equal keys stay in one shard, so a shard
+holding a single key cannot be split; it and a shard that could not be
+split for want of memory are left alone until they have doubled.
+*/
+static struct RBShardDir* split_(struct RBShardMap *map,
+  struct RBShardDir *old, size_t i) {
+
+  struct RBShard *shard = old->shards[i], *upper = NULL;
+  struct RBShardDir *dir = NULL;
+  struct RBTree *left = NULL, *right = NULL;
+  size_t n = tree_size(shard->tree), m = n / 2;
+  int *keys = malloc(n * sizeof(int));
+  void **data = malloc(n * sizeof(void *));
+
+  if (keys == NULL || data == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    goto fail;
+  }
+
+  collect_(shard->tree, keys, data);
+  while (m > 0 && keys[m - 1] == keys[m])
+    m--;
+  if (m == 0) {
+    for (m = n / 2; m < n && keys[m - 1] == keys[m]; m++)
+      ;
+    if (m == n)
+      goto fail;
+  }
+
+  if ((left = init_rbtree_sorted(keys, data, m, map->allocator)) == NULL ||
+      (right = init_rbtree_sorted(keys + m, data + m, n - m, map->allocator)) == NULL ||
+      (upper = new_shard_(map, keys[m], shard->high, right)) == NULL ||
+      (dir = new_dir_(old, i + 1, upper)) == NULL)
+    goto fail;
+
+  dest_rbtree(&shard->tree);
+  shard->tree  = left;
+  shard->high  = keys[m] - 1;
+  shard->limit = map->maxKeys;
+  shard->floor = map->maxKeys / 4;
+  free(keys);
+  free(data);
+  return dir;
+
+fail:
+  if (upper != NULL)
+    free_shard_(upper); // Destroys right.
+  else if (right != NULL)
+    dest_rbtree(&right);
+  if (left != NULL)
+    dest_rbtree(&left);
+  shard->limit = 2 * n;
+  free(keys);
+  free(data);
+  return NULL;
+}
+
+/*
+Merge shards i and i + 1 into shard i with a fresh tree, and return the
+directory without shard i + 1, which is marked dead. If memory runs out
+both are left as they are.
+*/
+static struct RBShardDir* merge_(struct RBShardMap *map,
+  struct RBShardDir *old, size_t i) {
+
+  struct RBShard *shard = old->shards[i], *upper = old->shards[i + 1];
+  struct RBShardDir *dir = NULL;
+  struct RBTree *tree = NULL;
+  size_t n = tree_size(shard->tree) + tree_size(upper->tree), m = 0;
+  int *keys = malloc((n > 0 ? n : 1) * sizeof(int));
+  void **data = malloc((n > 0 ? n : 1) * sizeof(void *));
+
+  if (keys == NULL || data == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    free(keys);
+    free(data);
+    return NULL;
+  }
+
+  m = collect_(shard->tree, keys, data);
+  collect_(upper->tree, keys + m, data + m);
+  if ((tree = init_rbtree_sorted(keys, data, n, map->allocator)) != NULL &&
+      (dir = new_dir_(old, i + 1, NULL)) != NULL) {
+    dest_rbtree(&shard->tree);
+    shard->tree  = tree;
+    shard->high  = upper->high;
+    shard->limit = map->maxKeys;
+    shard->floor = map->maxKeys / 4;
+    dest_rbtree(&upper->tree);
+    upper->dead = true;
+  } else if (tree != NULL) {
+    dest_rbtree(&tree);
+  }
+  free(keys);
+  free(data);
+
+  return dir;
+}
+
+/*
+Drop the empty shard i and return the directory without it. Its range
+goes to the shard before it, or after it for the first shard.
+*/
+static struct RBShardDir* drop_(struct RBShardDir *old, size_t i) {
+
+  struct RBShard *shard = old->shards[i];
+  struct RBShardDir *dir = new_dir_(old, i, NULL);
+
+  if (dir == NULL)
+    return NULL;
+  if (i == 0)
+    old->shards[1]->low = INT_MIN;
+  else
+    old->shards[i - 1]->high = shard->high;
+  dest_rbtree(&shard->tree);
+  shard->dead = true;
+
+  return dir;
+}
+
+/*
+Wait until every operation that may have loaded a directory before the
+call has left the map. Each flip sends new operations to the other
+counter of each slot, so the counters of the phase before only drain.
+*/
+static void synchronize_(struct RBShardMap *map) {
+
+  size_t phase = map->phase, round = 0, i = 0;
+
+  for (round = 0; round < 2; round++) {
+    __atomic_store_n(&map->phase, ++phase, __ATOMIC_SEQ_CST);
+    for (i = 0; i < SHARD_SLOTS; i++)
+      while (__atomic_load_n(&map->slots[i].readers[(phase - 1) & 1],
+          __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+  }
+}
+
+/* Copy the keys and data of a tree, in order, to the arrays. */
+static size_t collect_(struct RBTree *tree, int *keys, void **data) {
+
+  struct RBTreeIter iter;
+  struct RBTreeNode *node = NULL;
+  size_t i = 0;
+
+  for (node = iter_begin(tree, &iter); node != NULL; node = iter_next(&iter), i++) {
+    keys[i] = node->key;
+    data[i] = node->data;
+  }
+
+  return i;
+}
+
+/* range_scan callback: pass the node on and remember a request to stop. */
+static int scan_visit_(struct RBTreeNode *node, void *arg) {
+
+  struct ScanState *state = arg;
+
+  if (state->visit(node, state->ctx) != 0)
+    state->stop = true;
+
+  return state->stop;
+}
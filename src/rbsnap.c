@@ -0,0 +1,547 @@
+#include "errors.h"
+#include "rbsnap.h"
+#include<errno.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+// Byte order mark of the header.
+#define SNAP_ORDER 0x01020304u
+
+// Round a data section offset up to the alignment of its items.
+#define ALIGN8(n)\
+  (((n) + 7) & ~(uint64_t)7)
+
+/* State shared by the passes of snap_save. */
+struct SaveState {
+
+  FILE *file;                      /* File being written.               */
+  struct RBTreeNode *nil;          /* Sentinel of the tree being saved. */
+  const struct RBSnapCodec *codec; /* Data serializer, or NULL.         */
+  uint64_t next;                   /* Index of the next node written.   */
+  uint64_t dataSize;               /* Bytes of data laid out so far.    */
+  char *buf;                       /* Encoding buffer.                  */
+  size_t bufSize;                  /* Capacity of buf.                  */
+  bool ok;                         /* No write has failed.              */
+
+};
+
+static uint64_t save_nodes_(struct SaveState *, struct RBTreeNode *);
+static void save_data_(struct SaveState *, struct RBTreeNode *);
+static const struct RBSnapNode* child_(const struct RBSnapNode *, int32_t,
+  const struct RBSnapNode *);
+static int check_(struct RBSnapshot *, const struct RBSnapNode *,
+  const struct RBSnapNode *, int, long, long);
+static struct RBTreeNode* promote_(struct RBTree *, char *, struct RBSnapshot *,
+  const struct RBSnapCodec *, const struct RBSnapNode *,
+  const struct RBSnapNode *);
+static size_t scan_(struct RBSnapshot *, const struct RBSnapNode *,
+  const struct RBSnapNode *, int, int, int,
+  int (*)(const struct RBSnapNode *, void *), void *, bool *);
+
+/**
+Function to write a tree to a snapshot file, replacing any file of that
+name. The nodes are written in postorder, so that both children of a node
+are already placed when the node itself is written, and a second pass in
+the same order writes the data items. Runs in O(n) and needs no memory
+beyond the encoding buffer for one data item.
+
+NOTE: Only the int keys and the shape are saved; a comparator-ordered
+tree must get its comparator back after snap_promote.
+
+@param tree The RBT to save.
+@param path Name of the file to write.
+@param codec Serializer for the satellite data, or NULL to save none.
+@return true on success. On failure the error is reported (see report_error),
+errno tells why and no file is left.
+**/
+bool snap_save(struct RBTree *tree, const char *path,
+  const struct RBSnapCodec *codec) {
+
+  struct RBSnapHeader header;
+  struct SaveState state;
+  size_t count = tree_size(tree);
+  int err = 0;
+
+  if (count > INT32_MAX) { // Offsets must fit the node fields.
+    report_error(EOVERFLOW, SNAP_TOO_LARGE);
+    return false;
+  }
+  if ((state.file = fopen(path, "wb")) == NULL) {
+    report_error(errno, FILE_ERROR);
+    return false;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+  header.version  = SNAP_VERSION;
+  header.order    = SNAP_ORDER;
+  header.nodeSize = sizeof(struct RBSnapNode);
+  header.count    = count;
+  header.root     = count > 0 ? count - 1 : 0;
+
+  state.nil      = tree->nil;
+  state.codec    = codec;
+  state.next     = 0;
+  state.dataSize = 0;
+  state.buf      = NULL;
+  state.bufSize  = 0;
+  state.ok       = fwrite(&header, sizeof(header), 1, state.file) == 1;
+
+  if (tree->root != tree->nil)
+    save_nodes_(&state, tree->root);
+  if (codec != NULL)
+    save_data_(&state, tree->root);
+
+  // The header goes in again now that the data size is known.
+  header.dataSize = state.dataSize;
+  if (state.ok)
+    state.ok = fseek(state.file, 0, SEEK_SET) == 0 &&
+      fwrite(&header, sizeof(header), 1, state.file) == 1;
+
+  free(state.buf);
+  if (fclose(state.file) != 0)
+    state.ok = false;
+  if (!state.ok) {
+    err = errno;
+    remove(path);
+    report_error(err, err == ENOMEM ? MEM_ERROR : FILE_ERROR);
+  }
+
+  return state.ok;
+}
+
+/*
+First pass of snap_save: write the nodes of a subtree in postorder and
+lay out their data items. Returns the index of the subtree's root.
+*/
+static uint64_t save_nodes_(struct SaveState *state, struct RBTreeNode *node) {
+
+  struct RBSnapNode rec;
+  uint64_t left = 0, right = 0;
+  size_t size = 0;
+
+  if (node->left != state->nil)
+    left = save_nodes_(state, node->left);
+  if (node->right != state->nil)
+    right = save_nodes_(state, node->right);
+
+  rec.key   = node->key;
+  rec.left  = node->left != state->nil ? (int32_t)(left - state->next) : 0;
+  rec.right = node->right != state->nil ? (int32_t)(right - state->next) : 0;
+  rec.flags = node_color(node) == BLACK ? SNAP_BLACK : 0;
+  rec.data  = 0;
+
+  if (state->codec != NULL && node->data != NULL) {
+    size = state->codec->size(node->data, state->codec->ctx);
+    rec.flags |= SNAP_DATA;
+    rec.data = state->dataSize;
+    state->dataSize += ALIGN8(sizeof(uint64_t) + size);
+  }
+
+  if (state->ok)
+    state->ok = fwrite(&rec, sizeof(rec), 1, state->file) == 1;
+
+  return state->next++;
+}
+
+/* Second pass of snap_save: write the data items in the order laid out. */
+static void save_data_(struct SaveState *state, struct RBTreeNode *node) {
+
+  uint64_t size = 0;
+  size_t padded = 0;
+
+  if (node == state->nil || !state->ok)
+    return;
+
+  save_data_(state, node->left);
+  save_data_(state, node->right);
+  if (node->data == NULL)
+    return;
+
+  size = state->codec->size(node->data, state->codec->ctx);
+  padded = ALIGN8(sizeof(uint64_t) + size);
+  if (padded > state->bufSize) {
+    free(state->buf);
+    state->bufSize = 2 * padded;
+    if ((state->buf = malloc(state->bufSize)) == NULL) {
+      state->bufSize = 0;
+      state->ok = false;
+      errno = ENOMEM; // Reported by snap_save.
+      return;
+    }
+  }
+
+  memset(state->buf, 0, padded);
+  memcpy(state->buf, &size, sizeof(size));
+  state->codec->encode(node->data, state->buf + sizeof(uint64_t),
+    state->codec->ctx);
+  state->ok = fwrite(state->buf, padded, 1, state->file) == 1;
+}
+
+/**
+Function to map a snapshot file. Only the header is checked: the nodes
+are not read until they are searched, so opening takes the same time for
+any number of nodes, and the pages of the file are shared with the page
+cache. Once it is open the snapshot can be searched from any number of
+threads.
+
+NOTE: The nodes of a damaged file are only caught as far as reading them
+safely needs (see child_); searching it may give wrong answers.
+
+@param path Name of the snapshot file.
+@return Pointer to the open snapshot, or NULL with errno set if the file
+cannot be mapped or is not a snapshot from this kind of machine.
+**/
+struct RBSnapshot* snap_open(const char *path) {
+
+  struct RBSnapshot *snap = NULL;
+  const struct RBSnapHeader *header = NULL;
+  struct stat st;
+  void *map = NULL;
+  uint64_t count = 0;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    report_error(errno, FILE_ERROR);
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*header)) {
+    close(fd);
+    report_error(EINVAL, BAD_SNAP);
+    return NULL;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    report_error(errno, FILE_ERROR);
+    return NULL;
+  }
+
+  header = map;
+  if (memcmp(header->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) != 0 ||
+      header->version != SNAP_VERSION || header->order != SNAP_ORDER ||
+      header->nodeSize != sizeof(struct RBSnapNode) ||
+      header->count > INT32_MAX ||
+      header->root != (header->count > 0 ? header->count - 1 : 0) ||
+      header->dataSize > (uint64_t)st.st_size ||
+      sizeof(*header) + header->count * sizeof(struct RBSnapNode) >
+        (uint64_t)st.st_size - header->dataSize) {
+    munmap(map, st.st_size);
+    report_error(EINVAL, BAD_SNAP);
+    return NULL;
+  }
+
+  if ((snap = malloc(sizeof(struct RBSnapshot))) == NULL) {
+    munmap(map, st.st_size);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  snap->map      = map;
+  snap->length   = st.st_size;
+  snap->header   = header;
+  snap->nodes    = (const struct RBSnapNode *)(header + 1);
+  snap->dataBase = (const char *)(snap->nodes + header->count);
+
+  // A Red-Black tree of n nodes is at most 2 lg(n + 1) deep.
+  snap->maxDepth = 1;
+  for (count = header->count + 1; count > 1; count >>= 1)
+    snap->maxDepth += 2;
+
+  return snap;
+}
+
+/**
+Function to unmap a snapshot. Nodes and data found in it become invalid.
+Once the snapshot has been closed the reference is nullified.
+
+@param snap Double pointer to the snapshot to be closed.
+**/
+void snap_close(struct RBSnapshot **snap) {
+  munmap((*snap)->map, (*snap)->length);
+  free(*snap);
+  *snap = NULL;
+}
+
+/**
+Function to build an ordinary, mutable tree from a snapshot. All nodes are
+taken from the pool as one block and linked in the shape and colors they
+were saved with, so no rebalancing is needed. Runs in O(n). Snapshots keep
+only keys, so with RBTREE_INTERVALS every node becomes the point [key, key].
+
+The file is checked first, in another O(n) pass that decodes no data: the
+nodes reached from the root must be in key order and meet the Red-Black
+properties. Nodes that are never reached are left out.
+
+@param snap The open snapshot. It may be closed afterwards.
+@param codec Deserializer for the data, or NULL to leave all data NULL.
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@return Pointer to the new tree handle, or NULL if memory ran out or the
+file is damaged.
+**/
+struct RBTree* snap_promote(struct RBSnapshot *snap,
+  const struct RBSnapCodec *codec, const struct RBTreeAllocator *allocator) {
+
+  const struct RBSnapNode *root = snap->nodes + snap->header->root;
+  struct RBTree *tree = NULL;
+  struct RBTreeNode *walk = NULL;
+  char *block = NULL;
+
+  if (snap->header->count > 0 && (!(root->flags & SNAP_BLACK) ||
+      check_(snap, root, snap->nodes, 1, INT_MIN, INT_MAX) < 0)) {
+    report_error(EINVAL, BAD_SNAP);
+    return NULL;
+  }
+
+  tree = init_rbtree_alloc(allocator);
+  if (tree == NULL || snap->header->count == 0)
+    return tree;
+
+  if ((block = pool_alloc_block(tree->pool, snap->header->count)) == NULL) {
+    dest_rbtree(&tree);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  tree->size = 0;
+  tree->root = promote_(tree, block, snap, codec, root, snap->nodes);
+  set_parent(tree->root, tree->nil);
+
+  tree->leftmost  = subtree_minimum(tree, tree->root);
+  tree->rightmost = subtree_maximum(tree, tree->root);
+  for (walk = tree->root; walk != tree->nil; walk = walk->left)
+    tree->blackHeight += node_color(walk) == BLACK;
+
+  return tree;
+}
+
+/*
+Check pass of snap_promote over the subtree at rec, whose nodes must lie
+between floor and rec (see child_), no deeper than maxDepth, with keys in
+[lo, hi]. Returns its black-height, or -1 if it is not a valid subtree.
+*/
+static int check_(struct RBSnapshot *snap, const struct RBSnapNode *rec,
+  const struct RBSnapNode *floor, int depth, long lo, long hi) {
+
+  const struct RBSnapNode *left = child_(rec, rec->left, floor);
+  const struct RBSnapNode *right =
+    child_(rec, rec->right, left != NULL ? left + 1 : floor);
+  bool red = !(rec->flags & SNAP_BLACK);
+  int lh = 0, rh = 0;
+
+  if (depth > snap->maxDepth || rec->key < lo || rec->key > hi ||
+      (red && ((left != NULL && !(left->flags & SNAP_BLACK)) ||
+        (right != NULL && !(right->flags & SNAP_BLACK)))))
+    return -1;
+
+  // Equal keys may sit on either side after rotations.
+  if (left != NULL)
+    lh = check_(snap, left, floor, depth + 1, lo, rec->key);
+  if (right != NULL)
+    rh = check_(snap, right, left != NULL ? left + 1 : floor, depth + 1,
+      rec->key, hi);
+  if (lh < 0 || rh < 0 || lh != rh)
+    return -1;
+
+  return lh + !red;
+}
+
+/*
+Recursive helper for snap_promote. Node i of the snapshot goes to slot i
+of the block; the caller sets the parent of the returned node.
+*/
+static struct RBTreeNode* promote_(struct RBTree *tree, char *block,
+  struct RBSnapshot *snap, const struct RBSnapCodec *codec,
+  const struct RBSnapNode *rec, const struct RBSnapNode *floor) {
+
+  struct RBTreeNode *node = NULL;
+  const struct RBSnapNode *left = child_(rec, rec->left, floor);
+  const struct RBSnapNode *right =
+    child_(rec, rec->right, left != NULL ? left + 1 : floor);
+  const void *data = NULL;
+  size_t size = 0;
+
+  node = (struct RBTreeNode *)
+    (block + (rec - snap->nodes) * tree->pool->nodeSize);
+#ifndef RBTREE_COMPACT
+  node->isSen = false;
+#else
+  node->pc    = 0;
+#endif
+  set_color(node, rec->flags & SNAP_BLACK ? BLACK : RED);
+  node->key   = rec->key;
+  node->data  = NULL;
+  if (codec != NULL && (data = snap_data(snap, rec, &size)) != NULL)
+    node->data = codec->decode(data, size, codec->ctx);
+
+  node->left = left != NULL
+    ? promote_(tree, block, snap, codec, left, floor) : tree->nil;
+  node->right = right != NULL
+    ? promote_(tree, block, snap, codec, right,
+      left != NULL ? left + 1 : floor) : tree->nil;
+
+  if (node->left != tree->nil)
+    set_parent(node->left, node);
+  if (node->right != tree->nil)
+    set_parent(node->right, node);
+#ifdef RBTREE_ORDER_STATS
+  node->size = node->left->size + node->right->size + 1;
+#endif
+#ifdef RBTREE_INTERVALS
+  node->high = node->key; // Snapshots keep only the start of an interval.
+  fix_max_(node);
+#endif
+  tree->size++;
+
+  return node;
+}
+
+/**
+Search a snapshot for a given key, following the saved child offsets.
+Touches only the pages on the search path.
+
+@param snap The open snapshot.
+@param key Key to look for.
+@return The node with the key, or null if there is none.
+**/
+const struct RBSnapNode* snap_search(struct RBSnapshot *snap, int key) {
+
+  const struct RBSnapNode *node = NULL;
+  const struct RBSnapNode *floor = snap->nodes;
+  const struct RBSnapNode *left = NULL;
+
+  if (snap->header->count == 0)
+    return NULL;
+
+  node = snap->nodes + snap->header->root;
+  while (node != NULL && node->key != key) {
+    left = child_(node, node->left, floor);
+    if (key < node->key) {
+      node = left;
+    } else {
+      if (left != NULL)
+        floor = left + 1;
+      node = child_(node, node->right, floor);
+    }
+  }
+
+  return node;
+}
+
+/**
+Saved data of a snapshot node, pointing into the mapping. It is valid until
+the snapshot is closed and is aligned to 8 bytes.
+
+@param snap The open snapshot.
+@param node A node of the snapshot.
+@param size Receives the length of the data in bytes. May be NULL.
+@return The data, or NULL if the node has none.
+**/
+const void* snap_data(struct RBSnapshot *snap, const struct RBSnapNode *node,
+  size_t *size) {
+
+  uint64_t length = 0;
+  uint64_t room = snap->header->dataSize;
+
+  if (size != NULL)
+    *size = 0;
+  if (!(node->flags & SNAP_DATA) || room < sizeof(uint64_t) ||
+      node->data > room - sizeof(uint64_t))
+    return NULL;
+
+  memcpy(&length, snap->dataBase + node->data, sizeof(length));
+  if (length > room - sizeof(uint64_t) - node->data)
+    return NULL;
+
+  if (size != NULL)
+    *size = length;
+  return snap->dataBase + node->data + sizeof(uint64_t);
+}
+
+/**
+Number of nodes in a snapshot.
+
+@param snap The open snapshot.
+@return Number of nodes.
+**/
+size_t snap_size(struct RBSnapshot *snap) {
+  return snap->header->count;
+}
+
+/**
+Range query over a snapshot, as range_scan. Calls visit on every node with
+lo <= key < hi, in order, and stops early when visit returns non-zero.
+Runs in O(lg n + k) for k visited nodes.
+
+@param snap The open snapshot.
+@param lo Inclusive lower bound of the range.
+@param hi Exclusive upper bound of the range.
+@param visit Callback receiving each node and ctx.
+@param ctx User pointer passed through to visit.
+@return Number of nodes visited.
+**/
+size_t snap_scan(struct RBSnapshot *snap, int lo, int hi,
+  int (*visit)(const struct RBSnapNode *, void *), void *ctx) {
+
+  bool stop = false;
+
+  if (snap->header->count == 0)
+    return 0;
+  return scan_(snap, snap->nodes + snap->header->root, snap->nodes, 1, lo, hi,
+    visit, ctx, &stop);
+}
+
+/*
+Recursive helper for snap_scan. The subtree at node lies between floor and
+node (see child_); depth stops at maxDepth, however the file is damaged.
+*/
+static size_t scan_(struct RBSnapshot *snap, const struct RBSnapNode *node,
+  const struct RBSnapNode *floor, int depth, int lo, int hi,
+  int (*visit)(const struct RBSnapNode *, void *), void *ctx, bool *stop) {
+
+  const struct RBSnapNode *left = NULL;
+  size_t count = 0;
+
+  if (node == NULL || depth > snap->maxDepth)
+    return 0;
+
+  left = child_(node, node->left, floor);
+  if (lo <= node->key)
+    count += scan_(snap, left, floor, depth + 1, lo, hi, visit, ctx, stop);
+  if (*stop || node->key >= hi)
+    return count;
+  if (lo <= node->key) {
+    count++;
+    if (visit(node, ctx) != 0) {
+      *stop = true;
+      return count;
+    }
+  }
+  if (left != NULL)
+    floor = left + 1;
+  return count + scan_(snap, child_(node, node->right, floor), floor,
+    depth + 1, lo, hi, visit, ctx, stop);
+}
+
+/*
+Child of a node at a saved offset, or NULL for none. In postorder every
+subtree is a run of the node array that ends at its root, with the run of
+the left child before that of the right. So the subtree of a node lies in
+[floor, node), the left child's in [floor, left] and the right child's in
+[left + 1, right]. Any offset that is not negative or leads below floor is
+treated as no child; then no node is reached twice and no read leaves the
+mapping, though a damaged file can still give wrong answers.
+*/
+static const struct RBSnapNode* child_(const struct RBSnapNode *node,
+  int32_t offset, const struct RBSnapNode *floor) {
+
+  if (offset >= 0 || -(ptrdiff_t)offset > node - floor)
+    return NULL;
+  return node + offset;
+}
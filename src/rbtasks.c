@@ -0,0 +1,366 @@
+#include "errors.h"
+#include "rbtasks.h"
+#include<sched.h>
+#include<stdbool.h>
+#include<stdlib.h>
+
+/*
+Memory order. The deques follow Le, Pop, Cohen and Zappa Nardelli,
+"Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+Sleeping uses a flag-then-check handshake: a thread going to sleep counts
+itself in sleepers or waiters and then looks for work or completion once
+more, while a thread that makes work or completes a task publishes that
+first and then reads the count, both sequentially consistent. So either
+the sleeper sees the change or the other thread sees the sleeper and
+wakes it under the lock. A worker looks for work outside the lock, so it
+notes the wake count before it looks and only sleeps while that count is
+unchanged; a waiter checks its task under the lock.
+*/
+
+#define LOAD(p, order)\
+  __atomic_load_n(p, __ATOMIC_##order)
+#define STORE(p, v, order)\
+  __atomic_store_n(p, v, __ATOMIC_##order)
+#define FENCE()\
+  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define CAS(p, expected, v)\
+  __atomic_compare_exchange_n(p, expected, v, false, __ATOMIC_SEQ_CST,\
+    __ATOMIC_RELAXED)
+
+// Deque of the calling thread if it is a worker, else NULL.
+static __thread struct RBTaskDeque *self = NULL;
+
+static void* worker(void *arg);
+static bool push_(struct RBTaskDeque *, struct RBTask *);
+static struct RBTask* take_(struct RBTaskDeque *);
+static struct RBTask* steal_(struct RBTaskDeque *);
+static struct RBTask* pop_shared(struct RBTaskPool *);
+static struct RBTask* find_task(struct RBTaskPool *, struct RBTaskDeque *);
+static void run_task(struct RBTaskPool *, struct RBTask *);
+
+/**
+Function to construct a new task pool. The pool follows a fork-join
+discipline: a task forks children with task_spawn and joins them with
+task_wait, and a thread blocked in task_wait runs pending tasks in the
+meantime, so nested parallel recursion cannot deadlock the workers.
+
+@param nthreads Number of worker threads to start. Zero gives a pool in
+which only the threads calling task_wait do any work.
+@return Pointer to the new pool, or NULL if memory or threads ran out; any
+workers already started are stopped again.
+**/
+struct RBTaskPool* init_task_pool(size_t nthreads) {
+
+  struct RBTaskPool *pool = NULL;
+  size_t i = 0;
+
+  if ((pool = malloc(sizeof(struct RBTaskPool))) == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  pool->threads = malloc(nthreads * sizeof(pthread_t));
+  pool->deques = aligned_alloc(64, nthreads * sizeof(struct RBTaskDeque));
+  if (nthreads > 0 && (pool->threads == NULL || pool->deques == NULL)) {
+    free(pool->threads);
+    free(pool->deques);
+    free(pool);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->finished, NULL);
+  pool->stack    = NULL;
+  pool->sleepers = 0;
+  pool->wakes    = 0;
+  pool->waiters  = 0;
+  pool->shutdown = 0;
+  pool->nthreads = nthreads;
+
+  for (i = 0; i < nthreads; i++) {
+    pool->deques[i].top    = 0;
+    pool->deques[i].bottom = 0;
+    pool->deques[i].pool   = pool;
+    pool->deques[i].seed   = 2 * (unsigned)i + 1;
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, worker, &pool->deques[i])
+        != 0) {
+      pool->nthreads = i; // Only these are joined.
+      dest_task_pool(&pool);
+      report_error(EAGAIN, THREAD_ERROR);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+/**
+Function to stop the workers and free the pool. Once the pool has been
+destroyed the reference is nullified.
+
+@param pool Double pointer to the pool to be destroyed.
+**/
+void dest_task_pool(struct RBTaskPool **pool) {
+
+  size_t i = 0;
+
+  pthread_mutex_lock(&(*pool)->lock);
+  STORE(&(*pool)->shutdown, 1, RELAXED);
+  STORE(&(*pool)->wakes, (*pool)->wakes + 1, RELAXED);
+  pthread_cond_broadcast(&(*pool)->wake);
+  pthread_mutex_unlock(&(*pool)->lock);
+
+  for (i = 0; i < (*pool)->nthreads; i++)
+    pthread_join((*pool)->threads[i], NULL);
+
+  pthread_mutex_destroy(&(*pool)->lock);
+  pthread_cond_destroy(&(*pool)->wake);
+  pthread_cond_destroy(&(*pool)->finished);
+  free((*pool)->deques);
+  free((*pool)->threads);
+  free(*pool);
+  *pool = NULL;
+}
+
+/**
+Queue a task for the pool. A worker pushes it onto its own deque, where
+it is the first task the worker itself takes back and the last one other
+threads steal, which keeps a recursive fork-join computation close to
+depth-first order. Other threads put it on the pool's shared stack.
+Without a pool, or when the worker's deque is full, the task runs right
+away.
+
+@param pool Pool to run the task, or NULL to run it in the caller.
+@param task Caller-owned task record.
+@param run Work to perform.
+@param arg Argument passed to run.
+**/
+void task_spawn(struct RBTaskPool *pool, struct RBTask *task,
+  void (*run)(void *), void *arg) {
+
+  task->run  = run;
+  task->arg  = arg;
+  task->done = 0;
+  task->next = NULL;
+
+  if (pool == NULL) {
+    run(arg);
+    task->done = 1;
+    return;
+  }
+
+  if (self != NULL && self->pool == pool) {
+    if (!push_(self, task)) {
+      run(arg);
+      task->done = 1;
+      return;
+    }
+  } else {
+    pthread_mutex_lock(&pool->lock);
+    task->next = pool->stack;
+    STORE(&pool->stack, task, RELAXED);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  FENCE();
+  if (LOAD(&pool->sleepers, RELAXED) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    STORE(&pool->wakes, pool->wakes + 1, RELAXED);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/**
+Block until a spawned task has completed. While it is pending the caller
+runs other tasks: first its own, normally starting with the one it waits
+for, then tasks stolen from the workers. Only when there is nothing left
+to run does it sleep until some task completes.
+
+@param pool Pool the task was spawned on, or NULL.
+@param task Task to wait for.
+**/
+void task_wait(struct RBTaskPool *pool, struct RBTask *task) {
+
+  struct RBTaskDeque *own = self != NULL && self->pool == pool ? self : NULL;
+  struct RBTask *other = NULL;
+
+  if (pool == NULL)
+    return;
+
+  while (!LOAD(&task->done, ACQUIRE)) {
+    if ((other = find_task(pool, own)) != NULL) {
+      run_task(pool, other);
+      continue;
+    }
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->waiters, 1, __ATOMIC_SEQ_CST);
+    if (!LOAD(&task->done, SEQ_CST))
+      pthread_cond_wait(&pool->finished, &pool->lock);
+    __atomic_sub_fetch(&pool->waiters, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/**
+Number of threads that may run tasks at the same time: the workers plus
+the thread that forks and waits.
+
+@param pool The pool, or NULL.
+@return Degree of parallelism, at least one.
+**/
+size_t task_parallelism(struct RBTaskPool *pool) {
+  return pool != NULL ? pool->nthreads + 1 : 1;
+}
+
+// Worker loop: run tasks until shutdown, sleeping when there are none.
+static void* worker(void *arg) {
+
+  struct RBTaskDeque *own = arg;
+  struct RBTaskPool *pool = own->pool;
+  struct RBTask *task = NULL;
+  unsigned wakes = 0;
+  int spins = 0;
+
+  self = own;
+  while (!LOAD(&pool->shutdown, RELAXED)) {
+    if ((task = find_task(pool, own)) != NULL) {
+      run_task(pool, task);
+      spins = 0;
+    } else if (++spins < TASK_SPINS) {
+      sched_yield();
+    } else {
+      __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+      wakes = LOAD(&pool->wakes, SEQ_CST);
+      if ((task = find_task(pool, own)) == NULL) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->wakes == wakes)
+          pthread_cond_wait(&pool->wake, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+      }
+      __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_RELAXED);
+      if (task != NULL)
+        run_task(pool, task);
+      spins = 0;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+Next task for a thread to run: the newest of its own deque if it has one,
+else the oldest of another worker's, trying every worker once from a
+random one on, else the newest of the shared stack.
+*/
+static struct RBTask* find_task(struct RBTaskPool *pool,
+  struct RBTaskDeque *own) {
+
+  struct RBTask *task = NULL;
+  size_t n = pool->nthreads, start = 0, i = 0;
+
+  if (own != NULL && (task = take_(own)) != NULL)
+    return task;
+
+  if (n > 0) {
+    if (own != NULL) {
+      own->seed = own->seed * 1103515245u + 12345u;
+      start = (own->seed >> 16) % n;
+    }
+    for (i = 0; i < n; i++)
+      if (&pool->deques[(start + i) % n] != own &&
+          (task = steal_(&pool->deques[(start + i) % n])) != NULL)
+        return task;
+  }
+
+  return pop_shared(pool);
+}
+
+// Push a task at the bottom of the owner's deque. False if it is full.
+static bool push_(struct RBTaskDeque *deque, struct RBTask *task) {
+
+  long bottom = LOAD(&deque->bottom, RELAXED);
+  long top = LOAD(&deque->top, ACQUIRE);
+
+  if (bottom - top >= TASK_DEQUE_SIZE)
+    return false;
+  STORE(&deque->tasks[bottom % TASK_DEQUE_SIZE], task, RELAXED);
+  STORE(&deque->bottom, bottom + 1, RELEASE);
+  return true;
+}
+
+// Pop the newest task of the owner's deque, or NULL.
+static struct RBTask* take_(struct RBTaskDeque *deque) {
+
+  long bottom = LOAD(&deque->bottom, RELAXED) - 1;
+  long top = 0;
+  struct RBTask *task = NULL;
+
+  STORE(&deque->bottom, bottom, RELAXED);
+  FENCE();
+  top = LOAD(&deque->top, RELAXED);
+
+  if (top <= bottom) {
+    task = LOAD(&deque->tasks[bottom % TASK_DEQUE_SIZE], RELAXED);
+    if (top == bottom) { // The last task: race the thieves for it.
+      if (!CAS(&deque->top, &top, top + 1))
+        task = NULL;
+      STORE(&deque->bottom, bottom + 1, RELAXED);
+    }
+  } else {
+    STORE(&deque->bottom, bottom + 1, RELAXED);
+  }
+
+  return task;
+}
+
+// Steal the oldest task of another worker's deque, or NULL.
+static struct RBTask* steal_(struct RBTaskDeque *deque) {
+
+  long top = LOAD(&deque->top, ACQUIRE);
+  long bottom = 0;
+  struct RBTask *task = NULL;
+
+  FENCE();
+  bottom = LOAD(&deque->bottom, ACQUIRE);
+  if (top >= bottom)
+    return NULL;
+
+  task = LOAD(&deque->tasks[top % TASK_DEQUE_SIZE], RELAXED);
+  if (!CAS(&deque->top, &top, top + 1))
+    return NULL; // Lost to the owner or another thief.
+  return task;
+}
+
+// Take the newest task of the shared stack, or NULL.
+static struct RBTask* pop_shared(struct RBTaskPool *pool) {
+
+  struct RBTask *task = NULL;
+
+  if (LOAD(&pool->stack, RELAXED) == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if ((task = pool->stack) != NULL)
+    STORE(&pool->stack, task->next, RELAXED);
+  pthread_mutex_unlock(&pool->lock);
+
+  return task;
+}
+
+// Run a task and wake the threads blocked in task_wait, if any.
+static void run_task(struct RBTaskPool *pool, struct RBTask *task) {
+
+  task->run(task->arg);
+  STORE(&task->done, 1, SEQ_CST);
+
+  if (LOAD(&pool->waiters, SEQ_CST) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->finished);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
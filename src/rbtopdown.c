@@ -0,0 +1,263 @@
+#include "errors.h"
+#include "rbtopdown.h"
+
+static bool is_red(struct TopDownNode *);
+static struct TopDownNode* rotate_(struct TopDownNode *, int);
+static struct TopDownNode* rotate_twice_(struct TopDownNode *, int);
+
+/**
+Function to construct a new, empty top-down tree.
+
+@return Pointer to the new tree handle, or NULL if memory ran out.
+**/
+struct TopDownTree* init_tdtree(void) {
+  return init_tdtree_alloc(NULL);
+}
+
+/**
+Function to construct a new, empty top-down tree whose nodes come from a
+pool on the given memory hooks.
+
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@return Pointer to the new tree handle, or NULL if memory ran out.
+**/
+struct TopDownTree* init_tdtree_alloc(const struct RBTreeAllocator *allocator) {
+
+  struct RBTreePool *pool =
+    init_rbtree_pool(allocator, sizeof(struct TopDownNode));
+  struct TopDownTree *tree = NULL;
+
+  if (pool == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  tree = pool->allocator.alloc(pool->allocator.ctx, sizeof(struct TopDownTree));
+  if (tree == NULL) {
+    dest_rbtree_pool(&pool);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  tree->root = NULL;
+  tree->size = 0;
+  tree->pool = pool;
+
+  return tree;
+}
+
+/**
+Function to destroy a top-down tree. All nodes go back with the pool in
+O(#slabs). Once the tree has been destroyed the reference is nullified.
+
+CAUTION: The satellite data of the keys must be handled by the caller.
+
+@param tree Double pointer to the tree to be destroyed.
+**/
+void dest_tdtree(struct TopDownTree **tree) {
+
+  struct RBTreePool *pool = (*tree)->pool;
+
+  pool->allocator.release(pool->allocator.ctx, *tree,
+    sizeof(struct TopDownTree));
+  dest_rbtree_pool(&pool);
+  *tree = NULL;
+}
+
+/**
+Insertion function. On the way down every node with two red children is
+split by a color flip, and a red node that now has a red parent is fixed
+at once by one or two rotations at its grandparent. The new red leaf then
+hangs below a black node, or below a red one that is fixed the same way,
+so nothing is left to do on the way back. Equal keys go to the right, as
+in insert. Runs in O(lg n).
+
+@param tree The tree.
+@param key Key to insert.
+@param data Satellite data of the key.
+@return true, or false if memory ran out; the tree is unchanged then.
+**/
+bool td_insert(struct TopDownTree *tree, int key, void *data) {
+
+  struct TopDownNode head = { { NULL, NULL }, 0, BLACK, NULL }; // False root.
+  struct TopDownNode *g = NULL, *p = NULL, *q = NULL;
+  struct TopDownNode *t = &head; // Parent of g, whose link is rewritten.
+  struct TopDownNode *node = pool_alloc_node(tree->pool);
+  int dir = 0, last = 0, up = 0;
+
+  if (node == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return false;
+  }
+  node->link[0] = node->link[1] = NULL;
+  node->key  = key;
+  node->c    = RED;
+  node->data = data;
+
+  head.link[1] = q = tree->root;
+  p = &head;
+  dir = 1;
+  for (;;) {
+    if (q == NULL) {
+      p->link[dir] = q = node;
+    } else if (is_red(q->link[0]) && is_red(q->link[1])) {
+      q->c = RED;
+      q->link[0]->c = q->link[1]->c = BLACK;
+    }
+
+    if (is_red(q) && is_red(p)) {
+      up = t->link[1] == g;
+      t->link[up] = q == p->link[last]
+        ? rotate_(g, !last) : rotate_twice_(g, !last);
+    }
+
+    if (q == node)
+      break;
+
+    last = dir;
+    dir  = key >= q->key;
+    if (g != NULL)
+      t = g;
+    g = p;
+    p = q;
+    q = q->link[dir];
+  }
+
+  tree->root = head.link[1];
+  tree->root->c = BLACK;
+  tree->size++;
+
+  return true;
+}
+
+/**
+Search and delete function. On the way down the current node is made red
+(or given a red child in the direction taken) by a color flip with its
+sibling or by rotations at its parent, so the node finally unlinked is red
+or has a red child and removing it cannot change a black-height. The last
+node with the key that was passed on the way down takes the key and data
+of that node, its in-order predecessor or itself. Runs in O(lg n).
+
+@param tree The tree.
+@param key Key to delete.
+@return The data of the deleted key, or NULL if the key was not found.
+**/
+void* td_search_and_delete(struct TopDownTree *tree, int key) {
+
+  struct TopDownNode head = { { NULL, NULL }, 0, BLACK, NULL }; // False root.
+  struct TopDownNode *g = NULL, *p = NULL, *q = &head, *s = NULL, *f = NULL;
+  void *data = NULL;
+  int dir = 1, last = 0, up = 0;
+
+  if (tree->root == NULL)
+    return NULL;
+
+  head.link[1] = tree->root;
+  while (q->link[dir] != NULL) {
+    last = dir;
+    g = p;
+    p = q;
+    q = q->link[dir];
+    dir = q->key < key;
+    if (q->key == key)
+      f = q;
+
+    if (is_red(q) || is_red(q->link[dir]))
+      continue;
+
+    if (is_red(q->link[!dir])) { // Rotate the red child up and q down.
+      p = p->link[last] = rotate_(q, dir);
+    } else if ((s = p->link[!last]) != NULL) {
+      if (!is_red(s->link[0]) && !is_red(s->link[1])) { // Merge with s.
+        p->c = BLACK;
+        s->c = q->c = RED;
+      } else { // Borrow from s.
+        up = g->link[1] == p;
+        g->link[up] = is_red(s->link[last])
+          ? rotate_twice_(p, last) : rotate_(p, last);
+        q->c = g->link[up]->c = RED;
+        g->link[up]->link[0]->c = g->link[up]->link[1]->c = BLACK;
+      }
+    }
+  }
+
+  if (f != NULL) {
+    data = f->data;
+    f->key  = q->key;
+    f->data = q->data;
+    p->link[p->link[1] == q] = q->link[q->link[0] == NULL];
+    pool_free_node(tree->pool, q);
+    tree->size--;
+  }
+
+  tree->root = head.link[1];
+  if (tree->root != NULL)
+    tree->root->c = BLACK;
+
+  return data;
+}
+
+/**
+Search the tree for a given key.
+
+@param tree The tree.
+@param key Key to look for.
+@param data Receives the data of the key if it is found. May be NULL.
+@return Whether the key was found.
+**/
+bool td_search(struct TopDownTree *tree, int key, void **data) {
+
+  struct TopDownNode *node = tree->root;
+  struct TopDownNode *left = NULL, *right = NULL;
+
+  while (node != NULL) {
+    // Both children are loaded before the compare so that the choice
+    // compiles to a conditional move, as in search.
+    left  = node->link[0];
+    right = node->link[1];
+    if (key == node->key) {
+      if (data != NULL)
+        *data = node->data;
+      return true;
+    }
+    node = key < node->key ? left : right;
+  }
+
+  return false;
+}
+
+/**
+Number of keys in the tree.
+
+@param tree The tree.
+@return Number of keys.
+**/
+size_t td_size(struct TopDownTree *tree) {
+  return tree->size;
+}
+
+/* NULL links count as black leaves. */
+static bool is_red(struct TopDownNode *node) {
+  return node != NULL && node->c == RED;
+}
+
+/*
+Rotate root towards dir (dir == 0 is a left rotation) and recolor: the
+child that comes up turns black and root turns red. Returns the new root.
+*/
+static struct TopDownNode* rotate_(struct TopDownNode *root, int dir) {
+
+  struct TopDownNode *save = root->link[!dir];
+
+  root->link[!dir] = save->link[dir];
+  save->link[dir]  = root;
+  root->c = RED;
+  save->c = BLACK;
+
+  return save;
+}
+
+/* Rotate the child of root away from dir first, then root towards dir. */
+static struct TopDownNode* rotate_twice_(struct TopDownNode *root, int dir) {
+  root->link[!dir] = rotate_(root->link[!dir], !dir);
+  return rotate_(root, dir);
+}
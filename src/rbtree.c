@@ -1,31 +1,125 @@
 #include "errors.h"
+#include "rbpool.h"
 #include "rbtree.h"
+#include<limits.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
 
 #define MAX(a, b)\
   (a < b ? b : a)
 
+// Batch entry: a key and its position in the caller's arrays.
+struct BatchEntry {
+  int key;
+  size_t index;
+};
+
+// Radix sort of batch keys: digit width, threshold for insertion sort.
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_MIN  64
+#define RADIX_DIGIT(key, shift)\
+  (((unsigned int)(key) ^ 0x80000000u) >> (shift) & (RADIX_SIZE - 1))
+
+// Software prefetch of a node about to be visited (build with RBTREE_PREFETCH).
+#ifdef RBTREE_PREFETCH
+#define PREFETCH(node)\
+  __builtin_prefetch(node)
+#else
+#define PREFETCH(node)\
+  ((void)(node))
+#endif
+
+// Instrumentation (build with RBTREE_STATS): count an event, count a step of
+// a descent, and file the length of a finished descent in a histogram.
+#ifdef RBTREE_STATS
+#define STAT(tree, counter)\
+  ((tree)->stats.counter++)
+#define STAT_STEP(depth)\
+  ((depth)++)
+#define STAT_DEPTH(tree, hist, depth)\
+  ((tree)->stats.hist[(depth) < STATS_DEPTHS ? (depth) : STATS_DEPTHS - 1]++)
+#else
+#define STAT(tree, counter)\
+  ((void)0)
+#define STAT_STEP(depth)\
+  ((void)0)
+#define STAT_DEPTH(tree, hist, depth)\
+  ((void)(depth))
+#endif
+
+// Checks of node arguments (build with RBTREE_DEBUG). On a bad node the
+// function reports INV_NODE and returns the given failure value.
+#ifdef RBTREE_DEBUG
+#define VALIDATE(node, chkNull, failure)\
+  do { if (!validate(node, chkNull)) return failure; } while (0)
+#else
+#define VALIDATE(node, chkNull, failure)\
+  ((void)0)
+#endif
+
+static void set_node_(struct RBTreeNode *, struct RBTreeNode *,
+  struct RBTreeNode *, struct RBTreeNode *, int, void *, color_t, bool);
+static void insert_by_key_(struct RBTree *, struct RBTreeNode *,
+  struct RBTreeNode *);
+#ifdef RBTREE_INTERVALS
+static bool interval_scan_(struct RBTree *, struct RBTreeNode *, int, int,
+  int (*)(struct RBTreeNode *, void *), void *, size_t *);
+#endif
 
-struct RBTreeNode* init_rbtree_node(struct RBTreeNode *p, struct RBTreeNode *l,
-  struct RBTreeNode *r, int k, void *d, color_t c, bool s) {
+/**
+Constructor for RBTreeNodes. The node is taken from the given pool rather
+than from malloc, so repeated inserts and deletes recycle the same memory.
 
-  struct RBTreeNode *node = NULL;
+Like the pool it reports nothing when memory runs out; it returns NULL
+with errno set to ENOMEM, and the caller reports the error.
+
+@param pool Node pool owned by the tree.
+@return Pointer to the initialized node, or NULL.
+**/
+struct RBTreeNode* init_rbtree_node(struct RBTreePool *pool,
+  struct RBTreeNode *p, struct RBTreeNode *l, struct RBTreeNode *r, int k,
+  void *d, color_t c, bool s) {
+
+  struct RBTreeNode *node = pool_alloc_node(pool);
+
+  if (node == NULL)
+    return NULL;
+
+  set_node_(node, p, l, r, k, d, c, s);
 
-  if ((node = malloc(sizeof(struct RBTreeNode))) == NULL )
-    display_error(MEM_ERROR);
+  return node;
 
+}
 
-  node->parent = p;
+/*
+Private helper for init_rbtree_node and relink_node_: sets every field of
+a node, including those of the optional layouts.
+*/
+static void set_node_(struct RBTreeNode *node, struct RBTreeNode *p,
+  struct RBTreeNode *l, struct RBTreeNode *r, int k, void *d, color_t c,
+  bool s) {
+
+#ifdef RBTREE_COMPACT
+  node->pc     = 0;   // The sentinel is recognized by address instead.
+  (void)s;
+#else
+  node->isSen  = s;
+#endif
+#ifdef RBTREE_ORDER_STATS
+  node->size   = s ? 0 : 1;
+#endif
+#ifdef RBTREE_INTERVALS
+  node->high    = k;
+  node->maxHigh = s ? INT_MIN : k;
+#endif
+  set_parent(node, p);
+  set_color(node, c);
   node->left   = l;
   node->right  = r;
   node->key    = k;
   node->data   = d;
-  node->c      = c;
-  node->isSen  = s;
-
-  return node;
-
 }
 
 /**
@@ -37,97 +131,383 @@ that the data has been handled.
 
 NOTE: There may be memory leaks if the satelite data is not handled properly.
 
+@param pool Node pool the node was allocated from.
 @param node Pointer to node to be destroyed.
 **/
-void dest_rbtree_node(struct RBTreeNode **node) {
+void dest_rbtree_node(struct RBTreePool *pool, struct RBTreeNode **node) {
   if ((*node)->data == 0) {
-    free_rbtree_node(node);
+    free_rbtree_node(pool, node);
   } else {
-    display_error(INV_DELOC);
+    report_error(EINVAL, INV_DELOC); // The node is left as it is.
   }
 }
 
 /**
 Specialized free function to avoid dangling pointers with
-RBTreeNodes after they have been removed. Once the node has been
-freed the reference is nullified to ensure we don't have a dangling
-pointer.
+RBTreeNodes after they have been removed. The node is recycled into
+the pool's free list. Once the node has been freed the reference is
+nullified to ensure we don't have a dangling pointer.
 
 NOTE: There may be other references to the same block of data, though. We must
 be careful to avoid any such situation. This may be particuarly relevant to
 the sentinel node where it will be the child of many nodes in the RBT.
 
+@param pool Node pool the node was allocated from.
 @param node Double pointer to RBTreeNode to be freed.
 **/
-void free_rbtree_node(struct RBTreeNode **node) {
+void free_rbtree_node(struct RBTreePool *pool, struct RBTreeNode **node) {
   if(node != NULL) {
-    free(*node);
+    pool_free_node(pool, *node);
     *node = NULL;
   }
 }
 
 /**
-Function to construct a new RBT with intial key k and initial satellite
-data pointer d. Function creates a root node and the sentinel node. The
-sentinel node can always be accessed by using root->parent. This sentinel
-will be useful in simplifying the implementation of the RBT operations.
+Function to construct a new, empty RBT. The tree handle owns the root
+pointer, the sentinel node, the node pool and a few cached fields: the
+number of nodes and the nodes with minimum and maximum key. While the
+tree is empty, root, leftmost and rightmost all refer to the sentinel.
+The sentinel will be useful in simplifying the implementation of the
+RBT operations.
+
+Nodes are allocated from a slab pool using malloc/free.
 
 NOTE: All operations will need to take into account the sentinel node.
 
-@param k Initial key of the root data.
-@param d Inital satelite data pointer, becomes root node's associated data.
-@return Pointer to root node of the rbtree.
+@return Pointer to the new tree handle, or NULL if it could not be
+allocated (see set_error_handler).
 **/
-struct RBTreeNode* init_rbtree(int k, void *d) {
+struct RBTree* init_rbtree(void) {
+  return init_rbtree_alloc(NULL);
+}
+
+/**
+Same as init_rbtree, but the handle and the slabs backing the tree's node
+pool are obtained through the user-supplied allocator hooks.
+
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@return Pointer to the new tree handle, or NULL.
+**/
+struct RBTree* init_rbtree_alloc(const struct RBTreeAllocator *allocator) {
+  return init_rbtree_sized(sizeof(struct RBTreeNode), allocator);
+}
+
+/**
+Same as init_rbtree_alloc, but for a tree whose nodes are larger than a
+struct RBTreeNode. This is used by the type-specialized trees generated
+with RBTREE_DEFINE (see rbgeneric.h), whose nodes embed a struct RBTreeNode
+as their first member followed by a key of arbitrary type.
+
+@param nodeSize Size in bytes of one node, at least sizeof(struct RBTreeNode).
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@return Pointer to the new tree handle, or NULL if memory ran out.
+**/
+struct RBTree* init_rbtree_sized(size_t nodeSize,
+  const struct RBTreeAllocator *allocator) {
+
+  struct RBTreePool *pool = init_rbtree_pool(allocator, nodeSize);
+  struct RBTree *tree = NULL;
+
+  if (pool == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  tree = pool->allocator.alloc(pool->allocator.ctx, sizeof(struct RBTree));
+  if (tree == NULL) {
+    dest_rbtree_pool(&pool);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
 
   //Allocate sentinel node.
-  struct RBTreeNode *sentinel =
-    init_rbtree_node(NULL, NULL, NULL, 0, NULL, BLACK, true);
+  tree->nil =
+    init_rbtree_node(pool, NULL, NULL, NULL, 0, NULL, BLACK, true);
+  if (tree->nil == NULL) {
+    pool->allocator.release(pool->allocator.ctx, tree, sizeof(struct RBTree));
+    dest_rbtree_pool(&pool);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
 
-  //Allocate root node with parent,left,right = sentinel.
-  struct RBTreeNode *root =
-    init_rbtree_node(sentinel, sentinel, sentinel, k, d, BLACK, false);
-  return root;
+  tree->root      = tree->nil;
+  tree->leftmost  = tree->nil;
+  tree->rightmost = tree->nil;
+  tree->size      = 0;
+  tree->pool      = pool;
+  tree->cmp       = NULL;
+  tree->blackHeight = 0;
+#ifdef RBTREE_STATS
+  tree_stats_reset(tree);
+#endif
+
+  return tree;
+}
+
+/**
+Function to construct a new, empty RBT ordered by a comparator callback
+instead of by int keys. The comparator is applied to the satellite data
+pointers themselves, i.e. each data item carries its own key, in the
+manner of qsort/bsearch. Such a tree is updated and queried with the
+insert_cmp, search_cmp and search_and_delete_cmp functions.
+
+@param cmp Returns <0, 0 or >0 as its first argument orders before, equal
+to or after its second.
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@return Pointer to the new tree handle, or NULL.
+**/
+struct RBTree* init_rbtree_cmp(int (*cmp)(const void *, const void *),
+  const struct RBTreeAllocator *allocator) {
+
+  struct RBTree *tree = init_rbtree_alloc(allocator);
+  if (tree != NULL)
+    tree->cmp = cmp;
+  return tree;
 }
 
 /**
-Function to free memory used by entire RBT. The function
-post-order walks the tree, freeing each node.
+Function to construct an RBT from n keys in non-decreasing order in O(n)
+time. There is no per-key descent, no fixup and no per-node allocation:
+the nodes come from one contiguous block of the pool, laid out in key
+order, and are linked into a perfectly balanced tree by build_sorted_.
+
+Coloring: all nodes are BLACK except those on the deepest level, which
+are RED unless that level is full. Every path from the root to the
+sentinel then holds the same number of BLACK nodes.
+
+@param keys Keys in non-decreasing order.
+@param data Satellite data for each key, or NULL for all NULL data.
+@param n Number of keys.
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@return Pointer to the new tree handle, or NULL if the keys are not sorted
+(errno EINVAL) or memory ran out (ENOMEM).
+**/
+struct RBTree* init_rbtree_sorted(const int *keys, void * const *data,
+  size_t n, const struct RBTreeAllocator *allocator) {
+
+  struct RBTree *tree = NULL;
+  char *block = NULL;
+  size_t i = 0;
+  int depth = 0;
+
+  for (i = 1; i < n; i++) {
+    if (keys[i] < keys[i - 1]) {
+      report_error(EINVAL, UNSORTED);
+      return NULL;
+    }
+  }
+
+  if ((tree = init_rbtree_alloc(allocator)) == NULL || n == 0)
+    return tree;
+
+  // Depth of the deepest level; it only gets RED nodes if it is not full.
+  for (i = n; i > 1; i >>= 1)
+    depth++;
+
+  if ((block = pool_alloc_block(tree->pool, n)) == NULL) {
+    dest_rbtree(&tree);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  tree->root = build_sorted_(tree, block, keys, data, 0, n,
+    0, (n & (n + 1)) != 0 ? depth : -1);
+  set_parent(tree->root, tree->nil);
+
+  tree->leftmost  = (struct RBTreeNode *)block;
+  tree->rightmost = (struct RBTreeNode *)(block + (n - 1) * tree->pool->nodeSize);
+  tree->size      = n;
+  tree->blackHeight = (n & (n + 1)) != 0 ? depth : depth + 1;
+
+  return tree;
+}
+
+/**
+Private helper for init_rbtree_sorted. Builds the subtree over keys
+[lo, hi) rooted at the middle key and returns its root; the caller sets
+the root's parent. Node i is stored at slot i of the block.
+
+@param tree The RBT being built.
+@param block Contiguous storage for all nodes, in key order.
+@param keys All keys.
+@param data All satellite data, or NULL.
+@param lo First key of the subtree.
+@param hi One past the last key of the subtree.
+@param depth Depth of the subtree's root.
+@param redDepth Depth whose nodes are colored RED, or -1 for none.
+@return Root of the subtree, or the sentinel if it is empty.
+**/
+struct RBTreeNode* build_sorted_(struct RBTree *tree, char *block,
+  const int *keys, void * const *data, size_t lo, size_t hi, int depth,
+  int redDepth) {
+
+  size_t mid = lo + (hi - lo) / 2;
+  struct RBTreeNode *node = NULL;
+
+  if (lo == hi)
+    return tree->nil;
+
+  node = sorted_node_(tree, block, mid, keys[mid],
+    data != NULL ? data[mid] : NULL, depth == redDepth, hi - lo);
+  sorted_link_(tree, node,
+    build_sorted_(tree, block, keys, data, lo, mid, depth + 1, redDepth),
+    build_sorted_(tree, block, keys, data, mid + 1, hi, depth + 1, redDepth));
+
+  return node;
+}
+
+/**
+Private helper for the sorted builds. Sets up slot i of the block as the
+node for a key; its children are linked by sorted_link_.
+
+@param tree The RBT being built.
+@param block Contiguous storage for all nodes, in key order.
+@param i Slot of the node.
+@param key Key of the node.
+@param data Satellite data of the node.
+@param red Color the node RED rather than BLACK?
+@param size Number of nodes in the node's subtree.
+@return The node.
+**/
+struct RBTreeNode* sorted_node_(struct RBTree *tree, char *block, size_t i,
+  int key, void *data, bool red, size_t size) {
+
+  struct RBTreeNode *node =
+    (struct RBTreeNode *)(block + i * tree->pool->nodeSize);
+
+#ifndef RBTREE_COMPACT
+  node->isSen = false;
+#else
+  node->pc    = 0;
+#endif
+  set_color(node, red ? RED : BLACK);
+  node->key   = key;
+  node->data  = data;
+#ifdef RBTREE_ORDER_STATS
+  node->size  = size;
+#else
+  (void)size;
+#endif
+#ifdef RBTREE_INTERVALS
+  node->high  = key;
+#endif
+
+  return node;
+}
+
+/**
+Private helper for the sorted builds. Links a node from sorted_node_ to
+the roots of its two finished subtrees.
+
+@param tree The RBT being built.
+@param node The node.
+@param left Root of the left subtree, or the sentinel.
+@param right Root of the right subtree, or the sentinel.
+**/
+void sorted_link_(struct RBTree *tree, struct RBTreeNode *node,
+  struct RBTreeNode *left, struct RBTreeNode *right) {
+
+  node->left  = left;
+  node->right = right;
+#ifdef RBTREE_INTERVALS
+  fix_max_(node);
+#endif
+
+  if (left != tree->nil)
+    set_parent(left, node);
+  if (right != tree->nil)
+    set_parent(right, node);
+}
+
+/**
+Function to construct a new, empty RBT in the same family as an existing
+one: it shares that tree's node pool and sentinel. Nodes then belong to the
+family rather than to one tree, which is what lets tree_join, tree_split
+and the set operations move whole subtrees between trees in O(1) each
+(see rbjoin.c). The pool is released along with the last tree of the
+family.
+
+NOTE: Trees of a family must not be updated concurrently.
+
+@param tree Any tree of the family.
+@return Pointer to the new tree handle, or NULL.
+**/
+struct RBTree* init_rbtree_like(struct RBTree *tree) {
+
+  struct RBTreePool *pool = tree->pool;
+  struct RBTree *like =
+    pool->allocator.alloc(pool->allocator.ctx, sizeof(struct RBTree));
+
+  if (like == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  like->nil       = tree->nil;
+  like->root      = like->nil;
+  like->leftmost  = like->nil;
+  like->rightmost = like->nil;
+  like->size      = 0;
+  like->pool      = pool;
+  like->cmp       = tree->cmp;
+  like->blackHeight = 0;
+  pool->refs++;
+#ifdef RBTREE_STATS
+  memset(&like->stats, 0, sizeof(struct RBTreeStats));
+#endif
+
+  return like;
+}
+
+/**
+Function to free memory used by entire RBT. Every node, including the
+sentinel, lives in the tree's pool, so the whole tree is released one
+slab at a time in O(#slabs) rather than by walking every node. Once the
+tree has been destroyed the handle is nullified.
+
+For a tree made with init_rbtree_like the pool is only released with the
+last tree of its family; until then the nodes of the destroyed tree are
+not reclaimed.
 
 CAUTION: This function assumes that all data associated to
 each node has already been destroyed.
 
-This function calls the dest_rbtree_ helper function to
-handle the left and right subtrees of the root. Finally,
-it destroys the sentinel (which, at this point, is no longer
-the child of any node), and then destroys the root node itself.
+@param tree Double pointer to the RBT to be deallocated.
+**/
+void dest_rbtree(struct RBTree **tree) {
+  struct RBTreeAllocator hooks = (*tree)->pool->allocator;
+  if (--(*tree)->pool->refs == 0)
+    dest_rbtree_pool(&(*tree)->pool);
+  hooks.release(hooks.ctx, *tree, sizeof(struct RBTree));
+  *tree = NULL;
+}
+
+/**
+Number of nodes currently stored in the tree. O(1), except for the first
+call after tree_split: a split cannot tell how many nodes went each way,
+so the size is recounted here in O(n) and cached again.
 
-@param root Root of RBT to be deallocated.
+@param tree The RBT.
+@return Number of nodes in the tree.
 **/
-void dest_rbtree(struct RBTreeNode **root) {
-  if((*root)->left->isSen == false) dest_rbtree_(&((*root)->left));
-  if((*root)->right->isSen == false) dest_rbtree_(&((*root)->right));
-  (*root)->data = 0;
-  (*root)->parent->data = 0;
-  dest_rbtree_node(&((*root)->parent));
-  dest_rbtree_node(root);
+size_t tree_size(struct RBTree *tree) {
+  if (tree->size == SIZE_UNKNOWN)
+    tree->size = count_nodes_(tree, tree->root);
+  return tree->size;
 }
 
 /**
-Helper function for dest_rbtree function. This
-function performs the post-order walk to
-free the left and right subtrees of the root node.
+Private helper for tree_size. Counts the nodes of a subtree.
 
-@param root Double pointer to root of tree for freeing.
+@param tree The RBT containing root.
+@param root Root of the subtree.
+@return Number of nodes in the subtree.
 **/
-void dest_rbtree_(struct RBTreeNode **root) {
-  if ((*root)->left->isSen != true)
-    dest_rbtree_(&(*root)->left);
-  if ((*root)->right->isSen != true)
-    dest_rbtree_(&(*root)->right);
+size_t count_nodes_(struct RBTree *tree, struct RBTreeNode *root) {
+  size_t count = 0;
 
-  (*root)->data = 0;
-  dest_rbtree_node(root);
+  for (; root != tree->nil; root = root->right) // Recurse on the left only.
+    count += 1 + count_nodes_(tree, root->left);
+  return count;
 }
 
 /**
@@ -137,47 +517,398 @@ data.
 
 New nodes inserted to the RBT are colored RED. The rest of the insert
 procedure is essentially the same as that for a standard BST, however
-NULL pointers are replaced with a reference to the sentinel (obtainable
-as *root->parent here), and an auxillary procedure, to fix any RBT property
-violations, is called at the end.
+NULL pointers are replaced with a reference to the sentinel (tree->nil),
+and an auxillary procedure, to fix any RBT property violations, is called
+at the end (see insert_link). The cached size, leftmost and rightmost
+nodes are updated along the way; rotations never change them since they
+preserve the in-order sequence.
 
+@param tree The RBT receiving the new node.
 @param k Key associated with data. Used for searching, ordering, etc.
 @param data Data associated with the node. void* for generic data.
-@return Pointer to the new node inserted into the tree.
+@return Pointer to the new node inserted into the tree, or NULL if no node
+could be allocated; the tree is then left as it was.
 **/
-struct RBTreeNode* insert(struct RBTreeNode **root, int k, void *data) {
+struct RBTreeNode* insert(struct RBTree *tree, int k, void *data) {
 
   // Create new node.
   struct RBTreeNode *newest =
-    init_rbtree_node(NULL, (*root)->parent, (*root)->parent, k, data, RED, false);
+    init_rbtree_node(tree->pool, NULL, tree->nil,
+      tree->nil, k, data, RED, false);
 
-  struct RBTreeNode *s = (*root)->parent; // Reference to sentinel.
-  struct RBTreeNode *walk = *root;      // Walk startes at the root.
-  struct RBTreeNode *parent = (*root)->parent; // Trailing pointer used for insert.
+  if (newest == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  insert_by_key_(tree, newest, tree->root);
+
+  return newest;
+}
+
+/*
+Private helper for the insert functions. Descends from start, the root or
+a node from finger_start, to the spot for a new node's key, after any
+equal keys, and links the node there.
+*/
+static void insert_by_key_(struct RBTree *tree, struct RBTreeNode *newest,
+  struct RBTreeNode *start) {
+
+  struct RBTreeNode *s = tree->nil; // Reference to sentinel.
+  struct RBTreeNode *walk = start;  // Walk starts at the root or a finger.
+  struct RBTreeNode *parent = tree->nil; // Trailing pointer used for insert.
+  int k = newest->key;
+  unsigned depth = 0; // Nodes visited, for the instrumentation.
 
   // Find the appropriate spot for the node.
   while (walk != s) { //While we haven't reached the sentinel.
     parent = walk;
+    STAT_STEP(depth);
     if (k < walk->key) {
       walk = walk->left;
     } else {
       walk = walk->right;
     }
   }
-  newest->parent = parent; //Correctly deals with the sentinel.
+  STAT_DEPTH(tree, insertDepth, depth);
+
+  insert_link(tree, parent, newest, parent != s && k < parent->key);
+}
+
+/**
+Private helper. Links a node that delete_node has detached back into the
+tree under a new key, after any equal keys, as insert would. The node is
+reused, so nothing is allocated and handles to it stay valid. With
+RBTREE_INTERVALS it becomes the point interval [key, key].
+
+@param tree The RBT the node was deleted from.
+@param node The detached node.
+@param key New key of the node.
+@param data Data of the node (delete_node clears it).
+**/
+void relink_node_(struct RBTree *tree, struct RBTreeNode *node, int key,
+  void *data) {
+  set_node_(node, NULL, tree->nil, tree->nil, key, data, RED, false);
+  insert_by_key_(tree, node, tree->root);
+}
+
+/**
+Insertion with a hint: a node of the tree next to where the new key goes,
+such as the node inserted just before it. When the key belongs directly
+after the hint, or directly before it, the new node is linked there
+without a descent, after one neighbour step. For ascending keys the hint
+is the maximum and this is O(1) plus the amortized O(1) rebalancing. A key
+that lands d positions away from the hint costs O(lg d), through
+finger_start. A NULL hint falls back to insert.
+
+@param tree The RBT receiving the new node.
+@param hint A node of the tree, or NULL.
+@param k Key associated with data.
+@param data Data associated with the node.
+@return Pointer to the new node, or NULL if no node could be allocated (or
+with RBTREE_DEBUG the hint is invalid); the tree is then left as it was.
+**/
+struct RBTreeNode* insert_hint(struct RBTree *tree, struct RBTreeNode *hint,
+  int k, void *data) {
+
+  struct RBTreeNode *newest = NULL;
+  struct RBTreeNode *next = NULL; // Neighbour of the hint on k's side.
+
+  VALIDATE(hint, false, NULL);
+  if (hint == NULL)
+    return insert(tree, k, data);
+
+  newest = init_rbtree_node(tree->pool, NULL, tree->nil, tree->nil, k,
+    data, RED, false);
+  if (newest == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  // Equal keys go after the hint, as insert puts them after existing ones.
+  if (hint->key <= k) {
+    next = hint == tree->rightmost ? NULL : successor(tree, hint);
+    if (next != NULL && next->key <= k)
+      insert_by_key_(tree, newest, finger_start(tree, hint, k));
+    else if (hint->right == tree->nil)
+      insert_link(tree, hint, newest, false);
+    else
+      insert_link(tree, next, newest, true); // next has no left child.
+  } else {
+    next = hint == tree->leftmost ? NULL : predecessor(tree, hint);
+    if (next != NULL && next->key > k)
+      insert_by_key_(tree, newest, finger_start(tree, hint, k));
+    else if (hint->left == tree->nil)
+      insert_link(tree, hint, newest, true);
+    else
+      insert_link(tree, next, newest, false); // next has no right child.
+  }
+
+  return newest;
+}
+
+/**
+Insert data into an RBT created with init_rbtree_cmp. Ordering is given
+by the tree's comparator applied to the satellite data. Equal items are
+placed after the existing ones, just as insert does for equal keys.
+
+@param tree The RBT receiving the new node.
+@param data Data item to be inserted; it is also the key.
+@return Pointer to the new node inserted into the tree, or NULL.
+**/
+struct RBTreeNode* insert_cmp(struct RBTree *tree, void *data) {
+
+  struct RBTreeNode *newest =
+    init_rbtree_node(tree->pool, NULL, tree->nil,
+      tree->nil, 0, data, RED, false);
+
+  struct RBTreeNode *s = tree->nil;
+  struct RBTreeNode *walk = tree->root;
+  struct RBTreeNode *parent = tree->nil;
+  unsigned depth = 0;
+  int order = 0;
+
+  if (newest == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  while (walk != s) {
+    parent = walk;
+    STAT_STEP(depth);
+    order = tree->cmp(data, walk->data);
+    walk = order < 0 ? walk->left : walk->right;
+  }
+  STAT_DEPTH(tree, insertDepth, depth);
+
+  insert_link(tree, parent, newest, parent != s && order < 0);
+
+  return newest;
+}
+
+/**
+Sort n keys into a freshly allocated array of batch entries. Uses a stable
+LSD radix sort (three 11-bit passes over the key with its sign bit flipped),
+so equal keys keep the order they were given in. Short batches use an
+insertion sort instead. A general qsort with a comparator callback cost
+about as much as all the descents it was meant to save. Returns NULL if the
+entries cannot be allocated.
+**/
+static struct BatchEntry* batch_sort(const int *keys, size_t n) {
+  struct BatchEntry *batch = NULL;
+  struct BatchEntry *from = NULL, *to = NULL, *swap = NULL;
+  struct BatchEntry entry;
+  size_t count[RADIX_SIZE];
+  size_t i = 0, j = 0, sum = 0, t = 0;
+  unsigned int shift = 0;
+
+  if ((batch = malloc(2 * n * sizeof(struct BatchEntry))) == NULL)
+    return NULL;
+
+  for (i = 0; i < n; i++) {
+    batch[i].key = keys[i];
+    batch[i].index = i;
+  }
+
+  if (n < RADIX_MIN) {
+    for (i = 1; i < n; i++) {
+      entry = batch[i];
+      for (j = i; j > 0 && batch[j - 1].key > entry.key; j--)
+        batch[j] = batch[j - 1];
+      batch[j] = entry;
+    }
+    return batch;
+  }
+
+  from = batch;
+  to = batch + n;
+  for (shift = 0; shift < 32; shift += RADIX_BITS) {
+    for (i = 0; i < RADIX_SIZE; i++)
+      count[i] = 0;
+    for (i = 0; i < n; i++)
+      count[RADIX_DIGIT(from[i].key, shift)]++;
+    for (i = 0, sum = 0; i < RADIX_SIZE; i++) {
+      t = count[i];
+      count[i] = sum;
+      sum += t;
+    }
+    for (i = 0; i < n; i++)
+      to[count[RADIX_DIGIT(from[i].key, shift)]++] = from[i];
+    swap = from;
+    from = to;
+    to = swap;
+  }
+
+  // Three passes leave the result in the second half.
+  for (i = 0; i < n; i++)
+    batch[i] = from[i];
+  return batch;
+}
+
+/**
+Decide whether finger descents pay off for a sorted batch. Climbing from
+the finger to the common ancestor and back down visits about 2 lg d nodes
+for a gap of d nodes between consecutive keys, against about lg n from the
+root. The climb follows parent pointers, which is slower per node than a
+descent, so fingers are only used while d * d * d < n. The gap is
+estimated from the share of the tree's key range (its cached extremes)
+that the batch spans.
+**/
+static bool batch_use_finger(struct RBTree *tree, struct BatchEntry *batch,
+  size_t n) {
+
+  double range = 0, span = 0, gap = 0;
+
+  if (tree_size(tree) == 0 || n < 2)
+    return false;
+
+  range = (double)tree->rightmost->key - (double)tree->leftmost->key;
+  span  = (double)batch[n - 1].key - (double)batch[0].key;
+  gap   = range > 0 ? tree->size * (span / range) / n : 0;
+  return gap * gap * gap < (double)tree->size;
+}
+
+/**
+Insert n keys with their satellite data. The batch is sorted first, and
+each descent starts from the node inserted just before it (the finger)
+instead of from the root: the walk climbs only as far as needed for the
+next, larger key to fit below it (see finger_start). A batch whose keys
+land close together in the tree therefore costs far less than n full
+root-to-leaf descents. Sparse batches, where climbing would cost more than
+it saves, fall back to root descents. Rebalancing is done by insert_link
+as usual.
+
+@param tree The RBT receiving the new nodes.
+@param keys Keys to insert, in any order.
+@param data Satellite data for each key, or NULL for all NULL data.
+@param n Number of keys.
+@return Number of keys inserted: n, unless memory ran out, in which case
+the keys inserted are the smallest ones of the batch.
+**/
+size_t batch_insert(struct RBTree *tree, const int *keys, void * const *data,
+  size_t n) {
+
+  struct BatchEntry *batch = NULL;
+  struct RBTreeNode *finger = NULL;
+  struct RBTreeNode *walk = NULL;
+  struct RBTreeNode *parent = NULL;
+  size_t i = 0;
+  unsigned depth = 0;
+  int k = 0;
+  bool useFinger = false;
+
+  if (n == 0)
+    return 0;
+
+  if ((batch = batch_sort(keys, n)) == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return 0;
+  }
+  useFinger = batch_use_finger(tree, batch, n);
+
+  for (i = 0; i < n; i++) {
+    k = batch[i].key;
+    walk = useFinger && finger != NULL ? finger_start(tree, finger, k) : tree->root;
+    parent = tree->nil;
+    depth = 0;
+
+    while (walk != tree->nil) {
+      parent = walk;
+      STAT_STEP(depth);
+      walk = k < walk->key ? walk->left : walk->right;
+    }
+    STAT_DEPTH(tree, insertDepth, depth);
+
+    finger = init_rbtree_node(tree->pool, NULL, tree->nil, tree->nil, k,
+      data != NULL ? data[batch[i].index] : NULL, RED, false);
+    if (finger == NULL) {
+      report_error(ENOMEM, MEM_ERROR);
+      break;
+    }
+    insert_link(tree, parent, finger, parent != tree->nil && k < parent->key);
+  }
+
+  free(batch);
+  return i;
+}
+
+/**
+Private helper for the batch functions and insert_hint. Given a finger
+node, find the lowest ancestor of the finger whose subtree holds every
+position where k may live. If the finger's key does not exceed k, that is
+the first ancestor reached as a left child of a parent with key greater
+than k; the finger being inside it bounds the subtree from below. If it
+is larger, it is the first reached as a right child of a parent with key
+at most k. The climb costs O(lg d) when k lies d positions from the
+finger.
+
+@param tree The RBT.
+@param finger Node of the tree, or the sentinel.
+@param k Key about to be inserted or searched.
+@return Node to start the descent for k from.
+**/
+struct RBTreeNode* finger_start(struct RBTree *tree, struct RBTreeNode *finger,
+  int k) {
+
+  struct RBTreeNode *walk = finger;
+  struct RBTreeNode *p = NULL;
+  bool after = finger == tree->nil || finger->key <= k;
+
+  while (walk != tree->root && walk != tree->nil) {
+    p = node_parent(walk);
+    if (after ? walk == p->left && k < p->key : walk == p->right && p->key <= k)
+      break;
+    walk = p;
+  }
+
+  return walk;
+}
+
+/**
+Attach a new, RED node to the tree below parent once the descent of an
+insertion has found its position, then restore the RBT properties. This
+is the key-independent half of every insert function.
+
+The cached extremes need no key comparisons: only a left child of the
+current minimum can become the new minimum, and likewise on the right.
+
+@param tree The RBT receiving the new node.
+@param parent Last node on the search path, or the sentinel if the tree is
+empty.
+@param newest New node, with both children set to the sentinel.
+@param left Is newest to become the left child of parent?
+**/
+void insert_link(struct RBTree *tree, struct RBTreeNode *parent,
+  struct RBTreeNode *newest, bool left) {
+
+  struct RBTreeNode *s = tree->nil;
+
+  set_parent(newest, parent); //Correctly deals with the sentinel.
 
   // Update pointers.
   if (parent == s) {
-    *root = newest; //Tree was empty.
-  } else if (k < parent->key) {
+    tree->root = newest; //Tree was empty.
+    tree->leftmost = newest;
+    tree->rightmost = newest;
+  } else if (left) {
     parent->left = newest;
+    if (parent == tree->leftmost)
+      tree->leftmost = newest;
   } else {
     parent->right = newest;
+    if (parent == tree->rightmost)
+      tree->rightmost = newest;
   }
-
-  insert_fixup(root, newest); //Fix any violations.
-
-  return newest;
+  if (tree->size != SIZE_UNKNOWN)
+    tree->size++;
+#ifdef RBTREE_ORDER_STATS
+  add_size_(tree, parent, 1);
+#endif
+#ifdef RBTREE_INTERVALS
+  raise_max_(tree, parent, newest->maxHigh);
+#endif
+
+  insert_fixup(tree, newest); //Fix any violations.
 }
 
 /**
@@ -186,156 +917,350 @@ a standard BST insert. There are only two possible property
 violations (See notes for full details).
 
 
-@param root Root of RBT where insertion has taken place.
+@param tree RBT where insertion has taken place.
 @param newest New node inserted into the tree which violate RBT properties.
 **/
-void insert_fixup(struct RBTreeNode **root, struct RBTreeNode *newest) {
+void insert_fixup(struct RBTree *tree, struct RBTreeNode *newest) {
 
   struct RBTreeNode *uncle = NULL; // Uncle of newest.
 
-  while(newest->parent->c == RED) { // Violation of IV
+  STAT(tree, insertFixup[0]);
+  while(node_color(node_parent(newest)) == RED) { // Violation of IV
 
     // parent is left child of grandparent.
-    if (newest->parent == newest->parent->parent->left) {
+    if (node_parent(newest) == node_parent(node_parent(newest))->left) {
 
-      uncle = newest->parent->parent->right; // Uncle is right child of grandparent.
+      uncle = node_parent(node_parent(newest))->right; // Uncle is right child of grandparent.
 
-      if (uncle->c == RED) { // Case 1
+      if (node_color(uncle) == RED) { // Case 1
+        STAT(tree, insertFixup[1]);
 
-        newest->parent->c = BLACK;        //Change parent to BLACK.
-        uncle->c = BLACK;                 //Change uncle's color to BLACK.
-        newest->parent->parent->c = RED;  //Grandparent becomes RED.
-        newest = newest->parent->parent;      //Newest violation may now be the grandparent.
+        set_color(node_parent(newest), BLACK);        //Change parent to BLACK.
+        set_color(uncle, BLACK);                 //Change uncle's color to BLACK.
+        set_color(node_parent(node_parent(newest)), RED);  //Grandparent becomes RED.
+        newest = node_parent(node_parent(newest));      //Newest violation may now be the grandparent.
 
       } else {
 
-        if (newest == newest->parent->right) { // Case 2
-          newest = newest->parent;
-          left_rotate(root, newest); //Rotate to become Case 3.
+        if (newest == node_parent(newest)->right) { // Case 2
+          STAT(tree, insertFixup[2]);
+          newest = node_parent(newest);
+          left_rotate(tree, newest); //Rotate to become Case 3.
         }
 
         // Case 3
-        newest->parent->c = BLACK; //Note: This terminates the loop.
-        newest->parent->parent->c = RED;
-        right_rotate(root, newest->parent->parent);
+        STAT(tree, insertFixup[3]);
+        set_color(node_parent(newest), BLACK); //Note: This terminates the loop.
+        set_color(node_parent(node_parent(newest)), RED);
+        right_rotate(tree, node_parent(node_parent(newest)));
 
       } // End cases 2, 3
 
     } else { // parent is right child of grandparent.
 
-      uncle = newest->parent->parent->left; // Uncle is left child of grandparent.
+      uncle = node_parent(node_parent(newest))->left; // Uncle is left child of grandparent.
 
-      if (uncle->c == RED) { // Case 4
+      if (node_color(uncle) == RED) { // Case 4
+        STAT(tree, insertFixup[4]);
 
-        newest->parent->c = BLACK; // Same idea as above.
-        uncle->c = BLACK;
-        newest->parent->parent->c = RED;
-        newest = newest->parent->parent; // Newest violation may now be the grandparent.
+        set_color(node_parent(newest), BLACK); // Same idea as above.
+        set_color(uncle, BLACK);
+        set_color(node_parent(node_parent(newest)), RED);
+        newest = node_parent(node_parent(newest)); // Newest violation may now be the grandparent.
 
       } else {
 
-        if (newest == newest->parent->left) { // Case 5
-          newest = newest->parent;
-          right_rotate(root, newest); // Rotate to become case 6. Do we right_rotate?
+        if (newest == node_parent(newest)->left) { // Case 5
+          STAT(tree, insertFixup[5]);
+          newest = node_parent(newest);
+          right_rotate(tree, newest); // Rotate to become case 6. Do we right_rotate?
         }
 
         // Case 6
-        newest->parent->c = BLACK;
-        newest->parent->parent->c = RED;
-        left_rotate(root, newest->parent->parent); // left_rotate?
+        STAT(tree, insertFixup[6]);
+        set_color(node_parent(newest), BLACK);
+        set_color(node_parent(node_parent(newest)), RED);
+        left_rotate(tree, node_parent(node_parent(newest))); // left_rotate?
 
       } // End cases 5, 6
 
     } // End parent is right child of grandparent.
   } // Corrected property IV violation.
 
-  (*root)->c = BLACK; //Correct property II violation.
+  // A RED root turning BLACK is the only way an insert adds a BLACK level.
+  if (node_color(tree->root) == RED)
+    tree->blackHeight++;
+  set_color(tree->root, BLACK); //Correct property II violation.
 
 }
 
 /**
 Search and delete function. Removes a node with the given key
-in RBT rooted at *root. First the function finds a node
+in RBT rooted at tree->root. First the function finds a node
 with the given key, then calls the delete_node function on
 that node. This function will handle freeing the memory
 associated to the removed node. Thus, this function is
 for cases where only the data associated to the given
-key is returned.
+key is returned. The removed node goes back to the tree's pool.
 
-@param root Pointer to the root pointer of the rbtree.
+@param tree The RBT.
 @param key Key of node to be removed from the tree.
 @return Pointer to data removed from the tree, or NULL if node with
 given key does not exist.
 **/
-void* search_and_delete(struct RBTreeNode **root, int key) {
+void* search_and_delete(struct RBTree *tree, int key) {
 
-  void *response = NULL;
-  struct RBTreeNode *result = search(key, *root);
+  struct RBTreeNode *result = search(tree, key);
 
   if (result == NULL) {
     return result;
   } else {
-    response = delete_node(root, result);
-    dest_rbtree_node(&result); // Handle the memory in this case.
-    return response;
+    return erase_node(tree, result);
   }
 }
 
+/**
+Delete a node the caller already holds, e.g. one returned by insert, and
+recycle it into the tree's pool. Unlike search_and_delete no search is
+done. The node must not be used afterwards.
+
+@param tree The RBT.
+@param node Node of the tree to remove.
+@return Pointer to the data of the node, or NULL (errno EINVAL) for an
+invalid node with RBTREE_DEBUG.
+**/
+void* erase_node(struct RBTree *tree, struct RBTreeNode *node) {
+
+  void *response = NULL;
+
+  VALIDATE(node, true, NULL);
+  response = delete_node(tree, node);
+  dest_rbtree_node(tree->pool, &node); // Recycle the node into the pool.
+
+  return response;
+}
+
+/**
+Change the key of a node the caller holds, keeping the node and its data.
+If the new key still sorts between the node's predecessor and successor,
+it is written in place; otherwise the node is deleted and linked back in
+under the new key, with no allocation. Either way the node lands after
+any nodes with an equal key and stays valid as a handle. O(lg n), and
+O(1) plus a neighbour step when the key stays in place. With
+RBTREE_INTERVALS the node becomes the point interval [key, key].
+
+@param tree The RBT.
+@param node Node of the tree to re-key.
+@param key New key.
+@return false (errno EINVAL) for an invalid node with RBTREE_DEBUG.
+**/
+bool rekey_node(struct RBTree *tree, struct RBTreeNode *node, int key) {
+
+  struct RBTreeNode *pred = NULL, *next = NULL;
+  void *data = NULL;
+
+  VALIDATE(node, true, false);
+  if (key == node->key)
+    return true;
+
+  pred = node == tree->leftmost ? NULL : predecessor(tree, node);
+  next = node == tree->rightmost ? NULL : successor(tree, node);
+  if ((pred == NULL || pred->key <= key) && (next == NULL || key < next->key)) {
+    node->key = key;
+#ifdef RBTREE_INTERVALS
+    node->high = key;
+    for (; node != tree->nil; node = node_parent(node))
+      fix_max_(node);
+#endif
+  } else {
+    data = delete_node(tree, node);
+    relink_node_(tree, node, key, data);
+  }
+
+  return true;
+}
+
+/**
+Search and delete for an RBT created with init_rbtree_cmp. Removes a
+node whose data compares equal to probe and recycles it into the pool.
+
+@param tree The RBT.
+@param probe Item compared against the data in the tree.
+@return Pointer to data removed from the tree, or NULL if no item compares
+equal to probe.
+**/
+void* search_and_delete_cmp(struct RBTree *tree, const void *probe) {
+
+  struct RBTreeNode *result = search_cmp(tree, probe);
+  void *response = NULL;
+
+  if (result == NULL)
+    return NULL;
+
+  response = delete_node(tree, result);
+  dest_rbtree_node(tree->pool, &result);
+  return response;
+}
+
+/**
+Search for and delete n keys. The batch is sorted first, and each search
+starts from the in-order predecessor of the node deleted before it (the
+finger) rather than from the root; see finger_start and batch_insert.
+Removed nodes are recycled into the pool, as with search_and_delete.
+
+@param tree The RBT.
+@param keys Keys to delete, in any order. A key present m times in the
+batch removes m nodes with that key.
+@param n Number of keys.
+@param removed If not NULL, removed[i] receives the data of the node deleted
+for keys[i], or NULL if no node with that key was found.
+@return Number of nodes deleted; 0 with nothing deleted if the batch could
+not be sorted for lack of memory.
+**/
+size_t batch_delete(struct RBTree *tree, const int *keys, size_t n,
+  void **removed) {
+
+  struct BatchEntry *batch = NULL;
+  struct RBTreeNode *finger = NULL;
+  struct RBTreeNode *walk = NULL;
+  void *response = NULL;
+  size_t i = 0, count = 0;
+  int k = 0;
+  bool useFinger = false;
+
+  if (n == 0)
+    return 0;
+
+  if ((batch = batch_sort(keys, n)) == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return 0;
+  }
+  useFinger = batch_use_finger(tree, batch, n);
+
+  for (i = 0; i < n; i++) {
+    k = batch[i].key;
+
+    if (finger != NULL && finger->key == k) {
+      walk = finger; // The finger itself is a match.
+    } else {
+      walk = useFinger && finger != NULL ? finger_start(tree, finger, k) : tree->root;
+      while (walk != tree->nil && walk->key != k)
+        walk = k < walk->key ? walk->left : walk->right;
+    }
+
+    response = NULL;
+    if (walk != tree->nil) {
+      finger = predecessor(tree, walk); // Survives the deletion of walk.
+      response = delete_node(tree, walk);
+      dest_rbtree_node(tree->pool, &walk);
+      count++;
+    }
+    if (removed != NULL)
+      removed[batch[i].index] = response;
+  }
+
+  free(batch);
+  return count;
+}
+
 /**
 Function for deleting nodes. Removes the node
-pointed to by node from the rbtree.
+pointed to by node from the rbtree, keeping the cached size, leftmost
+and rightmost nodes of the tree up to date.
+
+@param tree The RBT where the deletion is to take place.
+With RBTREE_DEBUG a node that is not in a tree is reported as INV_NODE
+and the tree is left alone.
 
-@param root Pointer to the root pointer of the RBT where the deletion
-is to take place.
 @param node Pointer to RBTreeNode pointer to be removed from the tree.
 @return pointer to satelite data associated to the node being removed
-from the tree.
+from the tree, or NULL (errno EINVAL) for an invalid node.
 **/
-void* delete_node(struct RBTreeNode **root, struct RBTreeNode *node) {
+void* delete_node(struct RBTree *tree, struct RBTreeNode *node) {
 
-  struct RBTreeNode *s          = (*root)->parent; // Sentinel.
+  struct RBTreeNode *s          = tree->nil; // Sentinel.
   struct RBTreeNode *deleted    = node;  //Save pointer to the node.
   struct RBTreeNode *replace    = NULL;  //Node removed or moved in T.
   struct RBTreeNode *moved      = NULL;  //Node moved to replace's position.
   void *response                = NULL;  //ptr to hold the response.
   color_t originalColor         = BLACK; //Original color of replace.
+#ifdef RBTREE_INTERVALS
+  struct RBTreeNode *lowest     = NULL;  //Deepest node whose subtree changed.
+#endif
+
+  VALIDATE(node, true, NULL);
+
+  // Keep the cached extremes valid. The minimum has no left child, so its
+  // successor is the minimum of its right subtree or else its parent.
+  if (node == tree->leftmost)
+    tree->leftmost = node->right != s ? subtree_minimum(tree, node->right) : node_parent(node);
+  if (node == tree->rightmost)
+    tree->rightmost = node->left != s ? subtree_maximum(tree, node->left) : node_parent(node);
+  if (tree->size != SIZE_UNKNOWN)
+    tree->size--;
 
   // Replace is either node to be deleted, or node to be moved.
   replace = node;
-  originalColor = replace->c;
+  originalColor = node_color(replace);
+#ifdef RBTREE_INTERVALS
+  lowest = node_parent(node);
+#endif
+
+#ifdef RBTREE_ORDER_STATS
+  // Every ancestor of the position that loses a node shrinks by one. With
+  // two children that is the successor's position instead (see Case III).
+  if (node->left == s || node->right == s)
+    add_size_(tree, node_parent(node), (size_t)-1);
+#endif
 
   if (node->left == s) { // One child on the right, or none.
 
     moved = node->right;
-    transplant(root, node, node->right); // Case I
+    transplant(tree, node, node->right); // Case I
 
   } else if (node->right == s) { // One child on the left.
 
     moved = node->left;
-    transplant(root, node, node->left); // Case II
+    transplant(tree, node, node->left); // Case II
 
   } else { // Cases III  i.e. two children.
 
-    replace = minimum(node->right); // Node will be replaced with its successor.
-    originalColor = replace->c;     // We need to save the original color of the node we're moving.
+    replace = subtree_minimum(tree, node->right); // Node will be replaced with its successor.
+    originalColor = node_color(replace);     // We need to save the original color of the node we're moving.
     moved = replace->right;         // Note, replace has no left child. This will be moved into replace's position.
-
-    if (replace->parent == node) { // Case III-A, replace = node->right.
-      moved->parent = replace; // Note: moved may be s, the sentinel.
+#ifdef RBTREE_ORDER_STATS
+    add_size_(tree, node_parent(replace), (size_t)-1); // Includes node.
+#endif
+#ifdef RBTREE_INTERVALS
+    lowest = node_parent(replace) == node ? replace : node_parent(replace);
+#endif
+
+    if (node_parent(replace) == node) { // Case III-A, replace = node->right.
+      set_parent(moved, replace); // Note: moved may be s, the sentinel.
     } else { // Case III-B, replace != node->right, but is contained in the subtree root at node->right.
-      transplant(root, replace, replace->right);
+      transplant(tree, replace, replace->right);
       replace->right = node->right;
-      replace->right->parent = replace;
+      set_parent(replace->right, replace);
     }
 
-    transplant(root, node, replace);
+    transplant(tree, node, replace);
     replace->left = node->left;
-    replace->left->parent = replace;
-    replace->c = node->c;
+    set_parent(replace->left, replace);
+    set_color(replace, node_color(node));
+#ifdef RBTREE_ORDER_STATS
+    replace->size = node->size;
+#endif
 
   }
 
-  deleted->parent = deleted; //Start conventions for deleted node.
+#ifdef RBTREE_INTERVALS
+  // The interval is gone from every subtree on the path above the deepest
+  // changed position, including the one replace moved up to.
+  for (; lowest != s; lowest = node_parent(lowest))
+    fix_max_(lowest);
+#endif
+
+  set_parent(deleted, deleted); //Start conventions for deleted node.
   deleted->right = NULL;
   deleted->left = NULL;
   response = deleted->data;
@@ -344,7 +1269,7 @@ void* delete_node(struct RBTreeNode **root, struct RBTreeNode *node) {
   // Fix any RBT property violations. Properties can only be breached if
   // originalColor is BLACk.
   if (originalColor == BLACK)
-    delete_fixup(root, moved);
+    delete_fixup(tree, moved);
 
   return response;
 }
@@ -354,51 +1279,58 @@ Function for correcting RBT-property violations after performing
 a deletion. Cases 1 - 8 depend on the color of the sibling of dblack
 and the color of its children.
 
-@param root Root of the RBT.
+@param tree The RBT.
 @param dblack Node with violation. In the while loop, dblack always indicates
 a "double" black node.
 **/
-void delete_fixup(struct RBTreeNode **root, struct RBTreeNode *dblack) {
+void delete_fixup(struct RBTree *tree, struct RBTreeNode *dblack) {
 
   struct RBTreeNode *sibling = NULL; // Sibling of dblack in while loop.
+  bool absorbed = false; // Did Case 4 or 8 take up the extra black?
 
-  while(dblack != *root && dblack->c == BLACK) {
+  STAT(tree, deleteFixup[0]);
+  while(dblack != tree->root && node_color(dblack) == BLACK) {
 
-    if (dblack == dblack->parent->left) { // Sibling must be on the RIGHT.
+    if (dblack == node_parent(dblack)->left) { // Sibling must be on the RIGHT.
 
-      sibling = dblack->parent->right; // Get the sibling.
+      sibling = node_parent(dblack)->right; // Get the sibling.
 
-      if (sibling->c == RED) { // Case 1 -> Case 2, 3, or 4.
+      if (node_color(sibling) == RED) { // Case 1 -> Case 2, 3, or 4.
+        STAT(tree, deleteFixup[1]);
 
-        sibling->c = BLACK;
-        dblack->parent->c = RED;
-        left_rotate(root, dblack->parent);
-        sibling = dblack->parent->right;
+        set_color(sibling, BLACK);
+        set_color(node_parent(dblack), RED);
+        left_rotate(tree, node_parent(dblack));
+        sibling = node_parent(dblack)->right;
 
       }
 
-      if (sibling->left->c == BLACK && sibling->right->c == BLACK) { // Case 2
+      if (node_color(sibling->left) == BLACK && node_color(sibling->right) == BLACK) { // Case 2
+        STAT(tree, deleteFixup[2]);
 
-        sibling->c = RED;
-        dblack = dblack->parent;
+        set_color(sibling, RED);
+        dblack = node_parent(dblack);
 
       } else {
 
-        if (sibling->right->c == BLACK) { // Case 3 -> Case 4
+        if (node_color(sibling->right) == BLACK) { // Case 3 -> Case 4
+          STAT(tree, deleteFixup[3]);
 
-          sibling->left->c = BLACK;
-          sibling->c = RED;
-          right_rotate(root, sibling);
-          sibling = dblack->parent->right;
+          set_color(sibling->left, BLACK);
+          set_color(sibling, RED);
+          right_rotate(tree, sibling);
+          sibling = node_parent(dblack)->right;
 
         }
 
         // Case 4
-        sibling->c = dblack->parent->c;
-        dblack->parent->c = BLACK;
-        sibling->right->c = BLACK;
-        left_rotate(root, dblack->parent);
-        dblack = *root;
+        STAT(tree, deleteFixup[4]);
+        set_color(sibling, node_color(node_parent(dblack)));
+        set_color(node_parent(dblack), BLACK);
+        set_color(sibling->right, BLACK);
+        left_rotate(tree, node_parent(dblack));
+        dblack = tree->root;
+        absorbed = true;
 
       }
 
@@ -406,38 +1338,44 @@ void delete_fixup(struct RBTreeNode **root, struct RBTreeNode *dblack) {
 
       // Mirror image of the above case. Replace left and right everywhere.
 
-      sibling = dblack->parent->left; // Get the sibling.
+      sibling = node_parent(dblack)->left; // Get the sibling.
 
-      if (sibling->c == RED) { // Case 5 -> Case 6, 7, 8
+      if (node_color(sibling) == RED) { // Case 5 -> Case 6, 7, 8
+        STAT(tree, deleteFixup[5]);
 
-        sibling->c = BLACK;
-        dblack->parent->c = RED;
-        right_rotate(root, dblack->parent);
-        sibling = dblack->parent->left;
+        set_color(sibling, BLACK);
+        set_color(node_parent(dblack), RED);
+        right_rotate(tree, node_parent(dblack));
+        sibling = node_parent(dblack)->left;
 
       }
 
-      if (sibling->right->c == BLACK && sibling->left->c == BLACK) { // Case 6
+      if (node_color(sibling->right) == BLACK && node_color(sibling->left) == BLACK) { // Case 6
+        STAT(tree, deleteFixup[6]);
 
-        dblack->c = RED;
-        dblack = dblack->parent;
+        set_color(sibling, RED);
+        dblack = node_parent(dblack);
 
       } else {
 
-        if (sibling->left->c == BLACK) { // Case 7 -> Case 8
+        if (node_color(sibling->left) == BLACK) { // Case 7 -> Case 8
+          STAT(tree, deleteFixup[7]);
 
-          sibling->right->c = BLACK;
-          sibling->c = RED;
-          left_rotate(root, sibling);
-          sibling = dblack->parent->left;
+          set_color(sibling->right, BLACK);
+          set_color(sibling, RED);
+          left_rotate(tree, sibling);
+          sibling = node_parent(dblack)->left;
 
         }
 
-        sibling->c = dblack->parent->c;
-        dblack->parent->c = BLACK;
-        dblack->left->c = BLACK;
-        right_rotate(root, dblack->parent);
-        dblack = *root;
+        // Case 8
+        STAT(tree, deleteFixup[8]);
+        set_color(sibling, node_color(node_parent(dblack)));
+        set_color(node_parent(dblack), BLACK);
+        set_color(sibling->left, BLACK);
+        right_rotate(tree, node_parent(dblack));
+        dblack = tree->root;
+        absorbed = true;
 
       }
 
@@ -445,7 +1383,11 @@ void delete_fixup(struct RBTreeNode **root, struct RBTreeNode *dblack) {
 
   } // End while
 
-  dblack->c = BLACK; // Remove red-black, double black, or the other violations.
+  // An extra black that made it up to the root is dropped, which takes one
+  // BLACK node off every path (this includes deleting the last node).
+  if (dblack == tree->root && node_color(dblack) == BLACK && !absorbed)
+    tree->blackHeight--;
+  set_color(dblack, BLACK); // Remove red-black, double black, or the other violations.
 
 }
 
@@ -453,128 +1395,197 @@ void delete_fixup(struct RBTreeNode **root, struct RBTreeNode *dblack) {
 Private utility function used in the delete procedure. Reaplaces
 the subtree rooted at node dest with subtree rooted at node src.
 
-@param root Root of RB-tree where transplant is taking place.
+@param tree RB-tree where transplant is taking place.
 @param dest Destination of replacement.
 @param src Source of replacement.
 **/
-void transplant(struct RBTreeNode **root, struct RBTreeNode *dest,
+void transplant(struct RBTree *tree, struct RBTreeNode *dest,
   struct RBTreeNode *src) {
 
-    struct RBTreeNode *s = (*root)->parent; //Sentinel.
+    struct RBTreeNode *s = tree->nil; //Sentinel.
 
-    if (dest->parent == s) {
-      *root = src; // dest is the root.
-    } else if (dest == dest->parent->left) {
-      dest->parent->left = src; // dest is the left child of its parent.
+    if (node_parent(dest) == s) {
+      tree->root = src; // dest is the root.
+    } else if (dest == node_parent(dest)->left) {
+      node_parent(dest)->left = src; // dest is the left child of its parent.
     } else {
-      dest->parent->right = src; // dest is the right child of its parent.
+      node_parent(dest)->right = src; // dest is the right child of its parent.
     }
 
     // Unconditional -- the sentinel makes the Null check unnecessary.
-    src->parent = dest->parent; // src parent ptr is updated.
+    set_parent(src, node_parent(dest)); // src parent ptr is updated.
 
   }
 
 /**
-Perform a recursive search of the RB-tree rooted at root.
-Uses the BST property for fast searches. Let h = height(T),
-then the running time of search is O(h). Since h = O(lg n)
-for RBTs, this function is efficient even for large n.
+Perform an iterative search of the RBT. Uses the BST property for fast
+searches. Let h = height(T), then the running time of search is O(h).
+Since h = O(lg n) for RBTs, this function is efficient even for large n.
 
+The loop does no per-level validation, and the next child is picked with
+a conditional move rather than a branch. When compiled with RBTREE_PREFETCH
+both children of the current node are prefetched before its key is compared.
+
+@param tree The RBT being searched.
 @param key Key associated to the node being searched.
-@param root Root of the RB-tree being searched.
 @return Pointer to node with given key, or null if search fails.
 **/
-struct RBTreeNode* search(int key, struct RBTreeNode *root) {
-  validate(root, false);
+struct RBTreeNode* search(struct RBTree *tree, int key) {
+
+  struct RBTreeNode *s = tree->nil;
+  struct RBTreeNode *walk = tree->root;
+  unsigned depth = 0; // Nodes visited, for the instrumentation.
+
+  while (walk != s) {
+    PREFETCH(walk->left);
+    PREFETCH(walk->right);
+    STAT_STEP(depth);
+    if (key == walk->key) {
+      STAT_DEPTH(tree, searchDepth, depth);
+      return walk;
+    }
+    walk = key < walk->key ? walk->left : walk->right;
+  }
+  STAT_DEPTH(tree, searchDepth, depth);
 
-  struct RBTreeNode *walk = root;
+  return NULL; // Don't return the sentinel.
+}
 
-  if (walk->isSen == true) {
-    return NULL; // Don't return the sentinel.
-  } else if (key < walk->key) {
-    search(key, walk->left);
-  } else if (key > walk->key) {
-    search(key, walk->right);
-  } else {
-    return walk;
+/**
+Iterative search of an RBT created with init_rbtree_cmp, using the tree's
+comparator between probe and the data of each node on the path.
+
+@param tree The RBT being searched.
+@param probe Item compared against the data in the tree.
+@return Pointer to a node whose data compares equal to probe, or null if
+search fails.
+**/
+struct RBTreeNode* search_cmp(struct RBTree *tree, const void *probe) {
+
+  struct RBTreeNode *s = tree->nil;
+  struct RBTreeNode *walk = tree->root;
+  unsigned depth = 0;
+  int order = 0;
+
+  while (walk != s) {
+    PREFETCH(walk->left);
+    PREFETCH(walk->right);
+    STAT_STEP(depth);
+    if ((order = tree->cmp(probe, walk->data)) == 0) {
+      STAT_DEPTH(tree, searchDepth, depth);
+      return walk;
+    }
+    walk = order < 0 ? walk->left : walk->right;
   }
+  STAT_DEPTH(tree, searchDepth, depth);
+
+  return NULL;
 }
 
 /**
-Return a pointer to the node of the RB-tree with minimum key value. The search
-is done by recursively following the left pointers of each node from the root.
+Return a pointer to the node of the RBT with minimum key value. The node
+is cached in the tree handle, so this is an O(1) operation.
 
-@param root Root of the tree to get minimum key.
+@param tree The RBT.
 @return Pointer to node of the tree with minimum key, or null if the tree is
 empty.
 **/
-struct RBTreeNode* minimum(struct RBTreeNode *root) {
-  validate(root, false);
-  if (root->isSen == true || root->left->isSen == true) // Short circuting.
-    return root;
-  else
-    minimum(root->left);
+struct RBTreeNode* minimum(struct RBTree *tree) {
+  return tree->leftmost != tree->nil ? tree->leftmost : NULL;
 }
 
 /**
-Return a pointer to the node of the RB-tree with maximum key value. The search
-is done by recursively following the right pointers of each node from the root.
+Return a pointer to the node of the RBT with maximum key value. The node
+is cached in the tree handle, so this is an O(1) operation.
 
-@param root Root of the tree to get minimum key.
+@param tree The RBT.
 @return Pointer to node of the tree with maximum key, or null if the tree is
 empty.
 **/
-struct RBTreeNode* maximum(struct RBTreeNode *root) {
-  validate(root, false);
-  if (root->isSen == true || root->right->isSen == true) // Short circuting.
+struct RBTreeNode* maximum(struct RBTree *tree) {
+  return tree->rightmost != tree->nil ? tree->rightmost : NULL;
+}
+
+/**
+Return a pointer to the node of the RB-tree with minimum key value. The search
+is done by iteratively following the left pointers of each node from the root.
+
+@param tree The RBT containing root.
+@param root Root of the (sub)tree to get minimum key.
+@return Pointer to node of the subtree with minimum key, or the sentinel if
+the subtree is empty.
+**/
+struct RBTreeNode* subtree_minimum(struct RBTree *tree, struct RBTreeNode *root) {
+  if (root == tree->nil)
     return root;
-  else
-    maximum(root->right);
+  VALIDATE(root, false, tree->nil);
+  while (root->left != tree->nil)
+    root = root->left;
+  return root;
+}
+
+/**
+Return a pointer to the node of the RB-tree with maximum key value. The search
+is done by iteratively following the right pointers of each node from the root.
+
+@param tree The RBT containing root.
+@param root Root of the (sub)tree to get maximum key.
+@return Pointer to node of the subtree with maximum key, or the sentinel if
+the subtree is empty.
+**/
+struct RBTreeNode* subtree_maximum(struct RBTree *tree, struct RBTreeNode *root) {
+  if (root == tree->nil)
+    return root;
+  VALIDATE(root, false, tree->nil);
+  while (root->right != tree->nil)
+    root = root->right;
+  return root;
 }
 
 /**
 Return a pointer to the node of the RB-tree with key that is the
 predecessor of the key given node.
 
+@param tree The RBT containing node.
 @param node Pointer to node of RB-tree to find predecessor of.
 @return pointer to predecessor node, or null.
 **/
-struct RBTreeNode* predecessor(struct RBTreeNode *node) {
-  validate(node, true);
+struct RBTreeNode* predecessor(struct RBTree *tree, struct RBTreeNode *node) {
+  VALIDATE(node, true, NULL);
 
-  if (node->left != NULL) {
-    return maximum(node->left);
+  if (node->left != tree->nil) {
+    return subtree_maximum(tree, node->left);
   }
 
-  struct RBTreeNode *trace = node->parent; //Ascending the tree.
-  while(trace != NULL && node == trace->left) {
+  struct RBTreeNode *trace = node_parent(node); //Ascending the tree.
+  while(trace != tree->nil && node == trace->left) {
     node = trace;
-    trace = trace->parent;
+    trace = node_parent(trace);
   }
-  return trace;
+  return trace != tree->nil ? trace : NULL;
 }
 
 /**
 Return a pointer to the node of the RB-tree with key that is the
 successor of key of the given node.
 
+@param tree The RBT containing node.
 @param node Pointer to node of RB-tree to find successor of.
 @return pointer to successor node, or null.
 **/
-struct RBTreeNode* successor(struct RBTreeNode *node) {
-  validate(node, true);
+struct RBTreeNode* successor(struct RBTree *tree, struct RBTreeNode *node) {
+  VALIDATE(node, true, NULL);
 
-  if (node->right != NULL) {
-    return minimum(node->right);
+  if (node->right != tree->nil) {
+    return subtree_minimum(tree, node->right);
   }
 
-  struct RBTreeNode *trace = node->parent; // Ascending the tree.
-  while(trace != NULL && node == trace->right) {
+  struct RBTreeNode *trace = node_parent(node); // Ascending the tree.
+  while(trace != tree->nil && node == trace->right) {
     node = trace;
-    trace = trace->parent;
+    trace = node_parent(trace);
   }
-  return trace;
+  return trace != tree->nil ? trace : NULL;
 
 }
 
@@ -584,17 +1595,450 @@ of the RBT rooted at walk. This function is recursive,
 and is mostly used for testing purposes, i.e. to
 check the h <= 2lg(n + 1) bound.
 
+@param tree The RBT containing walk.
 @param walk Pointer to subtree targeted for height calculation.
 @return height of the tree.
 **/
-int height(struct RBTreeNode *walk) {
-  if (walk->isSen == true)
+int height(struct RBTree *tree, struct RBTreeNode *walk) {
+
+  int left = 0, right = 0;
+
+  if (walk == tree->nil)
     return 0;
 
-  return 1 + MAX(height(walk->left), height(walk->right));
+  // MAX evaluates its arguments twice; recursing inside it is exponential.
+  left  = height(tree, walk->left);
+  right = height(tree, walk->right);
+  return 1 + MAX(left, right);
+}
+
+/**
+Black-height of the RBT: the number of BLACK nodes on any path from the
+root down to the sentinel, the root included and the sentinel not. It is
+kept up to date by every update -- it only changes when insert_fixup turns
+a RED root BLACK or delete_fixup drops an extra black at the root -- so
+unlike height this is O(1), and the tree's height is known to lie between
+bh and 2bh.
+
+@param tree The RBT.
+@return Black-height of the tree, 0 if it is empty.
+**/
+int tree_black_height(struct RBTree *tree) {
+  return tree->blackHeight;
 }
 
 
+/**
+Position an iterator at the node with minimum key. O(1), since the
+minimum is cached in the tree handle.
+
+@param tree The RBT to iterate over.
+@param iter Iterator to position.
+@return The current node, or null if the tree is empty.
+**/
+struct RBTreeNode* iter_begin(struct RBTree *tree, struct RBTreeIter *iter) {
+  iter->tree = tree;
+  iter->node = tree->leftmost;
+  return minimum(tree);
+}
+
+/**
+Position an iterator one past the node with maximum key. The iterator is
+at the end, but iter_prev moves it onto the maximum.
+
+@param tree The RBT to iterate over.
+@param iter Iterator to position.
+@return Always null.
+**/
+struct RBTreeNode* iter_end(struct RBTree *tree, struct RBTreeIter *iter) {
+  iter->tree = tree;
+  iter->node = tree->nil;
+  return NULL;
+}
+
+/**
+Position an iterator at the first node, in order, whose key is not less
+than the given key. Runs in O(lg n) with a single descent.
+
+@param tree The RBT to iterate over.
+@param iter Iterator to position.
+@param key Key to seek.
+@return The current node, or null if every key is less than key.
+**/
+struct RBTreeNode* iter_lower_bound(struct RBTree *tree,
+  struct RBTreeIter *iter, int key) {
+
+  struct RBTreeNode *walk = tree->root;
+
+  iter->tree = tree;
+  iter->node = tree->nil;
+  while (walk != tree->nil) {
+    if (walk->key >= key) { // Candidate; an earlier one may be on the left.
+      iter->node = walk;
+      walk = walk->left;
+    } else {
+      walk = walk->right;
+    }
+  }
+
+  return iter->node != tree->nil ? iter->node : NULL;
+}
+
+/**
+Position an iterator at the first node, in order, whose key is greater
+than the given key. Runs in O(lg n) with a single descent.
+
+@param tree The RBT to iterate over.
+@param iter Iterator to position.
+@param key Key to seek.
+@return The current node, or null if no key is greater than key.
+**/
+struct RBTreeNode* iter_upper_bound(struct RBTree *tree,
+  struct RBTreeIter *iter, int key) {
+
+  struct RBTreeNode *walk = tree->root;
+
+  iter->tree = tree;
+  iter->node = tree->nil;
+  while (walk != tree->nil) {
+    if (walk->key > key) {
+      iter->node = walk;
+      walk = walk->left;
+    } else {
+      walk = walk->right;
+    }
+  }
+
+  return iter->node != tree->nil ? iter->node : NULL;
+}
+
+/**
+Advance an iterator to the in-order successor of its current node.
+Over a full traversal every edge is crossed twice, so each step is
+amortized O(1). Advancing an iterator at the end leaves it there.
+
+@param iter Iterator to advance.
+@return The new current node, or null at the end.
+**/
+struct RBTreeNode* iter_next(struct RBTreeIter *iter) {
+  struct RBTreeNode *next = NULL;
+
+  if (iter->node != iter->tree->nil) {
+    next = successor(iter->tree, iter->node);
+    iter->node = next != NULL ? next : iter->tree->nil;
+  }
+  return next;
+}
+
+/**
+Move an iterator to the in-order predecessor of its current node. From
+the end position this is the node with maximum key. Moving back past the
+minimum puts the iterator at the end. Each step is amortized O(1).
+
+@param iter Iterator to move.
+@return The new current node, or null at the end.
+**/
+struct RBTreeNode* iter_prev(struct RBTreeIter *iter) {
+  struct RBTreeNode *prev = NULL;
+
+  if (iter->node == iter->tree->nil)
+    prev = maximum(iter->tree);
+  else
+    prev = predecessor(iter->tree, iter->node);
+
+  iter->node = prev != NULL ? prev : iter->tree->nil;
+  return prev;
+}
+
+/**
+Range query. Calls visit on every node with lo <= key < hi, in order,
+without building a list of the results. The scan stops early when visit
+returns non-zero. Runs in O(lg n + k) for k visited nodes.
+
+NOTE: visit must not insert into or delete from the tree.
+
+@param tree The RBT to scan.
+@param lo Inclusive lower bound of the range.
+@param hi Exclusive upper bound of the range.
+@param visit Callback receiving each node and ctx.
+@param ctx User pointer passed through to visit.
+@return Number of nodes visited.
+**/
+size_t range_scan(struct RBTree *tree, int lo, int hi,
+  int (*visit)(struct RBTreeNode *, void *), void *ctx) {
+
+  struct RBTreeIter iter;
+  struct RBTreeNode *node = iter_lower_bound(tree, &iter, lo);
+  size_t count = 0;
+
+  while (node != NULL && node->key < hi) {
+    count++;
+    if (visit(node, ctx) != 0)
+      break;
+    node = iter_next(&iter);
+  }
+
+  return count;
+}
+
+#ifdef RBTREE_ORDER_STATS
+
+/**
+Order statistics select. Finds the node at a given position in key order
+by comparing the position with the size of the left subtree at every level
+on the way down. Runs in O(lg n).
+
+@param tree The RBT.
+@param k 0-based position; tree_select(tree, 0) is the minimum.
+@return The node at position k, or null if k >= tree_size(tree).
+**/
+struct RBTreeNode* tree_select(struct RBTree *tree, size_t k) {
+
+  struct RBTreeNode *walk = tree->root;
+
+  while (walk != tree->nil) {
+    if (k < walk->left->size) {
+      walk = walk->left;
+    } else if (k == walk->left->size) {
+      return walk;
+    } else {
+      k -= walk->left->size + 1;
+      walk = walk->right;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+Order statistics rank. Counts the keys less than key, adding up the left
+subtrees passed over on the way down. Runs in O(lg n). For a key in the
+tree this is the position tree_select would find it at.
+
+@param tree The RBT.
+@param key Key to rank; it need not be in the tree.
+@return Number of nodes with key less than key.
+**/
+size_t tree_rank(struct RBTree *tree, int key) {
+
+  struct RBTreeNode *walk = tree->root;
+  size_t rank = 0;
+
+  while (walk != tree->nil) {
+    if (walk->key < key) {
+      rank += walk->left->size + 1;
+      walk = walk->right;
+    } else {
+      walk = walk->left;
+    }
+  }
+
+  return rank;
+}
+
+/**
+Count the keys in [lo, hi), the range visited by range_scan, in O(lg n)
+without visiting them.
+
+@param tree The RBT.
+@param lo Inclusive lower bound of the range.
+@param hi Exclusive upper bound of the range.
+@return Number of nodes with lo <= key < hi.
+**/
+size_t count_range(struct RBTree *tree, int lo, int hi) {
+  return lo < hi ? tree_rank(tree, hi) - tree_rank(tree, lo) : 0;
+}
+
+/**
+Private helper. Adds delta to the subtree size of a node and of each of
+its ancestors. (size_t)-1 subtracts one.
+
+@param tree The RBT containing node.
+@param node First node to update, or the sentinel for none.
+@param delta Amount to add, modulo SIZE_MAX + 1.
+**/
+void add_size_(struct RBTree *tree, struct RBTreeNode *node, size_t delta) {
+  for (; node != tree->nil; node = node_parent(node))
+    node->size += delta;
+}
+
+/**
+Private helper. Recomputes the subtree size of a node whose children have
+changed, such as the lower node of a rotation. The sentinel's size is 0.
+
+@param node Node to update; not the sentinel.
+**/
+void fix_size_(struct RBTreeNode *node) {
+  node->size = node->left->size + node->right->size + 1;
+}
+
+#endif
+
+#ifdef RBTREE_INTERVALS
+
+/**
+Insert the closed interval [lo, hi]. The node is ordered by lo like any
+other key, so search, iterators and range_scan see it under lo, and
+search_and_delete(tree, lo) may remove it. Runs in O(lg n).
+
+@param tree The RBT.
+@param lo Start of the interval; the key of the new node.
+@param hi End of the interval; must not be less than lo.
+@param data Satellite data of the interval.
+@return Pointer to the new node, or NULL (errno EINVAL for hi < lo,
+ENOMEM if memory ran out).
+**/
+struct RBTreeNode* insert_interval(struct RBTree *tree, int lo, int hi,
+  void *data) {
+
+  struct RBTreeNode *newest = NULL;
+
+  if (hi < lo) {
+    report_error(EINVAL, INV_INTERVAL);
+    return NULL;
+  }
+
+  newest = init_rbtree_node(tree->pool, NULL, tree->nil,
+    tree->nil, lo, data, RED, false);
+  if (newest == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  newest->high    = hi;
+  newest->maxHigh = hi;
+
+  insert_by_key_(tree, newest, tree->root);
+
+  return newest;
+}
+
+/**
+Overlap search. Goes left whenever the left subtree reaches up to lo:
+either it holds an overlap, or no interval in the tree does, as all the
+ones to the right start later (CLRS 14.3). Runs in O(lg n).
+
+@param tree The RBT.
+@param lo Start of the query interval.
+@param hi End of the query interval.
+@return Some node whose interval overlaps [lo, hi], or NULL if none does.
+**/
+struct RBTreeNode* interval_search(struct RBTree *tree, int lo, int hi) {
+
+  struct RBTreeNode *walk = tree->root;
+
+  while (walk != tree->nil) {
+    if (walk->key <= hi && lo <= walk->high)
+      return walk;
+    walk = walk->left->maxHigh >= lo ? walk->left : walk->right;
+  }
+
+  return NULL;
+}
+
+/**
+Overlap scan. Calls visit on every node whose interval overlaps [lo, hi],
+in key order. Subtrees whose largest high is below lo are skipped, as are
+keys past hi, so the scan runs in O(min(n, (k + 1) lg n)) for k visited
+nodes. The scan stops early when visit returns non-zero.
+
+NOTE: visit must not insert into or delete from the tree.
+
+@param tree The RBT to scan.
+@param lo Start of the query interval.
+@param hi End of the query interval.
+@param visit Callback receiving each node and ctx.
+@param ctx User pointer passed through to visit.
+@return Number of nodes visited.
+**/
+size_t interval_scan(struct RBTree *tree, int lo, int hi,
+  int (*visit)(struct RBTreeNode *, void *), void *ctx) {
+
+  size_t count = 0;
+
+  interval_scan_(tree, tree->root, lo, hi, visit, ctx, &count);
+
+  return count;
+}
+
+/*
+Private helper for interval_scan: the in-order walk of one subtree.
+Returns true once visit has asked to stop.
+*/
+static bool interval_scan_(struct RBTree *tree, struct RBTreeNode *node,
+  int lo, int hi, int (*visit)(struct RBTreeNode *, void *), void *ctx,
+  size_t *count) {
+
+  if (node == tree->nil || node->maxHigh < lo)
+    return false;
+  if (interval_scan_(tree, node->left, lo, hi, visit, ctx, count))
+    return true;
+  if (node->key > hi)
+    return false; // So does everything to the right.
+  if (node->high >= lo) {
+    (*count)++;
+    if (visit(node, ctx) != 0)
+      return true;
+  }
+  return interval_scan_(tree, node->right, lo, hi, visit, ctx, count);
+}
+
+/**
+Private helper. Raises the largest high of a node and of each of its
+ancestors to at least h, stopping at the first that is already there.
+
+@param tree The RBT containing node.
+@param node First node to update, or the sentinel for none.
+@param h End of an interval added below node.
+**/
+void raise_max_(struct RBTree *tree, struct RBTreeNode *node, int h) {
+  for (; node != tree->nil && node->maxHigh < h; node = node_parent(node))
+    node->maxHigh = h;
+}
+
+/**
+Private helper. Recomputes the largest high of a node whose children have
+changed, such as the lower node of a rotation. The sentinel's is INT_MIN.
+
+@param node Node to update; not the sentinel.
+**/
+void fix_max_(struct RBTreeNode *node) {
+  node->maxHigh = MAX(node->high, MAX(node->left->maxHigh, node->right->maxHigh));
+}
+
+#endif
+
+#ifdef RBTREE_STATS
+
+/**
+Take a snapshot of the instrumentation counters of a tree. The allocation
+counters belong to the tree's pool and so cover every tree of its family
+(see init_rbtree_like); the others are the tree's own.
+
+@param tree The RBT.
+@param stats Receives the counters.
+**/
+void tree_stats(struct RBTree *tree, struct RBTreeStats *stats) {
+  *stats = tree->stats;
+  stats->nodeAllocs = tree->pool->nodeAllocs;
+  stats->nodeFrees  = tree->pool->nodeFrees;
+  stats->slabAllocs = tree->pool->slabAllocs;
+}
+
+/**
+Zero the instrumentation counters of a tree, and the allocation counters
+of its pool.
+
+@param tree The RBT.
+**/
+void tree_stats_reset(struct RBTree *tree) {
+  memset(&tree->stats, 0, sizeof(struct RBTreeStats));
+  tree->pool->nodeAllocs = 0;
+  tree->pool->nodeFrees  = 0;
+  tree->pool->slabAllocs = 0;
+}
+
+#endif
+
 /**
 Validate a the RBTreeNode pointed to by node.
 
@@ -606,25 +2050,33 @@ the chkNull parameter here specifies if a null node is considered
 invalid.
 
 Note: This function is mostly a relic from before the time
-of the sentinel node.
+of the sentinel node. The library only checks its arguments with it when
+built with RBTREE_DEBUG, to keep it off the hot paths.
 
 @param node Pointer to RBTreeNode to be validated
 @param chkNull Consider null pointers invalid?
+@return Whether the node is valid. An invalid node is reported as INV_NODE.
 **/
-void validate(struct RBTreeNode *node, bool chkNull) {
+bool validate(struct RBTreeNode *node, bool chkNull) {
 
   switch (chkNull) {
 
     case true:
-      if (node == NULL || node->parent == node)
-        display_error(INV_NODE);
+      if (node == NULL || node_parent(node) == node) {
+        report_error(EINVAL, INV_NODE);
+        return false;
+      }
       break;
 
     case false:
-      if (node != NULL && node->parent == node)
-        display_error(INV_NODE);
+      if (node != NULL && node_parent(node) == node) {
+        report_error(EINVAL, INV_NODE);
+        return false;
+      }
       break;
   }
+
+  return true;
 }
 
 /**
@@ -635,30 +2087,41 @@ preserves the BST properties.
 
 left_rotate assumes that node->right != s, the senitnel.
 
-@param root Root of the RBT containing node.
+@param tree The RBT containing node.
 @node Node of the tree to Left-Rotate.
 **/
-void left_rotate(struct RBTreeNode **root, struct RBTreeNode *node) {
+void left_rotate(struct RBTree *tree, struct RBTreeNode *node) {
 
   struct RBTreeNode *r = node->right; // r replaces node at node's position.
 
+  STAT(tree, leftRotations);
+
   node->right = r->left; // Left subtree of r becomes node's right subtree.
 
-  if (r->left->isSen == false) // Update parent pointer of r's left child.
-    r->left->parent = node;
+  if (r->left != tree->nil) // Update parent pointer of r's left child.
+    set_parent(r->left, node);
 
-  r->parent = node->parent; // r's parent becomes x's former parent.
+  set_parent(r, node_parent(node)); // r's parent becomes x's former parent.
 
-  if (node->parent->isSen == true) {        //Node was root.
-    *root = r;
-  } else if (node == node->parent->left) {  // Node is a left child.
-    node->parent->left = r;
+  if (node_parent(node) == tree->nil) {        //Node was root.
+    tree->root = r;
+  } else if (node == node_parent(node)->left) {  // Node is a left child.
+    node_parent(node)->left = r;
   } else {                                  // Node must be the right child.
-    node->parent->right = r;
+    node_parent(node)->right = r;
   }
 
   r->left = node; // Place node in it's proper place.
-  node->parent = r;
+  set_parent(node, r);
+
+#ifdef RBTREE_ORDER_STATS
+  r->size = node->size; // r now roots node's former subtree.
+  fix_size_(node);
+#endif
+#ifdef RBTREE_INTERVALS
+  r->maxHigh = node->maxHigh;
+  fix_max_(node);
+#endif
 
 }
 
@@ -670,29 +2133,40 @@ preserves the BST properties.
 
 right_rotate assumes that node->left != s, the senitnel.
 
-@param root Root of the RBT containing node.
+@param tree The RBT containing node.
 @node Node of the tree to Right-Rotate.
 **/
-void right_rotate(struct RBTreeNode **root, struct RBTreeNode *node) {
+void right_rotate(struct RBTree *tree, struct RBTreeNode *node) {
 
   struct RBTreeNode *r = node->left; // r places node in at node's position.
 
+  STAT(tree, rightRotations);
+
   node->left = r->right; //Left subtree of node becomes right subtree of r.
 
-  if (r->right->isSen == false) //s.p is meaningless here.
-    r->right->parent = node;
+  if (r->right != tree->nil) //s.p is meaningless here.
+    set_parent(r->right, node);
 
-  r->parent = node->parent; // r must take node's place.
+  set_parent(r, node_parent(node)); // r must take node's place.
 
-  if (node->parent->isSen == true) { // node is T's root.
-    *root = r;
-  } else if (node == node->parent->left) { //node is a left child.
-    node->parent->left = r;
+  if (node_parent(node) == tree->nil) { // node is T's root.
+    tree->root = r;
+  } else if (node == node_parent(node)->left) { //node is a left child.
+    node_parent(node)->left = r;
   } else {
-    node->parent->right = r; // node is a right child.
+    node_parent(node)->right = r; // node is a right child.
   }
 
   r->right = node;
-  node->parent = r;
+  set_parent(node, r);
+
+#ifdef RBTREE_ORDER_STATS
+  r->size = node->size;
+  fix_size_(node);
+#endif
+#ifdef RBTREE_INTERVALS
+  r->maxHigh = node->maxHigh;
+  fix_max_(node);
+#endif
 
 }
@@ -0,0 +1,475 @@
+#include "errors.h"
+#include "rbwide.h"
+#include<limits.h>
+#include<string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define WIDE_X86
+#endif
+
+#if WIDE_KEYS != 16
+#error "The node search assumes 16 keys per node."
+#endif
+
+static unsigned rank_scalar(const int *, unsigned, int);
+#if defined(WIDE_X86) && !defined(WIDE_SCALAR)
+static unsigned rank_avx2(const int *, unsigned, int);
+#endif
+static unsigned upper_(struct WideTree *, struct WideNode *, int);
+static struct WideNode* new_node(struct WideTree *, bool);
+static bool reserve_(struct WideTree *, int);
+static bool insert_(struct WideTree *, struct WideNode *, int, void *, int *,
+  struct WideNode **);
+static bool delete_(struct WideTree *, struct WideNode *, int, void **);
+static void rebalance_(struct WideTree *, struct WideNode *, unsigned);
+static void merge_(struct WideTree *, struct WideNode *, unsigned);
+
+/**
+Function to construct a new, empty wide-node tree.
+
+@return Pointer to the new tree handle.
+**/
+struct WideTree* init_wtree(void) {
+  return init_wtree_alloc(NULL);
+}
+
+/**
+Function to construct a new, empty wide-node tree whose nodes come from a
+pool on the given memory hooks. The node search is picked here: AVX2 if
+the CPU supports it, the scalar loop otherwise, or always the scalar loop
+when built with WIDE_SCALAR.
+
+@param allocator Memory hooks for the tree, or NULL for malloc/free.
+@return Pointer to the new tree handle, or NULL if memory ran out.
+**/
+struct WideTree* init_wtree_alloc(const struct RBTreeAllocator *allocator) {
+
+  struct RBTreePool *pool = init_rbtree_pool(allocator, sizeof(struct WideNode));
+  struct WideTree *tree = NULL;
+
+  if (pool == NULL) {
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+  tree = pool->allocator.alloc(pool->allocator.ctx, sizeof(struct WideTree));
+  if (tree == NULL) {
+    dest_rbtree_pool(&pool);
+    report_error(ENOMEM, MEM_ERROR);
+    return NULL;
+  }
+
+  tree->pool   = pool;
+  tree->size   = 0;
+  tree->height = 0;
+  tree->spare  = NULL;
+  tree->spares = 0;
+  tree->rank   = rank_scalar;
+#if defined(WIDE_X86) && !defined(WIDE_SCALAR)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    tree->rank = rank_avx2;
+#endif
+  if ((tree->root = new_node(tree, true)) == NULL) {
+    dest_wtree(&tree);
+    report_error(ENOMEM, MEM_ERROR);
+  }
+
+  return tree;
+}
+
+/**
+Function to destroy a wide-node tree. All nodes go back with the pool in
+O(#slabs). Once the tree has been destroyed the reference is nullified.
+
+CAUTION: The satellite data of the keys must be handled by the caller.
+
+@param tree Double pointer to the tree to be destroyed.
+**/
+void dest_wtree(struct WideTree **tree) {
+
+  struct RBTreePool *pool = (*tree)->pool;
+
+  pool->allocator.release(pool->allocator.ctx, *tree, sizeof(struct WideTree));
+  dest_rbtree_pool(&pool);
+  *tree = NULL;
+}
+
+/**
+Insertion function. Descends to the leaf for the key, after any equal
+keys, and inserts it there. A full node is split in two halves, and the
+first key of the right half goes up into the parent, which may split in
+turn; the tree grows at the root. Runs in O(lg n).
+
+A split cannot be undone half way up, so the nodes it may need, one per
+level plus a new root, are reserved before the descent. The reserve is
+kept between calls and only topped up after splits, so an insert either
+completes or fails before it changes anything.
+
+@param tree The tree.
+@param key Key to insert.
+@param data Satellite data of the key.
+@return Whether the key was inserted; false if memory ran out.
+**/
+bool wide_insert(struct WideTree *tree, int key, void *data) {
+
+  struct WideNode *right = NULL;
+  struct WideNode *root = NULL;
+  int up = 0;
+
+  if (!reserve_(tree, tree->height + 2)) {
+    report_error(ENOMEM, MEM_ERROR);
+    return false;
+  }
+
+  if (insert_(tree, tree->root, key, data, &up, &right)) {
+    root = new_node(tree, false);
+    root->keys[0]    = up;
+    root->u.child[0] = tree->root;
+    root->u.child[1] = right;
+    root->count      = 1;
+    tree->root = root;
+    tree->height++;
+  }
+  tree->size++;
+
+  return true;
+}
+
+/*
+Recursive helper for wide_insert. Returns whether the node was split; the
+new right node and the key that separates it then go to the caller.
+*/
+static bool insert_(struct WideTree *tree, struct WideNode *node, int key,
+  void *data, int *up, struct WideNode **right) {
+
+  int keys[WIDE_KEYS + 1];
+  void *slots[WIDE_KEYS + 2];
+  unsigned pos = upper_(tree, node, key);
+  unsigned n = node->count;
+  unsigned half = 0;
+  struct WideNode *split = NULL;
+
+  if (!node->leaf) {
+    if (!insert_(tree, node->u.child[pos], key, data, &key, &split))
+      return false;
+    data = split; // Insert the separator and the new child after it.
+  }
+
+  if (n < WIDE_KEYS) {
+    memmove(node->keys + pos + 1, node->keys + pos, (n - pos) * sizeof(int));
+    node->keys[pos] = key;
+    if (node->leaf) {
+      memmove(node->u.data + pos + 1, node->u.data + pos,
+        (n - pos) * sizeof(void *));
+      node->u.data[pos] = data;
+    } else {
+      memmove(node->u.child + pos + 2, node->u.child + pos + 1,
+        (n - pos) * sizeof(void *));
+      node->u.child[pos + 1] = data;
+    }
+    node->count++;
+    return false;
+  }
+
+  // Full: lay out all WIDE_KEYS + 1 keys, then split them.
+  memcpy(keys, node->keys, pos * sizeof(int));
+  keys[pos] = key;
+  memcpy(keys + pos + 1, node->keys + pos, (n - pos) * sizeof(int));
+  *right = new_node(tree, node->leaf);
+
+  if (node->leaf) {
+    memcpy(slots, node->u.data, pos * sizeof(void *));
+    slots[pos] = data;
+    memcpy(slots + pos + 1, node->u.data + pos, (n - pos) * sizeof(void *));
+
+    half = (WIDE_KEYS + 2) / 2;
+    memcpy(node->keys, keys, half * sizeof(int));
+    memcpy(node->u.data, slots, half * sizeof(void *));
+    memcpy((*right)->keys, keys + half, (WIDE_KEYS + 1 - half) * sizeof(int));
+    memcpy((*right)->u.data, slots + half,
+      (WIDE_KEYS + 1 - half) * sizeof(void *));
+    node->count = half;
+    (*right)->count = WIDE_KEYS + 1 - half;
+    (*right)->next = node->next;
+    node->next = *right;
+    *up = (*right)->keys[0];
+  } else {
+    memcpy(slots, node->u.child, (pos + 1) * sizeof(void *));
+    slots[pos + 1] = data;
+    memcpy(slots + pos + 2, node->u.child + pos + 1, (n - pos) * sizeof(void *));
+
+    // The middle key moves up and belongs to neither half.
+    half = WIDE_KEYS / 2;
+    memcpy(node->keys, keys, half * sizeof(int));
+    memcpy(node->u.child, slots, (half + 1) * sizeof(void *));
+    memcpy((*right)->keys, keys + half + 1, (WIDE_KEYS - half) * sizeof(int));
+    memcpy((*right)->u.child, slots + half + 1,
+      (WIDE_KEYS - half + 1) * sizeof(void *));
+    node->count = half;
+    (*right)->count = WIDE_KEYS - half;
+    *up = keys[half];
+  }
+
+  return true;
+}
+
+/**
+Search and delete function. Removes one key equal to the given key. A node
+left with fewer than WIDE_MIN keys borrows a key from a sibling, or is
+merged with it if the sibling has none to spare; the tree shrinks at the
+root. Runs in O(lg n).
+
+@param tree The tree.
+@param key Key to delete.
+@return The data of the deleted key, or NULL if the key was not found.
+**/
+void* wide_search_and_delete(struct WideTree *tree, int key) {
+
+  struct WideNode *root = tree->root;
+  void *data = NULL;
+
+  if (!delete_(tree, root, key, &data))
+    return NULL;
+
+  if (!root->leaf && root->count == 0) {
+    tree->root = root->u.child[0];
+    tree->height--;
+    pool_free_node(tree->pool, root);
+  }
+  tree->size--;
+
+  return data;
+}
+
+/*
+Recursive helper for wide_search_and_delete. Equal keys may continue past
+a separator equal to the key, so the next child is tried while the
+separator matches. Returns whether a key was deleted.
+*/
+static bool delete_(struct WideTree *tree, struct WideNode *node, int key,
+  void **data) {
+
+  unsigned pos = tree->rank(node->keys, node->count, key);
+
+  if (node->leaf) {
+    if (pos == node->count || node->keys[pos] != key)
+      return false;
+    *data = node->u.data[pos];
+    memmove(node->keys + pos, node->keys + pos + 1,
+      (node->count - pos - 1) * sizeof(int));
+    memmove(node->u.data + pos, node->u.data + pos + 1,
+      (node->count - pos - 1) * sizeof(void *));
+    node->count--;
+    return true;
+  }
+
+  for (;; pos++) {
+    if (delete_(tree, node->u.child[pos], key, data)) {
+      rebalance_(tree, node, pos);
+      return true;
+    }
+    if (pos == node->count || node->keys[pos] != key)
+      return false;
+  }
+}
+
+/* Refill child i of an inner node from a sibling if it ran low. */
+static void rebalance_(struct WideTree *tree, struct WideNode *parent,
+  unsigned i) {
+
+  struct WideNode *node = parent->u.child[i];
+  struct WideNode *left = i > 0 ? parent->u.child[i - 1] : NULL;
+  struct WideNode *right = i < parent->count ? parent->u.child[i + 1] : NULL;
+  unsigned n = node->count;
+
+  if (n >= WIDE_MIN)
+    return;
+
+  if (left != NULL && left->count > WIDE_MIN) { // Borrow the left's last.
+    memmove(node->keys + 1, node->keys, n * sizeof(int));
+    if (node->leaf) {
+      memmove(node->u.data + 1, node->u.data, n * sizeof(void *));
+      node->keys[0] = left->keys[left->count - 1];
+      node->u.data[0] = left->u.data[left->count - 1];
+      parent->keys[i - 1] = node->keys[0];
+    } else {
+      memmove(node->u.child + 1, node->u.child, (n + 1) * sizeof(void *));
+      node->keys[0] = parent->keys[i - 1];
+      node->u.child[0] = left->u.child[left->count];
+      parent->keys[i - 1] = left->keys[left->count - 1];
+    }
+    left->count--;
+    node->count++;
+  } else if (right != NULL && right->count > WIDE_MIN) { // The right's first.
+    if (node->leaf) {
+      node->keys[n] = right->keys[0];
+      node->u.data[n] = right->u.data[0];
+      memmove(right->u.data, right->u.data + 1,
+        (right->count - 1) * sizeof(void *));
+    } else {
+      node->keys[n] = parent->keys[i];
+      node->u.child[n + 1] = right->u.child[0];
+      memmove(right->u.child, right->u.child + 1,
+        right->count * sizeof(void *));
+      parent->keys[i] = right->keys[0];
+    }
+    memmove(right->keys, right->keys + 1, (right->count - 1) * sizeof(int));
+    if (node->leaf)
+      parent->keys[i] = right->keys[0];
+    right->count--;
+    node->count++;
+  } else {
+    merge_(tree, parent, left != NULL ? i - 1 : i);
+  }
+}
+
+/* Merge child i + 1 of an inner node into child i. */
+static void merge_(struct WideTree *tree, struct WideNode *parent,
+  unsigned i) {
+
+  struct WideNode *left = parent->u.child[i];
+  struct WideNode *right = parent->u.child[i + 1];
+  unsigned n = left->count;
+
+  if (left->leaf) {
+    memcpy(left->keys + n, right->keys, right->count * sizeof(int));
+    memcpy(left->u.data + n, right->u.data, right->count * sizeof(void *));
+    left->count += right->count;
+    left->next = right->next;
+  } else {
+    left->keys[n] = parent->keys[i];
+    memcpy(left->keys + n + 1, right->keys, right->count * sizeof(int));
+    memcpy(left->u.child + n + 1, right->u.child,
+      (right->count + 1) * sizeof(void *));
+    left->count += right->count + 1;
+  }
+
+  memmove(parent->keys + i, parent->keys + i + 1,
+    (parent->count - i - 1) * sizeof(int));
+  memmove(parent->u.child + i + 1, parent->u.child + i + 2,
+    (parent->count - i - 1) * sizeof(void *));
+  parent->count--;
+  pool_free_node(tree->pool, right);
+}
+
+/**
+Search the tree for a given key. Every level costs one node search over
+the keys of a node. The first key >= key is in the leaf reached or, if
+every key of that leaf is smaller, first in the next leaf.
+
+@param tree The tree.
+@param key Key to look for.
+@param data Receives the data of the key if it is found. May be NULL.
+@return Whether the key was found.
+**/
+bool wide_search(struct WideTree *tree, int key, void **data) {
+
+  struct WideNode *node = tree->root;
+  unsigned pos = 0;
+
+  while (!node->leaf)
+    node = node->u.child[tree->rank(node->keys, node->count, key)];
+
+  pos = tree->rank(node->keys, node->count, key);
+  if (pos == node->count) {
+    node = node->next;
+    pos = 0;
+  }
+  if (node == NULL || node->count == 0 || node->keys[pos] != key)
+    return false;
+
+  if (data != NULL)
+    *data = node->u.data[pos];
+  return true;
+}
+
+/**
+Number of keys in the tree.
+
+@param tree The tree.
+@return Number of keys.
+**/
+size_t wide_size(struct WideTree *tree) {
+  return tree->size;
+}
+
+/**
+Name of the node search the tree uses.
+
+@param tree The tree.
+@return "avx2" or "scalar".
+**/
+const char* wide_simd(struct WideTree *tree) {
+  return tree->rank == rank_scalar ? "scalar" : "avx2";
+}
+
+/* Number of keys <= key in a node: where an insert of key goes. */
+static unsigned upper_(struct WideTree *tree, struct WideNode *node, int key) {
+  return key == INT_MAX
+    ? node->count : tree->rank(node->keys, node->count, key + 1);
+}
+
+/* Number of the first n keys less than key, one at a time. */
+static unsigned rank_scalar(const int *keys, unsigned n, int key) {
+
+  unsigned i = 0, rank = 0;
+
+  for (i = 0; i < n; i++)
+    rank += keys[i] < key;
+  return rank;
+}
+
+#if defined(WIDE_X86) && !defined(WIDE_SCALAR)
+/*
+Number of the first n keys less than key, comparing all 16 at once. The
+unused tail of the node is compared too and masked off afterwards.
+*/
+__attribute__((target("avx2,popcnt")))
+static unsigned rank_avx2(const int *keys, unsigned n, int key) {
+
+  __m256i k = _mm256_set1_epi32(key);
+  __m256i lo = _mm256_loadu_si256((const __m256i *)keys);
+  __m256i hi = _mm256_loadu_si256((const __m256i *)(keys + 8));
+  unsigned less =
+    (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, lo)))
+    | (unsigned)_mm256_movemask_ps(
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(k, hi))) << 8;
+
+  return (unsigned)_mm_popcnt_u32(less & ((1u << n) - 1));
+}
+#endif
+
+/*
+Take a zeroed node from the reserve, or from the pool if the reserve is
+empty. Returns NULL if there is no memory.
+*/
+static struct WideNode* new_node(struct WideTree *tree, bool leaf) {
+
+  struct WideNode *node = tree->spare;
+
+  if (node != NULL) {
+    tree->spare = node->next;
+    tree->spares--;
+  } else if ((node = pool_alloc_node(tree->pool)) == NULL) {
+    return NULL;
+  }
+  memset(node, 0, sizeof(struct WideNode));
+  node->leaf = leaf;
+  return node;
+}
+
+/* Top the reserve up to n nodes. Returns false if memory ran out. */
+static bool reserve_(struct WideTree *tree, int n) {
+
+  struct WideNode *node = NULL;
+
+  while (tree->spares < n) {
+    if ((node = pool_alloc_node(tree->pool)) == NULL)
+      return false;
+    node->next = tree->spare;
+    tree->spare = node;
+    tree->spares++;
+  }
+  return true;
+}
@@ -0,0 +1,190 @@
+/*
+
+Tests for the concurrent tree. First, on one thread: data deleted while a
+read section holds it must not be released before the section ends, however
+many writes follow, and must be released by the next conc_synchronize.
+Then reader threads search the tree while one writer deletes and inserts:
+every item a reader finds must match its key and stay unreleased until the
+reader leaves its section, keys that are never deleted must always be
+found, and every deleted item must have been released exactly once when
+conc_synchronize returns, while no item still in the tree ever is.
+
+Prints "test-conc: ok" and exits with 0 if every check passes.
+
+Usage: test-conc
+
+*/
+
+#define TEST_NAME "test-conc"
+#include "test.h"
+#include "rbconc.h"
+#include<pthread.h>
+#include<stdint.h>
+
+//Constants
+#define KEYS    1000  // Even keys stay, odd keys come and go.
+#define READERS 3
+#define WRITES  20000
+#define ROUNDS  20    // Writes between checks are WRITES / ROUNDS.
+#define LOOKUPS 16    // Lookups per read section.
+
+// Data of a node; never freed, so late readers cannot crash the test.
+struct Item {
+  int key;
+  int released; // Times release_item was called on it.
+};
+
+// Prototypes.
+void held(void);
+void stress(void);
+void* reader(void *);
+struct Item* new_item(int);
+void release_item(void *);
+uint64_t next_rand(uint64_t *);
+
+static struct RBTreeConc *conc;
+static struct Item items[KEYS + WRITES + 4 * CONC_RECLAIM];
+static size_t nitems;
+static int stop;
+
+int main(void) {
+
+  held();
+  stress();
+
+  printf("test-conc: ok\n");
+  return 0;
+}
+
+// One reader holds an item across its deletion and many later writes.
+void held(void) {
+
+  struct RBTreeReader self;
+  struct Item *item = NULL, *churn[4 * CONC_RECLAIM];
+  void *data = NULL;
+  size_t i = 0;
+
+  check((conc = init_rbtree_conc(release_item, NULL)) != NULL,
+    "init_rbtree_conc");
+  conc_reader_register(conc, &self);
+  check(conc_insert(conc, 1, item = new_item(1)), "conc_insert");
+
+  conc_read_begin(conc, &self);
+  check(conc_search(conc, 1, &data) && data == item, "conc_search");
+  check(conc_search_and_delete(conc, 1), "conc_search_and_delete");
+  check(!conc_search(conc, 1, NULL), "deleted key is gone");
+  for (i = 0; i < 4 * CONC_RECLAIM; i++) { // Enough to try reclaiming.
+    check(conc_insert(conc, 2, churn[i] = new_item(2)), "conc_insert");
+    check(conc_search_and_delete(conc, 2), "conc_search_and_delete");
+  }
+  check(item->released == 0, "no release inside a section");
+  conc_read_end(&self);
+
+  conc_synchronize(conc);
+  check(item->released == 1, "release after conc_synchronize");
+  for (i = 0; i < 4 * CONC_RECLAIM; i++)
+    check(churn[i]->released == 1, "release after conc_synchronize");
+
+  conc_reader_unregister(conc, &self);
+  dest_rbtree_conc(&conc);
+}
+
+// Readers against one writer, the main thread.
+void stress(void) {
+
+  pthread_t threads[READERS];
+  struct Item *live[KEYS] = { NULL };
+  struct Item *gone[WRITES];
+  uint64_t seed = 88172645463325252ULL;
+  size_t ngone = 0, write = 0, i = 0;
+  int k = 0;
+
+  nitems = 0;
+  check((conc = init_rbtree_conc(release_item, NULL)) != NULL,
+    "init_rbtree_conc");
+  for (k = 0; k < KEYS; k += 2)
+    check(conc_insert(conc, k, live[k] = new_item(k)), "conc_insert");
+  for (i = 0; i < READERS; i++)
+    check(pthread_create(&threads[i], NULL, reader, (void *)(i + 1)) == 0,
+      "pthread_create");
+
+  for (write = 1; write <= WRITES; write++) {
+    k = (int)(next_rand(&seed) % (KEYS / 2)) * 2 + 1;
+    if (live[k] != NULL) {
+      check(conc_search_and_delete(conc, k), "conc_search_and_delete");
+      gone[ngone++] = live[k];
+      live[k] = NULL;
+    } else {
+      check(conc_insert(conc, k, live[k] = new_item(k)), "conc_insert");
+    }
+
+    if (write % (WRITES / ROUNDS) == 0) {
+      conc_synchronize(conc);
+      for (i = 0; i < ngone; i++)
+        check(__atomic_load_n(&gone[i]->released, __ATOMIC_RELAXED) == 1,
+          "deleted items released once by conc_synchronize");
+      for (k = 0; k < KEYS; k++)
+        check(live[k] == NULL || live[k]->released == 0,
+          "items in the tree are not released");
+    }
+  }
+
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < READERS; i++)
+    pthread_join(threads[i], NULL);
+  dest_rbtree_conc(&conc);
+}
+
+// Search random keys in short sections until stopped.
+void* reader(void *arg) {
+
+  struct RBTreeReader self;
+  struct Item *found[LOOKUPS];
+  uint64_t seed = (uint64_t)(uintptr_t)arg * 0x9E3779B97F4A7C15ULL;
+  void *data = NULL;
+  size_t i = 0;
+  int k = 0;
+
+  conc_reader_register(conc, &self);
+  while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+    conc_read_begin(conc, &self);
+    for (i = 0; i < LOOKUPS; i++) {
+      k = (int)(next_rand(&seed) % KEYS);
+      found[i] = NULL;
+      if (conc_search(conc, k, &data)) {
+        found[i] = data;
+        check(found[i]->key == k, "found item matches its key");
+      } else {
+        check(k % 2 == 1, "kept keys are always found");
+      }
+    }
+    // Everything found in the section is still unreleased at its end.
+    for (i = 0; i < LOOKUPS; i++)
+      check(found[i] == NULL ||
+        __atomic_load_n(&found[i]->released, __ATOMIC_RELAXED) == 0,
+        "no release inside a section");
+    conc_read_end(&self);
+  }
+  conc_reader_unregister(conc, &self);
+
+  return NULL;
+}
+
+// The next unused item, for the writer.
+struct Item* new_item(int key) {
+  check(nitems < sizeof(items) / sizeof(items[0]), "item supply");
+  items[nitems].key = key;
+  items[nitems].released = 0;
+  return &items[nitems++];
+}
+
+void release_item(void *data) {
+  __atomic_add_fetch(&((struct Item *)data)->released, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t next_rand(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
@@ -0,0 +1,119 @@
+/*
+
+Tests for the node checks compiled in with RBTREE_DEBUG. Empties trees of
+a few sizes by deleting every key, then calls minimum, maximum,
+subtree_minimum, subtree_maximum and tree_split on them, and splits full
+trees so that one side comes out empty. None of these calls passes a bad
+node, so none may report an error or set errno, and the trees must stay
+Red-Black trees. Finally checks that a NULL node is still reported as
+INV_NODE with EINVAL.
+
+Prints "test-debug: ok" and exits with 0 if every check passes.
+
+Usage: test-debug
+
+*/
+
+#define TEST_NAME "test-debug"
+#include "test.h"
+#include "rbjoin.h"
+#include<errno.h>
+
+//Constants
+#define MAX_N 200
+
+// Prototypes.
+void count_error(const char *, void *);
+void check_empty(struct RBTree *, size_t *);
+void fill(struct RBTree *, int);
+
+int main(void) {
+
+  int sizes[4] = { 1, 2, 17, MAX_N };
+  size_t reports = 0;
+
+  set_error_handler(count_error, &reports);
+
+  for (int s = 0; s < 4; s++) {
+    int n = sizes[s];
+    struct RBTree *tree = init_rbtree(), *right = NULL;
+
+    check(tree != NULL, "init_rbtree");
+    right = init_rbtree_like(tree);
+    check(right != NULL, "init_rbtree_like");
+
+    // Empty the tree by deletes, which leave the sentinel as its own parent.
+    fill(tree, n);
+    for (int i = 0; i < n; i++)
+      search_and_delete(tree, i);
+    errno = 0;
+    check_empty(tree, &reports);
+
+    tree_split(tree, n / 2, right);
+    check_empty(tree, &reports);
+    check_empty(right, &reports);
+
+    // Split at the smallest key: everything moves and tree ends up empty.
+    fill(tree, n);
+    tree_split(tree, 0, right);
+    check(errno == 0 && reports == 0, "split at minimum");
+    check_empty(tree, &reports);
+    check(tree_size(right) == (size_t)n, "size after split at minimum");
+    check_rbtree(right);
+
+    // Split past the largest key: nothing moves and right stays empty.
+    struct RBTree *rest = init_rbtree_like(tree);
+    check(rest != NULL, "init_rbtree_like");
+    tree_split(right, n, rest);
+    check(errno == 0 && reports == 0, "split past maximum");
+    check_empty(rest, &reports);
+    check(tree_size(right) == (size_t)n, "size after split past maximum");
+    check_rbtree(right);
+
+    while (tree_size(right) > 0)
+      search_and_delete(right, minimum(right)->key);
+    check_empty(right, &reports);
+
+    dest_rbtree(&rest);
+    dest_rbtree(&right);
+    dest_rbtree(&tree);
+  }
+
+  // Bad nodes are still caught.
+  struct RBTree *tree = init_rbtree();
+  check(tree != NULL, "init_rbtree");
+  check(successor(tree, NULL) == NULL, "successor of NULL");
+  check(errno == EINVAL && reports == 1, "NULL node reported");
+  dest_rbtree(&tree);
+
+  printf("test-debug: ok\n");
+  return 0;
+}
+
+/*
+Error handler counting the reports instead of printing them.
+*/
+void count_error(const char *msg, void *arg) {
+  (void)msg;
+  (*(size_t *)arg)++;
+}
+
+/*
+Check that an empty tree answers every end query without an error.
+*/
+void check_empty(struct RBTree *tree, size_t *reports) {
+  check(tree_size(tree) == 0, "empty size");
+  check(minimum(tree) == NULL && maximum(tree) == NULL, "empty ends");
+  check(subtree_minimum(tree, tree->root) == tree->nil, "subtree_minimum");
+  check(subtree_maximum(tree, tree->root) == tree->nil, "subtree_maximum");
+  check(errno == 0 && *reports == 0, "no error on empty tree");
+  check_rbtree(tree);
+}
+
+/*
+Insert the keys 0 to n - 1 in a scattered order; n must be prime to 7.
+*/
+void fill(struct RBTree *tree, int n) {
+  for (int i = 0; i < n; i++)
+    check(insert(tree, (i * 7) % n, NULL) != NULL, "insert");
+}
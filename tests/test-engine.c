@@ -25,10 +25,38 @@ Accepted commads and their formats:
 
 8. hit -- print height of the tree.
 
-9. end -- shutdown the test program.
+9. siz -- print the number of nodes in the tree.
+
+10. lbd x -- display the first node with key >= x.
+
+11. spl x -- split off the nodes with key >= x, print them, join them back.
+
+12. sel k -- display the node at 0-based position k in key order.
+
+13. rnk x -- display the number of keys less than x.
+
+14. bht -- print the black-height of the tree, kept and recomputed.
+
+15. sts -- print the instrumentation counters, then reset them.
+
+16. ivl x y -- insert the interval [x, y] into the tree.
+
+17. ovl x -- print the intervals that contain x, in key order.
+
+18. ers x -- erase the node holding x through its handle.
+
+19. rky x y -- change the key of the node holding x to y, keeping the node.
+
+20. hin x y -- insert y with the node holding x as the hint.
+
+21. end -- shutdown the test program.
+
+sel and rnk need the library built with DEFS=-DRBTREE_ORDER_STATS, sts
+needs DEFS=-DRBTREE_STATS, and ivl and ovl need DEFS=-DRBTREE_INTERVALS.
 
 */
 
+#include "rbjoin.h"
 #include "rbtree.h"
 #include<stdio.h>
 #include<stdlib.h>
@@ -43,7 +71,9 @@ Accepted commads and their formats:
   do{\
     printf("[C]: ");\
     scanf("%s", cmd);\
-    if (strcmp(cmd,"end") != 0 && strcmp(cmd,"prt") != 0 && strcmp(cmd,"rot") != 0 && strcmp(cmd,"hit") != 0) {\
+    if (strcmp(cmd,"end") != 0 && strcmp(cmd,"prt") != 0 && strcmp(cmd,"rot") != 0 && strcmp(cmd,"hit") != 0 &&\
+        strcmp(cmd,"min") != 0 && strcmp(cmd,"max") != 0 && strcmp(cmd,"siz") != 0 &&\
+        strcmp(cmd,"bht") != 0 && strcmp(cmd,"sts") != 0) {\
       scanf("%d", &param);\
     }\
   } while (0)
@@ -55,7 +85,7 @@ Accepted commads and their formats:
     char* color = NULL;\
     if (node != NULL) {\
       key = node->key;\
-      clr = node->c;\
+      clr = node_color(node);\
       if (clr == BLACK){\
         color = "BLACK";\
       } else {\
@@ -68,13 +98,26 @@ Accepted commads and their formats:
     } while (0)
 
 // Prototypes.
-void exec_ins(struct RBTreeNode **, int);
-void exec_del(struct RBTreeNode **, int);
-void exec_srh(struct RBTreeNode *, int);
-void exec_prt(struct RBTreeNode *);
-void inorder(struct RBTreeNode *);
-void exec_rot(struct RBTreeNode *);
-void exec_hit(struct RBTreeNode *);
+void exec_ins(struct RBTree *, int);
+void exec_del(struct RBTree *, int);
+void exec_srh(struct RBTree *, int);
+void exec_max(struct RBTree *);
+void exec_min(struct RBTree *);
+void exec_prt(struct RBTree *);
+void exec_lbd(struct RBTree *, int);
+void exec_rot(struct RBTree *);
+void exec_hit(struct RBTree *);
+void exec_siz(struct RBTree *);
+void exec_spl(struct RBTree *, int);
+void exec_sel(struct RBTree *, int);
+void exec_rnk(struct RBTree *, int);
+void exec_bht(struct RBTree *);
+void exec_sts(struct RBTree *);
+void exec_ivl(struct RBTree *, int);
+void exec_ovl(struct RBTree *, int);
+void exec_ers(struct RBTree *, int);
+void exec_rky(struct RBTree *, int);
+void exec_hin(struct RBTree *, int);
 
 int main(int argc, char** argv) {
 
@@ -87,24 +130,52 @@ int main(int argc, char** argv) {
   int param = 0;
 
   printf("Initalizing RBT!\n");
-  struct RBTreeNode *root = NULL;
+  struct RBTree *tree = init_rbtree();
 
   gather(cmd, param);
   while(strcmp(cmd, "end")) {
     printf("Commands: %s\n", cmd);
 
     if (strcmp(cmd,"ins") == 0) {
-      exec_ins(&root, param);
+      exec_ins(tree, param);
     } else if (strcmp(cmd,"del") == 0){
-      exec_del(&root, param);
+      exec_del(tree, param);
     } else if (strcmp(cmd,"srh") == 0) {
-      exec_srh(root, param);
+      exec_srh(tree, param);
+    } else if (strcmp(cmd,"max") == 0) {
+      exec_max(tree);
+    } else if (strcmp(cmd,"min") == 0) {
+      exec_min(tree);
     } else if (strcmp(cmd,"prt") == 0) {
-      exec_prt(root);
+      exec_prt(tree);
     } else if (strcmp(cmd,"rot") == 0) {
-      exec_rot(root);
+      exec_rot(tree);
     } else if (strcmp(cmd,"hit") == 0) {
-      exec_hit(root);
+      exec_hit(tree);
+    } else if (strcmp(cmd,"siz") == 0) {
+      exec_siz(tree);
+    } else if (strcmp(cmd,"lbd") == 0) {
+      exec_lbd(tree, param);
+    } else if (strcmp(cmd,"spl") == 0) {
+      exec_spl(tree, param);
+    } else if (strcmp(cmd,"sel") == 0) {
+      exec_sel(tree, param);
+    } else if (strcmp(cmd,"rnk") == 0) {
+      exec_rnk(tree, param);
+    } else if (strcmp(cmd,"bht") == 0) {
+      exec_bht(tree);
+    } else if (strcmp(cmd,"sts") == 0) {
+      exec_sts(tree);
+    } else if (strcmp(cmd,"ivl") == 0) {
+      exec_ivl(tree, param);
+    } else if (strcmp(cmd,"ovl") == 0) {
+      exec_ovl(tree, param);
+    } else if (strcmp(cmd,"ers") == 0) {
+      exec_ers(tree, param);
+    } else if (strcmp(cmd,"rky") == 0) {
+      exec_rky(tree, param);
+    } else if (strcmp(cmd,"hin") == 0) {
+      exec_hin(tree, param);
     } else {
       printf("Unreconized.\n");
     }
@@ -114,56 +185,227 @@ int main(int argc, char** argv) {
 
   // Testing different memory free techniques.
   printf("Shutting down!\n");
-  dest_rbtree(&root);
+  dest_rbtree(&tree);
   free(cmd);
   return 0;
 }
 
-void exec_ins(struct RBTreeNode **root, int p) {
-  if(*root == NULL)
-    *root = init_rbtree(p, NULL);
-  else
-    insert(root, p, NULL);
+void exec_ins(struct RBTree *tree, int p) {
+  insert(tree, p, NULL);
 }
 
-void exec_del(struct RBTreeNode **root, int p) {
-  search_and_delete(root, p);
+void exec_del(struct RBTree *tree, int p) {
+  search_and_delete(tree, p);
 }
 
-void exec_srh(struct RBTreeNode *root, int p) {
-  struct RBTreeNode *res = search(p, root);
+void exec_srh(struct RBTree *tree, int p) {
+  struct RBTreeNode *res = search(tree, p);
   if(res == NULL)
     printf("Search failed.\n");
   else
     print_node(res);
 }
 
-
-void exec_prt(struct RBTreeNode* root) {
-  if(root != NULL)
-    inorder(root);
+void exec_max(struct RBTree *tree) {
+  struct RBTreeNode *res = maximum(tree);
+  if(res == NULL)
+    printf("Empty tree!\n");
   else
+    print_node(res);
+}
+
+void exec_min(struct RBTree *tree) {
+  struct RBTreeNode *res = minimum(tree);
+  if(res == NULL)
     printf("Empty tree!\n");
+  else
+    print_node(res);
 }
 
-// Inorder traversal.
-void inorder(struct RBTreeNode* root) {
-  if (root->isSen != true) {
-    inorder(root->left);
-    print_node(root);
-    inorder(root->right);
+void exec_ers(struct RBTree *tree, int p) {
+  struct RBTreeNode *res = search(tree, p);
+  if(res == NULL)
+    printf("Search failed.\n");
+  else
+    erase_node(tree, res);
+}
+
+// The new key is the second parameter, read here. The node is the handle.
+void exec_rky(struct RBTree *tree, int p) {
+  struct RBTreeNode *res = search(tree, p);
+  int k = 0;
+  scanf("%d", &k);
+  if(res == NULL) {
+    printf("Search failed.\n");
+  } else {
+    rekey_node(tree, res, k);
+    print_node(res);
   }
 }
 
-void exec_rot(struct RBTreeNode *root) {
-  if (root == NULL)
+// The key is the second parameter, read here. No node holding p: no hint.
+void exec_hin(struct RBTree *tree, int p) {
+  struct RBTreeNode *hint = search(tree, p), *res = NULL;
+  int k = 0;
+  scanf("%d", &k);
+  if(hint == NULL)
+    printf("No hint.\n");
+  res = insert_hint(tree, hint, k, NULL);
+  print_node(res);
+}
+
+// Inorder traversal.
+void exec_prt(struct RBTree *tree) {
+  struct RBTreeIter iter;
+  struct RBTreeNode *node = iter_begin(tree, &iter);
+
+  if(node == NULL)
+    printf("Empty tree!\n");
+  for(; node != NULL; node = iter_next(&iter))
+    print_node(node);
+}
+
+void exec_lbd(struct RBTree *tree, int p) {
+  struct RBTreeIter iter;
+  struct RBTreeNode *res = iter_lower_bound(tree, &iter, p);
+  if(res == NULL)
+    printf("No such node.\n");
+  else
+    print_node(res);
+}
+
+void exec_rot(struct RBTree *tree) {
+  if (tree_size(tree) == 0)
     printf("Empty tree!\n");
   else
-    print_node(root);
+    print_node(tree->root);
 }
 
-void exec_hit(struct RBTreeNode *root) {
+void exec_hit(struct RBTree *tree) {
   int h = 0;
-  h = height(root);
+  h = height(tree, tree->root);
   printf("height(T) = %d\n", h);
 }
+
+void exec_siz(struct RBTree *tree) {
+  printf("size(T) = %lu\n", (unsigned long)tree_size(tree));
+}
+
+// Split at p, then join back through the minimum of the right part.
+void exec_spl(struct RBTree *tree, int p) {
+  struct RBTree *right = init_rbtree_like(tree);
+  struct RBTreeNode *mid = NULL;
+  int k = 0;
+
+  tree_split(tree, p, right);
+  printf("split(T, %d): left size = %lu, right size = %lu\n", p,
+    (unsigned long)tree_size(tree), (unsigned long)tree_size(right));
+  exec_prt(right);
+
+  if ((mid = minimum(right)) != NULL) {
+    k = mid->key;
+    search_and_delete(right, k);
+    tree_join(tree, k, NULL, right);
+  }
+  dest_rbtree(&right);
+}
+
+#ifdef RBTREE_ORDER_STATS
+void exec_sel(struct RBTree *tree, int p) {
+  struct RBTreeNode *res = p >= 0 ? tree_select(tree, (size_t)p) : NULL;
+  if(res == NULL)
+    printf("No such node.\n");
+  else
+    print_node(res);
+}
+
+void exec_rnk(struct RBTree *tree, int p) {
+  printf("rank(T, %d) = %lu\n", p, (unsigned long)tree_rank(tree, p));
+}
+#else
+void exec_sel(struct RBTree *tree, int p) {
+  (void)tree;
+  (void)p;
+  printf("Order statistics not enabled.\n");
+}
+
+void exec_rnk(struct RBTree *tree, int p) {
+  exec_sel(tree, p);
+}
+#endif
+
+// Kept black-height against the one counted down the leftmost path.
+void exec_bht(struct RBTree *tree) {
+  struct RBTreeNode *walk = tree->root;
+  int bh = 0;
+
+  for (; walk != tree->nil; walk = walk->left)
+    bh += node_color(walk) == BLACK;
+  printf("bh(T) = %d, counted = %d\n", tree_black_height(tree), bh);
+}
+
+#ifdef RBTREE_STATS
+void exec_sts(struct RBTree *tree) {
+  struct RBTreeStats stats;
+  size_t searches = 0, steps = 0;
+  int i = 0;
+
+  tree_stats(tree, &stats);
+  printf("rotations: left = %lu, right = %lu\n",
+    (unsigned long)stats.leftRotations, (unsigned long)stats.rightRotations);
+  printf("insert_fixup: calls = %lu, cases 1-6 =", (unsigned long)stats.insertFixup[0]);
+  for (i = 1; i <= 6; i++)
+    printf(" %lu", (unsigned long)stats.insertFixup[i]);
+  printf("\ndelete_fixup: calls = %lu, cases 1-8 =", (unsigned long)stats.deleteFixup[0]);
+  for (i = 1; i <= 8; i++)
+    printf(" %lu", (unsigned long)stats.deleteFixup[i]);
+  for (i = 0; i < STATS_DEPTHS; i++) {
+    searches += stats.searchDepth[i];
+    steps += i * stats.searchDepth[i];
+  }
+  printf("\nsearches = %lu, nodes visited = %lu\n", (unsigned long)searches,
+    (unsigned long)steps);
+  printf("nodes: allocated = %lu, freed = %lu\n",
+    (unsigned long)stats.nodeAllocs, (unsigned long)stats.nodeFrees);
+  tree_stats_reset(tree);
+}
+#else
+void exec_sts(struct RBTree *tree) {
+  (void)tree;
+  printf("Instrumentation not enabled.\n");
+}
+#endif
+
+#ifdef RBTREE_INTERVALS
+// The end of the interval is the second parameter, read here.
+void exec_ivl(struct RBTree *tree, int p) {
+  int hi = 0;
+  scanf("%d", &hi);
+  insert_interval(tree, p, hi, NULL);
+}
+
+static int print_interval(struct RBTreeNode *node, void *ctx) {
+  (void)ctx;
+  printf("[%d, %d]\n", node->key, node->high);
+  return 0;
+}
+
+void exec_ovl(struct RBTree *tree, int p) {
+  if (interval_scan(tree, p, p, print_interval, NULL) == 0)
+    printf("No such interval.\n");
+}
+#else
+void exec_ivl(struct RBTree *tree, int p) {
+  int hi = 0;
+  scanf("%d", &hi);
+  (void)tree;
+  (void)p;
+  printf("Interval queries not enabled.\n");
+}
+
+void exec_ovl(struct RBTree *tree, int p) {
+  (void)tree;
+  (void)p;
+  printf("Interval queries not enabled.\n");
+}
+#endif
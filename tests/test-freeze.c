@@ -0,0 +1,173 @@
+/*
+
+Tests for frozen trees. For every size from 0 to MAX_N, builds a sorted
+array of keys with gaps and runs of equal keys, sometimes reaching the ends
+of the int range, and inserts it into a tree in random order. Freezes the
+tree in both layouts and checks frozen_lower_bound, frozen_search and
+frozen_scan against the array for every key, its neighbours and the ends
+of the range. Then thaws each image and checks that the new tree holds the
+array in order and is a Red-Black tree with consistent parents and cached
+size, ends and black-height.
+
+Prints "test-freeze: ok" and exits with 0 if every check passes.
+
+Usage: test-freeze
+
+*/
+
+#define TEST_NAME "test-freeze"
+#include "test.h"
+#include "rbfreeze.h"
+#include<limits.h>
+
+//Constants
+#define MAX_N 300
+
+// Prototypes.
+void make_keys(size_t);
+void check_frozen(struct RBTreeFrozen *, size_t);
+void check_probe(struct RBTreeFrozen *, size_t, long);
+void check_thawed(struct RBTree *, size_t);
+size_t lower_bound(size_t, int);
+int next_key(int, void *, void *);
+
+static int keys[MAX_N];
+
+int main(void) {
+
+  enum freeze_layout layouts[2] = { FREEZE_EYTZINGER, FREEZE_VEB };
+  struct RBTreeFrozen *frozen = NULL;
+  struct RBTree *tree = NULL, *thawed = NULL;
+  size_t n = 0, i = 0, j = 0, order[MAX_N];
+  int l = 0;
+
+  srand(41);
+  for (n = 0; n <= MAX_N; n++) {
+    make_keys(n);
+    for (i = 0; i < n; i++)
+      order[i] = i;
+    for (i = n; i > 1; i--) { // Insert in random order.
+      j = (size_t)rand() % i;
+      l = (int)order[i - 1];
+      order[i - 1] = order[j];
+      order[j] = (size_t)l;
+    }
+    check((tree = init_rbtree()) != NULL, "init_rbtree");
+    for (i = 0; i < n; i++)
+      check(insert(tree, keys[order[i]], &keys[order[i]]) != NULL, "insert");
+
+    for (l = 0; l < 2; l++) {
+      check((frozen = tree_freeze(tree, layouts[l])) != NULL, "tree_freeze");
+      check_frozen(frozen, n);
+      check((thawed = tree_thaw(frozen, NULL)) != NULL, "tree_thaw");
+      check_thawed(thawed, n);
+      dest_rbtree(&thawed);
+      dest_rbtree_frozen(&frozen);
+      check(frozen == NULL, "dest_rbtree_frozen");
+    }
+    dest_rbtree(&tree);
+  }
+
+  printf("test-freeze: ok\n");
+  return 0;
+}
+
+// n sorted keys with gaps of 0 to 3; every third size spans the int range.
+void make_keys(size_t n) {
+
+  size_t i = 0;
+
+  for (i = 0; i < n; i++)
+    keys[i] = i == 0 ? rand() % 100 - 50 : keys[i - 1] + rand() % 4;
+  if (n % 3 == 0 && n > 0) {
+    keys[0] = INT_MIN;
+    keys[n - 1] = INT_MAX;
+  }
+}
+
+// Every search of the image agrees with the sorted array.
+void check_frozen(struct RBTreeFrozen *frozen, size_t n) {
+
+  size_t i = 0, next = 0;
+  long lo = 0, hi = 0;
+
+  check(frozen_size(frozen) == n, "frozen_size");
+  for (i = 0; i < n; i++)
+    check(frozen->keys[i] == keys[i] && *(int *)frozen->data[i] == keys[i],
+      "keys and data in order");
+
+  check_probe(frozen, n, (long)INT_MIN);
+  check_probe(frozen, n, (long)INT_MAX);
+  for (i = 0; i < n; i++) {
+    check_probe(frozen, n, (long)keys[i] - 1);
+    check_probe(frozen, n, (long)keys[i]);
+    check_probe(frozen, n, (long)keys[i] + 1);
+  }
+
+  for (i = 0; i < 10; i++) {
+    lo = n > 0 ? (long)keys[(size_t)rand() % n] - 1 : 0;
+    lo = lo < INT_MIN ? INT_MIN : lo;
+    hi = lo + rand() % 20;
+    hi = hi > INT_MAX ? INT_MAX : hi;
+    next = lower_bound(n, (int)lo);
+    check(frozen_scan(frozen, (int)lo, (int)hi, next_key, &next) ==
+      lower_bound(n, (int)hi) - lower_bound(n, (int)lo), "frozen_scan count");
+    check(next == lower_bound(n, (int)hi), "frozen_scan stops at hi");
+  }
+}
+
+// One key, if it is an int: its lower bound, and whether it is found.
+void check_probe(struct RBTreeFrozen *frozen, size_t n, long probe) {
+
+  size_t rank = 0;
+  void *data = NULL;
+  int key = (int)probe;
+
+  if (probe < INT_MIN || probe > INT_MAX)
+    return;
+  rank = lower_bound(n, key);
+  check(frozen_lower_bound(frozen, key) == rank, "frozen_lower_bound");
+  check(frozen_search(frozen, key, &data) == (rank < n && keys[rank] == key),
+    "frozen_search");
+  check(rank == n || keys[rank] != key || *(int *)data == key, "found data");
+}
+
+// The thawed tree holds the array in order and is a Red-Black tree.
+void check_thawed(struct RBTree *tree, size_t n) {
+
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+  size_t i = 0;
+
+  check(tree_size(tree) == n, "tree_size");
+  for (node = iter_begin(tree, &it); node != NULL; node = iter_next(&it), i++)
+    check(i < n && node->key == keys[i] && *(int *)node->data == keys[i],
+      "thawed keys in order");
+  check(i == n, "thawed key count");
+
+  check(check_rbtree(tree) - 1 == tree_black_height(tree),
+    "cached black-height");
+  check(n == 0 ? tree->leftmost == tree->nil && tree->rightmost == tree->nil
+    : tree->leftmost->key == keys[0] && tree->rightmost->key == keys[n - 1],
+    "cached ends");
+}
+
+// Position of the first of the n keys >= key, by a plain walk.
+size_t lower_bound(size_t n, int key) {
+
+  size_t i = 0;
+
+  while (i < n && keys[i] < key)
+    i++;
+  return i;
+}
+
+// Each scanned key is the next one of the array.
+int next_key(int key, void *data, void *ctx) {
+
+  size_t *next = ctx;
+
+  check(keys[*next] == key && *(int *)data == key, "scan order");
+  (*next)++;
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+
+Tests for type-specialized and comparator-ordered trees. Instantiates
+RBTREE_DEFINE for uint64_t keys that use the top bit, double keys on both
+sides of zero and 20-byte keys compared with memcmp, and runs a random
+history of inserts, searches and deletes on each against a count per key,
+with many equal keys. After every step the tree is a Red-Black tree whose
+in-order walk is the reference in order. The same history then runs on a
+tree made by init_rbtree_cmp whose records are ordered by a name field.
+
+Prints "test-generic: ok" and exits with 0 if every check passes.
+
+Usage: test-generic
+
+*/
+
+#define TEST_NAME "test-generic"
+#include "test.h"
+#include "rbgeneric.h"
+#include<string.h>
+
+//Constants
+#define RANGE 64
+#define STEPS 3000
+
+RBTREE_DEFINE(u64tree, uint64_t, RBTREE_CMP_NUM)
+RBTREE_DEFINE(dbltree, double, RBTREE_CMP_NUM)
+RBTREE_BYTES_KEY(digest, 20);
+RBTREE_DEFINE(digtree, struct digest, RBTREE_CMP_BYTES)
+
+// A record of the comparator-ordered tree, ordered by name.
+struct record {
+  char name[8];
+  int id;
+};
+
+// Prototypes.
+uint64_t u64_key(int);
+double dbl_key(int);
+struct digest dig_key(int);
+int cmp_records(const void *, const void *);
+void test_u64tree(void);
+void test_dbltree(void);
+void test_digtree(void);
+void test_cmp(void);
+
+static size_t counts[RANGE];
+static int tags[RANGE];
+static struct record records[RANGE][STEPS];
+
+int main(void) {
+
+  int i = 0;
+
+  for (i = 0; i < RANGE; i++)
+    tags[i] = i;
+  srand(5);
+  test_u64tree();
+  test_dbltree();
+  test_digtree();
+  test_cmp();
+
+  printf("test-generic: ok\n");
+  return 0;
+}
+
+// Key i of RANGE, increasing in i; the upper half has the top bit set.
+uint64_t u64_key(int i) {
+  return (uint64_t)i * 0x0400000000000001ULL;
+}
+
+// Key i of RANGE, increasing in i and negative for the lower half.
+double dbl_key(int i) {
+  return (i - RANGE / 2) * 0.75;
+}
+
+// Key i of RANGE, increasing in i under memcmp; only the first byte decides.
+struct digest dig_key(int i) {
+
+  struct digest key;
+
+  memset(key.bytes, 0xff - i, sizeof(key.bytes));
+  key.bytes[0] = (unsigned char)(i * 4);
+  return key;
+}
+
+// Compare records by name only, so records of equal names are equal keys.
+int cmp_records(const void *a, const void *b) {
+  return strcmp(((const struct record *)a)->name,
+    ((const struct record *)b)->name);
+}
+
+/*
+Run the random history on a generated tree: insert key i with &tags[i],
+search it, or delete it, and after each step check the tree against counts.
+cmp is the comparator the tree was generated with.
+*/
+#define TYPED_HISTORY(name, key_of, cmp)\
+void test_##name(void) {\
+\
+  struct RBTree *tree = NULL;\
+  struct RBTreeNode *node = NULL;\
+  int step = 0, i = 0;\
+  size_t j = 0;\
+\
+  memset(counts, 0, sizeof(counts));\
+  check((tree = name##_init(NULL)) != NULL, #name "_init");\
+  for (step = 0; step < STEPS; step++) {\
+    i = rand() % RANGE;\
+    switch (rand() % 3) {\
+    case 0: case 1:\
+      check((node = name##_insert(tree, key_of(i), &tags[i])) != NULL,\
+        #name "_insert");\
+      check(node->data == &tags[i], #name "_insert data");\
+      counts[i]++;\
+      break;\
+    default:\
+      check(name##_search_and_delete(tree, key_of(i)) ==\
+        (counts[i] > 0 ? &tags[i] : NULL), #name "_search_and_delete");\
+      counts[i] -= counts[i] > 0;\
+    }\
+    i = rand() % RANGE;\
+    node = name##_search(tree, key_of(i));\
+    check(counts[i] > 0 ? node != NULL && node->data == &tags[i] &&\
+      cmp(name##_key(node), key_of(i)) == 0 : node == NULL,\
+      #name "_search");\
+    check_rbtree(tree);\
+    node = minimum(tree);\
+    for (i = 0; i < RANGE; i++)\
+      for (j = 0; j < counts[i]; j++) {\
+        check(node != NULL && node->data == &tags[i] &&\
+          cmp(name##_key(node), key_of(i)) == 0, #name " key order");\
+        node = successor(tree, node);\
+      }\
+    check(node == NULL, #name " walk length");\
+  }\
+  dest_rbtree(&tree);\
+  check(tree == NULL, "dest_rbtree");\
+}
+
+TYPED_HISTORY(u64tree, u64_key, RBTREE_CMP_NUM)
+TYPED_HISTORY(dbltree, dbl_key, RBTREE_CMP_NUM)
+TYPED_HISTORY(digtree, dig_key, RBTREE_CMP_BYTES)
+
+/*
+The same history on init_rbtree_cmp. Every insert adds a new record, so
+equal names hold distinct records; deletes may return any of them.
+*/
+void test_cmp(void) {
+
+  struct RBTree *tree = NULL;
+  struct RBTreeNode *node = NULL;
+  struct record probe, *found = NULL;
+  int step = 0, i = 0;
+  size_t j = 0, made[RANGE];
+
+  memset(counts, 0, sizeof(counts));
+  memset(made, 0, sizeof(made));
+  check((tree = init_rbtree_cmp(cmp_records, NULL)) != NULL, "init_rbtree_cmp");
+  check(tree->cmp == cmp_records, "tree comparator");
+  for (step = 0; step < STEPS; step++) {
+    i = rand() % RANGE;
+    sprintf(probe.name, "r%03d", i);
+    probe.id = -1;
+    if (rand() % 3 != 2) {
+      found = &records[i][made[i]];
+      *found = probe;
+      found->id = (int)made[i]++;
+      check((node = insert_cmp(tree, found)) != NULL && node->data == found,
+        "insert_cmp");
+      counts[i]++;
+    }
+    else {
+      found = search_and_delete_cmp(tree, &probe);
+      check(counts[i] > 0 ? found != NULL && cmp_records(found, &probe) == 0 &&
+        found->id >= 0 : found == NULL, "search_and_delete_cmp");
+      counts[i] -= counts[i] > 0;
+    }
+    i = rand() % RANGE;
+    sprintf(probe.name, "r%03d", i);
+    node = search_cmp(tree, &probe);
+    check(counts[i] > 0 ? node != NULL && cmp_records(node->data, &probe) == 0
+      : node == NULL, "search_cmp");
+    check_rbtree(tree);
+    node = minimum(tree);
+    for (i = 0; i < RANGE; i++) {
+      sprintf(probe.name, "r%03d", i);
+      for (j = 0; j < counts[i]; j++) {
+        check(node != NULL && cmp_records(node->data, &probe) == 0,
+          "comparator order");
+        node = successor(tree, node);
+      }
+    }
+    check(node == NULL, "walk length");
+  }
+  dest_rbtree(&tree);
+  check(tree == NULL, "dest_rbtree");
+}
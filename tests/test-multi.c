@@ -0,0 +1,181 @@
+/*
+
+Tests for multimaps. Applies random inserts, multi_delete_one and
+multi_delete_all over a few keys, so that every key collects many values,
+and checks the map against a FIFO queue per key after every change: the
+oldest value is the one deleted, multi_delete_all releases every value
+oldest first, multi_count and the equal range give each key's values in
+insertion order, the tree holds one node per distinct key, and the entry
+pool holds one entry per value after the first of each key. Finally
+empties the map and checks that nothing is left in either pool.
+
+Prints "test-multi: ok" and exits with 0 if every check passes.
+
+Usage: test-multi
+
+*/
+
+#define TEST_NAME "test-multi"
+#include "test.h"
+#include "rbmulti.h"
+#include<stdint.h>
+
+//Constants
+#define OPS   20000
+#define RANGE 64  // Keys are in [0, RANGE).
+#define NONE  -1
+
+// Prototypes.
+void insert_value(int);
+void delete_one(int);
+void delete_all(int);
+void release_value(void *);
+void check_map(void);
+void check_key(int);
+
+static struct RBMultiMap *map;
+static int values;         // Values inserted so far; value v is v + 1.
+static int next[OPS];      // Next value of the same key, or NONE.
+static int head[RANGE];    // Oldest value of each key, or NONE.
+static int tail[RANGE];    // Newest value of each key, or NONE.
+static size_t count[RANGE];
+static int releasing;      // Key whose values release_value expects.
+
+int main(void) {
+
+  size_t i = 0;
+  int key = 0, roll = 0;
+
+  srand(43);
+  for (key = 0; key < RANGE; key++)
+    head[key] = tail[key] = NONE;
+  check((map = init_rbmulti(NULL)) != NULL, "init_rbmulti");
+
+  for (i = 0; i < OPS; i++) {
+    key = rand() % RANGE;
+    roll = rand() % 100;
+    if (roll < (i < OPS / 2 ? 70 : 45))
+      insert_value(key);
+    else if (roll < 98)
+      delete_one(key);
+    else
+      delete_all(key);
+    check_key(key);
+    if (i % 10 == 0)
+      check_map();
+  }
+
+  for (key = 0; key < RANGE; key++)
+    if (key % 2 == 0)
+      delete_all(key);
+    else
+      while (count[key] > 0)
+        delete_one(key);
+  check_map();
+  check(multi_size(map) == 0 && multi_keys(map) == 0, "emptied");
+  check(live_nodes(map->tree->pool) == 1 && live_nodes(map->entries) == 0,
+    "only the sentinel is left");
+
+  dest_rbmulti(&map);
+  check(map == NULL, "dest_rbmulti");
+
+  printf("test-multi: ok\n");
+  return 0;
+}
+
+void insert_value(int key) {
+
+  check(values < OPS, "value supply");
+  check(multi_insert(map, key, (void *)(intptr_t)(values + 1)),
+    "multi_insert");
+  next[values] = NONE;
+  if (tail[key] == NONE)
+    head[key] = values;
+  else
+    next[tail[key]] = values;
+  tail[key] = values++;
+  count[key]++;
+}
+
+// The oldest value goes.
+void delete_one(int key) {
+
+  void *data = NULL;
+
+  check(multi_delete_one(map, key, &data) == (count[key] > 0),
+    "multi_delete_one");
+  if (count[key] == 0)
+    return;
+  check((intptr_t)data == head[key] + 1, "oldest value deleted");
+  head[key] = next[head[key]];
+  if (head[key] == NONE)
+    tail[key] = NONE;
+  count[key]--;
+}
+
+// Every value goes, oldest first, through release_value.
+void delete_all(int key) {
+
+  size_t expected = count[key];
+
+  releasing = key;
+  check(multi_delete_all(map, key, release_value) == expected,
+    "multi_delete_all count");
+  check(count[key] == 0 && head[key] == NONE, "every value released");
+  tail[key] = NONE;
+  check(multi_delete_all(map, key, NULL) == 0, "no values left");
+  check(!multi_delete_one(map, key, NULL), "no value left");
+}
+
+void release_value(void *data) {
+
+  check(count[releasing] > 0, "released values of the key");
+  check((intptr_t)data == head[releasing] + 1, "released oldest first");
+  head[releasing] = next[head[releasing]];
+  count[releasing]--;
+}
+
+// Every key as in check_key, the totals of the map and its pools, and the
+// shape of its tree.
+void check_map(void) {
+
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+  size_t size = 0, keys = 0;
+  int key = 0;
+
+  for (key = 0; key < RANGE; key++) {
+    check_key(key);
+    size += count[key];
+    keys += count[key] > 0;
+  }
+  check(multi_size(map) == size, "multi_size");
+  check(multi_keys(map) == keys && tree_size(map->tree) == keys, "multi_keys");
+  check(live_nodes(map->tree->pool) == keys + 1, "one tree node per key");
+  check(live_nodes(map->entries) == size - keys, "one entry per extra value");
+  check_rbtree(map->tree);
+
+  for (node = iter_begin(map->tree, &it), key = -1; node != NULL;
+      node = iter_next(&it)) {
+    check(node->key > key, "distinct keys in order");
+    key = node->key;
+    check(((struct RBMultiNode *)node)->count == count[key], "node count");
+  }
+}
+
+// The key's values, in insertion order.
+void check_key(int key) {
+
+  struct RBMultiIter iter;
+  void *data = NULL;
+  int value = head[key];
+
+  check(multi_count(map, key) == count[key], "multi_count");
+  check(multi_equal_range(map, key, &iter) == count[key], "multi_equal_range");
+  while (multi_iter_next(&iter, &data)) {
+    check(value != NONE && (intptr_t)data == value + 1, "values in FIFO order");
+    value = next[value];
+  }
+  check(value == NONE, "every value seen");
+  check(!multi_iter_next(&iter, &data), "iterator stays done");
+}
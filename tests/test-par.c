@@ -0,0 +1,197 @@
+/*
+
+Tests for the parallel bulk operations and the work-stealing pool they run
+on. For pools of 0, 1, 2 and WORKERS workers, and without a pool, builds
+trees of several sizes from random keys with many duplicates, and from a
+single repeated key, with par_build_rbtree. Checks that each is a
+Red-Black tree of the right size and ends, holding the keys in sorted
+order with equal keys in the order they were given. Then checks
+par_reduce, with an order-sensitive hash, against a sequential fold, and
+that par_dest_rbtree releases the data of every node exactly once.
+
+Prints "test-par: ok" and exits with 0 if every check passes.
+
+Usage: test-par
+
+*/
+
+#define TEST_NAME "test-par"
+#include "test.h"
+#include "rbpar.h"
+#include<stdint.h>
+
+//Constants
+#define WORKERS 4
+#define BIG_N   100000 // Large enough to fork the sort, build and folds.
+#define HASH_P  1000003u
+
+// Accumulator of par_reduce: a polynomial hash of the keys in order.
+struct Hash {
+  uint64_t hash;
+  uint64_t power; // HASH_P to the number of keys folded.
+  size_t count;
+};
+
+// Prototypes.
+void run(size_t, int, struct RBTaskPool *);
+void check_build(struct RBTree *, size_t);
+void check_reduce(struct RBTree *, struct RBTaskPool *);
+void check_dest(struct RBTree **, size_t, struct RBTaskPool *);
+void* hash_visit(void *, struct RBTreeNode *, void *);
+void* hash_combine(void *, void *, void *);
+void release_item(void *);
+int by_key(const void *, const void *);
+
+static int keys[BIG_N];
+static void *data[BIG_N];
+static size_t order[BIG_N];   // Indices of the keys, sorted stably.
+static int released[BIG_N];
+
+int main(void) {
+
+  size_t sizes[5] = { 0, 1, 2, 1000, BIG_N };
+  size_t threads[4] = { 0, 1, 2, WORKERS };
+  struct RBTaskPool *workers = NULL;
+  size_t s = 0, t = 0;
+
+  srand(53);
+  for (s = 0; s < 5; s++) {
+    run(sizes[s], 0, NULL);
+    run(sizes[s], 1, NULL);
+  }
+  for (t = 0; t < 4; t++) {
+    check((workers = init_task_pool(threads[t])) != NULL, "init_task_pool");
+    check(task_parallelism(workers) == threads[t] + 1, "task_parallelism");
+    for (s = 0; s < 5; s++) {
+      run(sizes[s], 0, workers);
+      run(sizes[s], 1, workers);
+    }
+    dest_task_pool(&workers);
+    check(workers == NULL, "dest_task_pool");
+  }
+
+  printf("test-par: ok\n");
+  return 0;
+}
+
+/*
+Build a tree of n random keys in [0, n / 4], or of one repeated key if
+same is set, and run every check on it in workers.
+*/
+void run(size_t n, int same, struct RBTaskPool *workers) {
+
+  struct RBTree *tree = NULL;
+  size_t i = 0;
+
+  for (i = 0; i < n; i++) {
+    keys[i] = same ? 7 : rand() % (int)(n / 4 + 1);
+    data[i] = (void *)(uintptr_t)(i + 1);
+    order[i] = i;
+    released[i] = 0;
+  }
+  qsort(order, n, sizeof(size_t), by_key);
+
+  tree = par_build_rbtree(keys, data, n, NULL, workers);
+  check(tree != NULL, "par_build_rbtree");
+  check_build(tree, n);
+  check_reduce(tree, workers);
+  check_dest(&tree, n, workers);
+}
+
+/*
+The tree is a Red-Black tree of n nodes, with the cached ends of its
+shape, holding the keys in order and equal keys in input order.
+*/
+void check_build(struct RBTree *tree, size_t n) {
+
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+  size_t i = 0;
+
+  check_rbtree(tree);
+  check(tree_size(tree) == n, "tree_size");
+  check(n == 0 ? minimum(tree) == NULL && maximum(tree) == NULL :
+    minimum(tree)->data == data[order[0]] &&
+    maximum(tree)->data == data[order[n - 1]], "ends");
+  for (node = iter_begin(tree, &it); node != NULL; node = iter_next(&it)) {
+    check(i < n, "node count");
+    check(node->key == keys[order[i]] && node->data == data[order[i]],
+      "sorted and stable");
+    i++;
+  }
+  check(i == n, "every key in the tree");
+}
+
+// par_reduce gives what one fold over the nodes in key order gives.
+void check_reduce(struct RBTree *tree, struct RBTaskPool *workers) {
+
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+  struct Hash *par = NULL, *seq = NULL;
+
+  for (node = iter_begin(tree, &it); node != NULL; node = iter_next(&it))
+    seq = hash_visit(seq, node, NULL);
+  par = par_reduce(tree, hash_visit, hash_combine, NULL, workers);
+
+  check((par == NULL) == (seq == NULL), "par_reduce of an empty tree");
+  if (seq != NULL)
+    check(par->hash == seq->hash && par->power == seq->power &&
+      par->count == seq->count, "par_reduce");
+  free(par);
+  free(seq);
+}
+
+// par_dest_rbtree releases every item once and nullifies the handle.
+void check_dest(struct RBTree **tree, size_t n, struct RBTaskPool *workers) {
+
+  size_t i = 0;
+
+  par_dest_rbtree(tree, release_item, workers);
+  check(*tree == NULL, "par_dest_rbtree");
+  for (i = 0; i < n; i++)
+    check(released[i] == 1, "every item released once");
+}
+
+void* hash_visit(void *acc, struct RBTreeNode *node, void *ctx) {
+
+  struct Hash *h = acc;
+
+  (void)ctx;
+  if (h == NULL) {
+    check((h = malloc(sizeof(struct Hash))) != NULL, "malloc");
+    h->hash = 0;
+    h->power = 1;
+    h->count = 0;
+  }
+  h->hash = h->hash * HASH_P + (uint64_t)node->key;
+  h->power *= HASH_P;
+  h->count++;
+  return h;
+}
+
+// The hash of a followed by b: not commutative, so order matters.
+void* hash_combine(void *a, void *b, void *ctx) {
+
+  struct Hash *left = a, *right = b;
+
+  (void)ctx;
+  left->hash = left->hash * right->power + right->hash;
+  left->power *= right->power;
+  left->count += right->count;
+  free(right);
+  return left;
+}
+
+void release_item(void *item) {
+  __atomic_add_fetch(&released[(uintptr_t)item - 1], 1, __ATOMIC_RELAXED);
+}
+
+// Order indices by key, then by index, so equal keys keep input order.
+int by_key(const void *a, const void *b) {
+
+  size_t i = *(const size_t *)a, j = *(const size_t *)b;
+
+  if (keys[i] != keys[j])
+    return keys[i] < keys[j] ? -1 : 1;
+  return i < j ? -1 : i > j;
+}
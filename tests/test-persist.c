@@ -0,0 +1,252 @@
+/*
+
+Tests for persistent trees. Applies random inserts and deletes, keeping
+every version, and checks after each update that a few older versions
+still hold exactly what they held when they were made and are still
+Red-Black trees, and at the end that all of them are. Destroys the
+versions in random order, checking the survivors, and then checks that
+the node pool holds no node but the sentinel. Finally makes updates fail
+for want of memory at every possible allocation and checks that the
+version they started from is unchanged and nothing leaks.
+
+Prints "test-persist: ok" and exits with 0 if every check passes.
+
+Usage: test-persist
+
+*/
+
+#define TEST_NAME "test-persist"
+#include "test.h"
+#include "rbpersist.h"
+#include<errno.h>
+#include<limits.h>
+#include<stdint.h>
+#include<string.h>
+
+//Constants
+#define VERSIONS 400
+#define RANGE    300 // Keys are in [0, RANGE).
+
+// A version with the key counts it should hold.
+struct Kept {
+  struct RBTreeVersion *version;
+  int count[RANGE];
+};
+
+// Prototypes.
+void history(void);
+void out_of_memory(void);
+void check_version(struct Kept *);
+int check_tree(struct RBTreeNode *, struct RBTreeNode *, long, long, size_t *);
+int count_key(struct RBTreeNode *, void *);
+void* limited_alloc(void *, size_t);
+void limited_release(void *, void *, size_t);
+
+static struct Kept kept[VERSIONS];
+static int scanned[RANGE];
+static long allowed = -1; // Allocations left before limited_alloc fails.
+
+int main(void) {
+
+  srand(23);
+  history();
+  out_of_memory();
+
+  printf("test-persist: ok\n");
+  return 0;
+}
+
+// Keep every version of a random history and check them all along.
+void history(void) {
+
+  struct RBTreePersist *store = init_rbtree_persist(NULL);
+  struct RBTreeVersion *copy = NULL;
+  size_t sentinel = 0, i = 0, j = 0, n = 0, order[VERSIONS];
+  void *data = NULL;
+  int key = 0;
+
+  check(store != NULL, "init_rbtree_persist");
+  sentinel = live_nodes(store->pool);
+  check((kept[0].version = persist_empty(store)) != NULL, "persist_empty");
+  memset(kept[0].count, 0, sizeof(kept[0].count));
+
+  for (i = 1; i < VERSIONS; i++) {
+    key = rand() % RANGE;
+    memcpy(kept[i].count, kept[i - 1].count, sizeof(kept[i].count));
+    if (rand() % 3 != 0) { // Grow more often than shrink.
+      kept[i].version = persist_insert(kept[i - 1].version, key,
+        (void *)(intptr_t)(key + 1));
+      check(kept[i].version != NULL, "persist_insert");
+      kept[i].count[key]++;
+    } else {
+      kept[i].version = persist_delete(kept[i - 1].version, key, &data);
+      check(kept[i].version != NULL, "persist_delete");
+      if (kept[i].count[key] > 0) {
+        check((intptr_t)data == key + 1, "deleted data");
+        kept[i].count[key]--;
+      } else {
+        check(data == NULL, "no data for a missing key");
+      }
+    }
+    check_version(&kept[i]);
+    check_version(&kept[i - 1]);
+    check_version(&kept[rand() % i]);
+  }
+  for (i = 0; i < VERSIONS; i++)
+    check_version(&kept[i]);
+
+  // A snapshot outlives the handle it was taken from.
+  check((copy = persist_snapshot(kept[VERSIONS / 2].version)) != NULL,
+    "persist_snapshot");
+  dest_rbtree_version(&kept[VERSIONS / 2].version);
+  check(kept[VERSIONS / 2].version == NULL, "dest_rbtree_version");
+  kept[VERSIONS / 2].version = copy;
+  check_version(&kept[VERSIONS / 2]);
+
+  // Destroy in random order; the others must not notice.
+  for (i = 0; i < VERSIONS; i++)
+    order[i] = i;
+  for (i = VERSIONS - 1; i > 0; i--) {
+    j = (size_t)rand() % (i + 1);
+    n = order[i];
+    order[i] = order[j];
+    order[j] = n;
+  }
+  for (i = 0; i < VERSIONS; i++) {
+    dest_rbtree_version(&kept[order[i]].version);
+    if (i + 1 < VERSIONS)
+      check_version(&kept[order[i + 1 + (size_t)rand() % (VERSIONS - i - 1)]]);
+  }
+  check(live_nodes(store->pool) == sentinel, "every node released");
+
+  dest_rbtree_persist(&store);
+  check(store == NULL, "dest_rbtree_persist");
+}
+
+/*
+Let updates fail at every allocation they make in turn: each failure must
+return NULL with ENOMEM, leave the version intact and free what it made.
+*/
+void out_of_memory(void) {
+
+  struct RBTreeAllocator hooks = { limited_alloc, limited_release, NULL };
+  struct RBTreePersist *store = init_rbtree_persist(&hooks);
+  struct RBTreeVersion *next = NULL;
+  struct Kept *base = &kept[0];
+  size_t before = 0, i = 0;
+  long budget = 0;
+  int key = 0, op = 0;
+
+  check(store != NULL, "init_rbtree_persist");
+  check((base->version = persist_empty(store)) != NULL, "persist_empty");
+  memset(base->count, 0, sizeof(base->count));
+  for (i = 0; i < 200; i++) {
+    key = rand() % RANGE;
+    check((next = persist_insert(base->version, key, NULL)) != NULL,
+      "persist_insert");
+    dest_rbtree_version(&base->version);
+    base->version = next;
+    base->count[key]++;
+  }
+  set_error_handler(NULL, NULL);
+
+  for (op = 0; op < 2; op++) {
+    for (i = 0; i < 50; i++) {
+      key = rand() % RANGE;
+      if (op == 1 && base->count[key] == 0)
+        continue;
+      before = live_nodes(store->pool);
+      for (budget = 0, next = NULL; next == NULL; budget++) {
+        allowed = budget;
+        errno = 0;
+        next = op == 0 ? persist_insert(base->version, key, NULL)
+                       : persist_delete(base->version, key, NULL);
+        allowed = -1;
+        if (next == NULL) {
+          check(errno == ENOMEM, "update reports ENOMEM");
+          check(live_nodes(store->pool) == before,
+            "failed update frees its copies");
+          check_version(base);
+        }
+      }
+      dest_rbtree_version(&next);
+      check(live_nodes(store->pool) == before, "version released");
+    }
+  }
+
+  dest_rbtree_version(&base->version);
+  check(live_nodes(store->pool) == 1, "only the sentinel is left");
+  dest_rbtree_persist(&store);
+}
+
+/*
+The version holds exactly its counts, in order, and is a Red-Black tree
+of the size it caches.
+*/
+void check_version(struct Kept *kept) {
+
+  struct RBTreeVersion *version = kept->version;
+  struct RBTreeNode *nil = version->store->nil;
+  struct RBTreeNode *node = NULL;
+  size_t count = 0, total = 0;
+  int key = 0;
+
+  check(version->root == nil || node_color(version->root) == BLACK,
+    "black root");
+  check_tree(nil, version->root, (long)INT_MIN, (long)INT_MAX, &count);
+  check(count == version_size(version), "cached size");
+
+  memset(scanned, 0, sizeof(scanned));
+  check(persist_scan(version, 0, RANGE, count_key, NULL) == count,
+    "persist_scan count");
+  for (key = 0; key < RANGE; key++) {
+    check(scanned[key] == kept->count[key], "contents");
+    node = persist_search(version, key);
+    check((node != NULL) == (kept->count[key] > 0), "persist_search");
+    total += kept->count[key];
+  }
+  check(total == count, "size matches contents");
+}
+
+/*
+Check the subtree at node: keys in [lo, hi], no red node with a red
+child, equal black-heights. Counts its nodes and returns its black-height.
+*/
+int check_tree(struct RBTreeNode *nil, struct RBTreeNode *node, long lo,
+  long hi, size_t *count) {
+
+  int left = 0, right = 0;
+
+  if (node == nil)
+    return 1;
+  check(node->key >= lo && node->key <= hi, "key order");
+  check(node_color(node) == BLACK || (node_color(node->left) == BLACK &&
+    node_color(node->right) == BLACK), "no red node with a red child");
+  left = check_tree(nil, node->left, lo, node->key, count);
+  right = check_tree(nil, node->right, node->key, hi, count);
+  check(left == right, "equal black-heights");
+  (*count)++;
+  return left + (node_color(node) == BLACK);
+}
+
+int count_key(struct RBTreeNode *node, void *ctx) {
+  (void)ctx;
+  check((intptr_t)node->data == node->key + 1 || node->data == NULL, "data");
+  scanned[node->key]++;
+  return 0;
+}
+
+void* limited_alloc(void *ctx, size_t size) {
+  (void)ctx;
+  if (allowed == 0)
+    return NULL;
+  if (allowed > 0)
+    allowed--;
+  return malloc(size);
+}
+
+void limited_release(void *ctx, void *ptr, size_t size) {
+  (void)ctx;
+  (void)size;
+  free(ptr);
+}
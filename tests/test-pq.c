@@ -0,0 +1,204 @@
+/*
+
+Tests for priority queues. Applies random pushes, pops, cancels and
+decrease-keys over a few keys, so that many entries share a key, and
+checks the queue against a plain list of entries ordered by key and then
+by age: pq_peek and pq_pop give the oldest entry of the smallest key, a
+lowered entry queues up behind the entries already holding its new key,
+pq_decrease_key refuses a larger key, and the handle pq_push returned
+stays valid across decreases, whether the key changes in place or the
+node is relinked, until the entry is popped or cancelled. Checks every
+so often that the queue is a Red-Black tree with its ends cached, and
+finally pops everything in order.
+
+Prints "test-pq: ok" and exits with 0 if every check passes.
+
+Usage: test-pq
+
+*/
+
+#define TEST_NAME "test-pq"
+#include "test.h"
+#include "rbpq.h"
+#include<errno.h>
+#include<limits.h>
+
+//Constants
+#define OPS   20000
+#define RANGE 50 // Keys are in [0, RANGE).
+
+// An entry pushed into the queue; the data of its node.
+struct Entry {
+  struct RBTreeNode *node; // Handle from pq_push.
+  int key;
+  size_t age;              // Entries of a key come out by age.
+  bool queued;
+};
+
+// Prototypes.
+void push(void);
+void pop(void);
+void cancel(void);
+void decrease(void);
+struct Entry* queued_entry(void);
+struct Entry* first_entry(void);
+void check_queue(void);
+
+static struct RBTree *queue;
+static struct Entry entries[OPS];
+static size_t nentries, queued, ages;
+
+int main(void) {
+
+  size_t i = 0;
+  int roll = 0;
+
+  srand(47);
+  set_error_handler(NULL, NULL);
+  check((queue = init_rbtree()) != NULL, "init_rbtree");
+  check(pq_peek(queue) == NULL && !pq_pop(queue, NULL, NULL), "empty queue");
+
+  for (i = 0; i < OPS; i++) {
+    roll = rand() % 100;
+    if (roll < (i < OPS / 2 ? 50 : 30))
+      push();
+    else if (roll < 70)
+      decrease();
+    else if (roll < 90)
+      pop();
+    else
+      cancel();
+    check(tree_size(queue) == queued, "tree_size");
+    check(queued == 0 ? pq_peek(queue) == NULL
+      : pq_peek(queue) == first_entry()->node, "pq_peek");
+    if (i % 50 == 0)
+      check_queue();
+  }
+
+  while (queued > 0)
+    pop();
+  check_queue();
+  check(pq_peek(queue) == NULL && !pq_pop(queue, NULL, NULL), "emptied");
+  dest_rbtree(&queue);
+
+  printf("test-pq: ok\n");
+  return 0;
+}
+
+void push(void) {
+
+  struct Entry *entry = &entries[nentries++];
+
+  entry->key = rand() % RANGE;
+  entry->age = ages++;
+  entry->queued = true;
+  check((entry->node = pq_push(queue, entry->key, entry)) != NULL, "pq_push");
+  check(entry->node->key == entry->key && entry->node->data == entry,
+    "pushed node");
+  queued++;
+}
+
+// The oldest entry of the smallest key comes out.
+void pop(void) {
+
+  struct Entry *first = first_entry();
+  void *data = NULL;
+  int key = 0;
+
+  check(pq_pop(queue, &key, &data) == (first != NULL), "pq_pop");
+  if (first == NULL)
+    return;
+  check(data == first && key == first->key, "FIFO among equal keys");
+  first->queued = false;
+  queued--;
+}
+
+void cancel(void) {
+
+  struct Entry *entry = queued_entry();
+
+  if (entry == NULL)
+    return;
+  check(pq_cancel(queue, entry->node) == entry, "pq_cancel");
+  entry->queued = false;
+  queued--;
+}
+
+/*
+Lower the key of a random entry through its handle, sometimes to the key
+it has, and try to raise it too, which must fail and change nothing.
+*/
+void decrease(void) {
+
+  struct Entry *entry = queued_entry();
+  int key = 0;
+
+  if (entry == NULL)
+    return;
+  if (entry->key < INT_MAX) {
+    errno = 0;
+    check(!pq_decrease_key(queue, entry->node, entry->key + 1) &&
+      errno == EINVAL, "larger key refused");
+  }
+
+  key = entry->key - rand() % 4;
+  check(pq_decrease_key(queue, entry->node, key), "pq_decrease_key");
+  if (key < entry->key) { // It queues up behind the entries already at key.
+    entry->key = key;
+    entry->age = ages++;
+  }
+  check(entry->node->key == entry->key && entry->node->data == entry,
+    "handle stays valid");
+}
+
+// A random queued entry, or NULL if there is none.
+struct Entry* queued_entry(void) {
+
+  size_t i = 0, pick = 0;
+
+  if (queued == 0)
+    return NULL;
+  pick = (size_t)rand() % queued;
+  for (i = 0; i < nentries; i++)
+    if (entries[i].queued && pick-- == 0)
+      return &entries[i];
+  return NULL;
+}
+
+// The entry that should come out next, or NULL.
+struct Entry* first_entry(void) {
+
+  struct Entry *first = NULL;
+  size_t i = 0;
+
+  for (i = 0; i < nentries; i++)
+    if (entries[i].queued && (first == NULL || entries[i].key < first->key ||
+        (entries[i].key == first->key && entries[i].age < first->age)))
+      first = &entries[i];
+  return first;
+}
+
+/*
+The queue is a Red-Black tree of its entries, in order of key and then
+age, whose cached ends are its first and last node.
+*/
+void check_queue(void) {
+
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+  struct Entry *entry = NULL, *last = NULL;
+
+  check_rbtree(queue);
+
+  for (node = iter_begin(queue, &it); node != NULL; node = iter_next(&it)) {
+    entry = node->data;
+    check(entry->queued && entry->node == node, "queued entries");
+    check(last == NULL || last->key < entry->key ||
+      (last->key == entry->key && last->age < entry->age), "key, then age");
+    last = entry;
+  }
+  check(queued == 0 ? queue->leftmost == queue->nil :
+    queue->leftmost == first_entry()->node, "cached minimum");
+  check(last == NULL ? queue->rightmost == queue->nil :
+    queue->rightmost == last->node, "cached maximum");
+}
@@ -0,0 +1,201 @@
+/*
+
+Tests for the set operations. Builds pairs of trees of one family, where a
+has distinct keys and b may repeat them, in several shapes: overlapping at
+random, equal, disjoint with interleaved keys, disjoint with separate
+ranges, and with an empty side. Runs tree_union, tree_intersection and
+tree_difference on each pair, first with no task pool and then with a pool
+of workers on trees tall enough to fork, and checks the result against
+counts per key: which nodes of a and b survive, which data is discarded,
+and that the result is a Red-Black tree in key order and b is left empty.
+
+Prints "test-setops: ok" and exits with 0 if every check passes.
+
+Usage: test-setops
+
+*/
+
+#define TEST_NAME "test-setops"
+#include "test.h"
+#include "rbjoin.h"
+#include<string.h>
+
+//Constants
+#define WORKERS 4
+#define BIG_N 20000
+#define MAX_RANGE (4 * BIG_N)
+
+// Shapes of an operand pair.
+enum shape {
+  OVERLAP,
+  EQUAL,
+  INTERLEAVED,
+  SEPARATE,
+  EMPTY_A,
+  EMPTY_B,
+  SHAPES
+};
+
+// Satellite data of every node: its key and the operand it came from.
+struct item {
+  int key;
+  int from;
+};
+
+// Prototypes.
+void run_pair(enum shape, size_t, int, struct RBTaskPool *);
+void build(struct RBTree *, unsigned char *, int, enum shape, size_t);
+void check_result(struct RBTree *, struct RBTree *, int, int);
+void discard_item(void *);
+
+static unsigned char ca[MAX_RANGE], cb[MAX_RANGE];
+static size_t froma[MAX_RANGE], fromb[MAX_RANGE];
+static struct item items[2][2 * MAX_RANGE];
+static size_t nitems[2], discarded;
+
+int main(void) {
+
+  size_t sizes[5] = { 1, 2, 17, 300, BIG_N };
+  struct RBTaskPool *workers = NULL;
+  size_t s = 0;
+  int shape = 0, op = 0, round = 0;
+
+  srand(9);
+  check((workers = init_task_pool(WORKERS)) != NULL, "init_task_pool");
+  for (round = 0; round < 2; round++)
+    for (s = 0; s < 5; s++)
+      for (shape = 0; shape < SHAPES; shape++)
+        for (op = 0; op < 3; op++)
+          run_pair(shape, sizes[s], op, round == 0 ? NULL : workers);
+  dest_task_pool(&workers);
+  check(workers == NULL, "dest_task_pool");
+
+  printf("test-setops: ok\n");
+  return 0;
+}
+
+/*
+Build a pair of about n keys each in the given shape, run operation op
+(0 union, 1 intersection, 2 difference) in workers and check the result.
+*/
+void run_pair(enum shape shape, size_t n, int op, struct RBTaskPool *workers) {
+
+  struct RBTree *a = NULL, *b = NULL;
+  int range = (int)(2 * n), bh = 0;
+
+  nitems[0] = nitems[1] = 0;
+  discarded = 0;
+  check((a = init_rbtree()) != NULL, "init_rbtree");
+  check((b = init_rbtree_like(a)) != NULL, "init_rbtree_like");
+  build(a, ca, range, shape, 0);
+  build(b, cb, range, shape, 1);
+  bh = check_rbtree(a) - 1;
+  if (n == BIG_N && shape != EMPTY_A)
+    check(bh >= SET_PAR_BH, "operand tall enough to fork");
+
+  if (op == 0)
+    tree_union(a, b, discard_item, workers);
+  else if (op == 1)
+    tree_intersection(a, b, discard_item, workers);
+  else
+    tree_difference(a, b, discard_item, workers);
+  check_result(a, b, range, op);
+
+  dest_rbtree(&b);
+  dest_rbtree(&a);
+}
+
+/*
+Fill one operand over keys [0, range). Operand 0 (a) gets each key at most
+once, operand 1 (b) up to three times. counts receives the number of
+copies of every key.
+*/
+void build(struct RBTree *tree, unsigned char *counts, int range,
+  enum shape shape, size_t side) {
+
+  struct item *item = NULL;
+  int k = 0, copies = 0;
+
+  memset(counts, 0, (size_t)range);
+  for (k = 0; k < range; k++) {
+    switch (shape) {
+    case OVERLAP:
+      copies = side == 0 ? rand() % 2 : (rand() % 4 == 0) * (1 + rand() % 3);
+      break;
+    case EQUAL:
+      copies = k % 3 != 0;
+      break;
+    case INTERLEAVED:
+      copies = (size_t)(k % 2) == side ? 1 + (int)side * (k % 3 == 0) : 0;
+      break;
+    case SEPARATE:
+      copies = (k < range / 2) == (side == 0) ? 1 + (int)side * (k % 5 == 0) : 0;
+      break;
+    case EMPTY_A:
+      copies = side == 1 && rand() % 2;
+      break;
+    default:
+      copies = side == 0 && rand() % 2;
+    }
+    for (counts[k] = (unsigned char)copies; copies > 0; copies--) {
+      item = &items[side][nitems[side]++];
+      item->key = k;
+      item->from = (int)side;
+      check(insert(tree, k, item) != NULL, "insert");
+    }
+  }
+}
+
+/*
+Check the result left in a against the counts: a union keeps the node of a
+for every key of a and the copies of b beyond the one matched against it,
+an intersection keeps the nodes of a whose key b has, and a difference the
+nodes of a whose key b lacks. Every other item must have been discarded.
+*/
+void check_result(struct RBTree *a, struct RBTree *b, int range, int op) {
+
+  struct RBTreeNode *node = NULL;
+  struct item *item = NULL;
+  size_t total = 0, ea = 0, eb = 0;
+  int k = 0, last = -1;
+
+  check(b->root == b->nil && tree_size(b) == 0, "b emptied");
+  check(b->leftmost == b->nil && b->rightmost == b->nil, "b ends cleared");
+  check_rbtree(a);
+  memset(froma, 0, (size_t)range * sizeof(size_t));
+  memset(fromb, 0, (size_t)range * sizeof(size_t));
+  for (node = minimum(a); node != NULL; node = successor(a, node)) {
+    item = node->data;
+    check(item != NULL && item->key == node->key, "node data");
+    check(node->key >= last, "key order");
+    last = node->key;
+    if (item->from == 0)
+      froma[node->key]++;
+    else
+      fromb[node->key]++;
+  }
+
+  for (k = 0; k < range; k++) {
+    if (op == 0) {
+      ea = ca[k];
+      eb = ca[k] > 0 && cb[k] > 0 ? cb[k] - 1u : cb[k];
+    } else if (op == 1) {
+      ea = ca[k] > 0 && cb[k] > 0;
+      eb = 0;
+    } else {
+      ea = ca[k] > 0 && cb[k] == 0;
+      eb = 0;
+    }
+    check(froma[k] == ea, "nodes of a kept");
+    check(fromb[k] == eb, "nodes of b kept");
+    total += ea + eb;
+  }
+  check(a->size == total, "result size");
+  check(discarded == nitems[0] + nitems[1] - total, "discarded data");
+}
+
+// Count the items handed back by a set operation.
+void discard_item(void *data) {
+  check(data != NULL, "discarded data");
+  discarded++;
+}
@@ -0,0 +1,325 @@
+/*
+
+Tests for the sharded map. Runs random inserts and deletes on maps with
+small shards, so that they split, merge and drop shards all the time, and
+checks the map against a plain tree: searches, full and partial range
+scans in key order across shards, early stops and sizes, and after every
+change that the shards cover the key space in order with no gaps. Fills a
+shard with one repeated key, which cannot be split, and checks that it
+stays whole. Finally runs writer threads on disjoint keys while another
+thread scans, and checks order, contents and that the map shrinks back to
+one shard once emptied.
+
+Prints "test-shard: ok" and exits with 0 if every check passes.
+
+Usage: test-shard
+
+*/
+
+#define TEST_NAME "test-shard"
+#include "test.h"
+#include "rbshard.h"
+#include<limits.h>
+#include<pthread.h>
+#include<stdint.h>
+
+//Constants
+#define OPS     10000
+#define THREADS 4
+#define KEYS    2000  // Keys per writer thread.
+#define STEPS   10000 // Operations per writer thread.
+
+// Keys seen by a scan.
+struct Seen {
+  int *keys;
+  size_t n;
+  size_t max;
+  int last;
+  bool sorted;
+};
+
+// Prototypes.
+void random_ops(size_t, int);
+void repeated_key(void);
+void concurrent(void);
+void check_shards(struct RBShardMap *);
+void check_scan(struct RBShardMap *, struct RBTree *, int, int);
+int collect(struct RBTreeNode *, void *);
+int stop_at(struct RBTreeNode *, void *);
+void* writer(void *);
+void* scanner(void *);
+
+static struct RBShardMap *shared;
+static int stop;
+
+int main(void) {
+
+  srand(29);
+  random_ops(8, 100);       // Many duplicates.
+  random_ops(16, 100000);
+  random_ops(64, INT_MAX);  // Keys at both ends of the range.
+  repeated_key();
+  concurrent();
+
+  printf("test-shard: ok\n");
+  return 0;
+}
+
+/*
+Random updates of keys in [-range, range) on a map with shards of at most
+maxKeys keys, checked against a plain tree. Inserts win at first, so that
+the map grows and splits; deletes win later, so that it merges and drops.
+*/
+void random_ops(size_t maxKeys, int range) {
+
+  struct RBShardMap *map = init_rbshard_map(maxKeys, NULL);
+  struct RBTree *tree = init_rbtree();
+  struct RBTreeNode *node = NULL;
+  struct RBTreeIter it;
+  size_t i = 0;
+  void *data = NULL;
+  long key = 0;
+
+  check(map != NULL && tree != NULL, "init");
+  for (i = 0; i < OPS; i++) {
+    key = (long)rand() % (2 * (long)range) - range;
+    if (rand() % 100 < (i < OPS / 2 ? 70 : 30)) {
+      check(shard_insert(map, (int)key, (void *)(intptr_t)key),
+        "shard_insert");
+      insert(tree, (int)key, (void *)(intptr_t)key);
+    } else if ((node = search(tree, (int)key)) != NULL) {
+      check(shard_search_and_delete(map, (int)key, &data), "deletes a key");
+      check((intptr_t)data == key, "deleted data");
+      delete_node(tree, node);
+    } else {
+      check(!shard_search_and_delete(map, (int)key, NULL), "deletes no key");
+    }
+
+    check(shard_search(map, (int)key, &data) ==
+      (search(tree, (int)key) != NULL), "shard_search");
+    check(shard_size(map) == tree_size(tree), "shard_size");
+    if (i % 20 == 0)
+      check_shards(map);
+    if (i % 500 == 0) {
+      check_scan(map, tree, INT_MIN, INT_MAX);
+      key = (long)rand() % (2 * (long)range) - range;
+      check_scan(map, tree, (int)key, (int)(key + rand() % (range / 4 + 1)));
+    }
+  }
+  check_scan(map, tree, INT_MIN, INT_MAX);
+
+  // Empty it: every shard but one goes.
+  while ((node = iter_begin(tree, &it)) != NULL) {
+    check(shard_search_and_delete(map, node->key, NULL), "drain");
+    delete_node(tree, node);
+    check_shards(map);
+  }
+  check(shard_count(map) == 1 && shard_size(map) == 0, "drained to one shard");
+
+  dest_rbshard_map(&map);
+  dest_rbtree(&tree);
+}
+
+/*
+A shard of one repeated key outgrows its limit but cannot be split; keys
+around it split off, and it keeps every copy.
+*/
+void repeated_key(void) {
+
+  struct RBShardMap *map = init_rbshard_map(8, NULL);
+  struct Seen seen = { NULL, 0, 0, INT_MIN, true };
+  struct RBShard *shard = NULL;
+  size_t i = 0;
+  int key = 0;
+
+  check(map != NULL, "init_rbshard_map");
+  for (i = 0; i < 100; i++)
+    check(shard_insert(map, 5, NULL), "shard_insert");
+  check(shard_count(map) == 1, "a single key is not split");
+  for (key = -50; key < 50; key++)
+    if (key != 5)
+      check(shard_insert(map, key, NULL), "shard_insert");
+  check(shard_count(map) > 1, "other keys split off");
+  check_shards(map);
+
+  shard = map->dir->shards[0];
+  for (i = 0; i < map->dir->count; i++)
+    if (map->dir->shards[i]->low <= 5 && 5 <= map->dir->shards[i]->high)
+      shard = map->dir->shards[i];
+  check(tree_size(shard->tree) >= 100, "every copy in one shard");
+
+  seen.max = 1000;
+  check((seen.keys = malloc(seen.max * sizeof(int))) != NULL, "malloc");
+  check(shard_range_scan(map, 5, 6, collect, &seen) == 100, "copies scanned");
+  free(seen.keys);
+
+  for (i = 0; i < 100; i++)
+    check(shard_search_and_delete(map, 5, NULL), "delete a copy");
+  check(!shard_search(map, 5, NULL), "all copies gone");
+  check(shard_size(map) == 99, "shard_size");
+  check_shards(map);
+  dest_rbshard_map(&map);
+}
+
+// Writers own the keys congruent to their number; a scanner runs alongside.
+void concurrent(void) {
+
+  pthread_t writers[THREADS], scan;
+  size_t i = 0;
+  int key = 0;
+
+  check((shared = init_rbshard_map(32, NULL)) != NULL, "init_rbshard_map");
+  check(pthread_create(&scan, NULL, scanner, NULL) == 0, "pthread_create");
+  for (i = 0; i < THREADS; i++)
+    check(pthread_create(&writers[i], NULL, writer, (void *)i) == 0,
+      "pthread_create");
+  for (i = 0; i < THREADS; i++)
+    pthread_join(writers[i], NULL);
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  pthread_join(scan, NULL);
+
+  // Each writer left its keys deleted: the map merged back into one shard.
+  check(shard_size(shared) == 0, "emptied");
+  check(shard_count(shared) == 1, "merged back to one shard");
+  for (key = 0; key < THREADS * KEYS; key++)
+    check(!shard_search(shared, key, NULL), "no key left");
+  check_shards(shared);
+  dest_rbshard_map(&shared);
+}
+
+// Random updates of own keys, checked against own counts; then empty them.
+void* writer(void *arg) {
+
+  size_t self = (size_t)arg, i = 0;
+  unsigned seed = (unsigned)self + 1;
+  int *count = calloc(KEYS, sizeof(int));
+  int j = 0, key = 0;
+  void *data = NULL;
+
+  check(count != NULL, "calloc");
+  for (i = 0; i < STEPS; i++) {
+    j = rand_r(&seed) % KEYS;
+    key = j * THREADS + (int)self;
+    switch (rand_r(&seed) % 3) {
+      case 0:
+        check(shard_insert(shared, key, (void *)(intptr_t)key),
+          "shard_insert");
+        count[j]++;
+        break;
+      case 1:
+        check(shard_search_and_delete(shared, key, &data) == (count[j] > 0),
+          "concurrent delete");
+        if (count[j] > 0) {
+          check((intptr_t)data == key, "deleted data");
+          count[j]--;
+        }
+        break;
+      default:
+        check(shard_search(shared, key, NULL) == (count[j] > 0),
+          "concurrent search");
+    }
+  }
+
+  for (j = 0; j < KEYS; j++)
+    for (; count[j] > 0; count[j]--)
+      check(shard_search_and_delete(shared, j * THREADS + (int)self, NULL),
+        "final delete");
+  free(count);
+
+  return NULL;
+}
+
+// Full and partial scans while the writers run: always in key order.
+void* scanner(void *arg) {
+
+  struct Seen seen = { NULL, 0, 0, INT_MIN, true };
+  int lo = 0, stopAfter = 0;
+  unsigned seed = 99;
+
+  (void)arg;
+  while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+    lo = rand_r(&seed) % (THREADS * KEYS);
+    seen.last = INT_MIN;
+    seen.sorted = true;
+    shard_range_scan(shared, lo, lo + THREADS * KEYS / 4, collect, &seen);
+    check(seen.sorted, "concurrent scan in key order");
+    check(seen.last == INT_MIN || seen.last >= lo, "scan bounds");
+
+    stopAfter = 5;
+    check(shard_range_scan(shared, INT_MIN, INT_MAX, stop_at, &stopAfter)
+      <= 5, "concurrent scan stops");
+    shard_size(shared);
+  }
+
+  return NULL;
+}
+
+/*
+The directory covers the key space in order and without gaps, every shard
+is alive, holds only keys of its range and is a Red-Black tree.
+*/
+void check_shards(struct RBShardMap *map) {
+
+  struct RBShardDir *dir = map->dir;
+  struct RBShard *shard = NULL;
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+  size_t i = 0;
+
+  check(dir->count > 0 && dir->shards[0]->low == INT_MIN, "first shard");
+  check(dir->shards[dir->count - 1]->high == INT_MAX, "last shard");
+  for (i = 0; i < dir->count; i++) {
+    shard = dir->shards[i];
+    check(!shard->dead && dir->lows[i] == shard->low, "directory entry");
+    check(((uintptr_t)shard & 63) == 0, "shard alignment");
+    check(i + 1 == dir->count ||
+      (long)shard->high + 1 == dir->shards[i + 1]->low,
+      "ranges are contiguous");
+    for (node = iter_begin(shard->tree, &it); node != NULL;
+        node = iter_next(&it))
+      check(node->key >= shard->low && node->key <= shard->high,
+        "keys within the range");
+    check_rbtree(shard->tree);
+  }
+}
+
+// A scan of [lo, hi) visits exactly the tree's keys in that range, in order.
+void check_scan(struct RBShardMap *map, struct RBTree *tree, int lo, int hi) {
+
+  struct Seen seen = { NULL, 0, 0, INT_MIN, true };
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+  size_t i = 0, count = 0;
+  int stopAfter = 3;
+
+  seen.max = tree_size(tree) + 1;
+  check((seen.keys = malloc(seen.max * sizeof(int))) != NULL, "malloc");
+  count = shard_range_scan(map, lo, hi, collect, &seen);
+  check(count == seen.n && seen.sorted, "scan in key order");
+  for (node = iter_lower_bound(tree, &it, lo);
+      node != NULL && node->key < hi; node = iter_next(&it), i++)
+    check(i < seen.n && seen.keys[i] == node->key, "scan contents");
+  check(i == seen.n, "scan count");
+  free(seen.keys);
+
+  check(shard_range_scan(map, lo, hi, stop_at, &stopAfter) ==
+    (count < 3 ? count : 3), "scan stops early");
+}
+
+int collect(struct RBTreeNode *node, void *arg) {
+
+  struct Seen *seen = arg;
+
+  if (node->key < seen->last)
+    seen->sorted = false;
+  seen->last = node->key;
+  if (seen->n < seen->max)
+    seen->keys[seen->n] = node->key;
+  seen->n++;
+  return 0;
+}
+
+int stop_at(struct RBTreeNode *node, void *arg) {
+  (void)node;
+  return --*(int *)arg == 0;
+}
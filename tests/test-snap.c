@@ -0,0 +1,292 @@
+/*
+
+Tests for snapshot files. Saves random trees, some of them empty, with
+string data, opens them and checks every search, scan and data item
+against the original, then promotes them and checks the Red-Black
+properties, the cached fields and the contents of the mutable copy, also
+after further updates. Finally damages a saved file in several ways and
+checks that scans stay bounded and snap_promote refuses it.
+
+Prints "test-snap: ok" and exits with 0 if every check passes.
+
+Usage: test-snap
+
+*/
+
+#define TEST_NAME "test-snap"
+#include "test.h"
+#include "rbsnap.h"
+#include<errno.h>
+#include<limits.h>
+#include<string.h>
+#include<unistd.h>
+
+//Constants
+#define RUNS 20
+
+// Prototypes.
+void round_trip(const char *, size_t, int);
+void damaged(const char *);
+struct RBTree* random_tree(size_t, int);
+void check_fields(struct RBTree *);
+size_t encoded_size(const void *, void *);
+void encode(const void *, void *, void *);
+void* decode(const void *, size_t, void *);
+int collect(const struct RBSnapNode *, void *);
+int count_visit(const struct RBSnapNode *, void *);
+void free_data(struct RBTree *);
+
+static const struct RBSnapCodec codec = { encoded_size, encode, decode, NULL };
+
+// Keys seen by collect, in scan order.
+static int *seen;
+static size_t nseen;
+
+int main(void) {
+
+  char path[] = "/tmp/test-snapXXXXXX";
+  int fd = mkstemp(path);
+  size_t sizes[] = { 0, 1, 2, 3, 7, 100, 1000, 20000 };
+  size_t i = 0;
+
+  check(fd >= 0, "mkstemp");
+  close(fd);
+  srand(17);
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    round_trip(path, sizes[i], (int)(4 * sizes[i] + 1));
+  for (i = 0; i < RUNS; i++) // Few distinct keys: many duplicates.
+    round_trip(path, 1 + rand() % 3000, 1 + rand() % 50);
+  damaged(path);
+
+  remove(path);
+  printf("test-snap: ok\n");
+  return 0;
+}
+
+// Save, open, search, scan and promote a random tree of n keys in [0, range).
+void round_trip(const char *path, size_t n, int range) {
+
+  struct RBTree *tree = random_tree(n, range);
+  struct RBTree *copy = NULL;
+  struct RBSnapshot *snap = NULL;
+  struct RBTreeNode *node = NULL, *other = NULL;
+  const struct RBSnapNode *rec = NULL;
+  struct RBTreeIter it, jt;
+  const char *bytes = NULL;
+  size_t size = 0, count = 0, expect = 0, i = 0;
+  int key = 0;
+
+  check(snap_save(tree, path, &codec), "snap_save");
+  check((snap = snap_open(path)) != NULL, "snap_open");
+  check(snap_size(snap) == tree_size(tree), "snap_size");
+
+  for (key = -2; key < range + 2; key++) {
+    node = search(tree, key);
+    rec = snap_search(snap, key);
+    check((node == NULL) == (rec == NULL), "snap_search finds the keys");
+    if (rec == NULL)
+      continue;
+    check(rec->key == key, "snap_search key");
+    bytes = snap_data(snap, rec, &size);
+    check(bytes != NULL && size == strlen(bytes) + 1, "snap_data size");
+    check(atoi(bytes) == key, "snap_data contents");
+  }
+
+  // A full scan is the tree in order; a partial one is the right count.
+  seen = malloc((n + 1) * sizeof(int));
+  check(seen != NULL, "malloc");
+  nseen = 0;
+  check(snap_scan(snap, -1, range + 1, collect, NULL) == n, "snap_scan count");
+  for (node = iter_begin(tree, &it), i = 0; node != NULL;
+      node = iter_next(&it), i++)
+    check(seen[i] == node->key, "snap_scan order");
+  count = 0;
+  snap_scan(snap, range / 3, 2 * range / 3, count_visit, &count);
+  for (node = iter_lower_bound(tree, &it, range / 3);
+      node != NULL && node->key < 2 * range / 3; node = iter_next(&it))
+    expect++;
+  check(count == expect, "snap_scan range");
+  free(seen);
+
+  check((copy = snap_promote(snap, &codec, NULL)) != NULL, "snap_promote");
+  snap_close(&snap);
+  check(snap == NULL, "snap_close");
+  check_fields(copy);
+  for (node = iter_begin(tree, &it), other = iter_begin(copy, &jt);
+      node != NULL; node = iter_next(&it), other = iter_next(&jt)) {
+    check(other != NULL && other->key == node->key, "promoted keys");
+    check(strcmp(other->data, node->data) == 0, "promoted data");
+  }
+  check(other == NULL, "promoted size");
+
+  // The copy is an ordinary tree: update it and check it again.
+  for (i = 0; i < n; i++) {
+    key = rand() % range;
+    if (rand() % 2)
+      insert(copy, key, decode("0", 2, NULL));
+    else if ((node = search(copy, key)) != NULL)
+      free(erase_node(copy, node));
+  }
+  check_fields(copy);
+
+  free_data(copy);
+  dest_rbtree(&copy);
+  free_data(tree);
+  dest_rbtree(&tree);
+}
+
+/*
+Damage the file of a valid tree: all child offsets -1, so that every
+node is both children of the next; a node that is its own child; random
+changes to offsets, colors and keys. Scans must visit each node at most
+once and promotion must refuse what is no longer a Red-Black tree.
+*/
+void damaged(const char *path) {
+
+  struct RBTree *tree = random_tree(500, 2000);
+  struct RBTree *copy = NULL;
+  struct RBSnapshot *snap = NULL;
+  struct RBSnapNode *nodes = NULL;
+  char *image = NULL;
+  FILE *file = NULL;
+  long length = 0;
+  size_t n = tree_size(tree), count = 0, i = 0, round = 0;
+
+  check(snap_save(tree, path, NULL), "snap_save");
+  check((file = fopen(path, "rb")) != NULL, "fopen");
+  fseek(file, 0, SEEK_END);
+  length = ftell(file);
+  check((image = malloc(2 * length)) != NULL, "malloc");
+  rewind(file);
+  check(fread(image, length, 1, file) == 1, "fread");
+  fclose(file);
+  nodes = (struct RBSnapNode *)(image + length + sizeof(struct RBSnapHeader));
+  set_error_handler(NULL, NULL);
+
+  for (round = 0; round < 200; round++) {
+    memcpy(image + length, image, length);
+    if (round == 0) {
+      for (i = 1; i < n; i++)
+        nodes[i].left = nodes[i].right = -1;
+    } else if (round == 1) {
+      nodes[n - 1].left = -(int32_t)(n - 1); // Node 0 as the left child of
+      nodes[n - 2].left = -(int32_t)(n - 2); // the root and of its right.
+    } else {
+      for (i = 0; i < 3; i++) {
+        struct RBSnapNode *rec = &nodes[rand() % n];
+        switch (rand() % 4) {
+          case 0: rec->left = -(rand() % 20); break;
+          case 1: rec->right = -(rand() % 20); break;
+          case 2: rec->flags ^= SNAP_BLACK; break;
+          default: rec->key += rand() % 5 - 2;
+        }
+      }
+    }
+    check((file = fopen(path, "wb")) != NULL, "fopen");
+    check(fwrite(image + length, length, 1, file) == 1, "fwrite");
+    fclose(file);
+
+    check((snap = snap_open(path)) != NULL, "snap_open of a damaged file");
+    count = 0;
+    snap_scan(snap, -100, 100000, count_visit, &count);
+    check(count <= n, "damaged scan visits each node once");
+    for (i = 0; i < 100; i++)
+      snap_search(snap, rand() % 2000);
+
+    copy = snap_promote(snap, NULL, NULL);
+    if (round < 2)
+      check(copy == NULL && errno == EINVAL, "snap_promote refuses shared nodes");
+    if (copy != NULL) { // Damage that left a valid tree.
+      check_fields(copy);
+      dest_rbtree(&copy);
+    }
+    snap_close(&snap);
+  }
+
+  // Not a snapshot at all.
+  check((file = fopen(path, "wb")) != NULL, "fopen");
+  fputs("not a snapshot, but long enough to hold a header", file);
+  fclose(file);
+  check(snap_open(path) == NULL && errno == EINVAL, "snap_open refuses");
+
+  free(image);
+  free_data(tree);
+  dest_rbtree(&tree);
+}
+
+// A tree of n random keys in [0, range) whose data is the key as a string.
+struct RBTree* random_tree(size_t n, int range) {
+
+  struct RBTree *tree = init_rbtree();
+  char buf[16];
+  size_t i = 0;
+  int key = 0;
+
+  check(tree != NULL, "init_rbtree");
+  for (i = 0; i < n; i++) {
+    key = rand() % range;
+    sprintf(buf, "%d", key);
+    check(insert(tree, key, decode(buf, strlen(buf) + 1, NULL)) != NULL,
+      "insert");
+  }
+  return tree;
+}
+
+// Check a whole tree, its key order and the black-height it caches.
+void check_fields(struct RBTree *tree) {
+
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+  int last = INT_MIN;
+
+  check(check_rbtree(tree) - 1 == tree_black_height(tree),
+    "cached black-height");
+  for (node = iter_begin(tree, &it); node != NULL; node = iter_next(&it)) {
+    check(node->key >= last, "key order");
+    last = node->key;
+  }
+}
+
+size_t encoded_size(const void *data, void *ctx) {
+  (void)ctx;
+  return strlen(data) + 1;
+}
+
+void encode(const void *data, void *buf, void *ctx) {
+  (void)ctx;
+  strcpy(buf, data);
+}
+
+void* decode(const void *buf, size_t size, void *ctx) {
+
+  char *data = malloc(size);
+
+  (void)ctx;
+  check(data != NULL, "malloc");
+  memcpy(data, buf, size);
+  return data;
+}
+
+int collect(const struct RBSnapNode *node, void *ctx) {
+  (void)ctx;
+  seen[nseen++] = node->key;
+  return 0;
+}
+
+int count_visit(const struct RBSnapNode *node, void *ctx) {
+  (void)node;
+  (*(size_t *)ctx)++;
+  return 0;
+}
+
+void free_data(struct RBTree *tree) {
+
+  struct RBTreeIter it;
+  struct RBTreeNode *node = NULL;
+
+  for (node = iter_begin(tree, &it); node != NULL; node = iter_next(&it)) {
+    free(node->data);
+    node->data = NULL;
+  }
+}
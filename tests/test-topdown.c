@@ -0,0 +1,187 @@
+/*
+
+Tests for top-down trees. Applies random inserts and deletes, with many
+equal keys, and checks every result against a reference of what each key
+holds, and after every change that the tree is a Red-Black tree: a black
+root, no red node with a red child, equal black-heights, keys in order
+and the cached size, and that the pool holds exactly one node per key.
+Then inserts keys in ascending and descending runs, which rotate at every
+level, and deletes them in the same and the opposite order, checking the
+tree after each step until it is empty again.
+
+Prints "test-topdown: ok" and exits with 0 if every check passes.
+
+Usage: test-topdown
+
+*/
+
+#define TEST_NAME "test-topdown"
+#include "test.h"
+#include "rbtopdown.h"
+#include<limits.h>
+
+//Constants
+#define OPS   20000
+#define RANGE 300  // Keys are in [0, RANGE).
+#define RUN   1000 // Keys of an ascending or descending run.
+#define ITEMS (OPS + 4 * RUN)
+
+// Data of a key; tells which insert a found or deleted key came from.
+struct Item {
+  int key;
+  bool live;
+};
+
+// Prototypes.
+void random_ops(void);
+void runs(void);
+void insert_key(int);
+void delete_key(int);
+void check_search(int);
+void check_tdtree(void);
+int check_node(struct TopDownNode *, long, long, size_t *);
+
+static struct TopDownTree *tree;
+static struct Item items[ITEMS];
+static size_t nitems;
+static int count[RANGE + RUN]; // Copies of each key in the tree.
+
+int main(void) {
+
+  srand(37);
+  check((tree = init_tdtree()) != NULL, "init_tdtree");
+  random_ops();
+  runs();
+  dest_tdtree(&tree);
+  check(tree == NULL, "dest_tdtree");
+
+  printf("test-topdown: ok\n");
+  return 0;
+}
+
+// Random updates; inserts win at first, deletes later, down to empty.
+void random_ops(void) {
+
+  size_t i = 0;
+  int key = 0;
+
+  for (i = 0; i < OPS; i++) {
+    key = rand() % RANGE;
+    if (rand() % 100 < (i < OPS / 2 ? 65 : 40))
+      insert_key(key);
+    else
+      delete_key(key);
+    check_search(key);
+    check_search(rand() % RANGE);
+    check_tdtree();
+  }
+
+  for (key = 0; key < RANGE; key++)
+    while (count[key] > 0) {
+      delete_key(key);
+      check_tdtree();
+    }
+  check(tree->root == NULL && td_size(tree) == 0, "emptied");
+  delete_key(0);
+  for (i = 0; i < nitems; i++)
+    check(!items[i].live, "every item deleted");
+}
+
+// Sorted runs in, then out in the same and in the opposite order.
+void runs(void) {
+
+  int key = 0;
+
+  for (key = 0; key < RUN; key++) {
+    insert_key(key);
+    check_tdtree();
+  }
+  for (key = 0; key < RUN; key++) {
+    delete_key(key);
+    check_tdtree();
+  }
+  for (key = RUN - 1; key >= 0; key--) {
+    insert_key(key);
+    check_tdtree();
+  }
+  for (key = 0; key < RUN; key++) {
+    delete_key(key);
+    check_search(key);
+    check_tdtree();
+  }
+  check(tree->root == NULL && live_nodes(tree->pool) == 0, "emptied");
+}
+
+void insert_key(int key) {
+
+  check(nitems < ITEMS, "item supply");
+  items[nitems].key = key;
+  items[nitems].live = true;
+  check(td_insert(tree, key, &items[nitems]), "td_insert");
+  nitems++;
+  count[key]++;
+}
+
+// Deletes one copy, whichever the tree picks, or nothing if there is none.
+void delete_key(int key) {
+
+  struct Item *item = td_search_and_delete(tree, key);
+
+  if (count[key] == 0) {
+    check(item == NULL, "nothing to delete");
+    return;
+  }
+  check(item != NULL, "td_search_and_delete");
+  check(item->key == key && item->live, "deleted data");
+  item->live = false;
+  count[key]--;
+}
+
+void check_search(int key) {
+
+  void *data = NULL;
+
+  check(td_search(tree, key, &data) == (count[key] > 0), "td_search");
+  check(count[key] == 0 || (((struct Item *)data)->key == key &&
+    ((struct Item *)data)->live), "found data");
+}
+
+// The tree is a Red-Black tree of the size the reference says.
+void check_tdtree(void) {
+
+  size_t total = 0, nodes = 0;
+  int key = 0;
+
+  for (key = 0; key < RANGE + RUN; key++)
+    total += (size_t)count[key];
+  check(!(tree->root != NULL && tree->root->c == RED), "black root");
+  check_node(tree->root, (long)INT_MIN, (long)INT_MAX, &nodes);
+  check(nodes == total, "nodes in the tree");
+  check(td_size(tree) == total, "td_size");
+  check(live_nodes(tree->pool) == total, "one pool node per key");
+}
+
+/*
+Check the subtree at node: keys in [lo, hi], equal keys on either side,
+no red node with a red child, equal black-heights. Counts its nodes and
+returns its black-height.
+*/
+int check_node(struct TopDownNode *node, long lo, long hi, size_t *nodes) {
+
+  int left = 0, right = 0;
+
+  if (node == NULL)
+    return 1;
+  check(node->key >= lo && node->key <= hi, "key order");
+  check(node->c == BLACK ||
+    ((node->link[0] == NULL || node->link[0]->c == BLACK) &&
+     (node->link[1] == NULL || node->link[1]->c == BLACK)),
+    "no red node with a red child");
+  check(((struct Item *)node->data)->key == node->key,
+    "data moves with its key");
+  left = check_node(node->link[0], lo, node->key, nodes);
+  right = check_node(node->link[1], node->key, hi, nodes);
+  check(left == right, "equal black-heights");
+  (*nodes)++;
+  return left + (node->c == BLACK);
+}
@@ -0,0 +1,270 @@
+/*
+
+Tests for wide-node trees. Compares the node search the tree picked with a
+plain count over random nodes, including partly filled ones. Then applies
+random inserts and deletes and checks every result against a reference of
+what each key holds, and after every change that the tree is a B+ tree:
+keys in order and within the separators above them, every node but the
+root at least half full, all leaves at the same depth and linked in key
+order, and the cached size. Piles up copies of one key until they span
+many leaves and deletes them one by one, and finally empties the tree, so
+that nodes borrow, merge and the tree shrinks back to a leaf.
+
+Built twice: test-wide uses AVX2 when the CPU has it, test-wide-scalar is
+built with WIDE_SCALAR and always uses the scalar loop.
+
+Prints "test-wide: ok" (or "test-wide-scalar: ok") and exits with 0 if
+every check passes.
+
+Usage: test-wide
+
+*/
+
+#ifdef WIDE_SCALAR
+#define TEST_NAME "test-wide-scalar"
+#else
+#define TEST_NAME "test-wide"
+#endif
+#include "test.h"
+#include "rbwide.h"
+#include<limits.h>
+#include<stdint.h>
+#include<string.h>
+
+//Constants
+#define OPS    20000
+#define RANGE  400   // Key slots; the first and last are INT_MIN and INT_MAX.
+#define COPIES 300   // Copies of the repeated key, many leaves' worth.
+#define ITEMS  (OPS + COPIES)
+
+// Data of a key; tells which insert a found or deleted key came from.
+struct Item {
+  int key;
+  bool live;
+};
+
+// Prototypes.
+void node_search(void);
+void random_ops(void);
+void repeated_key(void);
+void drain(void);
+void insert_key(int);
+void delete_key(int);
+void check_search(int);
+void check_tree(void);
+size_t check_node(struct WideNode *, int, long, long, struct WideNode **);
+int key_of(int);
+
+static struct WideTree *tree;
+static struct Item items[ITEMS];
+static size_t nitems;
+static int count[RANGE]; // Copies of each key slot in the tree.
+
+int main(void) {
+
+  srand(31);
+  check((tree = init_wtree()) != NULL, "init_wtree");
+  node_search();
+  random_ops();
+  repeated_key();
+  drain();
+  dest_wtree(&tree);
+  check(tree == NULL, "dest_wtree");
+
+  printf(TEST_NAME ": ok\n");
+  return 0;
+}
+
+/*
+The tree's node search counts the keys less than a key among the first n,
+whatever follows them in the node.
+*/
+void node_search(void) {
+
+  int keys[WIDE_KEYS];
+  unsigned n = 0, i = 0, j = 0, less = 0, round = 0;
+  int key = 0;
+
+#if defined(WIDE_SCALAR) || !(defined(__x86_64__) || defined(__i386__))
+  check(strcmp(wide_simd(tree), "scalar") == 0, "scalar node search");
+#else
+  __builtin_cpu_init();
+  check(strcmp(wide_simd(tree), __builtin_cpu_supports("avx2")
+    ? "avx2" : "scalar") == 0, "node search picked by the CPU");
+#endif
+
+  for (round = 0; round < 10000; round++) {
+    n = (unsigned)rand() % (WIDE_KEYS + 1);
+    for (i = 0; i < WIDE_KEYS; i++)
+      keys[i] = key_of(rand() % RANGE);
+    for (i = 1; i < n; i++) // Sort the keys in use; the tail stays random.
+      for (key = keys[i], j = i; j > 0 && keys[j - 1] > key; j--) {
+        keys[j] = keys[j - 1];
+        keys[j - 1] = key;
+      }
+    key = key_of(rand() % RANGE);
+    for (i = 0, less = 0; i < n; i++)
+      less += keys[i] < key;
+    check(tree->rank(keys, n, key) == less, "node search");
+  }
+}
+
+// Random inserts, deletes and searches; inserts win at first, deletes later.
+void random_ops(void) {
+
+  size_t i = 0;
+  int slot = 0;
+
+  for (i = 0; i < OPS; i++) {
+    slot = rand() % RANGE;
+    if (rand() % 100 < (i < OPS / 2 ? 70 : 40))
+      insert_key(slot);
+    else
+      delete_key(slot);
+    check_search(rand() % RANGE);
+    check_tree();
+  }
+}
+
+// Copies of one key span several leaves and are all found and deleted.
+void repeated_key(void) {
+
+  struct WideNode *leaf = tree->root;
+  int slot = RANGE / 2, i = 0, leaves = 0;
+
+  for (i = 0; i < COPIES; i++) {
+    insert_key(slot);
+    check_tree();
+  }
+  while (!leaf->leaf)
+    leaf = leaf->u.child[0];
+  for (; leaf != NULL; leaf = leaf->next)
+    leaves += leaf->count > 0 && leaf->keys[0] <= key_of(slot) &&
+      leaf->keys[leaf->count - 1] >= key_of(slot);
+  check(leaves >= COPIES / WIDE_KEYS, "copies span leaves");
+  for (i = 0; i < COPIES; i++)
+    insert_key(rand() % RANGE);
+  check_tree();
+
+  while (count[slot] > 0) {
+    delete_key(slot);
+    check_search(slot);
+    check_search(slot - 1);
+    check_search(slot + 1);
+    check_tree();
+  }
+  check(!wide_search(tree, key_of(slot), NULL), "every copy deleted");
+}
+
+// Delete everything in random order, down to an empty leaf.
+void drain(void) {
+
+  size_t i = 0;
+  int slot = 0;
+
+  while (wide_size(tree) > 0) {
+    slot = rand() % RANGE;
+    if (count[slot] == 0)
+      continue;
+    delete_key(slot);
+    check_tree();
+  }
+  check(tree->height == 0 && tree->root->leaf && tree->root->count == 0,
+    "empty tree is an empty leaf");
+  for (slot = 0; slot < RANGE; slot++)
+    check(!wide_search(tree, key_of(slot), NULL), "no key left");
+  for (i = 0; i < nitems; i++)
+    check(!items[i].live, "every item deleted");
+}
+
+void insert_key(int slot) {
+
+  check(nitems < ITEMS, "item supply");
+  items[nitems].key = key_of(slot);
+  items[nitems].live = true;
+  check(wide_insert(tree, key_of(slot), &items[nitems]), "wide_insert");
+  nitems++;
+  count[slot]++;
+}
+
+// Deletes one copy, whichever the tree picks, or nothing if there is none.
+void delete_key(int slot) {
+
+  struct Item *item = wide_search_and_delete(tree, key_of(slot));
+
+  if (count[slot] == 0) {
+    check(item == NULL, "nothing to delete");
+    return;
+  }
+  check(item != NULL, "wide_search_and_delete");
+  check(item->key == key_of(slot) && item->live, "deleted data");
+  item->live = false;
+  count[slot]--;
+}
+
+void check_search(int slot) {
+
+  void *data = NULL;
+
+  if (slot < 0 || slot >= RANGE)
+    return;
+  check(wide_search(tree, key_of(slot), &data) == (count[slot] > 0),
+    "wide_search");
+  check(count[slot] == 0 || (((struct Item *)data)->key == key_of(slot) &&
+    ((struct Item *)data)->live), "found data");
+}
+
+// The whole tree is a B+ tree that holds as many keys as the reference.
+void check_tree(void) {
+
+  struct WideNode *leaf = NULL;
+  size_t total = 0;
+  int slot = 0;
+
+  for (slot = 0; slot < RANGE; slot++)
+    total += (size_t)count[slot];
+  check(wide_size(tree) == total, "wide_size");
+  check(tree->root->leaf == (tree->height == 0), "root is a leaf at height 0");
+  check(tree->root->leaf || tree->root->count > 0, "inner root has a key");
+  check(check_node(tree->root, tree->height, (long)INT_MIN, (long)INT_MAX,
+    &leaf) == total, "keys in the leaves");
+  check(leaf->next == NULL, "last leaf ends the chain");
+}
+
+/*
+Check the subtree at node, height levels above the leaves, with keys in
+[lo, hi]; equal keys may sit on both sides of a separator. leaf is the
+last leaf seen before it, which must link to its first. Returns the
+number of keys in its leaves.
+*/
+size_t check_node(struct WideNode *node, int height, long lo, long hi,
+  struct WideNode **leaf) {
+
+  size_t keys = 0;
+  unsigned i = 0;
+
+  check(node->count <= WIDE_KEYS, "node not overfull");
+  check(node == tree->root || node->count >= WIDE_MIN, "node at least half full");
+  check(node->leaf == (height == 0), "leaves at the same depth");
+  for (i = 0; i < node->count; i++) {
+    check(node->keys[i] >= lo && node->keys[i] <= hi, "keys within separators");
+    check(i == 0 || node->keys[i - 1] <= node->keys[i], "keys in order");
+  }
+
+  if (node->leaf) {
+    check(*leaf == NULL || (*leaf)->next == node, "leaves linked in order");
+    *leaf = node;
+    return node->count;
+  }
+
+  for (i = 0; i <= node->count; i++)
+    keys += check_node(node->u.child[i], height - 1,
+      i == 0 ? lo : node->keys[i - 1], i == node->count ? hi : node->keys[i],
+      leaf);
+  return keys;
+}
+
+// Key of a slot: the ends of the int range, and small keys around zero.
+int key_of(int slot) {
+  return slot == 0 ? INT_MIN : slot == RANGE - 1 ? INT_MAX : slot - RANGE / 2;
+}
@@ -0,0 +1,97 @@
+#ifndef TEST_H
+#define TEST_H
+
+/*
+Scaffolding shared by the self-checking module tests. A test defines
+TEST_NAME before including this file. check(cond, msg) stops the test at the
+first failed condition, printing "<TEST_NAME>: line N: msg failed" to stderr
+and exiting with EXT_F.
+*/
+
+#include "rbtree.h"
+#include<stdio.h>
+#include<stdlib.h>
+
+#ifndef TEST_NAME
+#error "define TEST_NAME before including test.h"
+#endif
+
+/****** CONSTANTS ******/
+
+#define EXT_F 1
+
+/****** CHECKS ******/
+
+#define check(cond, msg)\
+  do { if (!(cond)) test_fail(msg, __LINE__); } while (0)
+
+static inline void test_fail(const char *msg, int line) {
+  fprintf(stderr, "%s: line %d: %s failed\n", TEST_NAME, line, msg);
+  exit(EXT_F);
+}
+
+/* Shape checks of the subtree at node; returns its black-height. */
+static inline int check_subtree_(struct RBTree *tree, struct RBTreeNode *node,
+  size_t *nodes) {
+
+  int left = 0, right = 0;
+
+  if (node == tree->nil)
+    return 1;
+  check(node->left == tree->nil || node_parent(node->left) == node, "parent");
+  check(node->right == tree->nil || node_parent(node->right) == node, "parent");
+  check(node_color(node) == BLACK || (node_color(node->left) == BLACK &&
+    node_color(node->right) == BLACK), "no red node with a red child");
+  left = check_subtree_(tree, node->left, nodes);
+  right = check_subtree_(tree, node->right, nodes);
+  check(left == right, "equal black-heights");
+  (*nodes)++;
+  return left + (node_color(node) == BLACK);
+}
+
+/*
+Check that tree is a Red-Black tree: black root and sentinel, children that
+point back at their parents, no red node with a red child, equal
+black-heights, and a cached size and ends that match its shape. Key order is
+left to the caller, which knows how the tree is ordered. Returns the
+black-height, counting the sentinel.
+*/
+static inline int check_rbtree(struct RBTree *tree) {
+
+  struct RBTreeNode *first = tree->root, *last = tree->root;
+  size_t nodes = 0;
+  int black = 0;
+
+  check(node_color(tree->nil) == BLACK, "black sentinel");
+  check(node_color(tree->root) == BLACK, "black root");
+  check(tree->root == tree->nil || node_parent(tree->root) == tree->nil,
+    "root parent");
+  black = check_subtree_(tree, tree->root, &nodes);
+  check(nodes == tree_size(tree), "cached size");
+  while (first != tree->nil && first->left != tree->nil)
+    first = first->left;
+  while (last != tree->nil && last->right != tree->nil)
+    last = last->right;
+  check(tree->leftmost == first && tree->rightmost == last, "cached ends");
+  return black;
+}
+
+/****** POOLS ******/
+
+/* Nodes of a pool in use: handed out, less those back on the free list. */
+static inline size_t live_nodes(struct RBTreePool *pool) {
+
+  struct RBTreeSlab *slab = NULL;
+  void *item = NULL;
+  size_t count = 0;
+
+  for (slab = pool->slabs; slab != NULL; slab = slab->next)
+    count += slab->capacity;
+  count -= (size_t)(pool->bumpEnd - pool->bump) / pool->nodeSize;
+  for (item = pool->freeList; item != NULL; item = *(void **)item)
+    count--;
+
+  return count;
+}
+
+#endif